@@ -1,4 +1,39 @@
 
  C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe shader.vert -o vert.spv
  C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe shader.frag -o frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe particle_init.comp -o particle_init.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe particle_kickoff.comp -o particle_kickoff.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe particle_emit.comp -o particle_emit.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe particle_simulate.comp -o particle_simulate.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe particle_finalize.comp -o particle_finalize.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe particle_sort.comp -o particle_sort.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe particle.vert -o particle_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe particle.frag -o particle_frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe post_exposure.comp -o post_exposure.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe post_downsample.comp -o post_downsample.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe post_blur.comp -o post_blur.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe post_tonemap.comp -o post_tonemap.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe --target-env=vulkan1.1 -DUSE_SUBGROUPS post_tonemap.comp -o post_tonemap_subgroup.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe cluster_build.comp -o cluster_build.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe lit.vert -o lit_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe lit.frag -o lit_frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe debug.vert -o debug_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe debug.frag -o debug_frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe shadow_depth.vert -o shadow_depth_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe shadow_lit.vert -o shadow_lit_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe shadow_lit.frag -o shadow_lit_frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe skin.comp -o skin.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe skinned.vert -o skinned_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe skinned.frag -o skinned_frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe props.vert -o props_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe props.frag -o props_frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe meshlet_cull.comp -o meshlet_cull.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe meshlet_depth_reduce.comp -o meshlet_depth_reduce.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe meshlet.vert -o meshlet_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe meshlet.frag -o meshlet_frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe virtual_texture.vert -o virtual_texture_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe virtual_texture.frag -o virtual_texture_frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe virtual_texture_feedback.frag -o virtual_texture_feedback_frag.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe terrain.vert -o terrain_vert.spv
+ C:\VulkanSDK\1.1.121.2\Bin32\glslc.exe terrain.frag -o terrain_frag.spv
  pause
\ No newline at end of file
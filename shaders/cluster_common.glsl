@@ -0,0 +1,32 @@
+// shared by cluster_build.comp and the lit forward shaders
+
+struct Light {
+    vec4 positionRadius;  // world space xyz, w falloff radius
+    vec4 color;           // rgb * intensity
+};
+
+// lists are fixed size per cluster so the build needs no global atomics;
+// must match kMaxLightsPerCluster in clustered_lighting.h
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+layout(std140, binding = 0) uniform FrameConstants {
+    mat4 view;
+    mat4 viewProj;
+    vec4 projection;    // proj[0][0], proj[1][1], near, far
+    vec4 depthSlicing;  // slice = log(depth) * x + y, zw framebuffer size
+    uvec4 grid;         // clusters in x, y, z and the light count
+} frame;
+
+layout(std430, binding = 1) readonly buffer Lights { Light lights[]; };
+layout(std430, binding = 2) buffer ClusterCounts { uint clusterCounts[]; };
+layout(std430, binding = 3) buffer ClusterIndices { uint clusterIndices[]; };
+
+// exponential depth slices keep clusters roughly cubic along the view ray
+uint clusterIndex(vec2 fragCoord, float viewDepth) {
+    uvec2 tile = uvec2(fragCoord / frame.depthSlicing.zw * vec2(frame.grid.xy));
+    tile = min(tile, frame.grid.xy - 1u);
+    float slice = log(max(viewDepth, frame.projection.z)) * frame.depthSlicing.x +
+                  frame.depthSlicing.y;
+    uint z = min(uint(max(slice, 0.0)), frame.grid.z - 1u);
+    return (z * frame.grid.y + tile.y) * frame.grid.x + tile.x;
+}
@@ -0,0 +1,33 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "cluster_common.glsl"
+
+layout(location = 0) in vec3 worldPosition;
+layout(location = 1) in float viewDepth;
+
+layout(location = 0) out vec4 outColor;
+
+// forward shading that only visits the lights of this fragment's cluster,
+// so the per pixel cost is bounded by MAX_LIGHTS_PER_CLUSTER, not the
+// number of lights in the scene
+void main() {
+    const vec3 albedo = vec3(0.5);
+    const vec3 normal = vec3(0.0, 1.0, 0.0);
+
+    uint cluster = clusterIndex(gl_FragCoord.xy, viewDepth);
+    uint count = clusterCounts[cluster];
+    vec3 color = albedo * 0.02;
+    for (uint i = 0u; i < count; i++) {
+        Light light = lights[clusterIndices[cluster * MAX_LIGHTS_PER_CLUSTER + i]];
+        vec3 toLight = light.positionRadius.xyz - worldPosition;
+        float distanceSq = dot(toLight, toLight);
+        float radius = light.positionRadius.w;
+        // smooth window, reaches zero exactly at the radius the build used
+        float window = clamp(1.0 - distanceSq / (radius * radius), 0.0, 1.0);
+        float attenuation = window * window / max(distanceSq, 0.01);
+        float lambert = max(dot(normal, toLight * inversesqrt(max(distanceSq, 1e-6))), 0.0);
+        color += albedo * light.color.rgb * lambert * attenuation;
+    }
+    outColor = vec4(color, 1.0);
+}
@@ -0,0 +1,19 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "cluster_common.glsl"
+
+layout(location = 0) out vec3 worldPosition;
+layout(location = 1) out float viewDepth;
+
+// ground plane expanded from gl_VertexIndex, no vertex input
+const float extent = 20.0;
+const vec2 corners[6] = vec2[](vec2(-1, -1), vec2(1, -1), vec2(1, 1),
+                               vec2(1, 1), vec2(-1, 1), vec2(-1, -1));
+
+void main() {
+    vec3 position = vec3(corners[gl_VertexIndex].x, 0.0, corners[gl_VertexIndex].y) * extent;
+    worldPosition = position;
+    viewDepth = -(frame.view * vec4(position, 1.0)).z;
+    gl_Position = frame.viewProj * vec4(position, 1.0);
+}
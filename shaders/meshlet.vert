@@ -0,0 +1,27 @@
+#version 450
+
+// MeshletRenderer's vertex buffer: position, normal
+layout(std430, binding = 0) readonly buffer Vertices { vec4 vertices[]; };
+// position, scale
+layout(std430, binding = 1) readonly buffer Instances { vec4 instances[]; };
+
+layout(push_constant) uniform Constants {
+    mat4 viewProj;
+    uint vertexCount;  // per instance
+} pc;
+
+layout(location = 0) out vec3 worldNormal;
+layout(location = 1) out vec3 color;
+
+// the cull pass wrote instance * vertexCount + vertex as the index
+void main() {
+    uint instance = uint(gl_VertexIndex) / pc.vertexCount;
+    uint vertex = uint(gl_VertexIndex) - instance * pc.vertexCount;
+    vec4 placement = instances[instance];
+    vec3 position = vertices[vertex * 2u].xyz * placement.w + placement.xyz;
+    gl_Position = pc.viewProj * vec4(position, 1.0);
+    worldNormal = vertices[vertex * 2u + 1u].xyz;
+    uint hash = instance * 2654435761u;
+    color = vec3((hash >> 8) & 0xffu, (hash >> 16) & 0xffu, (hash >> 24) & 0xffu) /
+            255.0 * 0.5 + 0.35;
+}
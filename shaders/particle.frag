@@ -0,0 +1,11 @@
+#version 450
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragUv;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    float falloff = clamp(1.0 - dot(fragUv, fragUv), 0.0, 1.0);
+    outColor = vec4(fragColor.rgb, fragColor.a * falloff);
+}
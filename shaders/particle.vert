@@ -0,0 +1,25 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "particle_common.glsl"
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragUv;
+
+const vec2 corners[6] = vec2[](vec2(-1, -1), vec2(1, -1), vec2(1, 1),
+                               vec2(1, 1), vec2(-1, 1), vec2(-1, -1));
+
+// camera facing quad per instance, instances in sorted order
+void main() {
+    uint index = aliveLists[(pc.parity ^ 1u) * pc.capacity + gl_InstanceIndex];
+    Particle p = particles[index];
+    vec2 corner = corners[gl_VertexIndex];
+
+    vec4 center = pc.viewProj * vec4(p.positionLife.xyz, 1.0);
+    // offset in clip space so the quad always faces the camera
+    vec2 projScale = vec2(pc.emitterPosition.w, pc.cameraPosition.w);
+    center.xy += corner * p.velocitySize.w * projScale;
+    gl_Position = center;
+    fragColor = p.color;
+    fragUv = corner;
+}
@@ -0,0 +1,60 @@
+// shared by the particle compute passes and particle.vert
+
+struct Particle {
+    vec4 positionLife;  // xyz position, w seconds left
+    vec4 velocitySize;  // xyz velocity, w quad size
+    vec4 color;
+};
+
+layout(std430, binding = 0) buffer Particles { Particle particles[]; };
+layout(std430, binding = 1) buffer DeadList { uint deadList[]; };
+// two lists of capacity entries each; parity picks the one being read
+layout(std430, binding = 2) buffer AliveLists { uint aliveLists[]; };
+layout(std430, binding = 3) buffer SortKeys { float sortKeys[]; };
+
+// alive counts of both lists, dead count, particles emitted this frame and
+// the power of two the sort runs over
+#define COUNTER_ALIVE0 0
+#define COUNTER_ALIVE1 1
+#define COUNTER_DEAD 2
+#define COUNTER_EMIT 3
+#define COUNTER_SORT_SIZE 4
+layout(std430, binding = 4) buffer Counters { uint counters[]; };
+
+// emit dispatch, simulate dispatch, draw, sort dispatch
+#define ARGS_EMIT 0
+#define ARGS_SIMULATE 3
+#define ARGS_DRAW 6
+#define ARGS_SORT 10
+layout(std430, binding = 5) buffer IndirectArgs { uint indirectArgs[]; };
+
+layout(push_constant) uniform Constants {
+    mat4 viewProj;
+    vec4 emitterPosition;  // w: projection x scale
+    vec4 cameraPosition;   // w: projection y scale
+    float dt;
+    float time;
+    uint parity;
+    uint emitRequest;
+    uint capacity;
+    uint frame;
+    uint sortK;
+    uint sortJ;
+} pc;
+
+#define PARTICLE_GROUP_SIZE 256
+#define SORT_BLOCK 512
+
+uint hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+float random01(inout uint state) {
+    state = hash(state);
+    return float(state) / 4294967295.0;
+}
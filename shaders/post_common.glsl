@@ -0,0 +1,65 @@
+// shared by the post processing compute passes
+
+layout(binding = 0, rgba16f) uniform image2D hdrImage;
+// bloom pyramid, one storage view per mip. separate bindings instead of an
+// array so no dynamic indexing feature is needed; unused ones alias the last
+layout(binding = 1, rgba16f) coherent uniform image2D bloomMip0;
+layout(binding = 2, rgba16f) coherent uniform image2D bloomMip1;
+layout(binding = 3, rgba16f) coherent uniform image2D bloomMip2;
+layout(binding = 4, rgba16f) coherent uniform image2D bloomMip3;
+layout(binding = 5, rgba16f) coherent uniform image2D bloomMip4;
+layout(binding = 6, rgba16f) coherent uniform image2D bloomMip5;
+layout(binding = 7, rgba16f) coherent uniform image2D bloomMip6;
+layout(binding = 8, rgba16f) coherent uniform image2D bloomMip7;
+layout(binding = 9) uniform sampler2D bloomTexture;
+layout(binding = 10, rgba16f) uniform image2D blurTemp;
+layout(binding = 11) buffer PostState {
+    uint downsampleCounter;  // workgroups done, for the last-group handoff
+    uint lumSum;             // per workgroup average log2 luminance, 8.8 fixed
+    uint lumCount;           // workgroups that added to lumSum
+    float exposure;          // adapted exposure, 0 until the first frame
+} state;
+layout(binding = 12, rgba16f) uniform image2D bloomBlurMip;
+
+layout(push_constant) uniform Constants {
+    ivec2 hdrSize;
+    ivec2 mip0Size;
+    ivec2 blurSize;
+    uint mipCount;
+    uint groupCount;
+    uint blurDirection;
+    uint blurMip;
+    float dt;
+    float bloomStrength;
+    float bloomThreshold;
+} pc;
+
+float luminance(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec4 loadMip(int m, ivec2 p) {
+    switch (m) {
+        case 0: return imageLoad(bloomMip0, p);
+        case 1: return imageLoad(bloomMip1, p);
+        case 2: return imageLoad(bloomMip2, p);
+        case 3: return imageLoad(bloomMip3, p);
+        case 4: return imageLoad(bloomMip4, p);
+        case 5: return imageLoad(bloomMip5, p);
+        case 6: return imageLoad(bloomMip6, p);
+        default: return imageLoad(bloomMip7, p);
+    }
+}
+
+void storeMip(int m, ivec2 p, vec4 v) {
+    switch (m) {
+        case 0: imageStore(bloomMip0, p, v); break;
+        case 1: imageStore(bloomMip1, p, v); break;
+        case 2: imageStore(bloomMip2, p, v); break;
+        case 3: imageStore(bloomMip3, p, v); break;
+        case 4: imageStore(bloomMip4, p, v); break;
+        case 5: imageStore(bloomMip5, p, v); break;
+        case 6: imageStore(bloomMip6, p, v); break;
+        default: imageStore(bloomMip7, p, v); break;
+    }
+}
@@ -0,0 +1,19 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+// per instance, built on the CPU for this frame's camera
+layout(location = 2) in mat4 inMvp;
+layout(location = 6) in vec4 inRotation;  // cos and sin of the yaw, tint
+
+layout(location = 0) out vec3 worldNormal;
+layout(location = 1) out float tint;
+
+void main() {
+    gl_Position = inMvp * vec4(inPosition, 1.0);
+    float c = inRotation.x;
+    float s = inRotation.y;
+    worldNormal = vec3(c * inNormal.x + s * inNormal.z, inNormal.y,
+                       c * inNormal.z - s * inNormal.x);
+    tint = inRotation.z;
+}
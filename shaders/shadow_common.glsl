@@ -0,0 +1,12 @@
+// shared by the shadow receiving shaders; must match ShadowMaps::FrameConstants
+
+#define CASCADE_COUNT 4
+
+layout(std140, binding = 0) uniform FrameConstants {
+    mat4 viewProj;
+    mat4 view;
+    mat4 cascades[CASCADE_COUNT];  // world to light clip space
+    vec4 splits;                   // view depth where each cascade ends
+    vec4 texelSizes;               // world size of a shadow texel
+    vec4 sunDirection;             // xyz towards the sun
+} frame;
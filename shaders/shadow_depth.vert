@@ -0,0 +1,11 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+
+layout(push_constant) uniform Constants {
+    mat4 mvp;  // cascade viewProj * model
+} pc;
+
+void main() {
+    gl_Position = pc.mvp * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,54 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "shadow_common.glsl"
+
+// cascade i is layer i of both; static casters and dynamic ones are kept
+// apart so the static layer can stay cached while the dynamic one changes
+layout(binding = 1) uniform sampler2DArrayShadow staticShadows;
+layout(binding = 2) uniform sampler2DArrayShadow dynamicShadows;
+
+layout(push_constant) uniform Constants {
+    mat4 model;
+    vec4 color;
+} pc;
+
+layout(location = 0) in vec3 worldPosition;
+layout(location = 1) in vec3 worldNormal;
+layout(location = 2) in float viewDepth;
+
+layout(location = 0) out vec4 outColor;
+
+const vec2 taps[4] = vec2[](vec2(-0.5, -0.5), vec2(0.5, -0.5),
+                            vec2(-0.5, 0.5), vec2(0.5, 0.5));
+
+// four bilinear compare taps, a 3x3 texel filter
+float cascadeShadow(uint cascade, vec3 normal) {
+    // pushing the receiver out along its normal by about a texel hides the
+    // acne the slope bias leaves on surfaces facing away from the sun
+    vec3 position = worldPosition + normal * frame.texelSizes[cascade] * 1.5;
+    vec4 p = frame.cascades[cascade] * vec4(position, 1.0);
+    vec2 uv = p.xy * 0.5 + 0.5;
+    vec2 texel = 1.0 / vec2(textureSize(staticShadows, 0).xy);
+    float lit = 0.0;
+    for (int i = 0; i < 4; i++) {
+        vec4 coord = vec4(uv + taps[i] * texel, float(cascade), p.z);
+        lit += min(texture(staticShadows, coord), texture(dynamicShadows, coord));
+    }
+    return lit * 0.25;
+}
+
+void main() {
+    vec3 normal = normalize(worldNormal);
+    uint cascade = 0u;
+    while (cascade < CASCADE_COUNT - 1 && viewDepth > frame.splits[cascade]) {
+        cascade++;
+    }
+    float shadow = viewDepth > frame.splits[CASCADE_COUNT - 1]
+                       ? 1.0
+                       : cascadeShadow(cascade, normal);
+
+    float lambert = max(dot(normal, frame.sunDirection.xyz), 0.0);
+    vec3 color = pc.color.rgb * (0.08 + 0.9 * lambert * shadow);
+    outColor = vec4(color, 1.0);
+}
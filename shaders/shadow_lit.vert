@@ -0,0 +1,25 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "shadow_common.glsl"
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+
+layout(push_constant) uniform Constants {
+    mat4 model;
+    vec4 color;
+} pc;
+
+layout(location = 0) out vec3 worldPosition;
+layout(location = 1) out vec3 worldNormal;
+layout(location = 2) out float viewDepth;
+
+void main() {
+    vec4 position = pc.model * vec4(inPosition, 1.0);
+    worldPosition = position.xyz;
+    // boxes are scaled unevenly
+    worldNormal = transpose(inverse(mat3(pc.model))) * inNormal;
+    viewDepth = -(frame.view * position).z;
+    gl_Position = frame.viewProj * position;
+}
@@ -0,0 +1,17 @@
+#version 450
+
+layout(location = 0) in vec3 worldNormal;
+
+layout(location = 0) out vec4 outColor;
+
+layout(push_constant) uniform Constants {
+    layout(offset = 64) vec4 color;
+} pc;
+
+void main() {
+    const vec3 sun = normalize(vec3(0.4, 1.0, 0.3));
+    vec3 normal = normalize(worldNormal);
+    // sun plus a little sky from above
+    float light = max(dot(normal, sun), 0.0) * 0.8 + 0.15 + 0.1 * normal.y;
+    outColor = vec4(pc.color.rgb * light, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 450
+
+// already skinned, in world space
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+
+layout(location = 0) out vec3 worldNormal;
+
+layout(push_constant) uniform Constants {
+    mat4 viewProj;
+} pc;
+
+void main() {
+    gl_Position = pc.viewProj * vec4(inPosition, 1.0);
+    worldNormal = inNormal;
+}
@@ -0,0 +1,19 @@
+#version 450
+
+layout(location = 0) in vec3 worldNormal;
+layout(location = 1) in float height;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 normal = normalize(worldNormal);
+    const vec3 sun = normalize(vec3(0.4, 1.0, 0.3));
+    // grass on the flats, rock on the slopes, snow on high flats
+    float steep = smoothstep(0.12, 0.3, 1.0 - normal.y);
+    vec3 color = mix(vec3(0.22, 0.34, 0.13), vec3(0.42, 0.38, 0.33), steep);
+    float snow = smoothstep(22.0, 28.0, height) * (1.0 - steep * 0.8);
+    color = mix(color, vec3(0.9, 0.92, 0.95), snow);
+    // sun plus a little sky from above
+    float light = max(dot(normal, sun), 0.0) * 0.8 + 0.15 + 0.1 * normal.y;
+    outColor = vec4(color * light, 1.0);
+}
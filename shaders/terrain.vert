@@ -0,0 +1,79 @@
+#version 450
+
+// must match TerrainRenderer::DrawConstants
+layout(push_constant) uniform Constants {
+    mat4 viewProj;
+    vec4 camera;  // world space position, unused
+    vec4 valley;  // floor height, base height, inner and outer radius
+} pc;
+
+// a tile per resident node: the grid's heights with a border sample around
+layout(binding = 0) uniform sampler2D heights;
+
+// per node
+// corner x, z relative to the camera, size, unused
+layout(location = 0) in vec4 inNode;
+layout(location = 1) in vec4 inTile;  // atlas texel x, y, morph start, end
+
+layout(location = 0) out vec3 worldNormal;
+layout(location = 1) out float height;
+
+const uint kGridCells = 32u;  // TerrainRenderer::kGridCells
+
+float tileSample(ivec2 grid) {
+    return texelFetch(heights, ivec2(inTile.xy) + 1 + grid, 0).r;
+}
+
+// bilinear between the tile's samples; exact on the grid's vertices
+float tileHeight(vec2 grid) {
+    ivec2 i = ivec2(floor(grid));
+    vec2 f = grid - vec2(i);
+    float h00 = tileSample(i);
+    float h10 = tileSample(i + ivec2(1, 0));
+    float h01 = tileSample(i + ivec2(0, 1));
+    float h11 = tileSample(i + ivec2(1, 1));
+    return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+}
+
+// 0 on the valley floor around the world origin, 1 out in the terrain
+float valleyOpen(vec2 worldXZ) {
+    return smoothstep(pc.valley.z, pc.valley.w, length(worldXZ));
+}
+
+float valleyHeight(float h, vec2 worldXZ) {
+    return mix(pc.valley.x, h + pc.valley.y, valleyOpen(worldXZ));
+}
+
+void main() {
+    // the grid vertex is the index itself
+    uint index = uint(gl_VertexIndex);
+    vec2 grid = vec2(index % (kGridCells + 1u), index / (kGridCells + 1u));
+    float spacing = inNode.z / float(kGridCells);
+
+    // how far into its level's morph range the vertex is, then odd
+    // vertices slide onto the coarser grid's edges: fully morphed, the node
+    // matches a neighbour one level up. positions stay relative to the
+    // camera until they're small world space ones.
+    vec2 relativeXZ = inNode.xy + grid * spacing;
+    float h = valleyHeight(tileHeight(grid), relativeXZ + pc.camera.xz);
+    float cameraDistance =
+        length(vec3(relativeXZ.x, h - pc.camera.y, relativeXZ.y));
+    float morph =
+        clamp((cameraDistance - inTile.z) / (inTile.w - inTile.z), 0.0, 1.0);
+    grid -= fract(grid * 0.5) * 2.0 * morph;
+
+    vec2 worldXZ = inNode.xy + grid * spacing + pc.camera.xz;
+    h = valleyHeight(tileHeight(grid), worldXZ);
+    gl_Position = pc.viewProj * vec4(worldXZ.x, h, worldXZ.y, 1.0);
+
+    // central differences around the nearest sample, flattened like the
+    // heights
+    ivec2 center = ivec2(round(grid));
+    float dx = tileSample(center - ivec2(1, 0)) -
+               tileSample(center + ivec2(1, 0));
+    float dz = tileSample(center - ivec2(0, 1)) -
+               tileSample(center + ivec2(0, 1));
+    float open = valleyOpen(worldXZ);
+    worldNormal = vec3(dx * open, 2.0 * spacing, dz * open);
+    height = h;
+}
@@ -0,0 +1,28 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "virtual_texture_common.glsl"
+
+layout(binding = 0) uniform sampler2D atlas;
+// per page of every mip: atlas x, atlas y, and the mip of the page that's
+// there - the page itself or the nearest coarser one that's resident
+layout(binding = 1) uniform usampler2D indirection;
+
+layout(location = 0) in vec2 uv;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    uint mip = uint(virtualMip(uv));
+    uvec4 entry = texelFetch(indirection, ivec2(virtualPage(uv, mip)),
+                             int(mip));
+
+    // where uv falls inside the resident page, then inside its border
+    vec2 pages = vec2(virtualPages(entry.z));
+    vec2 position = clamp(uv, 0.0, 1.0) * pages;
+    vec2 inPage = position - min(floor(position), pages - 1.0);
+    vec2 texel =
+        vec2(entry.xy) * pc.atlas.x + pc.atlas.y + inPage * pc.texture.w;
+    // bilinear within the page only; the atlas has no mips to blend
+    outColor = vec4(textureLod(atlas, texel / pc.atlas.zw, 0.0).rgb, 1.0);
+}
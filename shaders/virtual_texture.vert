@@ -0,0 +1,17 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "virtual_texture_common.glsl"
+
+layout(location = 0) out vec2 uv;
+
+// the ground plane as two triangles; the virtual texture covers it once
+void main() {
+    const vec2 corners[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0),
+                                   vec2(1.0, 1.0), vec2(-1.0, -1.0),
+                                   vec2(1.0, 1.0), vec2(-1.0, 1.0));
+    vec2 corner = corners[gl_VertexIndex];
+    gl_Position = pc.viewProj * vec4(corner.x * pc.plane.x, pc.plane.y,
+                                     corner.y * pc.plane.x, 1.0);
+    uv = corner * 0.5 + 0.5;
+}
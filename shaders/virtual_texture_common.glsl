@@ -0,0 +1,29 @@
+// shared by the virtual texture shaders; must match
+// VirtualTexture::DrawConstants
+
+layout(push_constant) uniform Constants {
+    mat4 viewProj;
+    vec4 plane;    // half size, height, lod bias, unused
+    vec4 texture;  // pages x, pages y, mip count, texels per page
+    vec4 atlas;    // page size, border, atlas width, height
+} pc;
+
+// the finest mip the pixel at uv needs, from how many mip 0 texels it spans
+int virtualMip(vec2 uv) {
+    vec2 texels = uv * pc.texture.xy * pc.texture.w;
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + pc.plane.z;
+    return clamp(int(floor(lod)), 0, int(pc.texture.z) - 1);
+}
+
+// pages of mip `mip` per side
+uvec2 virtualPages(uint mip) {
+    return max(uvec2(pc.texture.xy) >> mip, uvec2(1u));
+}
+
+// the page of mip `mip` that uv falls into
+uvec2 virtualPage(vec2 uv, uint mip) {
+    uvec2 pages = virtualPages(mip);
+    return min(uvec2(clamp(uv, 0.0, 1.0) * vec2(pages)), pages - 1u);
+}
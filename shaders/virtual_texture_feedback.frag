@@ -0,0 +1,15 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "virtual_texture_common.glsl"
+
+layout(location = 0) in vec2 uv;
+
+layout(location = 0) out uint page;
+
+// the page this pixel wants as mip << 24 | y << 12 | x
+void main() {
+    uint mip = uint(virtualMip(uv));
+    uvec2 xy = virtualPage(uv, mip);
+    page = mip << 24 | xy.y << 12 | xy.x;
+}
@@ -0,0 +1,100 @@
+#include "alloc_counter.h"
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+namespace {
+
+std::atomic<uint64_t> count{0};
+std::atomic<uint64_t> bytes{0};
+
+void* countedAlloc(size_t size) {
+  count.fetch_add(1, std::memory_order_relaxed);
+  bytes.fetch_add(size, std::memory_order_relaxed);
+  // new has to return a unique pointer even for zero bytes
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* countedAlignedAlloc(size_t size, std::align_val_t alignment) {
+  count.fetch_add(1, std::memory_order_relaxed);
+  bytes.fetch_add(size, std::memory_order_relaxed);
+  size_t align = (size_t)alignment;
+#ifdef _WIN32
+  void* p = _aligned_malloc(size ? size : 1, align);
+#else
+  // aligned_alloc wants a multiple of the alignment
+  void* p = aligned_alloc(align, ((size ? size : 1) + align - 1) & ~(align - 1));
+#endif
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void alignedFree(void* p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+}  // namespace
+
+uint64_t allocationCount() { return count.load(std::memory_order_relaxed); }
+uint64_t allocatedBytes() { return bytes.load(std::memory_order_relaxed); }
+
+// the array and nothrow forms forward to these by default, but not on every
+// standard library, so all of them are replaced
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return countedAlloc(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return countedAlloc(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+  return countedAlignedAlloc(size, alignment);
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return countedAlignedAlloc(size, alignment);
+}
+void* operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  try {
+    return countedAlignedAlloc(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void* operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  try {
+    return countedAlignedAlloc(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  alignedFree(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+  alignedFree(p);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+// The engine replaces the global operator new/delete with versions that
+// count calls, so a frame's heap traffic can be measured by diffing the
+// counters around it (--check-allocs). Relaxed atomics, cheap enough to be
+// always on. malloc calls made by C libraries and the driver aren't seen.
+
+uint64_t allocationCount();
+uint64_t allocatedBytes();
@@ -0,0 +1,273 @@
+#include "animation.h"
+
+#include <assert.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ANIMATION_SSE 1
+#include <emmintrin.h>
+#endif
+
+uint32_t Skeleton::addJoint(int32_t parent, const glm::vec3& offset) {
+  assert(parent < (int32_t)parents.size());
+  assert(parents.size() < kMaxJoints);
+  parents.push_back(parent);
+  restOffsets.push_back(offset);
+  uint32_t joint = (uint32_t)parents.size() - 1;
+  inverseBind.push_back(glm::mat4(1.0f));
+  inverseBind[joint][3] = glm::vec4(-restPosition(joint), 1.0f);
+  return joint;
+}
+
+glm::vec3 Skeleton::restPosition(uint32_t joint) const {
+  glm::vec3 position(0.0f);
+  for (int32_t j = (int32_t)joint; j >= 0; j = parents[j]) {
+    position += restOffsets[j];
+  }
+  return position;
+}
+
+AnimationClip bakeClip(
+    const Skeleton& skeleton, float duration, float keysPerSecond,
+    const std::function<void(float, glm::quat*, glm::vec3&)>& pose) {
+  const uint32_t jointCount = skeleton.jointCount();
+  const uint32_t padded = skeleton.paddedJointCount();
+  AnimationClip clip;
+  clip.duration = duration;
+  clip.keysPerSecond = keysPerSecond;
+  clip.keyCount = (uint32_t)ceilf(duration * keysPerSecond) + 1;
+  clip.rx.assign((size_t)clip.keyCount * padded, 0.0f);
+  clip.ry.assign((size_t)clip.keyCount * padded, 0.0f);
+  clip.rz.assign((size_t)clip.keyCount * padded, 0.0f);
+  clip.rw.assign((size_t)clip.keyCount * padded, 1.0f);
+  clip.rootTranslation.resize(clip.keyCount);
+
+  glm::quat rotations[Skeleton::kMaxJoints];
+  for (uint32_t key = 0; key < clip.keyCount; key++) {
+    float time = key + 1 < clip.keyCount ? key / keysPerSecond : 0.0f;
+    for (uint32_t j = 0; j < jointCount; j++) {
+      rotations[j] = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    }
+    pose(time, rotations, clip.rootTranslation[key]);
+    for (uint32_t j = 0; j < jointCount; j++) {
+      size_t i = (size_t)key * padded + j;
+      glm::quat q = glm::normalize(rotations[j]);
+      // neighbouring keys in the same hemisphere, so sampling can lerp
+      // without checking
+      if (key > 0) {
+        size_t p = i - padded;
+        float d = q.x * clip.rx[p] + q.y * clip.ry[p] + q.z * clip.rz[p] +
+                  q.w * clip.rw[p];
+        if (d < 0.0f) q = -q;
+      }
+      clip.rx[i] = q.x;
+      clip.ry[i] = q.y;
+      clip.rz[i] = q.z;
+      clip.rw[i] = q.w;
+    }
+  }
+  return clip;
+}
+
+// SoA rotations of one pose, kMaxJoints wide
+struct alignas(16) PoseRotations {
+  float x[Skeleton::kMaxJoints];
+  float y[Skeleton::kMaxJoints];
+  float z[Skeleton::kMaxJoints];
+  float w[Skeleton::kMaxJoints];
+};
+
+// lerps between the two keys around time; the result isn't normalized
+static void sampleClip(const AnimationClip& clip, uint32_t padded, float time,
+                       PoseRotations& out, glm::vec3& root) {
+  float t = fmodf(time, clip.duration);
+  if (t < 0.0f) t += clip.duration;
+  float keyPosition = t * clip.keysPerSecond;
+  uint32_t key = (uint32_t)keyPosition;
+  if (key > clip.keyCount - 2) key = clip.keyCount - 2;
+  float f = keyPosition - key;
+  root = glm::mix(clip.rootTranslation[key], clip.rootTranslation[key + 1], f);
+
+  const size_t k0 = (size_t)key * padded;
+  const size_t k1 = k0 + padded;
+  const float* tracks[4] = {clip.rx.data(), clip.ry.data(), clip.rz.data(),
+                            clip.rw.data()};
+  float* outputs[4] = {out.x, out.y, out.z, out.w};
+  for (uint32_t c = 0; c < 4; c++) {
+    const float* track = tracks[c];
+    float* dst = outputs[c];
+#ifdef ANIMATION_SSE
+    __m128 vf = _mm_set1_ps(f);
+    for (uint32_t j = 0; j < padded; j += 4) {
+      __m128 a = _mm_loadu_ps(track + k0 + j);
+      __m128 b = _mm_loadu_ps(track + k1 + j);
+      _mm_store_ps(dst + j, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), vf)));
+    }
+#else
+    for (uint32_t j = 0; j < padded; j++) {
+      float a = track[k0 + j];
+      dst[j] = a + (track[k1 + j] - a) * f;
+    }
+#endif
+  }
+}
+
+// a = normalize(lerp(a, b, weight)), taking b through the shorter arc
+static void blendRotations(PoseRotations& a, const PoseRotations& b,
+                           uint32_t padded, float weight) {
+#ifdef ANIMATION_SSE
+  const __m128 wa = _mm_set1_ps(1.0f - weight);
+  const __m128 wb = _mm_set1_ps(weight);
+  const __m128 signBit = _mm_set1_ps(-0.0f);
+  for (uint32_t j = 0; j < padded; j += 4) {
+    __m128 ax = _mm_load_ps(a.x + j), ay = _mm_load_ps(a.y + j);
+    __m128 az = _mm_load_ps(a.z + j), aw = _mm_load_ps(a.w + j);
+    __m128 bx = _mm_load_ps(b.x + j), by = _mm_load_ps(b.y + j);
+    __m128 bz = _mm_load_ps(b.z + j), bw = _mm_load_ps(b.w + j);
+    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                          _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+    // flip b's weight where the dot product is negative
+    __m128 s = _mm_xor_ps(wb, _mm_and_ps(d, signBit));
+    __m128 x = _mm_add_ps(_mm_mul_ps(ax, wa), _mm_mul_ps(bx, s));
+    __m128 y = _mm_add_ps(_mm_mul_ps(ay, wa), _mm_mul_ps(by, s));
+    __m128 z = _mm_add_ps(_mm_mul_ps(az, wa), _mm_mul_ps(bz, s));
+    __m128 w = _mm_add_ps(_mm_mul_ps(aw, wa), _mm_mul_ps(bw, s));
+    __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+                                 _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+    __m128 invLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSq));
+    _mm_store_ps(a.x + j, _mm_mul_ps(x, invLength));
+    _mm_store_ps(a.y + j, _mm_mul_ps(y, invLength));
+    _mm_store_ps(a.z + j, _mm_mul_ps(z, invLength));
+    _mm_store_ps(a.w + j, _mm_mul_ps(w, invLength));
+  }
+#else
+  for (uint32_t j = 0; j < padded; j++) {
+    float d = a.x[j] * b.x[j] + a.y[j] * b.y[j] + a.z[j] * b.z[j] +
+              a.w[j] * b.w[j];
+    float s = d < 0.0f ? -weight : weight;
+    float x = a.x[j] * (1.0f - weight) + b.x[j] * s;
+    float y = a.y[j] * (1.0f - weight) + b.y[j] * s;
+    float z = a.z[j] * (1.0f - weight) + b.z[j] * s;
+    float w = a.w[j] * (1.0f - weight) + b.w[j] * s;
+    float invLength = 1.0f / sqrtf(x * x + y * y + z * z + w * w);
+    a.x[j] = x * invLength;
+    a.y[j] = y * invLength;
+    a.z[j] = z * invLength;
+    a.w[j] = w * invLength;
+  }
+#endif
+}
+
+// rotation parts of the local joint matrices, SoA; m[c * 3 + r] holds
+// column c, row r
+struct alignas(16) PoseMatrices {
+  float m[9][Skeleton::kMaxJoints];
+};
+
+static void buildRotations(const PoseRotations& q, uint32_t padded,
+                           PoseMatrices& out) {
+#ifdef ANIMATION_SSE
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  for (uint32_t j = 0; j < padded; j += 4) {
+    __m128 x = _mm_load_ps(q.x + j), y = _mm_load_ps(q.y + j);
+    __m128 z = _mm_load_ps(q.z + j), w = _mm_load_ps(q.w + j);
+    __m128 x2 = _mm_mul_ps(x, two), y2 = _mm_mul_ps(y, two);
+    __m128 z2 = _mm_mul_ps(z, two);
+    __m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2);
+    __m128 zz = _mm_mul_ps(z, z2);
+    __m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2);
+    __m128 yz = _mm_mul_ps(y, z2);
+    __m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2);
+    __m128 wz = _mm_mul_ps(w, z2);
+    _mm_store_ps(out.m[0] + j, _mm_sub_ps(one, _mm_add_ps(yy, zz)));
+    _mm_store_ps(out.m[1] + j, _mm_add_ps(xy, wz));
+    _mm_store_ps(out.m[2] + j, _mm_sub_ps(xz, wy));
+    _mm_store_ps(out.m[3] + j, _mm_sub_ps(xy, wz));
+    _mm_store_ps(out.m[4] + j, _mm_sub_ps(one, _mm_add_ps(xx, zz)));
+    _mm_store_ps(out.m[5] + j, _mm_add_ps(yz, wx));
+    _mm_store_ps(out.m[6] + j, _mm_add_ps(xz, wy));
+    _mm_store_ps(out.m[7] + j, _mm_sub_ps(yz, wx));
+    _mm_store_ps(out.m[8] + j, _mm_sub_ps(one, _mm_add_ps(xx, yy)));
+  }
+#else
+  for (uint32_t j = 0; j < padded; j++) {
+    float x = q.x[j], y = q.y[j], z = q.z[j], w = q.w[j];
+    out.m[0][j] = 1.0f - 2.0f * (y * y + z * z);
+    out.m[1][j] = 2.0f * (x * y + w * z);
+    out.m[2][j] = 2.0f * (x * z - w * y);
+    out.m[3][j] = 2.0f * (x * y - w * z);
+    out.m[4][j] = 1.0f - 2.0f * (x * x + z * z);
+    out.m[5][j] = 2.0f * (y * z + w * x);
+    out.m[6][j] = 2.0f * (x * z + w * y);
+    out.m[7][j] = 2.0f * (y * z - w * x);
+    out.m[8][j] = 1.0f - 2.0f * (x * x + y * y);
+  }
+#endif
+}
+
+// out = a * b, column major; out must not alias a or b
+static void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out) {
+#ifdef ANIMATION_SSE
+  __m128 a0 = _mm_loadu_ps(&a[0][0]), a1 = _mm_loadu_ps(&a[1][0]);
+  __m128 a2 = _mm_loadu_ps(&a[2][0]), a3 = _mm_loadu_ps(&a[3][0]);
+  for (int c = 0; c < 4; c++) {
+    __m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[c][0]));
+    r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[c][1])));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[c][2])));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[c][3])));
+    _mm_storeu_ps(&out[c][0], r);
+  }
+#else
+  out = a * b;
+#endif
+}
+
+// the top three rows of m, for a 3x4 palette entry
+static void storeRows(const glm::mat4& m, float* dst) {
+#ifdef ANIMATION_SSE
+  __m128 c0 = _mm_loadu_ps(&m[0][0]), c1 = _mm_loadu_ps(&m[1][0]);
+  __m128 c2 = _mm_loadu_ps(&m[2][0]), c3 = _mm_loadu_ps(&m[3][0]);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+  _mm_storeu_ps(dst, c0);
+  _mm_storeu_ps(dst + 4, c1);
+  _mm_storeu_ps(dst + 8, c2);
+#else
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) dst[r * 4 + c] = m[c][r];
+  }
+#endif
+}
+
+void samplePalette(const Skeleton& skeleton, const AnimationClip& a,
+                   float timeA, const AnimationClip& b, float timeB,
+                   float weight, const glm::mat4& world, float* palette) {
+  const uint32_t jointCount = skeleton.jointCount();
+  const uint32_t padded = skeleton.paddedJointCount();
+  PoseRotations poseA, poseB;
+  glm::vec3 rootA, rootB;
+  sampleClip(a, padded, timeA, poseA, rootA);
+  sampleClip(b, padded, timeB, poseB, rootB);
+  blendRotations(poseA, poseB, padded, weight);
+  PoseMatrices rotations;
+  buildRotations(poseA, padded, rotations);
+
+  glm::mat4 model[Skeleton::kMaxJoints];
+  for (uint32_t j = 0; j < jointCount; j++) {
+    glm::mat4 local;
+    for (int c = 0; c < 3; c++) {
+      local[c] = glm::vec4(rotations.m[c * 3][j], rotations.m[c * 3 + 1][j],
+                           rotations.m[c * 3 + 2][j], 0.0f);
+    }
+    glm::vec3 offset = skeleton.restOffsets[j];
+    if (j == 0) offset += glm::mix(rootA, rootB, weight);
+    local[3] = glm::vec4(offset, 1.0f);
+
+    int32_t parent = skeleton.parents[j];
+    multiply(parent < 0 ? world : model[parent], local, model[j]);
+    glm::mat4 skin;
+    multiply(model[j], skeleton.inverseBind[j], skin);
+    storeRows(skin, palette + j * 12);
+  }
+}
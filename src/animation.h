@@ -0,0 +1,61 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+// Skeletal animation on the CPU: a joint hierarchy, looping clips baked into
+// keyframe tracks, and sampling two clips into a blended skinning palette.
+//
+// Clip tracks are SoA: one array per quaternion component, indexed
+// [key * paddedJointCount + joint], so four neighbouring joints of a key
+// are one SIMD load. Sampling, the blend (nlerp) and building the local
+// joint matrices all run on four joints at a time with SSE where the
+// target has it and plain scalar code otherwise; only the hierarchy walk is
+// per joint. Nothing here allocates or locks, so callers can split
+// characters across job workers freely.
+
+struct Skeleton {
+  static const uint32_t kMaxJoints = 64;
+
+  // parents must be added before their children; -1 for the root. offset
+  // is the joint's rest translation from its parent, rest rotations are
+  // identity.
+  uint32_t addJoint(int32_t parent, const glm::vec3& offset);
+  // rest pose model space position of a joint
+  glm::vec3 restPosition(uint32_t joint) const;
+
+  uint32_t jointCount() const { return (uint32_t)parents.size(); }
+  // jointCount rounded up to the SIMD width, the stride of clip tracks
+  uint32_t paddedJointCount() const { return (jointCount() + 3) & ~3u; }
+
+  std::vector<int32_t> parents;
+  std::vector<glm::vec3> restOffsets;
+  std::vector<glm::mat4> inverseBind;
+};
+
+struct AnimationClip {
+  float duration = 0.0f;
+  float keysPerSecond = 0.0f;
+  // the last key repeats the first, so sampling never wraps between keys
+  uint32_t keyCount = 0;
+  std::vector<float> rx, ry, rz, rw;
+  // added to the root's rest offset
+  std::vector<glm::vec3> rootTranslation;
+};
+
+// samples pose(time, rotations, rootTranslation) at every key of a looping
+// clip; pose fills one rotation per joint
+AnimationClip bakeClip(
+    const Skeleton& skeleton, float duration, float keysPerSecond,
+    const std::function<void(float, glm::quat*, glm::vec3&)>& pose);
+
+// samples a at timeA and b at timeB, blends them by weight (0 is all a) and
+// writes jointCount skinning matrices (world * joint * inverse bind) to
+// palette, each as three row major rows of a 3x4 matrix
+void samplePalette(const Skeleton& skeleton, const AnimationClip& a,
+                   float timeA, const AnimationClip& b, float timeB,
+                   float weight, const glm::mat4& world, float* palette);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// On-disk layout of cooked asset archives (.pak), shared by the engine and
+// tools/cook.
+//
+// A file is an ArchiveHeader, the chunks, and then three tables: one
+// ArchiveEntry per asset, a hash table of tableSlotCount uint32_t slots and
+// the names, each followed by a 0. Chunks start on kArchiveChunkAlignment
+// boundaries so they can be mapped or read with direct I/O on their own.
+// Everything is little endian.
+//
+// The hash table maps archiveNameHash(name) to an entry: linear probing
+// from hash & (tableSlotCount - 1), slots hold entry index + 1 and 0 ends
+// the probe. Entry indices are the asset ids used at runtime.
+
+static const uint32_t kArchiveMagic = 0x4b415056;  // "VPAK"
+static const uint32_t kArchiveVersion = 1;
+static const uint64_t kArchiveChunkAlignment = 4096;
+
+struct ArchiveHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t tableSlotCount;  // a power of two
+  uint64_t entriesOffset;
+  uint64_t tableOffset;
+  uint64_t namesOffset;
+  uint64_t namesSize;
+};
+
+enum ArchiveEntryFlags : uint32_t {
+  ARCHIVE_ENTRY_LZ4 = 1,  // the chunk is one LZ4 block (lz4.h)
+};
+
+struct ArchiveEntry {
+  uint64_t nameHash;
+  uint64_t offset;      // of the chunk, from the start of the file
+  uint64_t storedSize;  // bytes in the file
+  uint64_t size;        // bytes once decompressed
+  uint32_t nameOffset;  // into the names
+  uint32_t nameLength;  // without the 0
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+// 64 bit FNV-1a; names are relative paths with forward slashes, the way
+// they're passed to readFile()
+inline uint64_t archiveNameHash(const char* name, size_t length) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t)name[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
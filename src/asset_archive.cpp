@@ -0,0 +1,206 @@
+#include "asset_archive.h"
+
+#include "lz4.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// offset + size inside [0, limit) without overflowing
+bool inside(uint64_t offset, uint64_t size, uint64_t limit) {
+  return offset <= limit && size <= limit - offset;
+}
+
+}  // namespace
+
+bool AssetArchive::open(const char* path) {
+  close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER fileSize;
+  HANDLE mapping = nullptr;
+  const void* view = nullptr;
+  if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping) view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view) {
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  fileHandle = file;
+  mappingHandle = mapping;
+  mapped = (const uint8_t*)view;
+  mappedSize = (uint64_t)fileSize.QuadPart;
+#else
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void* view = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive
+  ::close(fd);
+  if (view == MAP_FAILED) return false;
+  // lookups jump around the tables and chunks are read once, front to back;
+  // neither wants the kernel's default read-around
+  madvise(view, (size_t)st.st_size, MADV_RANDOM);
+  mapped = (const uint8_t*)view;
+  mappedSize = (uint64_t)st.st_size;
+#endif
+
+  // check everything reads will rely on once, here
+  bool valid = inside(0, sizeof(ArchiveHeader), mappedSize);
+  if (valid) {
+    header = (const ArchiveHeader*)mapped;
+    uint32_t slots = header->tableSlotCount;
+    valid = header->magic == kArchiveMagic &&
+            header->version == kArchiveVersion && slots &&
+            (slots & (slots - 1)) == 0 && header->entryCount < slots &&
+            inside(header->entriesOffset,
+                   (uint64_t)header->entryCount * sizeof(ArchiveEntry),
+                   mappedSize) &&
+            header->entriesOffset % alignof(ArchiveEntry) == 0 &&
+            inside(header->tableOffset, (uint64_t)slots * sizeof(uint32_t),
+                   mappedSize) &&
+            header->tableOffset % alignof(uint32_t) == 0 &&
+            inside(header->namesOffset, header->namesSize, mappedSize);
+  }
+  if (valid) {
+    entries = (const ArchiveEntry*)(mapped + header->entriesOffset);
+    table = (const uint32_t*)(mapped + header->tableOffset);
+    names = (const char*)(mapped + header->namesOffset);
+    for (uint32_t i = 0; i < header->entryCount && valid; i++) {
+      const ArchiveEntry& entry = entries[i];
+      valid = inside(entry.offset, entry.storedSize, mappedSize) &&
+              inside(entry.nameOffset, (uint64_t)entry.nameLength + 1,
+                     header->namesSize) &&
+              names[entry.nameOffset + entry.nameLength] == 0 &&
+              ((entry.flags & ARCHIVE_ENTRY_LZ4) ||
+               entry.storedSize == entry.size);
+    }
+    for (uint32_t i = 0; i < header->tableSlotCount && valid; i++)
+      valid = table[i] <= header->entryCount;
+  }
+  if (!valid) {
+    printf("archive: %s is not a version %u asset archive\n", path,
+           kArchiveVersion);
+    close();
+    return false;
+  }
+  return true;
+}
+
+void AssetArchive::close() {
+  if (mapped) {
+#ifdef _WIN32
+    UnmapViewOfFile(mapped);
+    CloseHandle((HANDLE)mappingHandle);
+    CloseHandle((HANDLE)fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    munmap((void*)mapped, (size_t)mappedSize);
+#endif
+  }
+  mapped = nullptr;
+  mappedSize = 0;
+  header = nullptr;
+  entries = nullptr;
+  table = nullptr;
+  names = nullptr;
+}
+
+uint32_t AssetArchive::find(const char* name) const {
+  if (!header) return kInvalidAsset;
+  size_t length = strlen(name);
+  uint64_t hash = archiveNameHash(name, length);
+  uint32_t mask = header->tableSlotCount - 1;
+  // the table is never full, so this ends at an empty slot
+  for (uint32_t slot = (uint32_t)hash & mask;; slot = (slot + 1) & mask) {
+    uint32_t index = table[slot];
+    if (!index) return kInvalidAsset;
+    const ArchiveEntry& entry = entries[index - 1];
+    if (entry.nameHash == hash && entry.nameLength == length &&
+        memcmp(names + entry.nameOffset, name, length) == 0)
+      return index - 1;
+  }
+}
+
+const char* AssetArchive::name(uint32_t id) const {
+  return names + entries[id].nameOffset;
+}
+
+const void* AssetArchive::data(uint32_t id) const {
+  const ArchiveEntry& entry = entries[id];
+  if (entry.flags & ARCHIVE_ENTRY_LZ4) return nullptr;
+  return mapped + entry.offset;
+}
+
+bool AssetArchive::read(uint32_t id, void* dst) const {
+  const ArchiveEntry& entry = entries[id];
+  const uint8_t* chunk = mapped + entry.offset;
+  readCount.fetch_add(1, std::memory_order_relaxed);
+  bytesRead.fetch_add(entry.size, std::memory_order_relaxed);
+
+  if (!(entry.flags & ARCHIVE_ENTRY_LZ4)) {
+    memcpy(dst, chunk, (size_t)entry.size);
+    return true;
+  }
+
+  PROFILE_SCOPE("decompress asset");
+  uint64_t begin = profilerNow();
+  bool ok = lz4Decompress(chunk, (size_t)entry.storedSize, dst,
+                          (size_t)entry.size);
+  decompressNanoseconds.fetch_add(profilerNow() - begin,
+                                  std::memory_order_relaxed);
+  bytesDecompressed.fetch_add(entry.size, std::memory_order_relaxed);
+  if (!ok) printf("archive: %s is corrupt\n", name(id));
+  return ok;
+}
+
+void AssetArchive::readAsync(JobSystem& jobs, JobCounter* counter, uint32_t id,
+                             void* dst, bool* ok) const {
+  jobs.run(
+      counter,
+      [this, id, dst, ok]() {
+        bool result = read(id, dst);
+        if (ok) *ok = result;
+      },
+      "read asset");
+}
+
+void AssetArchive::printStats() const {
+  if (!header) return;
+  uint64_t stored = 0;
+  uint64_t unpacked = 0;
+  for (uint32_t i = 0; i < header->entryCount; i++) {
+    stored += entries[i].storedSize;
+    unpacked += entries[i].size;
+  }
+  uint64_t decompressed = bytesDecompressed.load();
+  double ms = decompressNanoseconds.load() / 1e6;
+  printf("archive: %u assets, %.2fMB stored / %.2fMB unpacked, %llu reads "
+         "(%.2fMB), %.2fMB decompressed in %.2fms (%.0fMB/s)\n",
+         header->entryCount, stored / (1024.0 * 1024.0),
+         unpacked / (1024.0 * 1024.0), (unsigned long long)readCount.load(),
+         bytesRead.load() / (1024.0 * 1024.0),
+         decompressed / (1024.0 * 1024.0), ms,
+         ms > 0 ? decompressed / (1024.0 * 1024.0) / (ms / 1000.0) : 0.0);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "archive_format.h"
+#include "job_system.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Read side of a cooked archive (archive_format.h, made by tools/cook).
+//
+// open() maps the whole file read only and never copies it: the OS pages
+// chunks in as they're touched, so opening is O(entries) no matter how big
+// the archive is and nothing is read that isn't asked for. find() is one
+// hash and a short probe. read() decompresses a chunk straight into the
+// caller's memory - a mapped staging buffer, say - and stored chunks are a
+// single memcpy out of the mapping. Everything but open/close is const and
+// safe to call from any number of threads at once.
+class AssetArchive {
+ public:
+  static const uint32_t kInvalidAsset = ~0u;
+
+  ~AssetArchive() { close(); }
+
+  // false if the file is missing or isn't an archive of this version
+  bool open(const char* path);
+  void close();
+  bool isOpen() const { return mapped != nullptr; }
+
+  // kInvalidAsset if the archive has no such name
+  uint32_t find(const char* name) const;
+  uint32_t assetCount() const { return header ? header->entryCount : 0; }
+  const char* name(uint32_t id) const;
+  // decompressed size
+  uint64_t size(uint32_t id) const { return entries[id].size; }
+  // the bytes inside the mapping, for chunks stored uncompressed; null for
+  // compressed ones
+  const void* data(uint32_t id) const;
+
+  // size(id) bytes into dst; false (and dst undefined) if the chunk is corrupt
+  bool read(uint32_t id, void* dst) const;
+  // read() on a worker, counted by counter; success lands in *ok if given.
+  // dst has to stay valid until the counter is done.
+  void readAsync(JobSystem& jobs, JobCounter* counter, uint32_t id, void* dst,
+                 bool* ok = nullptr) const;
+
+  void printStats() const;
+
+ private:
+  const uint8_t* mapped = nullptr;
+  uint64_t mappedSize = 0;
+#ifdef _WIN32
+  void* fileHandle = nullptr;
+  void* mappingHandle = nullptr;
+#endif
+
+  const ArchiveHeader* header = nullptr;
+  const ArchiveEntry* entries = nullptr;
+  const uint32_t* table = nullptr;
+  const char* names = nullptr;
+
+  mutable std::atomic<uint64_t> readCount{0};
+  mutable std::atomic<uint64_t> bytesRead{0};  // decompressed
+  mutable std::atomic<uint64_t> bytesDecompressed{0};
+  mutable std::atomic<uint64_t> decompressNanoseconds{0};
+};
@@ -0,0 +1,427 @@
+#pragma once
+
+#include "vk_common.h"
+
+// On-disk layout of --capture files, shared by the engine and tools/replay.
+//
+// A file is a CaptureFileHeader followed by records. Each record is a
+// CaptureRecordHeader and `size` bytes of payload: one of the structs below,
+// followed by the arrays its comment lists, in that order. Everything is
+// little endian and only holds fixed size fields, so captures stay readable
+// by later builds. Bump kCaptureVersion when a payload changes.
+//
+// Object ids are the engine's handle values. They're unique among live
+// objects, so a create record whose id is already taken replaces the older
+// object. 0 is VK_NULL_HANDLE.
+//
+// Records outside a FRAME_BEGIN/FRAME_END pair create objects or upload
+// data. Inside one they're commands recorded into that frame's command
+// buffer, plus the host writes to mapped buffers made since the last frame
+// (written just before FRAME_END), plus objects created in the meantime by
+// other threads.
+
+static const uint32_t kCaptureMagic = 0x50414356;  // "VCAP"
+static const uint32_t kCaptureVersion = 1;
+
+struct CaptureFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t apiVersion;  // of the capturing device
+  uint32_t reserved;
+};
+
+enum CaptureRecordType : uint16_t {
+  // objects
+  CAPTURE_SHADER = 1,
+  CAPTURE_SET_LAYOUT,
+  CAPTURE_PIPELINE_LAYOUT,
+  CAPTURE_RENDER_PASS,
+  CAPTURE_COMPUTE_PIPELINE,
+  CAPTURE_GRAPHICS_PIPELINE,
+  CAPTURE_BUFFER,
+  CAPTURE_IMAGE,
+  CAPTURE_IMAGE_VIEW,
+  CAPTURE_SAMPLER,
+  CAPTURE_FRAMEBUFFER,
+  CAPTURE_DESCRIPTOR_SET,
+  CAPTURE_DESCRIPTOR_WRITE,
+  CAPTURE_UPLOAD,
+
+  // frames
+  CAPTURE_FRAME_BEGIN = 64,
+  CAPTURE_FRAME_END,  // no payload
+
+  // commands
+  CAPTURE_CMD_BIND_PIPELINE = 128,
+  CAPTURE_CMD_BIND_DESCRIPTOR_SETS,
+  CAPTURE_CMD_PUSH_CONSTANTS,
+  CAPTURE_CMD_BIND_VERTEX_BUFFERS,
+  CAPTURE_CMD_BIND_INDEX_BUFFER,
+  CAPTURE_CMD_SET_VIEWPORT,  // a VkViewport, viewport 0 only
+  CAPTURE_CMD_SET_SCISSOR,   // a VkRect2D, scissor 0 only
+  CAPTURE_CMD_BEGIN_RENDER_PASS,
+  CAPTURE_CMD_END_RENDER_PASS,  // no payload
+  CAPTURE_CMD_DRAW,
+  CAPTURE_CMD_DRAW_INDEXED,
+  CAPTURE_CMD_DRAW_INDIRECT,
+  CAPTURE_CMD_DISPATCH,
+  CAPTURE_CMD_DISPATCH_INDIRECT,
+  CAPTURE_CMD_PIPELINE_BARRIER,
+  CAPTURE_CMD_COPY_BUFFER,
+  CAPTURE_CMD_FILL_BUFFER,
+  CAPTURE_CMD_BLIT_IMAGE,
+  CAPTURE_CMD_SET_DEPTH_BIAS,
+  CAPTURE_CMD_DRAW_INDEXED_INDIRECT,  // a CaptureCmdDrawIndirect
+  CAPTURE_CMD_COPY_BUFFER_TO_IMAGE,   // a CaptureCmdCopyBufferImage
+  CAPTURE_CMD_COPY_IMAGE_TO_BUFFER,   // a CaptureCmdCopyBufferImage
+  CAPTURE_CMD_COPY_IMAGE,
+};
+
+struct CaptureRecordHeader {
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t size;
+};
+
+// + codeSize bytes of SPIR-V
+struct CaptureShader {
+  uint64_t id;
+  uint32_t codeSize;
+  uint32_t reserved;
+};
+
+struct CaptureLayoutBinding {
+  uint32_t binding;
+  uint32_t descriptorType;
+  uint32_t descriptorCount;
+  uint32_t stageFlags;
+};
+
+// + bindingCount CaptureLayoutBinding
+struct CaptureSetLayout {
+  uint64_t id;
+  uint32_t bindingCount;
+  uint32_t reserved;
+};
+
+// + setLayoutCount uint64_t ids, + pushRangeCount VkPushConstantRange
+struct CapturePipelineLayout {
+  uint64_t id;
+  uint32_t setLayoutCount;
+  uint32_t pushRangeCount;
+};
+
+// single subpass. + attachmentCount VkAttachmentDescription,
+// + colorCount VkAttachmentReference, + dependencyCount VkSubpassDependency
+struct CaptureRenderPass {
+  uint64_t id;
+  uint32_t attachmentCount;
+  uint32_t colorCount;
+  uint32_t hasDepth;
+  uint32_t dependencyCount;
+  VkAttachmentReference depth;
+};
+
+struct CaptureComputePipeline {
+  uint64_t id;
+  uint64_t shader;
+  uint64_t layout;
+};
+
+// the fields of GraphicsPipelineDesc
+struct CaptureGraphicsPipeline {
+  uint64_t id;
+  uint64_t vertexShader;
+  uint64_t fragmentShader;
+  uint64_t layout;
+  uint64_t renderPass;
+  uint32_t subpass;
+  uint32_t bindingCount;
+  VkVertexInputBindingDescription bindings[4];
+  uint32_t attributeCount;
+  VkVertexInputAttributeDescription attributes[8];
+  uint32_t topology;
+  uint32_t polygonMode;
+  uint32_t cullMode;
+  uint32_t frontFace;
+  uint32_t depthBiasEnable;
+  uint32_t depthTestEnable;
+  uint32_t depthWriteEnable;
+  uint32_t depthCompareOp;
+  uint32_t blendEnable;
+  uint32_t srcColorBlendFactor;
+  uint32_t dstColorBlendFactor;
+  uint32_t colorBlendOp;
+  uint32_t srcAlphaBlendFactor;
+  uint32_t dstAlphaBlendFactor;
+  uint32_t alphaBlendOp;
+  uint32_t colorAttachmentCount;
+  uint32_t samples;
+};
+
+struct CaptureBuffer {
+  uint64_t id;
+  uint64_t size;
+  uint32_t usage;
+  uint32_t memoryFlags;  // VkMemoryPropertyFlags it was allocated with
+};
+
+// swapchain images are captured as plain 2d images
+struct CaptureImage {
+  uint64_t id;
+  uint32_t flags;
+  uint32_t imageType;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t depth;
+  uint32_t mipLevels;
+  uint32_t arrayLayers;
+  uint32_t samples;
+  uint32_t tiling;
+  uint32_t usage;
+  uint32_t swapchain;
+};
+
+struct CaptureImageView {
+  uint64_t id;
+  uint64_t image;
+  uint32_t viewType;
+  uint32_t format;
+  VkComponentMapping components;
+  VkImageSubresourceRange range;
+};
+
+struct CaptureSampler {
+  uint64_t id;
+  uint32_t magFilter;
+  uint32_t minFilter;
+  uint32_t mipmapMode;
+  uint32_t addressModeU;
+  uint32_t addressModeV;
+  uint32_t addressModeW;
+  float mipLodBias;
+  uint32_t anisotropyEnable;
+  float maxAnisotropy;
+  uint32_t compareEnable;
+  uint32_t compareOp;
+  float minLod;
+  float maxLod;
+  uint32_t borderColor;
+};
+
+// + attachmentCount uint64_t image view ids
+struct CaptureFramebuffer {
+  uint64_t id;
+  uint64_t renderPass;
+  uint32_t width;
+  uint32_t height;
+  uint32_t layers;
+  uint32_t attachmentCount;
+};
+
+struct CaptureDescriptorSet {
+  uint64_t id;
+  uint64_t layout;
+};
+
+struct CaptureDescriptorInfo {
+  uint64_t buffer;
+  uint64_t offset;
+  uint64_t range;
+  uint64_t sampler;
+  uint64_t imageView;
+  uint32_t imageLayout;
+  uint32_t reserved;
+};
+
+// + descriptorCount CaptureDescriptorInfo
+struct CaptureDescriptorWrite {
+  uint64_t set;
+  uint32_t binding;
+  uint32_t arrayElement;
+  uint32_t descriptorType;
+  uint32_t descriptorCount;
+};
+
+// + size bytes
+struct CaptureUpload {
+  uint64_t buffer;
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct CaptureFrameBegin {
+  uint64_t frame;
+};
+
+struct CaptureCmdBindPipeline {
+  uint64_t pipeline;
+  uint32_t bindPoint;
+  uint32_t reserved;
+};
+
+// + setCount uint64_t ids, + dynamicOffsetCount uint32_t
+struct CaptureCmdBindDescriptorSets {
+  uint64_t layout;
+  uint32_t bindPoint;
+  uint32_t firstSet;
+  uint32_t setCount;
+  uint32_t dynamicOffsetCount;
+};
+
+// + size bytes
+struct CaptureCmdPushConstants {
+  uint64_t layout;
+  uint32_t stageFlags;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t reserved;
+};
+
+// + bindingCount uint64_t ids, + bindingCount uint64_t offsets
+struct CaptureCmdBindVertexBuffers {
+  uint32_t firstBinding;
+  uint32_t bindingCount;
+};
+
+struct CaptureCmdBindIndexBuffer {
+  uint64_t buffer;
+  uint64_t offset;
+  uint32_t indexType;
+  uint32_t reserved;
+};
+
+// + clearValueCount VkClearValue
+struct CaptureCmdBeginRenderPass {
+  uint64_t renderPass;
+  uint64_t framebuffer;
+  VkRect2D renderArea;
+  uint32_t clearValueCount;
+  uint32_t reserved;
+};
+
+struct CaptureCmdDraw {
+  uint32_t vertexCount;
+  uint32_t instanceCount;
+  uint32_t firstVertex;
+  uint32_t firstInstance;
+};
+
+struct CaptureCmdDrawIndexed {
+  uint32_t indexCount;
+  uint32_t instanceCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+  uint32_t firstInstance;
+  uint32_t reserved;
+};
+
+struct CaptureCmdDrawIndirect {
+  uint64_t buffer;
+  uint64_t offset;
+  uint32_t drawCount;
+  uint32_t stride;
+};
+
+struct CaptureCmdDispatch {
+  uint32_t x;
+  uint32_t y;
+  uint32_t z;
+  uint32_t reserved;
+};
+
+struct CaptureCmdDispatchIndirect {
+  uint64_t buffer;
+  uint64_t offset;
+};
+
+struct CaptureMemoryBarrier {
+  uint32_t srcAccessMask;
+  uint32_t dstAccessMask;
+};
+
+struct CaptureBufferBarrier {
+  uint64_t buffer;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t srcAccessMask;
+  uint32_t dstAccessMask;
+  uint32_t srcQueueFamilyIndex;
+  uint32_t dstQueueFamilyIndex;
+};
+
+struct CaptureImageBarrier {
+  uint64_t image;
+  uint32_t srcAccessMask;
+  uint32_t dstAccessMask;
+  uint32_t oldLayout;
+  uint32_t newLayout;
+  uint32_t srcQueueFamilyIndex;
+  uint32_t dstQueueFamilyIndex;
+  VkImageSubresourceRange range;
+  uint32_t reserved;
+};
+
+// + memoryCount CaptureMemoryBarrier, + bufferCount CaptureBufferBarrier,
+// + imageCount CaptureImageBarrier
+struct CaptureCmdPipelineBarrier {
+  uint32_t srcStageMask;
+  uint32_t dstStageMask;
+  uint32_t dependencyFlags;
+  uint32_t memoryCount;
+  uint32_t bufferCount;
+  uint32_t imageCount;
+};
+
+// + regionCount VkBufferCopy
+struct CaptureCmdCopyBuffer {
+  uint64_t src;
+  uint64_t dst;
+  uint32_t regionCount;
+  uint32_t reserved;
+};
+
+struct CaptureCmdFillBuffer {
+  uint64_t buffer;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t data;
+  uint32_t reserved;
+};
+
+// + regionCount VkImageBlit
+struct CaptureCmdBlitImage {
+  uint64_t src;
+  uint64_t dst;
+  uint32_t srcLayout;
+  uint32_t dstLayout;
+  uint32_t regionCount;
+  uint32_t filter;
+};
+
+// + regionCount VkImageCopy
+struct CaptureCmdCopyImage {
+  uint64_t src;
+  uint64_t dst;
+  uint32_t srcLayout;
+  uint32_t dstLayout;
+  uint32_t regionCount;
+  uint32_t reserved;
+};
+
+// + regionCount VkBufferImageCopy. the image is the copy's source or
+// destination depending on the record type
+struct CaptureCmdCopyBufferImage {
+  uint64_t buffer;
+  uint64_t image;
+  uint32_t imageLayout;
+  uint32_t regionCount;
+};
+
+struct CaptureCmdSetDepthBias {
+  float constantFactor;
+  float clamp;
+  float slopeFactor;
+  uint32_t reserved;
+};
@@ -0,0 +1,411 @@
+#include "clustered_lighting.h"
+
+#include "file_io.h"
+#include "frame_arena.h"
+#include "gpu_timer.h"
+#include "memory_budget.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+// must match local_size_x in cluster_build.comp
+static const uint32_t kBuildGroupSize = 128;
+// frame constants sit at the start of each slot, lights after them; 256
+// covers every device's uniform and storage offset alignment
+static const VkDeviceSize kLightsOffset = 256;
+
+// same math as clusterBounds() in cluster_build.comp
+static void clusterBounds(const ClusteredLighting::FrameConstants& c,
+                          uint32_t cluster, glm::vec3& boundsMin,
+                          glm::vec3& boundsMax) {
+  uint32_t x = cluster % c.grid[0];
+  uint32_t y = (cluster / c.grid[0]) % c.grid[1];
+  uint32_t z = cluster / (c.grid[0] * c.grid[1]);
+
+  float nearPlane = c.projection.z;
+  float farPlane = c.projection.w;
+  float depth0 = nearPlane * powf(farPlane / nearPlane, (float)z / (float)c.grid[2]);
+  float depth1 = nearPlane * powf(farPlane / nearPlane, (float)(z + 1) / (float)c.grid[2]);
+  glm::vec2 gridSize((float)c.grid[0], (float)c.grid[1]);
+  glm::vec2 ndc0 = glm::vec2((float)x, (float)y) / gridSize * 2.0f - 1.0f;
+  glm::vec2 ndc1 = glm::vec2((float)x + 1, (float)y + 1) / gridSize * 2.0f - 1.0f;
+  glm::vec2 scale(c.projection.x, c.projection.y);
+
+  glm::vec2 a = ndc0 * depth0 / scale, b = ndc1 * depth0 / scale;
+  glm::vec2 cc = ndc0 * depth1 / scale, d = ndc1 * depth1 / scale;
+  boundsMin = glm::vec3(glm::min(glm::min(a, b), glm::min(cc, d)), -depth1);
+  boundsMax = glm::vec3(glm::max(glm::max(a, b), glm::max(cc, d)), -depth0);
+}
+
+static float distanceToBounds(const glm::vec3& boundsMin,
+                              const glm::vec3& boundsMax,
+                              const glm::vec3& point) {
+  glm::vec3 delta = glm::clamp(point, boundsMin, boundsMax) - point;
+  return glm::dot(delta, delta);
+}
+
+void ClusteredLighting::buildReference(const FrameConstants& constants,
+                                       const std::vector<Light>& lights,
+                                       std::vector<uint32_t>& counts,
+                                       std::vector<uint32_t>& indices) {
+  uint32_t clusterCount =
+      constants.grid[0] * constants.grid[1] * constants.grid[2];
+  counts.assign(clusterCount, 0);
+  indices.assign((size_t)clusterCount * kMaxLightsPerCluster, 0);
+
+  FrameVector<glm::vec4> viewLights(lights.size());
+  for (size_t i = 0; i < lights.size(); i++) {
+    glm::vec4 l = lights[i].positionRadius;
+    viewLights[i] = glm::vec4(
+        glm::vec3(constants.view * glm::vec4(glm::vec3(l), 1.0f)), l.w);
+  }
+
+  for (uint32_t cluster = 0; cluster < clusterCount; cluster++) {
+    glm::vec3 boundsMin, boundsMax;
+    clusterBounds(constants, cluster, boundsMin, boundsMax);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < viewLights.size(); i++) {
+      const glm::vec4& l = viewLights[i];
+      if (distanceToBounds(boundsMin, boundsMax, glm::vec3(l)) <= l.w * l.w &&
+          count < kMaxLightsPerCluster) {
+        indices[(size_t)cluster * kMaxLightsPerCluster + count++] = i;
+      }
+    }
+    counts[cluster] = count;
+  }
+}
+
+void ClusteredLighting::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                             VkPipelineCache cache, uint32_t lightCount,
+                             uint32_t framesInFlight) {
+  this->device = device;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  // lights orbit over the ground plane, mostly in front of the camera
+  lights.resize(lightCount);
+  motion.resize(lightCount);
+  uint32_t seed = 0x9e3779b9u;
+  for (uint32_t i = 0; i < lightCount; i++) {
+    LightMotion& m = motion[i];
+    m.center = glm::vec3(randomFloat(seed) * 40.0f - 20.0f,
+                         0.2f + randomFloat(seed) * 1.5f,
+                         randomFloat(seed) * 30.0f - 25.0f);
+    m.orbitRadius = 0.5f + randomFloat(seed) * 2.0f;
+    m.speed = 0.2f + randomFloat(seed);
+    m.phase = randomFloat(seed) * 6.2831853f;
+    glm::vec3 color(randomFloat(seed), randomFloat(seed), randomFloat(seed));
+    color /= std::max(std::max(color.r, color.g), std::max(color.b, 0.01f));
+    lights[i].positionRadius = glm::vec4(m.center, 1.0f + randomFloat(seed) * 2.0f);
+    lights[i].color = glm::vec4(color * 2.0f, 1.0f);
+  }
+
+  lightsOffset = kLightsOffset;
+  slotStride = (kLightsOffset + (VkDeviceSize)lightCount * sizeof(Light) + 255) &
+               ~(VkDeviceSize)255;
+  frameBuffer = createBuffer(
+      device, memoryProperties, slotStride * framesInFlight,
+      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MEMORY_BUFFER, frameMemory);
+  VK_CHECK(vkd.vkMapMemory(device, frameMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&frameMapped));
+
+  const VkDeviceSize countsSize = kClusterCount * sizeof(uint32_t);
+  const VkDeviceSize indicesSize =
+      (VkDeviceSize)kClusterCount * kMaxLightsPerCluster * sizeof(uint32_t);
+  const VkBufferUsageFlags gridUsage =
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  countsBuffer = createBuffer(device, memoryProperties, countsSize, gridUsage, 0,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                              MEMORY_BUFFER, countsMemory);
+  indicesBuffer = createBuffer(device, memoryProperties, indicesSize, gridUsage,
+                               0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                               MEMORY_BUFFER, indicesMemory);
+  readbackBuffer = createBuffer(
+      device, memoryProperties, countsSize + indicesSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MEMORY_STAGING, readbackMemory);
+
+  const VkShaderStageFlags computeAndFragment =
+      VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  VkDescriptorSetLayoutBinding bindings[4] = {};
+  for (uint32_t i = 0; i < 4; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = computeAndFragment;
+  }
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  bindings[0].stageFlags = computeAndFragment | VK_SHADER_STAGE_VERTEX_BIT;
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+  setLayoutInfo.bindingCount = 4;
+  setLayoutInfo.pBindings = bindings;
+  VK_CHECK(vkd.vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr,
+                                           &setLayout));
+
+  VkDescriptorPoolSize poolSizes[] = {
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, framesInFlight},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 * framesInFlight}};
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = framesInFlight;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  VK_CHECK(vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                      &descriptorPool));
+
+  std::vector<VkDescriptorSetLayout> setLayouts(framesInFlight, setLayout);
+  descriptorSets.resize(framesInFlight);
+  VkDescriptorSetAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = framesInFlight;
+  allocInfo.pSetLayouts = setLayouts.data();
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &allocInfo,
+                                        descriptorSets.data()));
+
+  for (uint32_t slot = 0; slot < framesInFlight; slot++) {
+    VkDeviceSize base = slot * slotStride;
+    VkDescriptorBufferInfo bufferInfos[4] = {
+        {frameBuffer, base, sizeof(FrameConstants)},
+        {frameBuffer, base + lightsOffset,
+         std::max<VkDeviceSize>(lightCount * sizeof(Light), sizeof(Light))},
+        {countsBuffer, 0, VK_WHOLE_SIZE},
+        {indicesBuffer, 0, VK_WHOLE_SIZE}};
+    VkWriteDescriptorSet writes[4] = {};
+    for (uint32_t i = 0; i < 4; i++) {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = descriptorSets[slot];
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = bindings[i].descriptorType;
+      writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    vkd.vkUpdateDescriptorSets(device, 4, writes, 0, nullptr);
+  }
+
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout));
+
+  buildShader =
+      createShaderModule(device, readFile("shaders/cluster_build.spv"));
+  buildPipeline = compileComputePipeline(device, cache, buildShader, layout);
+  assert(buildPipeline);
+
+  vertexShader = createShaderRef(device, readFile("shaders/lit_vert.spv"));
+  fragmentShader = createShaderRef(device, readFile("shaders/lit_frag.spv"));
+
+  // no vertex input, the plane is expanded from gl_VertexIndex
+  drawDesc = GraphicsPipelineDesc();
+  drawDesc.vertexShader = vertexShader;
+  drawDesc.fragmentShader = fragmentShader;
+  drawDesc.cullMode = VK_CULL_MODE_NONE;
+  drawDesc.depthTestEnable = VK_TRUE;
+  drawDesc.depthWriteEnable = VK_TRUE;
+  drawDesc.layout = layout;
+
+  printf("clustered lighting: %u lights, %ux%ux%u clusters, %.2fmb of lists\n",
+         lightCount, kGridX, kGridY, kGridZ,
+         (countsSize + indicesSize) / (1024.0 * 1024.0));
+}
+
+void ClusteredLighting::destroy() {
+  vkd.vkDestroyPipeline(device, buildPipeline, nullptr);
+  vkd.vkDestroyShaderModule(device, buildShader, nullptr);
+  vkd.vkDestroyShaderModule(device, vertexShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, fragmentShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(device, layout, nullptr);
+  vkd.vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  vkd.vkUnmapMemory(device, frameMemory);
+  VkBuffer buffers[] = {frameBuffer, countsBuffer, indicesBuffer,
+                        readbackBuffer};
+  VkDeviceMemory memories[] = {frameMemory, countsMemory, indicesMemory,
+                               readbackMemory};
+  for (uint32_t i = 0; i < 4; i++) {
+    vkd.vkDestroyBuffer(device, buffers[i], nullptr);
+    freeTrackedMemory(device, memories[i]);
+  }
+}
+
+void ClusteredLighting::update(VkCommandBuffer cmd, uint32_t slot, float time,
+                               const glm::mat4& view, const glm::mat4& proj,
+                               float nearPlane, float farPlane, VkExtent2D extent,
+                               GpuTimer& timer) {
+  for (size_t i = 0; i < lights.size(); i++) {
+    const LightMotion& m = motion[i];
+    float angle = time * m.speed + m.phase;
+    glm::vec3 p = m.center + glm::vec3(cosf(angle), 0.0f, sinf(angle)) *
+                                 m.orbitRadius;
+    lights[i].positionRadius = glm::vec4(p, lights[i].positionRadius.w);
+  }
+
+  float sliceScale = (float)kGridZ / logf(farPlane / nearPlane);
+  constants.view = view;
+  constants.viewProj = proj * view;
+  constants.projection = glm::vec4(proj[0][0], proj[1][1], nearPlane, farPlane);
+  constants.depthSlicing = glm::vec4(sliceScale, -logf(nearPlane) * sliceScale,
+                                     (float)extent.width, (float)extent.height);
+  constants.grid[0] = kGridX;
+  constants.grid[1] = kGridY;
+  constants.grid[2] = kGridZ;
+  constants.grid[3] = (uint32_t)lights.size();
+
+  // host writes before the submit are visible to the device without barriers
+  uint8_t* dst = frameMapped + slot * slotStride;
+  memcpy(dst, &constants, sizeof(constants));
+  memcpy(dst + lightsOffset, lights.data(), lights.size() * sizeof(Light));
+
+  uint32_t zone = timer.begin(cmd, "light clusters");
+
+  // the previous frame's shading (and a validation copy) still read the lists
+  VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  vkd.vkCmdPipelineBarrier(cmd,
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                           0, nullptr, 0, nullptr);
+
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, buildPipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1,
+                              &descriptorSets[slot], 0, nullptr);
+  vkd.vkCmdDispatch(cmd,
+                    (kClusterCount + kBuildGroupSize - 1) / kBuildGroupSize, 1,
+                    1);
+
+  VkMemoryBarrier built = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  built.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  built.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           0, 1, &built, 0, nullptr, 0, nullptr);
+
+  if (validationRequested && !validationPending) {
+    const VkDeviceSize countsSize = kClusterCount * sizeof(uint32_t);
+    VkBufferCopy counts = {0, 0, countsSize};
+    VkBufferCopy indices = {0, countsSize, (VkDeviceSize)kClusterCount *
+                                               kMaxLightsPerCluster *
+                                               sizeof(uint32_t)};
+    vkd.vkCmdCopyBuffer(cmd, countsBuffer, readbackBuffer, 1, &counts);
+    vkd.vkCmdCopyBuffer(cmd, indicesBuffer, readbackBuffer, 1, &indices);
+    VkMemoryBarrier toHost = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &toHost, 0,
+                             nullptr, 0, nullptr);
+    validationLights = lights;
+    validationConstants = constants;
+    validationSlot = slot;
+    validationPending = true;
+    validationRequested = false;
+  }
+  timer.end(cmd, zone, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+
+void ClusteredLighting::draw(VkCommandBuffer cmd, uint32_t slot,
+                             PipelineVariantCache& pipelines) {
+  VkPipeline pipeline = pipelines.request(drawDesc);
+  if (!pipeline) return;
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0,
+                              1, &descriptorSets[slot], 0, nullptr);
+  vkd.vkCmdDraw(cmd, 6, 1, 0, 0);
+}
+
+bool ClusteredLighting::retire(uint32_t slot) {
+  if (!validationPending || slot != validationSlot) return true;
+  validationPending = false;
+  return validate();
+}
+
+// the GPU and CPU disagree on lights that graze a cluster within float
+// error, so only differences clearly away from the sphere surface count
+bool ClusteredLighting::validate() {
+  std::vector<uint32_t> counts, indices;
+  buildReference(validationConstants, validationLights, counts, indices);
+
+  void* mapped;
+  VK_CHECK(vkd.vkMapMemory(device, readbackMemory, 0, VK_WHOLE_SIZE, 0,
+                           &mapped));
+  const uint32_t* gpuCounts = (const uint32_t*)mapped;
+  const uint32_t* gpuIndices = gpuCounts + kClusterCount;
+
+  const FrameConstants& c = validationConstants;
+  uint32_t mismatched = 0, grazing = 0, saturated = 0;
+  uint64_t totalRefs = 0;
+  FrameVector<uint8_t> inGpu(validationLights.size());
+  for (uint32_t cluster = 0; cluster < kClusterCount; cluster++) {
+    const uint32_t* gpuList = gpuIndices + (size_t)cluster * kMaxLightsPerCluster;
+    const uint32_t* cpuList = indices.data() + (size_t)cluster * kMaxLightsPerCluster;
+    uint32_t gpuCount = std::min(gpuCounts[cluster], kMaxLightsPerCluster);
+    uint32_t cpuCount = counts[cluster];
+    totalRefs += gpuCount;
+    // a full list is a prefix, which lights make it in is order dependent
+    bool full = gpuCount == kMaxLightsPerCluster ||
+                cpuCount == kMaxLightsPerCluster;
+    if (full) saturated++;
+
+    std::fill(inGpu.begin(), inGpu.end(), 0);
+    for (uint32_t i = 0; i < gpuCount; i++) {
+      if (gpuList[i] < inGpu.size()) inGpu[gpuList[i]] = 1;
+    }
+
+    glm::vec3 boundsMin, boundsMax;
+    clusterBounds(c, cluster, boundsMin, boundsMax);
+    bool bad = false;
+    // distance past the light's radius, relative to what float error allows
+    auto overshoot = [&](uint32_t light) {
+      glm::vec4 l = validationLights[light].positionRadius;
+      glm::vec3 center = glm::vec3(c.view * glm::vec4(glm::vec3(l), 1.0f));
+      float distance = sqrtf(distanceToBounds(boundsMin, boundsMax, center));
+      return (distance - l.w) / (1e-3f * std::max(1.0f, -boundsMin.z));
+    };
+    auto grazes = [&](uint32_t light) { return fabsf(overshoot(light)) <= 1.0f; };
+    for (uint32_t i = 0; i < gpuCount; i++) {
+      uint32_t light = gpuList[i];
+      if (light >= validationLights.size()) {
+        bad = true;
+        continue;
+      }
+      bool inCpu = std::find(cpuList, cpuList + cpuCount, light) !=
+                   cpuList + cpuCount;
+      if (inCpu) continue;
+      if (full) {
+        // can't compare membership, but the light must still touch
+        if (overshoot(light) > 1.0f) bad = true;
+      } else if (grazes(light)) {
+        grazing++;
+      } else {
+        bad = true;
+      }
+    }
+    if (!full) {
+      for (uint32_t i = 0; i < cpuCount; i++) {
+        if (!inGpu[cpuList[i]]) {
+          if (grazes(cpuList[i])) grazing++;
+          else bad = true;
+        }
+      }
+    }
+    if (bad) mismatched++;
+  }
+  vkd.vkUnmapMemory(device, readbackMemory);
+
+  printf("clustered lighting: validation %s, %u/%u clusters differ, %u "
+         "grazing differences, %u full lists, %.1f lights per cluster\n",
+         mismatched ? "FAILED" : "passed", mismatched, kClusterCount, grazing,
+         saturated, (double)totalRefs / kClusterCount);
+  return mismatched == 0;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "memory_budget.h"
+#include "pipeline_cache.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+class GpuTimer;
+
+// Clustered forward lighting. The view frustum is cut into a 16x9x24 grid
+// (exponential depth slices); each frame a compute pass gathers, per
+// cluster, the lights whose spheres touch it into a fixed size list, and the
+// lit fragment shader walks only its own cluster's list. Lights are animated
+// on the CPU and streamed through a host visible buffer per frame in flight.
+class ClusteredLighting {
+ public:
+  static const uint32_t kGridX = 16;
+  static const uint32_t kGridY = 9;
+  static const uint32_t kGridZ = 24;
+  static const uint32_t kClusterCount = kGridX * kGridY * kGridZ;
+  // must match MAX_LIGHTS_PER_CLUSTER in cluster_common.glsl
+  static const uint32_t kMaxLightsPerCluster = 128;
+
+  // mirror the std140/std430 blocks in cluster_common.glsl
+  struct Light {
+    glm::vec4 positionRadius;
+    glm::vec4 color;
+  };
+
+  struct FrameConstants {
+    glm::mat4 view;
+    glm::mat4 viewProj;
+    glm::vec4 projection;    // proj[0][0], proj[1][1], near, far
+    glm::vec4 depthSlicing;  // slice = log(depth) * x + y, zw framebuffer size
+    uint32_t grid[4];        // clusters in x, y, z and the light count
+  };
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            VkPipelineCache cache, uint32_t lightCount,
+            uint32_t framesInFlight);
+  void destroy();
+
+  // animates the lights, uploads them and builds the cluster lists. record
+  // outside a render pass, before draw(); the planes must match proj.
+  void update(VkCommandBuffer cmd, uint32_t slot, float time,
+              const glm::mat4& view, const glm::mat4& proj, float nearPlane,
+              float farPlane, VkExtent2D extent, GpuTimer& timer);
+  // lit ground plane inside the main render pass
+  void draw(VkCommandBuffer cmd, uint32_t slot,
+            PipelineVariantCache& pipelines);
+
+  // copies the next frame's GPU lists back and checks them against
+  // buildReference() once that frame's slot comes around again
+  void requestValidation() { validationRequested = true; }
+  // call after the slot's fence wait; returns false on a mismatch
+  bool retire(uint32_t slot);
+
+  // CPU version of cluster_build.comp: exact lists in light order, counts
+  // capped at kMaxLightsPerCluster like the GPU's
+  static void buildReference(const FrameConstants& constants,
+                             const std::vector<Light>& lights,
+                             std::vector<uint32_t>& counts,
+                             std::vector<uint32_t>& indices);
+
+  uint32_t lightCount() const { return (uint32_t)lights.size(); }
+  // positions as of the last update()
+  const std::vector<Light>& lightList() const { return lights; }
+
+  // the owner fills in renderPassKey like for any other pipeline
+  GraphicsPipelineDesc drawDesc;
+
+ private:
+  struct LightMotion {
+    glm::vec3 center;
+    float orbitRadius;
+    float speed;
+    float phase;
+  };
+
+  bool validate();
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  VkDeviceSize slotStride = 0;
+  VkDeviceSize lightsOffset = 0;
+
+  std::vector<Light> lights;
+  std::vector<LightMotion> motion;
+  FrameConstants constants = {};
+
+  // per slot: frame constants, then the lights; persistently mapped
+  VkBuffer frameBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory frameMemory = VK_NULL_HANDLE;
+  uint8_t* frameMapped = nullptr;
+  VkBuffer countsBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory countsMemory = VK_NULL_HANDLE;
+  VkBuffer indicesBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory indicesMemory = VK_NULL_HANDLE;
+
+  bool validationRequested = false;
+  bool validationPending = false;
+  uint32_t validationSlot = 0;
+  std::vector<Light> validationLights;
+  FrameConstants validationConstants = {};
+  VkBuffer readbackBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory readbackMemory = VK_NULL_HANDLE;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> descriptorSets;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkShaderModule buildShader = VK_NULL_HANDLE;
+  VkPipeline buildPipeline = VK_NULL_HANDLE;
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+};
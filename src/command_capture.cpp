@@ -0,0 +1,1139 @@
+#include "command_capture.h"
+
+#include "capture_format.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// pending records go to disk at frame ends, or sooner once this big
+const size_t kFlushThreshold = 1 << 20;
+// mapped buffers are compared against their last captured contents in
+// blocks this big; runs of changed blocks become one upload
+const VkDeviceSize kDiffBlock = 256;
+
+std::atomic<bool> active{false};
+std::atomic<VkCommandBuffer> frameCmd{VK_NULL_HANDLE};
+
+std::mutex mutex;
+FILE* file = nullptr;
+std::vector<uint8_t> pending;
+uint64_t bytesWritten = 0;
+uint64_t recordCount = 0;
+uint64_t frameCount = 0;
+
+// the driver's entry points, and the table the thunks were swapped into
+VkDeviceDispatch real;
+VkDeviceDispatch* table = nullptr;
+VkPhysicalDeviceMemoryProperties memoryProperties = {};
+
+struct MemoryState {
+  VkMemoryPropertyFlags flags = 0;
+  VkDeviceSize size = 0;
+  uint8_t* mapped = nullptr;  // at mapOffset
+  VkDeviceSize mapOffset = 0;
+  VkDeviceSize mapSize = 0;
+};
+
+struct BufferState {
+  VkDeviceSize size = 0;
+  VkBufferUsageFlags usage = 0;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize memoryOffset = 0;
+  // host visible buffers: the contents the replay has, as of the last upload
+  std::vector<uint8_t> shadow;
+};
+
+struct SwapchainState {
+  VkFormat format;
+  VkExtent2D extent;
+  VkImageUsageFlags usage;
+};
+
+// guards the objects below. taken before `mutex`, never after
+std::mutex stateMutex;
+std::unordered_map<uint64_t, MemoryState> memories;
+std::unordered_map<uint64_t, BufferState> buffers;
+std::unordered_map<uint64_t, SwapchainState> swapchains;
+
+template <class Handle>
+uint64_t id(Handle handle) {
+  return (uint64_t)handle;
+}
+
+// with mutex held
+void flush() {
+  if (pending.empty()) return;
+  fwrite(pending.data(), 1, pending.size(), file);
+  bytesWritten += pending.size();
+  pending.clear();
+}
+
+class Record {
+ public:
+  explicit Record(CaptureRecordType type) : type(type) {}
+
+  template <class T>
+  void put(const T& value) {
+    putBytes(&value, sizeof(T));
+  }
+  void putBytes(const void* data, size_t size) {
+    if (size == 0) return;
+    const uint8_t* bytes = (const uint8_t*)data;
+    payload.insert(payload.end(), bytes, bytes + size);
+  }
+
+  void commit() {
+    CaptureRecordHeader header = {};
+    header.type = type;
+    header.size = (uint32_t)payload.size();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+    const uint8_t* bytes = (const uint8_t*)&header;
+    pending.insert(pending.end(), bytes, bytes + sizeof(header));
+    pending.insert(pending.end(), payload.begin(), payload.end());
+    recordCount++;
+    if (pending.size() >= kFlushThreshold) flush();
+  }
+
+ private:
+  CaptureRecordType type;
+  std::vector<uint8_t> payload;
+};
+
+bool recording(VkCommandBuffer cmd) {
+  return active.load(std::memory_order_relaxed) &&
+         cmd == frameCmd.load(std::memory_order_relaxed);
+}
+
+void writeUpload(uint64_t buffer, VkDeviceSize offset, const void* data,
+                 VkDeviceSize size) {
+  if (size == 0) return;
+  CaptureUpload upload = {buffer, offset, size};
+  Record record(CAPTURE_UPLOAD);
+  record.put(upload);
+  record.putBytes(data, (size_t)size);
+  record.commit();
+}
+
+// only the GPU writes them, nothing the host does needs replaying
+bool readbackOnly(const BufferState& b) {
+  return b.usage == VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+}
+
+// with stateMutex held: the buffer's bytes, if all of it is mapped
+const uint8_t* mappedData(const BufferState& b) {
+  auto m = memories.find(id(b.memory));
+  if (m == memories.end() || !m->second.mapped) return nullptr;
+  const MemoryState& memory = m->second;
+  if (b.memoryOffset < memory.mapOffset ||
+      b.memoryOffset + b.size > memory.mapOffset + memory.mapSize) {
+    return nullptr;
+  }
+  return memory.mapped + (b.memoryOffset - memory.mapOffset);
+}
+
+// with stateMutex held
+void uploadRun(uint64_t buffer, BufferState& b, const uint8_t* data,
+               VkDeviceSize begin, VkDeviceSize end) {
+  memcpy(b.shadow.data() + begin, data + begin, (size_t)(end - begin));
+  writeUpload(buffer, begin, data + begin, end - begin);
+}
+
+// with stateMutex held: uploads what the host changed in a mapped buffer
+// since its last upload. shaders and copies can change a buffer under its
+// shadow, so buffers they write to are uploaded whole.
+void uploadChanges(uint64_t buffer, BufferState& b, const uint8_t* data) {
+  const VkBufferUsageFlags gpuWritten =
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  if (b.shadow.size() != b.size || (b.usage & gpuWritten)) {
+    b.shadow.resize((size_t)b.size);
+    uploadRun(buffer, b, data, 0, b.size);
+    return;
+  }
+  VkDeviceSize runBegin = 0;
+  bool inRun = false;
+  for (VkDeviceSize offset = 0; offset < b.size; offset += kDiffBlock) {
+    VkDeviceSize size = std::min(kDiffBlock, b.size - offset);
+    bool changed =
+        memcmp(data + offset, b.shadow.data() + offset, (size_t)size) != 0;
+    if (changed && !inRun) runBegin = offset;
+    if (!changed && inRun) uploadRun(buffer, b, data, runBegin, offset);
+    inRun = changed;
+  }
+  if (inRun) uploadRun(buffer, b, data, runBegin, b.size);
+}
+
+void writeImage(const CaptureImage& image) {
+  Record record(CAPTURE_IMAGE);
+  record.put(image);
+  record.commit();
+}
+
+void writeCopyBufferImage(CaptureRecordType type, VkBuffer buffer,
+                          VkImage image, VkImageLayout layout,
+                          uint32_t regionCount,
+                          const VkBufferImageCopy* regions) {
+  CaptureCmdCopyBufferImage copy = {};
+  copy.buffer = id(buffer);
+  copy.image = id(image);
+  copy.imageLayout = layout;
+  copy.regionCount = regionCount;
+  Record record(type);
+  record.put(copy);
+  record.putBytes(regions, regionCount * sizeof(VkBufferImageCopy));
+  record.commit();
+}
+
+// objects
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateShaderModule(
+    VkDevice device, const VkShaderModuleCreateInfo* info,
+    const VkAllocationCallbacks* allocator, VkShaderModule* module) {
+  VkResult result = real.vkCreateShaderModule(device, info, allocator, module);
+  if (result != VK_SUCCESS) return result;
+  CaptureShader shader = {};
+  shader.id = id(*module);
+  shader.codeSize = (uint32_t)info->codeSize;
+  Record record(CAPTURE_SHADER);
+  record.put(shader);
+  record.putBytes(info->pCode, info->codeSize);
+  record.commit();
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateDescriptorSetLayout(
+    VkDevice device, const VkDescriptorSetLayoutCreateInfo* info,
+    const VkAllocationCallbacks* allocator, VkDescriptorSetLayout* layout) {
+  VkResult result =
+      real.vkCreateDescriptorSetLayout(device, info, allocator, layout);
+  if (result != VK_SUCCESS) return result;
+  CaptureSetLayout setLayout = {};
+  setLayout.id = id(*layout);
+  setLayout.bindingCount = info->bindingCount;
+  Record record(CAPTURE_SET_LAYOUT);
+  record.put(setLayout);
+  for (uint32_t i = 0; i < info->bindingCount; i++) {
+    const VkDescriptorSetLayoutBinding& b = info->pBindings[i];
+    CaptureLayoutBinding binding = {b.binding, (uint32_t)b.descriptorType,
+                                    b.descriptorCount, b.stageFlags};
+    record.put(binding);
+  }
+  record.commit();
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreatePipelineLayout(
+    VkDevice device, const VkPipelineLayoutCreateInfo* info,
+    const VkAllocationCallbacks* allocator, VkPipelineLayout* layout) {
+  VkResult result =
+      real.vkCreatePipelineLayout(device, info, allocator, layout);
+  if (result != VK_SUCCESS) return result;
+  CapturePipelineLayout pipelineLayout = {};
+  pipelineLayout.id = id(*layout);
+  pipelineLayout.setLayoutCount = info->setLayoutCount;
+  pipelineLayout.pushRangeCount = info->pushConstantRangeCount;
+  Record record(CAPTURE_PIPELINE_LAYOUT);
+  record.put(pipelineLayout);
+  for (uint32_t i = 0; i < info->setLayoutCount; i++) {
+    record.put(id(info->pSetLayouts[i]));
+  }
+  record.putBytes(info->pPushConstantRanges,
+                  info->pushConstantRangeCount * sizeof(VkPushConstantRange));
+  record.commit();
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateRenderPass(
+    VkDevice device, const VkRenderPassCreateInfo* info,
+    const VkAllocationCallbacks* allocator, VkRenderPass* renderPass) {
+  VkResult result =
+      real.vkCreateRenderPass(device, info, allocator, renderPass);
+  if (result != VK_SUCCESS) return result;
+  assert(info->subpassCount == 1);
+  const VkSubpassDescription& subpass = info->pSubpasses[0];
+  CaptureRenderPass pass = {};
+  pass.id = id(*renderPass);
+  pass.attachmentCount = info->attachmentCount;
+  pass.colorCount = subpass.colorAttachmentCount;
+  pass.hasDepth = subpass.pDepthStencilAttachment != nullptr;
+  if (pass.hasDepth) pass.depth = *subpass.pDepthStencilAttachment;
+  pass.dependencyCount = info->dependencyCount;
+  Record record(CAPTURE_RENDER_PASS);
+  record.put(pass);
+  record.putBytes(info->pAttachments,
+                  info->attachmentCount * sizeof(VkAttachmentDescription));
+  record.putBytes(subpass.pColorAttachments,
+                  subpass.colorAttachmentCount * sizeof(VkAttachmentReference));
+  record.putBytes(info->pDependencies,
+                  info->dependencyCount * sizeof(VkSubpassDependency));
+  record.commit();
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateComputePipelines(
+    VkDevice device, VkPipelineCache cache, uint32_t count,
+    const VkComputePipelineCreateInfo* infos,
+    const VkAllocationCallbacks* allocator, VkPipeline* pipelines) {
+  VkResult result = real.vkCreateComputePipelines(device, cache, count, infos,
+                                                  allocator, pipelines);
+  for (uint32_t i = 0; i < count; i++) {
+    if (!pipelines[i]) continue;
+    CaptureComputePipeline compute = {id(pipelines[i]),
+                                      id(infos[i].stage.module),
+                                      id(infos[i].layout)};
+    Record record(CAPTURE_COMPUTE_PIPELINE);
+    record.put(compute);
+    record.commit();
+  }
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateGraphicsPipelines(
+    VkDevice device, VkPipelineCache cache, uint32_t count,
+    const VkGraphicsPipelineCreateInfo* infos,
+    const VkAllocationCallbacks* allocator, VkPipeline* pipelines) {
+  VkResult result = real.vkCreateGraphicsPipelines(device, cache, count, infos,
+                                                   allocator, pipelines);
+  for (uint32_t n = 0; n < count; n++) {
+    if (!pipelines[n]) continue;
+    const VkGraphicsPipelineCreateInfo& info = infos[n];
+    CaptureGraphicsPipeline g = {};
+    g.id = id(pipelines[n]);
+    for (uint32_t i = 0; i < info.stageCount; i++) {
+      const VkPipelineShaderStageCreateInfo& stage = info.pStages[i];
+      if (stage.stage == VK_SHADER_STAGE_VERTEX_BIT) {
+        g.vertexShader = id(stage.module);
+      } else if (stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) {
+        g.fragmentShader = id(stage.module);
+      }
+    }
+    g.layout = id(info.layout);
+    g.renderPass = id(info.renderPass);
+    g.subpass = info.subpass;
+    const VkPipelineVertexInputStateCreateInfo& input = *info.pVertexInputState;
+    assert(input.vertexBindingDescriptionCount <= 4 &&
+           input.vertexAttributeDescriptionCount <= 8);
+    g.bindingCount = input.vertexBindingDescriptionCount;
+    memcpy(g.bindings, input.pVertexBindingDescriptions,
+           g.bindingCount * sizeof(VkVertexInputBindingDescription));
+    g.attributeCount = input.vertexAttributeDescriptionCount;
+    memcpy(g.attributes, input.pVertexAttributeDescriptions,
+           g.attributeCount * sizeof(VkVertexInputAttributeDescription));
+    g.topology = info.pInputAssemblyState->topology;
+    g.polygonMode = info.pRasterizationState->polygonMode;
+    g.cullMode = info.pRasterizationState->cullMode;
+    g.frontFace = info.pRasterizationState->frontFace;
+    g.depthBiasEnable = info.pRasterizationState->depthBiasEnable;
+    if (info.pDepthStencilState) {
+      g.depthTestEnable = info.pDepthStencilState->depthTestEnable;
+      g.depthWriteEnable = info.pDepthStencilState->depthWriteEnable;
+      g.depthCompareOp = info.pDepthStencilState->depthCompareOp;
+    }
+    // every attachment blends like the first
+    if (info.pColorBlendState && info.pColorBlendState->attachmentCount) {
+      const VkPipelineColorBlendAttachmentState& blend =
+          info.pColorBlendState->pAttachments[0];
+      g.blendEnable = blend.blendEnable;
+      g.srcColorBlendFactor = blend.srcColorBlendFactor;
+      g.dstColorBlendFactor = blend.dstColorBlendFactor;
+      g.colorBlendOp = blend.colorBlendOp;
+      g.srcAlphaBlendFactor = blend.srcAlphaBlendFactor;
+      g.dstAlphaBlendFactor = blend.dstAlphaBlendFactor;
+      g.alphaBlendOp = blend.alphaBlendOp;
+      g.colorAttachmentCount = info.pColorBlendState->attachmentCount;
+    }
+    g.samples = info.pMultisampleState->rasterizationSamples;
+    Record record(CAPTURE_GRAPHICS_PIPELINE);
+    record.put(g);
+    record.commit();
+  }
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkAllocateMemory(
+    VkDevice device, const VkMemoryAllocateInfo* info,
+    const VkAllocationCallbacks* allocator, VkDeviceMemory* memory) {
+  VkResult result = real.vkAllocateMemory(device, info, allocator, memory);
+  if (result != VK_SUCCESS) return result;
+  MemoryState state;
+  state.flags =
+      memoryProperties.memoryTypes[info->memoryTypeIndex].propertyFlags;
+  state.size = info->allocationSize;
+  std::lock_guard<std::mutex> lock(stateMutex);
+  memories[id(*memory)] = state;
+  return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkFreeMemory(
+    VkDevice device, VkDeviceMemory memory,
+    const VkAllocationCallbacks* allocator) {
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    memories.erase(id(memory));
+  }
+  real.vkFreeMemory(device, memory, allocator);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkMapMemory(VkDevice device,
+                                              VkDeviceMemory memory,
+                                              VkDeviceSize offset,
+                                              VkDeviceSize size,
+                                              VkMemoryMapFlags flags,
+                                              void** data) {
+  VkResult result =
+      real.vkMapMemory(device, memory, offset, size, flags, data);
+  if (result != VK_SUCCESS) return result;
+  std::lock_guard<std::mutex> lock(stateMutex);
+  auto m = memories.find(id(memory));
+  if (m == memories.end()) return result;
+  m->second.mapped = (uint8_t*)*data;
+  m->second.mapOffset = offset;
+  m->second.mapSize = size == VK_WHOLE_SIZE ? m->second.size - offset : size;
+  return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkUnmapMemory(VkDevice device,
+                                            VkDeviceMemory memory) {
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    for (auto& entry : buffers) {
+      BufferState& b = entry.second;
+      if (b.memory != memory || readbackOnly(b)) continue;
+      const uint8_t* data = mappedData(b);
+      if (!data) continue;
+      // a staging buffer is only read by copies, which upload its contents
+      // to their destination
+      if (b.usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT) {
+        b.shadow.assign(data, data + b.size);
+      } else {
+        uploadChanges(entry.first, b, data);
+      }
+    }
+    auto m = memories.find(id(memory));
+    if (m != memories.end()) m->second.mapped = nullptr;
+  }
+  real.vkUnmapMemory(device, memory);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateBuffer(
+    VkDevice device, const VkBufferCreateInfo* info,
+    const VkAllocationCallbacks* allocator, VkBuffer* buffer) {
+  VkResult result = real.vkCreateBuffer(device, info, allocator, buffer);
+  if (result != VK_SUCCESS) return result;
+  BufferState state;
+  state.size = info->size;
+  state.usage = info->usage;
+  std::lock_guard<std::mutex> lock(stateMutex);
+  buffers[id(*buffer)] = std::move(state);
+  return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkDestroyBuffer(
+    VkDevice device, VkBuffer buffer, const VkAllocationCallbacks* allocator) {
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    buffers.erase(id(buffer));
+  }
+  real.vkDestroyBuffer(device, buffer, allocator);
+}
+
+// the record waits for the memory, the replay allocates the same kind
+VKAPI_ATTR VkResult VKAPI_CALL thunkBindBufferMemory(VkDevice device,
+                                                     VkBuffer buffer,
+                                                     VkDeviceMemory memory,
+                                                     VkDeviceSize offset) {
+  VkResult result = real.vkBindBufferMemory(device, buffer, memory, offset);
+  if (result != VK_SUCCESS) return result;
+  std::lock_guard<std::mutex> lock(stateMutex);
+  auto b = buffers.find(id(buffer));
+  auto m = memories.find(id(memory));
+  if (b == buffers.end() || m == memories.end()) return result;
+  b->second.memory = memory;
+  b->second.memoryOffset = offset;
+  CaptureBuffer c = {id(buffer), b->second.size, b->second.usage,
+                     m->second.flags};
+  Record record(CAPTURE_BUFFER);
+  record.put(c);
+  record.commit();
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateImage(
+    VkDevice device, const VkImageCreateInfo* info,
+    const VkAllocationCallbacks* allocator, VkImage* image) {
+  VkResult result = real.vkCreateImage(device, info, allocator, image);
+  if (result != VK_SUCCESS) return result;
+  CaptureImage i = {};
+  i.id = id(*image);
+  i.flags = info->flags;
+  i.imageType = info->imageType;
+  i.format = info->format;
+  i.width = info->extent.width;
+  i.height = info->extent.height;
+  i.depth = info->extent.depth;
+  i.mipLevels = info->mipLevels;
+  i.arrayLayers = info->arrayLayers;
+  i.samples = info->samples;
+  i.tiling = info->tiling;
+  i.usage = info->usage;
+  writeImage(i);
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateSwapchainKHR(
+    VkDevice device, const VkSwapchainCreateInfoKHR* info,
+    const VkAllocationCallbacks* allocator, VkSwapchainKHR* swapchain) {
+  VkResult result =
+      real.vkCreateSwapchainKHR(device, info, allocator, swapchain);
+  if (result != VK_SUCCESS) return result;
+  SwapchainState state = {info->imageFormat, info->imageExtent,
+                          info->imageUsage};
+  std::lock_guard<std::mutex> lock(stateMutex);
+  swapchains[id(*swapchain)] = state;
+  return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkDestroySwapchainKHR(
+    VkDevice device, VkSwapchainKHR swapchain,
+    const VkAllocationCallbacks* allocator) {
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    swapchains.erase(id(swapchain));
+  }
+  real.vkDestroySwapchainKHR(device, swapchain, allocator);
+}
+
+// swapchain images are recorded as plain 2d images
+VKAPI_ATTR VkResult VKAPI_CALL thunkGetSwapchainImagesKHR(
+    VkDevice device, VkSwapchainKHR swapchain, uint32_t* count,
+    VkImage* images) {
+  VkResult result =
+      real.vkGetSwapchainImagesKHR(device, swapchain, count, images);
+  if (!images || (result != VK_SUCCESS && result != VK_INCOMPLETE)) {
+    return result;
+  }
+  SwapchainState state;
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    auto s = swapchains.find(id(swapchain));
+    if (s == swapchains.end()) return result;
+    state = s->second;
+  }
+  for (uint32_t n = 0; n < *count; n++) {
+    CaptureImage i = {};
+    i.id = id(images[n]);
+    i.imageType = VK_IMAGE_TYPE_2D;
+    i.format = state.format;
+    i.width = state.extent.width;
+    i.height = state.extent.height;
+    i.depth = 1;
+    i.mipLevels = 1;
+    i.arrayLayers = 1;
+    i.samples = VK_SAMPLE_COUNT_1_BIT;
+    i.tiling = VK_IMAGE_TILING_OPTIMAL;
+    i.usage = state.usage;
+    i.swapchain = 1;
+    writeImage(i);
+  }
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateImageView(
+    VkDevice device, const VkImageViewCreateInfo* info,
+    const VkAllocationCallbacks* allocator, VkImageView* view) {
+  VkResult result = real.vkCreateImageView(device, info, allocator, view);
+  if (result != VK_SUCCESS) return result;
+  CaptureImageView v = {};
+  v.id = id(*view);
+  v.image = id(info->image);
+  v.viewType = info->viewType;
+  v.format = info->format;
+  v.components = info->components;
+  v.range = info->subresourceRange;
+  Record record(CAPTURE_IMAGE_VIEW);
+  record.put(v);
+  record.commit();
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateSampler(
+    VkDevice device, const VkSamplerCreateInfo* info,
+    const VkAllocationCallbacks* allocator, VkSampler* sampler) {
+  VkResult result = real.vkCreateSampler(device, info, allocator, sampler);
+  if (result != VK_SUCCESS) return result;
+  CaptureSampler s = {};
+  s.id = id(*sampler);
+  s.magFilter = info->magFilter;
+  s.minFilter = info->minFilter;
+  s.mipmapMode = info->mipmapMode;
+  s.addressModeU = info->addressModeU;
+  s.addressModeV = info->addressModeV;
+  s.addressModeW = info->addressModeW;
+  s.mipLodBias = info->mipLodBias;
+  s.anisotropyEnable = info->anisotropyEnable;
+  s.maxAnisotropy = info->maxAnisotropy;
+  s.compareEnable = info->compareEnable;
+  s.compareOp = info->compareOp;
+  s.minLod = info->minLod;
+  s.maxLod = info->maxLod;
+  s.borderColor = info->borderColor;
+  Record record(CAPTURE_SAMPLER);
+  record.put(s);
+  record.commit();
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkCreateFramebuffer(
+    VkDevice device, const VkFramebufferCreateInfo* info,
+    const VkAllocationCallbacks* allocator, VkFramebuffer* framebuffer) {
+  VkResult result =
+      real.vkCreateFramebuffer(device, info, allocator, framebuffer);
+  if (result != VK_SUCCESS) return result;
+  CaptureFramebuffer f = {};
+  f.id = id(*framebuffer);
+  f.renderPass = id(info->renderPass);
+  f.width = info->width;
+  f.height = info->height;
+  f.layers = info->layers;
+  f.attachmentCount = info->attachmentCount;
+  Record record(CAPTURE_FRAMEBUFFER);
+  record.put(f);
+  for (uint32_t i = 0; i < info->attachmentCount; i++) {
+    record.put(id(info->pAttachments[i]));
+  }
+  record.commit();
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL thunkAllocateDescriptorSets(
+    VkDevice device, const VkDescriptorSetAllocateInfo* info,
+    VkDescriptorSet* sets) {
+  VkResult result = real.vkAllocateDescriptorSets(device, info, sets);
+  if (result != VK_SUCCESS) return result;
+  for (uint32_t i = 0; i < info->descriptorSetCount; i++) {
+    CaptureDescriptorSet s = {id(sets[i]), id(info->pSetLayouts[i])};
+    Record record(CAPTURE_DESCRIPTOR_SET);
+    record.put(s);
+    record.commit();
+  }
+  return result;
+}
+
+// the engine never copies descriptors
+VKAPI_ATTR void VKAPI_CALL thunkUpdateDescriptorSets(
+    VkDevice device, uint32_t count, const VkWriteDescriptorSet* writes,
+    uint32_t copyCount, const VkCopyDescriptorSet* copies) {
+  real.vkUpdateDescriptorSets(device, count, writes, copyCount, copies);
+  for (uint32_t i = 0; i < count; i++) {
+    const VkWriteDescriptorSet& w = writes[i];
+    CaptureDescriptorWrite write = {};
+    write.set = id(w.dstSet);
+    write.binding = w.dstBinding;
+    write.arrayElement = w.dstArrayElement;
+    write.descriptorType = w.descriptorType;
+    write.descriptorCount = w.descriptorCount;
+    Record record(CAPTURE_DESCRIPTOR_WRITE);
+    record.put(write);
+    for (uint32_t d = 0; d < w.descriptorCount; d++) {
+      CaptureDescriptorInfo info = {};
+      if (w.pBufferInfo) {
+        info.buffer = id(w.pBufferInfo[d].buffer);
+        info.offset = w.pBufferInfo[d].offset;
+        info.range = w.pBufferInfo[d].range;
+      }
+      if (w.pImageInfo) {
+        info.sampler = id(w.pImageInfo[d].sampler);
+        info.imageView = id(w.pImageInfo[d].imageView);
+        info.imageLayout = w.pImageInfo[d].imageLayout;
+      }
+      record.put(info);
+    }
+    record.commit();
+  }
+}
+
+// frames
+
+// the host is done writing this frame's data once it's recorded
+VKAPI_ATTR VkResult VKAPI_CALL thunkEndCommandBuffer(VkCommandBuffer cmd) {
+  VkResult result = real.vkEndCommandBuffer(cmd);
+  if (!recording(cmd)) return result;
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    for (auto& entry : buffers) {
+      if (readbackOnly(entry.second)) continue;
+      const uint8_t* data = mappedData(entry.second);
+      if (data) uploadChanges(entry.first, entry.second, data);
+    }
+  }
+  frameCmd.store(VK_NULL_HANDLE);
+  Record(CAPTURE_FRAME_END).commit();
+  std::lock_guard<std::mutex> lock(mutex);
+  frameCount++;
+  flush();
+  return result;
+}
+
+// commands
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdBindPipeline(VkCommandBuffer cmd,
+                                                VkPipelineBindPoint bindPoint,
+                                                VkPipeline pipeline) {
+  real.vkCmdBindPipeline(cmd, bindPoint, pipeline);
+  if (!recording(cmd)) return;
+  CaptureCmdBindPipeline bind = {id(pipeline), (uint32_t)bindPoint, 0};
+  Record record(CAPTURE_CMD_BIND_PIPELINE);
+  record.put(bind);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdBindDescriptorSets(
+    VkCommandBuffer cmd, VkPipelineBindPoint bindPoint,
+    VkPipelineLayout layout, uint32_t firstSet, uint32_t setCount,
+    const VkDescriptorSet* sets, uint32_t dynamicOffsetCount,
+    const uint32_t* dynamicOffsets) {
+  real.vkCmdBindDescriptorSets(cmd, bindPoint, layout, firstSet, setCount,
+                               sets, dynamicOffsetCount, dynamicOffsets);
+  if (!recording(cmd)) return;
+  CaptureCmdBindDescriptorSets bind = {id(layout), (uint32_t)bindPoint,
+                                       firstSet, setCount, dynamicOffsetCount};
+  Record record(CAPTURE_CMD_BIND_DESCRIPTOR_SETS);
+  record.put(bind);
+  for (uint32_t i = 0; i < setCount; i++) record.put(id(sets[i]));
+  record.putBytes(dynamicOffsets, dynamicOffsetCount * sizeof(uint32_t));
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdPushConstants(VkCommandBuffer cmd,
+                                                 VkPipelineLayout layout,
+                                                 VkShaderStageFlags stageFlags,
+                                                 uint32_t offset, uint32_t size,
+                                                 const void* values) {
+  real.vkCmdPushConstants(cmd, layout, stageFlags, offset, size, values);
+  if (!recording(cmd)) return;
+  CaptureCmdPushConstants push = {id(layout), stageFlags, offset, size, 0};
+  Record record(CAPTURE_CMD_PUSH_CONSTANTS);
+  record.put(push);
+  record.putBytes(values, size);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdBindVertexBuffers(
+    VkCommandBuffer cmd, uint32_t firstBinding, uint32_t bindingCount,
+    const VkBuffer* buffers, const VkDeviceSize* offsets) {
+  real.vkCmdBindVertexBuffers(cmd, firstBinding, bindingCount, buffers,
+                              offsets);
+  if (!recording(cmd)) return;
+  CaptureCmdBindVertexBuffers bind = {firstBinding, bindingCount};
+  Record record(CAPTURE_CMD_BIND_VERTEX_BUFFERS);
+  record.put(bind);
+  for (uint32_t i = 0; i < bindingCount; i++) record.put(id(buffers[i]));
+  for (uint32_t i = 0; i < bindingCount; i++) record.put((uint64_t)offsets[i]);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdBindIndexBuffer(VkCommandBuffer cmd,
+                                                   VkBuffer buffer,
+                                                   VkDeviceSize offset,
+                                                   VkIndexType indexType) {
+  real.vkCmdBindIndexBuffer(cmd, buffer, offset, indexType);
+  if (!recording(cmd)) return;
+  CaptureCmdBindIndexBuffer bind = {id(buffer), offset, (uint32_t)indexType,
+                                    0};
+  Record record(CAPTURE_CMD_BIND_INDEX_BUFFER);
+  record.put(bind);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdSetViewport(VkCommandBuffer cmd,
+                                               uint32_t firstViewport,
+                                               uint32_t viewportCount,
+                                               const VkViewport* viewports) {
+  real.vkCmdSetViewport(cmd, firstViewport, viewportCount, viewports);
+  if (!recording(cmd)) return;
+  // the engine only ever sets viewport 0
+  assert(firstViewport == 0 && viewportCount == 1);
+  Record record(CAPTURE_CMD_SET_VIEWPORT);
+  record.put(viewports[0]);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdSetScissor(VkCommandBuffer cmd,
+                                              uint32_t firstScissor,
+                                              uint32_t scissorCount,
+                                              const VkRect2D* scissors) {
+  real.vkCmdSetScissor(cmd, firstScissor, scissorCount, scissors);
+  if (!recording(cmd)) return;
+  assert(firstScissor == 0 && scissorCount == 1);
+  Record record(CAPTURE_CMD_SET_SCISSOR);
+  record.put(scissors[0]);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdSetDepthBias(VkCommandBuffer cmd,
+                                                float constantFactor,
+                                                float clamp,
+                                                float slopeFactor) {
+  real.vkCmdSetDepthBias(cmd, constantFactor, clamp, slopeFactor);
+  if (!recording(cmd)) return;
+  CaptureCmdSetDepthBias bias = {constantFactor, clamp, slopeFactor, 0};
+  Record record(CAPTURE_CMD_SET_DEPTH_BIAS);
+  record.put(bias);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdBeginRenderPass(
+    VkCommandBuffer cmd, const VkRenderPassBeginInfo* info,
+    VkSubpassContents contents) {
+  real.vkCmdBeginRenderPass(cmd, info, contents);
+  if (!recording(cmd)) return;
+  assert(contents == VK_SUBPASS_CONTENTS_INLINE);
+  CaptureCmdBeginRenderPass begin = {};
+  begin.renderPass = id(info->renderPass);
+  begin.framebuffer = id(info->framebuffer);
+  begin.renderArea = info->renderArea;
+  begin.clearValueCount = info->clearValueCount;
+  Record record(CAPTURE_CMD_BEGIN_RENDER_PASS);
+  record.put(begin);
+  record.putBytes(info->pClearValues,
+                  info->clearValueCount * sizeof(VkClearValue));
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdEndRenderPass(VkCommandBuffer cmd) {
+  real.vkCmdEndRenderPass(cmd);
+  if (!recording(cmd)) return;
+  Record(CAPTURE_CMD_END_RENDER_PASS).commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdDraw(VkCommandBuffer cmd,
+                                        uint32_t vertexCount,
+                                        uint32_t instanceCount,
+                                        uint32_t firstVertex,
+                                        uint32_t firstInstance) {
+  real.vkCmdDraw(cmd, vertexCount, instanceCount, firstVertex, firstInstance);
+  if (!recording(cmd)) return;
+  CaptureCmdDraw draw = {vertexCount, instanceCount, firstVertex,
+                         firstInstance};
+  Record record(CAPTURE_CMD_DRAW);
+  record.put(draw);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdDrawIndexed(VkCommandBuffer cmd,
+                                               uint32_t indexCount,
+                                               uint32_t instanceCount,
+                                               uint32_t firstIndex,
+                                               int32_t vertexOffset,
+                                               uint32_t firstInstance) {
+  real.vkCmdDrawIndexed(cmd, indexCount, instanceCount, firstIndex,
+                        vertexOffset, firstInstance);
+  if (!recording(cmd)) return;
+  CaptureCmdDrawIndexed draw = {indexCount, instanceCount, firstIndex,
+                                vertexOffset, firstInstance, 0};
+  Record record(CAPTURE_CMD_DRAW_INDEXED);
+  record.put(draw);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdDrawIndirect(VkCommandBuffer cmd,
+                                                VkBuffer buffer,
+                                                VkDeviceSize offset,
+                                                uint32_t drawCount,
+                                                uint32_t stride) {
+  real.vkCmdDrawIndirect(cmd, buffer, offset, drawCount, stride);
+  if (!recording(cmd)) return;
+  CaptureCmdDrawIndirect draw = {id(buffer), offset, drawCount, stride};
+  Record record(CAPTURE_CMD_DRAW_INDIRECT);
+  record.put(draw);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdDrawIndexedIndirect(VkCommandBuffer cmd,
+                                                       VkBuffer buffer,
+                                                       VkDeviceSize offset,
+                                                       uint32_t drawCount,
+                                                       uint32_t stride) {
+  real.vkCmdDrawIndexedIndirect(cmd, buffer, offset, drawCount, stride);
+  if (!recording(cmd)) return;
+  CaptureCmdDrawIndirect draw = {id(buffer), offset, drawCount, stride};
+  Record record(CAPTURE_CMD_DRAW_INDEXED_INDIRECT);
+  record.put(draw);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdDispatch(VkCommandBuffer cmd, uint32_t x,
+                                            uint32_t y, uint32_t z) {
+  real.vkCmdDispatch(cmd, x, y, z);
+  if (!recording(cmd)) return;
+  CaptureCmdDispatch dispatch = {x, y, z, 0};
+  Record record(CAPTURE_CMD_DISPATCH);
+  record.put(dispatch);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdDispatchIndirect(VkCommandBuffer cmd,
+                                                    VkBuffer buffer,
+                                                    VkDeviceSize offset) {
+  real.vkCmdDispatchIndirect(cmd, buffer, offset);
+  if (!recording(cmd)) return;
+  CaptureCmdDispatchIndirect dispatch = {id(buffer), offset};
+  Record record(CAPTURE_CMD_DISPATCH_INDIRECT);
+  record.put(dispatch);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdPipelineBarrier(
+    VkCommandBuffer cmd, VkPipelineStageFlags srcStageMask,
+    VkPipelineStageFlags dstStageMask, VkDependencyFlags dependencyFlags,
+    uint32_t memoryCount, const VkMemoryBarrier* memoryBarriers,
+    uint32_t bufferCount, const VkBufferMemoryBarrier* bufferBarriers,
+    uint32_t imageCount, const VkImageMemoryBarrier* imageBarriers) {
+  real.vkCmdPipelineBarrier(cmd, srcStageMask, dstStageMask, dependencyFlags,
+                            memoryCount, memoryBarriers, bufferCount,
+                            bufferBarriers, imageCount, imageBarriers);
+  if (!recording(cmd)) return;
+  CaptureCmdPipelineBarrier barrier = {srcStageMask, dstStageMask,
+                                       dependencyFlags, memoryCount,
+                                       bufferCount, imageCount};
+  Record record(CAPTURE_CMD_PIPELINE_BARRIER);
+  record.put(barrier);
+  for (uint32_t i = 0; i < memoryCount; i++) {
+    CaptureMemoryBarrier m = {memoryBarriers[i].srcAccessMask,
+                              memoryBarriers[i].dstAccessMask};
+    record.put(m);
+  }
+  for (uint32_t i = 0; i < bufferCount; i++) {
+    const VkBufferMemoryBarrier& b = bufferBarriers[i];
+    CaptureBufferBarrier c = {};
+    c.buffer = id(b.buffer);
+    c.offset = b.offset;
+    c.size = b.size;
+    c.srcAccessMask = b.srcAccessMask;
+    c.dstAccessMask = b.dstAccessMask;
+    c.srcQueueFamilyIndex = b.srcQueueFamilyIndex;
+    c.dstQueueFamilyIndex = b.dstQueueFamilyIndex;
+    record.put(c);
+  }
+  for (uint32_t i = 0; i < imageCount; i++) {
+    const VkImageMemoryBarrier& b = imageBarriers[i];
+    CaptureImageBarrier c = {};
+    c.image = id(b.image);
+    c.srcAccessMask = b.srcAccessMask;
+    c.dstAccessMask = b.dstAccessMask;
+    c.oldLayout = b.oldLayout;
+    c.newLayout = b.newLayout;
+    c.srcQueueFamilyIndex = b.srcQueueFamilyIndex;
+    c.dstQueueFamilyIndex = b.dstQueueFamilyIndex;
+    c.range = b.subresourceRange;
+    record.put(c);
+  }
+  record.commit();
+}
+
+// outside a frame this is an upload through a staging buffer: what the
+// host wrote into the source is captured as an upload to the destination
+VKAPI_ATTR void VKAPI_CALL thunkCmdCopyBuffer(VkCommandBuffer cmd,
+                                              VkBuffer src, VkBuffer dst,
+                                              uint32_t regionCount,
+                                              const VkBufferCopy* regions) {
+  real.vkCmdCopyBuffer(cmd, src, dst, regionCount, regions);
+  if (!recording(cmd)) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    auto s = buffers.find(id(src));
+    if (s == buffers.end()) return;
+    const uint8_t* data = mappedData(s->second);
+    if (!data && s->second.shadow.size() == s->second.size) {
+      data = s->second.shadow.data();
+    }
+    if (!data) return;
+    for (uint32_t i = 0; i < regionCount; i++) {
+      writeUpload(id(dst), regions[i].dstOffset, data + regions[i].srcOffset,
+                  regions[i].size);
+    }
+    return;
+  }
+  CaptureCmdCopyBuffer copy = {id(src), id(dst), regionCount, 0};
+  Record record(CAPTURE_CMD_COPY_BUFFER);
+  record.put(copy);
+  record.putBytes(regions, regionCount * sizeof(VkBufferCopy));
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdFillBuffer(VkCommandBuffer cmd,
+                                              VkBuffer buffer,
+                                              VkDeviceSize offset,
+                                              VkDeviceSize size,
+                                              uint32_t data) {
+  real.vkCmdFillBuffer(cmd, buffer, offset, size, data);
+  if (!recording(cmd)) return;
+  CaptureCmdFillBuffer fill = {id(buffer), offset, size, data, 0};
+  Record record(CAPTURE_CMD_FILL_BUFFER);
+  record.put(fill);
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdCopyImage(
+    VkCommandBuffer cmd, VkImage src, VkImageLayout srcLayout, VkImage dst,
+    VkImageLayout dstLayout, uint32_t regionCount, const VkImageCopy* regions) {
+  real.vkCmdCopyImage(cmd, src, srcLayout, dst, dstLayout, regionCount,
+                      regions);
+  if (!recording(cmd)) return;
+  CaptureCmdCopyImage copy = {};
+  copy.src = id(src);
+  copy.dst = id(dst);
+  copy.srcLayout = srcLayout;
+  copy.dstLayout = dstLayout;
+  copy.regionCount = regionCount;
+  Record record(CAPTURE_CMD_COPY_IMAGE);
+  record.put(copy);
+  record.putBytes(regions, regionCount * sizeof(VkImageCopy));
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdBlitImage(
+    VkCommandBuffer cmd, VkImage src, VkImageLayout srcLayout, VkImage dst,
+    VkImageLayout dstLayout, uint32_t regionCount, const VkImageBlit* regions,
+    VkFilter filter) {
+  real.vkCmdBlitImage(cmd, src, srcLayout, dst, dstLayout, regionCount,
+                      regions, filter);
+  if (!recording(cmd)) return;
+  CaptureCmdBlitImage blit = {};
+  blit.src = id(src);
+  blit.dst = id(dst);
+  blit.srcLayout = srcLayout;
+  blit.dstLayout = dstLayout;
+  blit.regionCount = regionCount;
+  blit.filter = filter;
+  Record record(CAPTURE_CMD_BLIT_IMAGE);
+  record.put(blit);
+  record.putBytes(regions, regionCount * sizeof(VkImageBlit));
+  record.commit();
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdCopyBufferToImage(
+    VkCommandBuffer cmd, VkBuffer src, VkImage dst, VkImageLayout dstLayout,
+    uint32_t regionCount, const VkBufferImageCopy* regions) {
+  real.vkCmdCopyBufferToImage(cmd, src, dst, dstLayout, regionCount, regions);
+  if (!recording(cmd)) return;
+  writeCopyBufferImage(CAPTURE_CMD_COPY_BUFFER_TO_IMAGE, src, dst, dstLayout,
+                       regionCount, regions);
+}
+
+VKAPI_ATTR void VKAPI_CALL thunkCmdCopyImageToBuffer(
+    VkCommandBuffer cmd, VkImage src, VkImageLayout srcLayout, VkBuffer dst,
+    uint32_t regionCount, const VkBufferImageCopy* regions) {
+  real.vkCmdCopyImageToBuffer(cmd, src, srcLayout, dst, regionCount, regions);
+  if (!recording(cmd)) return;
+  writeCopyBufferImage(CAPTURE_CMD_COPY_IMAGE_TO_BUFFER, dst, src, srcLayout,
+                       regionCount, regions);
+}
+
+// every entry point the capture sees, vk##name is replaced by thunk##name
+#define CAPTURE_THUNKS(X)      \
+  X(CreateShaderModule)        \
+  X(CreateDescriptorSetLayout) \
+  X(CreatePipelineLayout)      \
+  X(CreateRenderPass)          \
+  X(CreateComputePipelines)    \
+  X(CreateGraphicsPipelines)   \
+  X(AllocateMemory)            \
+  X(FreeMemory)                \
+  X(MapMemory)                 \
+  X(UnmapMemory)               \
+  X(CreateBuffer)              \
+  X(DestroyBuffer)             \
+  X(BindBufferMemory)          \
+  X(CreateImage)               \
+  X(CreateSwapchainKHR)        \
+  X(DestroySwapchainKHR)       \
+  X(GetSwapchainImagesKHR)     \
+  X(CreateImageView)           \
+  X(CreateSampler)             \
+  X(CreateFramebuffer)         \
+  X(AllocateDescriptorSets)    \
+  X(UpdateDescriptorSets)      \
+  X(EndCommandBuffer)          \
+  X(CmdBindPipeline)           \
+  X(CmdBindDescriptorSets)     \
+  X(CmdPushConstants)          \
+  X(CmdBindVertexBuffers)      \
+  X(CmdBindIndexBuffer)        \
+  X(CmdSetViewport)            \
+  X(CmdSetScissor)             \
+  X(CmdSetDepthBias)           \
+  X(CmdBeginRenderPass)        \
+  X(CmdEndRenderPass)          \
+  X(CmdDraw)                   \
+  X(CmdDrawIndexed)            \
+  X(CmdDrawIndirect)           \
+  X(CmdDrawIndexedIndirect)    \
+  X(CmdDispatch)               \
+  X(CmdDispatchIndirect)       \
+  X(CmdPipelineBarrier)        \
+  X(CmdCopyBuffer)             \
+  X(CmdFillBuffer)             \
+  X(CmdCopyImage)              \
+  X(CmdBlitImage)              \
+  X(CmdCopyBufferToImage)      \
+  X(CmdCopyImageToBuffer)
+
+}  // namespace
+
+bool captureOpen(const char* path, VkPhysicalDevice physicalDevice,
+                 VkDeviceDispatch& deviceTable) {
+  VkPhysicalDeviceProperties properties;
+  vki.vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  std::lock_guard<std::mutex> lock(mutex);
+  file = fopen(path, "wb");
+  if (!file) {
+    printf("failed to open capture file:%s \n", path);
+    return false;
+  }
+  CaptureFileHeader header = {};
+  header.magic = kCaptureMagic;
+  header.version = kCaptureVersion;
+  header.apiVersion = properties.apiVersion;
+  fwrite(&header, sizeof(header), 1, file);
+  bytesWritten = sizeof(header);
+
+  real = deviceTable;
+  table = &deviceTable;
+#define CAPTURE_INSTALL(name) deviceTable.vk##name = thunk##name;
+  CAPTURE_THUNKS(CAPTURE_INSTALL)
+#undef CAPTURE_INSTALL
+  active.store(true);
+  return true;
+}
+
+void captureClose() {
+  if (!active.load()) return;
+  active.store(false);
+  *table = real;
+  table = nullptr;
+  std::lock_guard<std::mutex> lock(mutex);
+  flush();
+  fclose(file);
+  file = nullptr;
+  printf("capture: %llu frames, %llu records, %.2fMB\n",
+         (unsigned long long)frameCount, (unsigned long long)recordCount,
+         bytesWritten / (1024.0 * 1024.0));
+}
+
+bool captureActive() { return active.load(std::memory_order_relaxed); }
+
+void captureFrameBegin(VkCommandBuffer cmd, uint64_t frame) {
+  if (!captureActive()) return;
+  frameCmd.store(cmd);
+  CaptureFrameBegin begin = {frame};
+  Record record(CAPTURE_FRAME_BEGIN);
+  record.put(begin);
+  record.commit();
+}
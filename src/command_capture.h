@@ -0,0 +1,37 @@
+#pragma once
+
+#include "vk_common.h"
+#include "vk_dispatch.h"
+
+// Command stream capture for offline replay (tools/replay). While a capture
+// is open, the engine reports the objects it creates, the data it uploads
+// and the commands it records into each frame's command buffer; they're
+// written to a compact binary file (capture_format.h) that replays without
+// the engine, the window or the original GPU.
+//
+// Opening a capture swaps thunks into the device table for every entry point
+// the replay needs. Each calls the driver, then writes its record, so code
+// calling through the table is captured without knowing about it:
+//  - objects are recorded as they're created. Buffers are recorded once
+//    bound, when the memory they live in is known.
+//  - host writes are found by comparing mapped buffers against what was
+//    captured of them last, when they're unmapped and when a frame ends.
+//    Buffers only ever copied into (readbacks) are left out; the contents of
+//    staging buffers are recorded as uploads to where they're copied to.
+//  - commands are only kept for the command buffer passed to
+//    captureFrameBegin(), up to its vkEndCommandBuffer, which ends the frame.
+//    Uploads and other one-off command buffers are filtered out.
+// Object records are thread safe. Without an open capture the table holds
+// the driver's entry points and none of this costs anything.
+
+// after the device table is loaded and before anything is created, the
+// replay needs every object
+bool captureOpen(const char* path, VkPhysicalDevice physicalDevice,
+                 VkDeviceDispatch& table);
+// restores the table's driver entry points
+void captureClose();
+bool captureActive();
+
+// right after vkBeginCommandBuffer; the frame ends with the command
+// buffer's vkEndCommandBuffer
+void captureFrameBegin(VkCommandBuffer cmd, uint64_t frame);
@@ -0,0 +1,271 @@
+#include "debug_draw.h"
+
+#include "file_io.h"
+#include "memory_budget.h"
+#include "vk_dispatch.h"
+
+#include <math.h>
+
+VkVertexInputBindingDescription DebugDraw::Vertex::getbindingDescription() {
+  VkVertexInputBindingDescription desc = {};
+  desc.binding = 0;
+  desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+  desc.stride = sizeof(Vertex);
+  return desc;
+}
+
+std::array<VkVertexInputAttributeDescription, 2>
+DebugDraw::Vertex::getAttributeDescriptions() {
+  std::array<VkVertexInputAttributeDescription, 2> desc = {};
+  desc[0].binding = 0;
+  desc[0].location = 0;
+  desc[0].offset = offsetof(Vertex, position);
+  desc[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+  desc[1].binding = 0;
+  desc[1].location = 1;
+  desc[1].offset = offsetof(Vertex, color);
+  desc[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+  return desc;
+}
+
+void DebugDraw::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                     uint32_t framesInFlight, uint32_t maxVertices) {
+  this->device = device;
+  capacity = maxVertices;
+  for (uint32_t t = 0; t < TOPOLOGY_COUNT; t++) cursors[t].store(0);
+
+  VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  bufferInfo.size =
+      (VkDeviceSize)framesInFlight * TOPOLOGY_COUNT * capacity * sizeof(Vertex);
+  bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VK_CHECK(vkd.vkCreateBuffer(device, &bufferInfo, nullptr, &buffer));
+
+  // the GPU reads every vertex exactly once, so plain host memory is fine;
+  // device local + host visible is taken when the device offers it
+  VkMemoryRequirements memReq;
+  vkd.vkGetBufferMemoryRequirements(device, buffer, &memReq);
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  const VkMemoryPropertyFlags hostFlags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  const VkMemoryPropertyFlags preferred[] = {
+      hostFlags | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, hostFlags};
+  VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+  allocInfo.allocationSize = memReq.size;
+  allocInfo.memoryTypeIndex = UINT32_MAX;
+  for (VkMemoryPropertyFlags flags : preferred) {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+      if ((memReq.memoryTypeBits & (1u << i)) &&
+          (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags) {
+        allocInfo.memoryTypeIndex = i;
+        break;
+      }
+    }
+    if (allocInfo.memoryTypeIndex != UINT32_MAX) break;
+  }
+  assert(allocInfo.memoryTypeIndex != UINT32_MAX);
+  VK_CHECK(allocateTrackedMemory(device, allocInfo, MEMORY_BUFFER, memory));
+  VK_CHECK(vkd.vkBindBufferMemory(device, buffer, memory, 0));
+  VK_CHECK(vkd.vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&mapped));
+  beginFrame(0);
+
+  VkPushConstantRange pushRange = {VK_SHADER_STAGE_VERTEX_BIT, 0,
+                                   sizeof(glm::mat4)};
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushRange;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout));
+
+  vertexShader = createShaderRef(device, readFile("shaders/debug_vert.spv"));
+  fragmentShader = createShaderRef(device, readFile("shaders/debug_frag.spv"));
+
+  // depth tested so debug geometry sits in the scene, but never occludes
+  const VkPrimitiveTopology topologies[TOPOLOGY_COUNT] = {
+      VK_PRIMITIVE_TOPOLOGY_LINE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST};
+  for (uint32_t t = 0; t < TOPOLOGY_COUNT; t++) {
+    GraphicsPipelineDesc& desc = drawDescs[t];
+    desc = GraphicsPipelineDesc();
+    desc.vertexShader = vertexShader;
+    desc.fragmentShader = fragmentShader;
+    desc.setVertexLayout<Vertex>();
+    desc.topology = topologies[t];
+    desc.cullMode = VK_CULL_MODE_NONE;
+    desc.depthTestEnable = VK_TRUE;
+    desc.depthWriteEnable = VK_FALSE;
+    desc.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    desc.blendEnable = VK_TRUE;
+    desc.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    desc.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    desc.layout = layout;
+  }
+}
+
+void DebugDraw::destroy() {
+  vkd.vkDestroyShaderModule(device, vertexShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, fragmentShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(device, layout, nullptr);
+  vkd.vkUnmapMemory(device, memory);
+  vkd.vkDestroyBuffer(device, buffer, nullptr);
+  freeTrackedMemory(device, memory);
+}
+
+void DebugDraw::setRenderPassKey(uint64_t renderPassKey) {
+  for (GraphicsPipelineDesc& desc : drawDescs) {
+    desc.renderPassKey = renderPassKey;
+  }
+}
+
+void DebugDraw::beginFrame(uint32_t slot) {
+  for (uint32_t t = 0; t < TOPOLOGY_COUNT; t++) {
+    uint32_t used = cursors[t].load(std::memory_order_relaxed);
+    if (used > peak[t]) peak[t] = used;
+    regions[t] = mapped + ((size_t)slot * TOPOLOGY_COUNT + t) * capacity;
+    cursors[t].store(0, std::memory_order_relaxed);
+  }
+}
+
+DebugDraw::Vertex* DebugDraw::reserve(Topology topology, uint32_t count) {
+  // never past capacity, so every vertex below the cursor was reserved by
+  // someone who writes it
+  uint32_t first = cursors[topology].load(std::memory_order_relaxed);
+  do {
+    if (capacity - first < count) {
+      dropped.fetch_add(count, std::memory_order_relaxed);
+      return nullptr;
+    }
+  } while (!cursors[topology].compare_exchange_weak(
+      first, first + count, std::memory_order_relaxed));
+  return regions[topology] + first;
+}
+
+void DebugDraw::line(const glm::vec3& a, const glm::vec3& b, uint32_t color) {
+  Vertex* v = reserve(TOPOLOGY_LINES, 2);
+  if (!v) return;
+  v[0] = {a, color};
+  v[1] = {b, color};
+}
+
+void DebugDraw::path(const glm::vec3* points, uint32_t count,
+                     uint32_t color) {
+  if (count < 2) return;
+  Vertex* v = reserve(TOPOLOGY_LINES, (count - 1) * 2);
+  if (!v) return;
+  for (uint32_t i = 0; i + 1 < count; i++) {
+    v[i * 2] = {points[i], color};
+    v[i * 2 + 1] = {points[i + 1], color};
+  }
+}
+
+void DebugDraw::cross(const glm::vec3& center, float size, uint32_t color) {
+  Vertex* v = reserve(TOPOLOGY_LINES, 6);
+  if (!v) return;
+  for (int axis = 0; axis < 3; axis++) {
+    glm::vec3 offset(0.0f);
+    offset[axis] = size;
+    v[axis * 2] = {center - offset, color};
+    v[axis * 2 + 1] = {center + offset, color};
+  }
+}
+
+void DebugDraw::box(const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                    uint32_t color) {
+  Vertex* v = reserve(TOPOLOGY_LINES, 24);
+  if (!v) return;
+  glm::vec3 corners[8];
+  for (int i = 0; i < 8; i++) {
+    corners[i] = glm::vec3(i & 1 ? boundsMax.x : boundsMin.x,
+                           i & 2 ? boundsMax.y : boundsMin.y,
+                           i & 4 ? boundsMax.z : boundsMin.z);
+  }
+  // corner pairs differing in exactly one bit
+  static const uint8_t edges[24] = {0, 1, 2, 3, 4, 5, 6, 7, 0, 2, 1, 3,
+                                    4, 6, 5, 7, 0, 4, 1, 5, 2, 6, 3, 7};
+  for (int i = 0; i < 24; i++) v[i] = {corners[edges[i]], color};
+}
+
+void DebugDraw::sphere(const glm::vec3& center, float radius, uint32_t color,
+                       uint32_t segments) {
+  // three great circles
+  Vertex* v = reserve(TOPOLOGY_LINES, segments * 6);
+  if (!v) return;
+  const float step = 6.2831853f / (float)segments;
+  for (uint32_t i = 0; i < segments; i++) {
+    float c0 = cosf(i * step) * radius, s0 = sinf(i * step) * radius;
+    float c1 = cosf((i + 1) * step) * radius, s1 = sinf((i + 1) * step) * radius;
+    v[0] = {center + glm::vec3(c0, s0, 0.0f), color};
+    v[1] = {center + glm::vec3(c1, s1, 0.0f), color};
+    v[2] = {center + glm::vec3(c0, 0.0f, s0), color};
+    v[3] = {center + glm::vec3(c1, 0.0f, s1), color};
+    v[4] = {center + glm::vec3(0.0f, c0, s0), color};
+    v[5] = {center + glm::vec3(0.0f, c1, s1), color};
+    v += 6;
+  }
+}
+
+void DebugDraw::frustum(const glm::mat4& inverseViewProj, uint32_t color) {
+  Vertex* v = reserve(TOPOLOGY_LINES, 24);
+  if (!v) return;
+  // vulkan clip space, depth 0..1
+  glm::vec3 corners[8];
+  for (int i = 0; i < 8; i++) {
+    glm::vec4 p = inverseViewProj * glm::vec4(i & 1 ? 1.0f : -1.0f,
+                                              i & 2 ? 1.0f : -1.0f,
+                                              i & 4 ? 1.0f : 0.0f, 1.0f);
+    corners[i] = glm::vec3(p) / p.w;
+  }
+  static const uint8_t edges[24] = {0, 1, 2, 3, 4, 5, 6, 7, 0, 2, 1, 3,
+                                    4, 6, 5, 7, 0, 4, 1, 5, 2, 6, 3, 7};
+  for (int i = 0; i < 24; i++) v[i] = {corners[edges[i]], color};
+}
+
+void DebugDraw::axes(const glm::mat4& transform, float size) {
+  Vertex* v = reserve(TOPOLOGY_LINES, 6);
+  if (!v) return;
+  glm::vec3 origin = glm::vec3(transform[3]);
+  const uint32_t colors[3] = {color(255, 0, 0), color(0, 255, 0),
+                              color(0, 0, 255)};
+  for (int axis = 0; axis < 3; axis++) {
+    v[axis * 2] = {origin, colors[axis]};
+    v[axis * 2 + 1] = {origin + glm::vec3(transform[axis]) * size,
+                       colors[axis]};
+  }
+}
+
+void DebugDraw::triangle(const glm::vec3& a, const glm::vec3& b,
+                         const glm::vec3& c, uint32_t color) {
+  Vertex* v = reserve(TOPOLOGY_TRIANGLES, 3);
+  if (!v) return;
+  v[0] = {a, color};
+  v[1] = {b, color};
+  v[2] = {c, color};
+}
+
+void DebugDraw::draw(VkCommandBuffer cmd, const glm::mat4& viewProj,
+                     PipelineVariantCache& pipelines) {
+  bool constantsPushed = false;
+  for (uint32_t t = 0; t < TOPOLOGY_COUNT; t++) {
+    uint32_t count = cursors[t].load(std::memory_order_acquire);
+    if (count == 0) continue;
+    VkPipeline pipeline = pipelines.request(drawDescs[t]);
+    if (!pipeline) continue;
+    vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    if (!constantsPushed) {
+      vkd.vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                             sizeof(glm::mat4), &viewProj);
+      constantsPushed = true;
+    }
+    VkDeviceSize offset = (VkDeviceSize)(regions[t] - mapped) * sizeof(Vertex);
+    vkd.vkCmdBindVertexBuffers(cmd, 0, 1, &buffer, &offset);
+    vkd.vkCmdDraw(cmd, count, 1, 0, 0);
+  }
+}
+
+void DebugDraw::printStats() const {
+  printf("debug draw: peak %u line and %u triangle vertices per frame of %u, "
+         "%llu dropped\n",
+         peak[TOPOLOGY_LINES], peak[TOPOLOGY_TRIANGLES], capacity,
+         (unsigned long long)dropped.load());
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "pipeline_cache.h"
+
+#include <array>
+#include <atomic>
+#include <glm/glm.hpp>
+
+// Immediate mode debug geometry. Every frame in flight owns a slice of one
+// persistently mapped, host visible vertex buffer, split per topology. A
+// primitive call reserves its vertices with a compare and swap on the
+// topology's cursor, which never moves past the slice, and writes them
+// straight into mapped memory: no locks, allocations or submits, so it's
+// safe from any job worker and cheap in hot loops.
+// Everything appended in a frame becomes one draw per topology.
+class DebugDraw {
+ public:
+  enum Topology { TOPOLOGY_LINES, TOPOLOGY_TRIANGLES, TOPOLOGY_COUNT };
+
+  struct Vertex {
+    glm::vec3 position;
+    uint32_t color;  // rgba8, r in the low byte
+
+    static VkVertexInputBindingDescription getbindingDescription();
+    static std::array<VkVertexInputAttributeDescription, 2>
+    getAttributeDescriptions();
+  };
+
+  static uint32_t color(uint32_t r, uint32_t g, uint32_t b,
+                        uint32_t a = 255) {
+    return r | (g << 8) | (b << 16) | (a << 24);
+  }
+
+  // maxVertices is per topology and frame; appends past it are dropped
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            uint32_t framesInFlight, uint32_t maxVertices);
+  void destroy();
+  void setRenderPassKey(uint64_t renderPassKey);
+
+  // main thread, once the slot's fence has signalled; empties the slot
+  void beginFrame(uint32_t slot);
+
+  // thread safe. everything appended before draw() is recorded is drawn;
+  // workers must have been waited on by then.
+  void line(const glm::vec3& a, const glm::vec3& b, uint32_t color);
+  void path(const glm::vec3* points, uint32_t count, uint32_t color);
+  void cross(const glm::vec3& center, float size, uint32_t color);
+  void box(const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+           uint32_t color);
+  void sphere(const glm::vec3& center, float radius, uint32_t color,
+              uint32_t segments = 24);
+  // the eight corners of clip space pulled back through the inverse
+  void frustum(const glm::mat4& inverseViewProj, uint32_t color);
+  void axes(const glm::mat4& transform, float size);
+  void triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c,
+                uint32_t color);
+
+  // one draw per non-empty topology, inside the main render pass
+  void draw(VkCommandBuffer cmd, const glm::mat4& viewProj,
+            PipelineVariantCache& pipelines);
+
+  // peak vertices in a frame and how many were dropped for lack of room
+  void printStats() const;
+
+ private:
+  Vertex* reserve(Topology topology, uint32_t count);
+
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t capacity = 0;
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  Vertex* mapped = nullptr;
+  Vertex* regions[TOPOLOGY_COUNT] = {};
+  std::atomic<uint32_t> cursors[TOPOLOGY_COUNT];
+
+  std::atomic<uint64_t> dropped{0};
+  uint32_t peak[TOPOLOGY_COUNT] = {};
+
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+  GraphicsPipelineDesc drawDescs[TOPOLOGY_COUNT];
+};
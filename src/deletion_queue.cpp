@@ -0,0 +1,77 @@
+#include "deletion_queue.h"
+
+#include "memory_budget.h"
+#include "vk_dispatch.h"
+
+void DeletionQueue::pushAt(uint64_t frame, Type type, uint64_t handle) {
+  if (handle == 0) return;
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.push_back({frame, handle, type});
+}
+
+void DeletionQueue::collect(uint64_t completedFrame) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (entries[i].frame <= completedFrame) {
+        ready.push_back(entries[i]);
+      } else {
+        entries[kept++] = entries[i];
+      }
+    }
+    entries.resize(kept);
+  }
+  // destroy outside the lock, in push order so views go before their images
+  // and framebuffers before their render pass
+  for (const Entry& entry : ready) {
+    destroy(entry);
+  }
+  ready.clear();
+}
+
+void DeletionQueue::flush() { collect(UINT64_MAX); }
+
+size_t DeletionQueue::pending() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+void DeletionQueue::destroy(const Entry& entry) {
+  switch (entry.type) {
+    case TYPE_BUFFER:
+      vkd.vkDestroyBuffer(device, (VkBuffer)entry.handle, nullptr);
+      break;
+    case TYPE_IMAGE:
+      vkd.vkDestroyImage(device, (VkImage)entry.handle, nullptr);
+      break;
+    case TYPE_IMAGE_VIEW:
+      vkd.vkDestroyImageView(device, (VkImageView)entry.handle, nullptr);
+      break;
+    case TYPE_MEMORY:
+      freeTrackedMemory(device, (VkDeviceMemory)entry.handle);
+      break;
+    case TYPE_FRAMEBUFFER:
+      vkd.vkDestroyFramebuffer(device, (VkFramebuffer)entry.handle, nullptr);
+      break;
+    case TYPE_RENDER_PASS:
+      vkd.vkDestroyRenderPass(device, (VkRenderPass)entry.handle, nullptr);
+      break;
+    case TYPE_PIPELINE:
+      vkd.vkDestroyPipeline(device, (VkPipeline)entry.handle, nullptr);
+      break;
+    case TYPE_SAMPLER:
+      vkd.vkDestroySampler(device, (VkSampler)entry.handle, nullptr);
+      break;
+    case TYPE_DESCRIPTOR_POOL:
+      vkd.vkDestroyDescriptorPool(device, (VkDescriptorPool)entry.handle,
+                                  nullptr);
+      break;
+    case TYPE_SHADER_MODULE:
+      vkd.vkDestroyShaderModule(device, (VkShaderModule)entry.handle, nullptr);
+      break;
+    case TYPE_SWAPCHAIN:
+      vkd.vkDestroySwapchainKHR(device, (VkSwapchainKHR)entry.handle, nullptr);
+      break;
+  }
+}
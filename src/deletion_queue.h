@@ -0,0 +1,69 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// objects retired while the GPU may still be using them. every entry carries
+// the frame value it was last used in; collect() destroys whatever the GPU has
+// finished with, so nothing needs vkDeviceWaitIdle to be released. safe to push
+// from worker threads.
+class DeletionQueue {
+ public:
+  void init(VkDevice device) { this->device = device; }
+
+  // value that push() tags new entries with; bump once per submitted frame
+  void setCurrentFrame(uint64_t frame) { currentFrame.store(frame); }
+  uint64_t frame() const { return currentFrame.load(); }
+
+  void push(VkBuffer buffer) { pushAt(frame(), TYPE_BUFFER, (uint64_t)buffer); }
+  void push(VkImage image) { pushAt(frame(), TYPE_IMAGE, (uint64_t)image); }
+  void push(VkImageView view) { pushAt(frame(), TYPE_IMAGE_VIEW, (uint64_t)view); }
+  void push(VkDeviceMemory memory) { pushAt(frame(), TYPE_MEMORY, (uint64_t)memory); }
+  void push(VkFramebuffer framebuffer) { pushAt(frame(), TYPE_FRAMEBUFFER, (uint64_t)framebuffer); }
+  void push(VkRenderPass renderPass) { pushAt(frame(), TYPE_RENDER_PASS, (uint64_t)renderPass); }
+  void push(VkPipeline pipeline) { pushAt(frame(), TYPE_PIPELINE, (uint64_t)pipeline); }
+  void push(VkSampler sampler) { pushAt(frame(), TYPE_SAMPLER, (uint64_t)sampler); }
+  void push(VkDescriptorPool pool) { pushAt(frame(), TYPE_DESCRIPTOR_POOL, (uint64_t)pool); }
+  void push(VkShaderModule module) { pushAt(frame(), TYPE_SHADER_MODULE, (uint64_t)module); }
+  void push(VkSwapchainKHR swapchain) { pushAt(frame(), TYPE_SWAPCHAIN, (uint64_t)swapchain); }
+
+  // destroys every object whose frame is <= completedFrame
+  void collect(uint64_t completedFrame);
+  // destroys everything; only after the device is idle
+  void flush();
+
+  size_t pending();
+
+ private:
+  enum Type : uint8_t {
+    TYPE_BUFFER,
+    TYPE_IMAGE,
+    TYPE_IMAGE_VIEW,
+    TYPE_MEMORY,
+    TYPE_FRAMEBUFFER,
+    TYPE_RENDER_PASS,
+    TYPE_PIPELINE,
+    TYPE_SAMPLER,
+    TYPE_DESCRIPTOR_POOL,
+    TYPE_SHADER_MODULE,
+    TYPE_SWAPCHAIN,
+  };
+
+  struct Entry {
+    uint64_t frame;
+    uint64_t handle;
+    Type type;
+  };
+
+  void pushAt(uint64_t frame, Type type, uint64_t handle);
+  void destroy(const Entry& entry);
+
+  VkDevice device = VK_NULL_HANDLE;
+  std::atomic<uint64_t> currentFrame{0};
+  std::mutex mutex;
+  std::vector<Entry> entries;
+  std::vector<Entry> ready;
+};
@@ -0,0 +1,51 @@
+#include "file_io.h"
+
+#include "asset_archive.h"
+
+#include <assert.h>
+#include <fstream>
+#include <stdio.h>
+
+namespace {
+
+AssetArchive archive;
+
+}  // namespace
+
+std::vector<char> readFile(const std::string& filename) {
+  uint32_t asset = archive.find(filename.c_str());
+  if (asset != AssetArchive::kInvalidAsset) {
+    std::vector<char> buffer(archive.size(asset));
+    if (!archive.read(asset, buffer.data())) {
+      printf("failed to read file:%s from the archive\n", filename.c_str());
+      assert(0);
+      return {};
+    }
+    return buffer;
+  }
+
+  std::ifstream file(filename, std::ios::ate | std::ios::binary);
+
+  if (!file.is_open()) {
+    printf("failed to open file:%s \n", filename.c_str());
+    assert(0);
+  }
+  size_t fsize = file.tellg();
+  std::vector<char> buffer(fsize);
+  file.seekg(0);
+  file.read(buffer.data(), fsize);
+  file.close();
+  return buffer;
+}
+
+bool mountArchive(const char* path) {
+  if (!archive.open(path)) return false;
+  printf("archive: mounted %s, %u assets\n", path, archive.assetCount());
+  return true;
+}
+
+void unmountArchive() { archive.close(); }
+
+const AssetArchive* mountedArchive() {
+  return archive.isOpen() ? &archive : nullptr;
+}
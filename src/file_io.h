@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class AssetArchive;
+
+// whole file as bytes; asserts if it can't be opened. names found in the
+// mounted archive come from there, anything else from disk.
+std::vector<char> readFile(const std::string& filename);
+
+// makes readFile() look in a cooked archive (tools/cook) first; false if it
+// can't be opened. mount before the loading jobs start, unmount after they
+// are done.
+bool mountArchive(const char* path);
+void unmountArchive();
+// null when nothing is mounted
+const AssetArchive* mountedArchive();
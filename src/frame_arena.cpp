@@ -0,0 +1,137 @@
+#include "frame_arena.h"
+
+#include <assert.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+
+namespace {
+
+const uint32_t kMaxFrames = 4;
+// what a thread takes from the region at a time
+const size_t kThreadBlock = 64 * 1024;
+
+struct Region {
+  uint8_t* base = nullptr;
+  size_t capacity = 0;
+  std::atomic<size_t> used{0};
+  // heap blocks of a frame that ran out, freed when the region rewinds
+  std::vector<void*> overflow;
+};
+
+Region regions[kMaxFrames];
+uint32_t regionCount = 0;
+std::atomic<uint32_t> current{0};
+// bumped on every rewind, so threads drop blocks of an older frame
+std::atomic<uint64_t> epoch{0};
+std::mutex overflowMutex;
+
+uint64_t frames = 0;
+size_t peakBytes = 0;
+// frames that spilled into the heap; the region grew after each
+uint32_t growths = 0;
+
+struct ThreadBlock {
+  uint64_t epoch = ~0ull;
+  uintptr_t cursor = 0;
+  uintptr_t end = 0;
+};
+thread_local ThreadBlock block;
+
+uintptr_t alignUp(uintptr_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(uintptr_t)(alignment - 1);
+}
+
+}  // namespace
+
+void frameArenaInit(uint32_t framesInFlight, size_t bytesPerFrame) {
+  assert(framesInFlight > 0 && framesInFlight <= kMaxFrames);
+  regionCount = framesInFlight;
+  for (uint32_t i = 0; i < regionCount; i++) {
+    regions[i].base = (uint8_t*)::operator new(bytesPerFrame);
+    regions[i].capacity = bytesPerFrame;
+    regions[i].used.store(0);
+  }
+  current.store(0);
+  epoch.fetch_add(1);
+}
+
+void frameArenaShutdown() {
+  for (uint32_t i = 0; i < regionCount; i++) {
+    Region& region = regions[i];
+    for (void* p : region.overflow) ::operator delete(p);
+    region.overflow.clear();
+    ::operator delete(region.base);
+    region.base = nullptr;
+    region.capacity = 0;
+  }
+  regionCount = 0;
+  epoch.fetch_add(1);
+}
+
+void frameArenaBeginFrame(uint32_t slot) {
+  assert(slot < regionCount);
+  Region& region = regions[slot];
+  // every block counts, whether it fit or spilled
+  size_t used = region.used.load();
+  if (used > peakBytes) peakBytes = used;
+  frames++;
+
+  if (!region.overflow.empty()) {
+    for (void* p : region.overflow) ::operator delete(p);
+    region.overflow.clear();
+    // room for what the frame needed, plus slack for the next one
+    size_t capacity = used + used / 2;
+    ::operator delete(region.base);
+    region.base = (uint8_t*)::operator new(capacity);
+    region.capacity = capacity;
+    growths++;
+  }
+  region.used.store(0, std::memory_order_relaxed);
+  current.store(slot, std::memory_order_relaxed);
+  epoch.fetch_add(1, std::memory_order_release);
+}
+
+void* frameArenaAlloc(size_t size, size_t alignment) {
+  uint64_t now = epoch.load(std::memory_order_acquire);
+  if (block.epoch == now) {
+    uintptr_t p = alignUp(block.cursor, alignment);
+    if (p + size <= block.end) {
+      block.cursor = p + size;
+      return (void*)p;
+    }
+  }
+
+  // a new block for this thread, or one just for this allocation if it's
+  // big
+  assert(regionCount);
+  Region& region = regions[current.load(std::memory_order_relaxed)];
+  size_t want = size + alignment > kThreadBlock ? size + alignment
+                                                : kThreadBlock;
+  size_t offset = region.used.fetch_add(want, std::memory_order_relaxed);
+  uintptr_t start;
+  if (offset + want <= region.capacity) {
+    start = (uintptr_t)region.base + offset;
+  } else {
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    void* p = ::operator new(want);
+    region.overflow.push_back(p);
+    start = (uintptr_t)p;
+  }
+  uintptr_t p = alignUp(start, alignment);
+  block.epoch = now;
+  block.cursor = p + size;
+  block.end = start + want;
+  return (void*)p;
+}
+
+void frameArenaPrintStats() {
+  if (!frames) return;
+  size_t capacity = 0;
+  for (uint32_t i = 0; i < regionCount; i++) capacity += regions[i].capacity;
+  printf("frame arena: %u regions, %.2fMB reserved, peak frame %.2fMB, %u "
+         "frames spilled to the heap\n",
+         regionCount, capacity / (1024.0 * 1024.0),
+         peakBytes / (1024.0 * 1024.0), growths);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Scratch memory for data that dies with the frame: query results, draw
+// lists, culling output, job parameters. One linear region per frame in
+// flight; frameArenaBeginFrame() rewinds the region of the slot whose fence
+// was just waited on, so anything allocated while recording a frame stays
+// valid until that frame's slot comes around again. Freeing is a no-op.
+//
+// Each thread bumps through its own block carved out of the region (one
+// atomic add per block, none per allocation), so the job workers allocate
+// without contention. A frame that runs out spills into the heap, and the
+// region grows to fit at the start of its next use: steady state frames
+// never call malloc.
+void frameArenaInit(uint32_t framesInFlight, size_t bytesPerFrame);
+void frameArenaShutdown();
+// the thread recording frames, after waiting on the slot's fence
+void frameArenaBeginFrame(uint32_t slot);
+// any thread; alignment is a power of two
+void* frameArenaAlloc(size_t size, size_t alignment = 16);
+void frameArenaPrintStats();
+
+template <class T>
+T* frameArenaAllocArray(size_t count) {
+  return (T*)frameArenaAlloc(count * sizeof(T), alignof(T));
+}
+
+// STL adapter; containers using it must not outlive the frame. growing one
+// leaves the old storage behind until the region rewinds, so reserve()
+// when the size is known.
+template <class T>
+struct FrameAllocator {
+  using value_type = T;
+
+  FrameAllocator() = default;
+  template <class U>
+  FrameAllocator(const FrameAllocator<U>&) {}
+
+  T* allocate(size_t count) { return frameArenaAllocArray<T>(count); }
+  void deallocate(T*, size_t) {}
+
+  template <class U>
+  bool operator==(const FrameAllocator<U>&) const {
+    return true;
+  }
+  template <class U>
+  bool operator!=(const FrameAllocator<U>&) const {
+    return false;
+  }
+};
+
+template <class T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
@@ -0,0 +1,313 @@
+#include "frame_readback.h"
+
+#include "image_writer.h"
+#include "memory_budget.h"
+#include "profiler.h"
+#include "vk_dispatch.h"
+
+#include <filesystem>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+bool parseExportFormat(const char* name, ExportFormat& format) {
+  if (strcmp(name, "png") == 0) {
+    format = EXPORT_PNG;
+  } else if (strcmp(name, "raw") == 0) {
+    format = EXPORT_RAW;
+  } else if (strcmp(name, "exr") == 0) {
+    format = EXPORT_EXR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static const char* exportExtension(ExportFormat format) {
+  switch (format) {
+    case EXPORT_PNG:
+      return "png";
+    case EXPORT_RAW:
+      return "raw";
+    case EXPORT_EXR:
+      return "exr";
+  }
+  return "";
+}
+
+// byte order of the 8 bit formats a swapchain can realistically have
+static bool channelOrder(VkFormat format, bool& bgr) {
+  switch (format) {
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+      bgr = true;
+      return true;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+      bgr = false;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool FrameReadback::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                         JobSystem* jobs, const char* directory,
+                         ExportFormat format) {
+  this->device = device;
+  this->jobs = jobs;
+  this->directory = directory;
+  this->format = format;
+
+  std::error_code ec;
+  std::filesystem::create_directories(directory, ec);
+  if (ec) {
+    printf("failed to create export directory:%s \n", directory);
+    return false;
+  }
+
+  // cached memory makes the cpu side reads fast; coherent is only the
+  // fallback and then no invalidate is needed
+  VkPhysicalDeviceMemoryProperties props;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &props);
+  const VkMemoryPropertyFlags preferred[] = {
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+  bool found = false;
+  for (VkMemoryPropertyFlags flags : preferred) {
+    for (uint32_t i = 0; i < props.memoryTypeCount && !found; i++) {
+      if ((props.memoryTypes[i].propertyFlags & flags) == flags) {
+        memoryTypeIndex = i;
+        coherent = (props.memoryTypes[i].propertyFlags &
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+        found = true;
+      }
+    }
+  }
+  assert(found);
+  return true;
+}
+
+void FrameReadback::destroy() {
+  for (Slot& slot : slots) {
+    if (slot.buffer) {
+      vkd.vkUnmapMemory(device, slot.memory);
+      vkd.vkDestroyBuffer(device, slot.buffer, nullptr);
+      freeTrackedMemory(device, slot.memory);
+    }
+    slot.buffer = VK_NULL_HANDLE;
+    slot.memory = VK_NULL_HANDLE;
+    slot.mapped = nullptr;
+    slot.capacity = 0;
+    slot.state = SLOT_FREE;
+  }
+  printf("frame export: %llu frames written to %s, %.2fms avg encode, %llu "
+         "stalls on a full ring\n",
+         (unsigned long long)written.load(), directory.c_str(),
+         written.load() ? encodeNs.load() / 1e6 / written.load() : 0.0,
+         (unsigned long long)stalls);
+}
+
+void FrameReadback::ensureCapacity(Slot& slot, VkDeviceSize size) {
+  if (slot.capacity >= size) return;
+  if (slot.buffer) {
+    vkd.vkUnmapMemory(device, slot.memory);
+    vkd.vkDestroyBuffer(device, slot.buffer, nullptr);
+    freeTrackedMemory(device, slot.memory);
+  }
+
+  VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  bufferInfo.size = size;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VK_CHECK(vkd.vkCreateBuffer(device, &bufferInfo, nullptr, &slot.buffer));
+
+  VkMemoryRequirements memReq;
+  vkd.vkGetBufferMemoryRequirements(device, slot.buffer, &memReq);
+  assert(memReq.memoryTypeBits & (1u << memoryTypeIndex));
+  VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+  allocInfo.allocationSize = memReq.size;
+  allocInfo.memoryTypeIndex = memoryTypeIndex;
+  VK_CHECK(
+      allocateTrackedMemory(device, allocInfo, MEMORY_STAGING, slot.memory));
+  VK_CHECK(vkd.vkBindBufferMemory(device, slot.buffer, slot.memory, 0));
+  VK_CHECK(vkd.vkMapMemory(device, slot.memory, 0, VK_WHOLE_SIZE, 0,
+                           &slot.mapped));
+  slot.capacity = size;
+}
+
+FrameReadback::Slot* FrameReadback::acquireSlot() {
+  for (;;) {
+    Slot* oldest = nullptr;
+    for (Slot& slot : slots) {
+      if (slot.state == SLOT_ENCODING && slot.encoding.done()) {
+        slot.state = SLOT_FREE;
+      }
+      if (slot.state == SLOT_FREE) {
+        return &slot;
+      }
+      if (slot.state == SLOT_ENCODING &&
+          (!oldest || slot.sequence < oldest->sequence)) {
+        oldest = &slot;
+      }
+    }
+    // the writers fell behind; block on (and help with) the oldest encode
+    // rather than dropping frames
+    assert(oldest);
+    stalls++;
+    PROFILE_SCOPE("wait frame export");
+    jobs->wait(&oldest->encoding);
+  }
+}
+
+void FrameReadback::capture(VkCommandBuffer cmd, VkImage image,
+                            VkFormat format, VkExtent2D extent) {
+  bool bgr;
+  if (!channelOrder(format, bgr)) {
+    static bool warned = false;
+    if (!warned) {
+      printf("frame export: unsupported swapchain format %d\n", format);
+      warned = true;
+    }
+    return;
+  }
+
+  Slot& slot = *acquireSlot();
+  ensureCapacity(slot, (VkDeviceSize)extent.width * extent.height * 4);
+  slot.format = format;
+  slot.extent = extent;
+  slot.sequence = nextSequence++;
+  slot.state = SLOT_RECORDED;
+
+  VkImageMemoryBarrier toTransfer = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+  // written either by the render pass or by a blit from the post chain
+  toTransfer.srcAccessMask =
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  toTransfer.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.image = image;
+  toTransfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkd.vkCmdPipelineBarrier(cmd,
+                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                           nullptr, 1, &toTransfer);
+
+  VkBufferImageCopy region = {};
+  region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageExtent = {extent.width, extent.height, 1};
+  vkd.vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             slot.buffer, 1, &region);
+
+  VkImageMemoryBarrier toPresent = toTransfer;
+  toPresent.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  toPresent.dstAccessMask = 0;
+  toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  toPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  VkBufferMemoryBarrier toHost = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+  toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toHost.buffer = slot.buffer;
+  toHost.size = VK_WHOLE_SIZE;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_HOST_BIT |
+                               VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                           0, 0, nullptr, 1, &toHost, 1, &toPresent);
+}
+
+void FrameReadback::submitted(uint64_t frame) {
+  for (Slot& slot : slots) {
+    if (slot.state == SLOT_RECORDED) {
+      slot.frame = frame;
+      slot.state = SLOT_IN_FLIGHT;
+    }
+  }
+}
+
+void FrameReadback::poll(uint64_t completedFrame) {
+  for (Slot& slot : slots) {
+    if (slot.state == SLOT_IN_FLIGHT && slot.frame <= completedFrame) {
+      slot.state = SLOT_ENCODING;
+      Slot* s = &slot;
+      jobs->run(&slot.encoding, [this, s] { encode(*s); }, "encode frame");
+    }
+  }
+}
+
+void FrameReadback::finish() {
+  for (Slot& slot : slots) {
+    if (slot.state == SLOT_ENCODING) {
+      jobs->wait(&slot.encoding);
+      slot.state = SLOT_FREE;
+    }
+  }
+}
+
+void FrameReadback::encode(Slot& slot) {
+  uint64_t begin = profilerNow();
+  const uint32_t width = slot.extent.width;
+  const uint32_t height = slot.extent.height;
+  const size_t pixels = (size_t)width * height;
+
+  if (!coherent) {
+    VkMappedMemoryRange range = {VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE};
+    range.memory = slot.memory;
+    range.offset = 0;
+    range.size = VK_WHOLE_SIZE;
+    VK_CHECK(vkd.vkInvalidateMappedMemoryRanges(device, 1, &range));
+  }
+
+  bool bgr = false;
+  channelOrder(slot.format, bgr);
+  const uint8_t* src = (const uint8_t*)slot.mapped;
+  const int r = bgr ? 2 : 0;
+  const int b = bgr ? 0 : 2;
+
+  char path[512];
+  snprintf(path, sizeof(path), "%s/frame_%06llu.%s", directory.c_str(),
+           (unsigned long long)slot.sequence, exportExtension(format));
+
+  bool ok = false;
+  if (format == EXPORT_PNG) {
+    std::vector<uint8_t> rgb(pixels * 3);
+    for (size_t i = 0; i < pixels; i++) {
+      rgb[i * 3 + 0] = src[i * 4 + r];
+      rgb[i * 3 + 1] = src[i * 4 + 1];
+      rgb[i * 3 + 2] = src[i * 4 + b];
+    }
+    ok = writePng(path, rgb.data(), width, height);
+  } else if (format == EXPORT_EXR) {
+    // the surface color space is srgb nonlinear whether or not the format
+    // does the encode, so decode to linear for exr
+    float toLinear[256];
+    for (int i = 0; i < 256; i++) {
+      float c = i / 255.0f;
+      toLinear[i] = c <= 0.04045f ? c / 12.92f
+                                  : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+    std::vector<float> rgb(pixels * 3);
+    for (size_t i = 0; i < pixels; i++) {
+      rgb[i * 3 + 0] = toLinear[src[i * 4 + r]];
+      rgb[i * 3 + 1] = toLinear[src[i * 4 + 1]];
+      rgb[i * 3 + 2] = toLinear[src[i * 4 + b]];
+    }
+    ok = writeExr(path, rgb.data(), width, height);
+  } else {
+    // rgba8 in the swapchain's byte order, size goes in the name
+    snprintf(path, sizeof(path), "%s/frame_%06llu_%ux%u_%s.%s",
+             directory.c_str(), (unsigned long long)slot.sequence, width,
+             height, bgr ? "bgra" : "rgba", exportExtension(format));
+    ok = writeRaw(path, src, (uint64_t)pixels * 4);
+  }
+
+  if (ok) {
+    written.fetch_add(1);
+  }
+  encodeNs.fetch_add(profilerNow() - begin);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "job_system.h"
+
+#include <string>
+
+enum ExportFormat { EXPORT_PNG, EXPORT_RAW, EXPORT_EXR };
+
+bool parseExportFormat(const char* name, ExportFormat& format);
+
+// copies presented images back into a ring of persistently mapped host
+// buffers and writes them out on the job system. the GPU side is a copy at the
+// end of the frame's command buffer; completion comes from the frame fences
+// the renderer already waits on, so nothing here blocks the render thread
+// unless every slot is still being encoded.
+class FrameReadback {
+ public:
+  bool init(VkPhysicalDevice physicalDevice, VkDevice device, JobSystem* jobs,
+            const char* directory, ExportFormat format);
+  void destroy();
+
+  // records a copy of a swapchain image that is in PRESENT_SRC layout and
+  // leaves it in that layout. the image needs TRANSFER_SRC usage.
+  void capture(VkCommandBuffer cmd, VkImage image, VkFormat format,
+               VkExtent2D extent);
+  // tags the captures recorded since the last call with their frame number
+  void submitted(uint64_t frame);
+  // starts encoding every capture whose frame has finished on the GPU
+  void poll(uint64_t completedFrame);
+  // waits for all started encodes; call poll() first at shutdown
+  void finish();
+
+  uint64_t framesWritten() const { return written.load(); }
+
+ private:
+  enum SlotState { SLOT_FREE, SLOT_RECORDED, SLOT_IN_FLIGHT, SLOT_ENCODING };
+
+  struct Slot {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void* mapped = nullptr;
+    VkDeviceSize capacity = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent = {};
+    uint64_t frame = 0;
+    uint64_t sequence = 0;
+    SlotState state = SLOT_FREE;
+    JobCounter encoding;
+  };
+
+  // frames in flight + frames being written
+  static const uint32_t kSlotCount = 6;
+
+  Slot* acquireSlot();
+  void ensureCapacity(Slot& slot, VkDeviceSize size);
+  void encode(Slot& slot);
+
+  VkDevice device = VK_NULL_HANDLE;
+  JobSystem* jobs = nullptr;
+  std::string directory;
+  ExportFormat format = EXPORT_PNG;
+  uint32_t memoryTypeIndex = 0;
+  bool coherent = false;
+
+  Slot slots[kSlotCount];
+  uint64_t nextSequence = 0;
+  uint64_t stalls = 0;
+  std::atomic<uint64_t> encodeNs{0};
+  std::atomic<uint64_t> written{0};
+};
@@ -0,0 +1,102 @@
+#include "gpu_timer.h"
+
+#include "vk_dispatch.h"
+
+#include <string.h>
+
+void GpuTimer::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                    uint32_t queueFamilyIndex, uint32_t framesInFlight) {
+  this->device = device;
+
+  VkPhysicalDeviceProperties props;
+  vki.vkGetPhysicalDeviceProperties(physicalDevice, &props);
+  uint32_t familyCount = 0;
+  vki.vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                               nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vki.vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                               families.data());
+  uint32_t validBits = families[queueFamilyIndex].timestampValidBits;
+  supported = validBits != 0 && props.limits.timestampPeriod > 0.0f;
+  if (!supported) {
+    printf("gpu timer: timestamps not supported on the graphics queue\n");
+    return;
+  }
+  validMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+  nsPerTick = props.limits.timestampPeriod;
+
+  slots.resize(framesInFlight);
+  VkQueryPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+  poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  poolInfo.queryCount = framesInFlight * kMaxZones * 2;
+  VK_CHECK(vkd.vkCreateQueryPool(device, &poolInfo, nullptr, &pool));
+}
+
+void GpuTimer::destroy() {
+  if (pool) {
+    vkd.vkDestroyQueryPool(device, pool, nullptr);
+    pool = VK_NULL_HANDLE;
+  }
+}
+
+uint32_t GpuTimer::statsIndex(const char* name) {
+  for (uint32_t i = 0; i < stats.size(); i++) {
+    if (stats[i].name == name || strcmp(stats[i].name, name) == 0) return i;
+  }
+  stats.push_back({name, 0.0, 0.0, 0});
+  return (uint32_t)stats.size() - 1;
+}
+
+void GpuTimer::beginFrame(VkCommandBuffer cmd, uint32_t slotIndex) {
+  if (!supported) return;
+  currentSlot = slotIndex;
+  Slot& slot = slots[slotIndex];
+  uint32_t first = slotIndex * kMaxZones * 2;
+
+  if (slot.count) {
+    uint64_t ticks[kMaxZones * 2];
+    VkResult result = vkd.vkGetQueryPoolResults(
+        device, pool, first, slot.count * 2, sizeof(ticks), ticks,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result == VK_SUCCESS) {
+      for (uint32_t i = 0; i < slot.count; i++) {
+        uint64_t elapsed = ((ticks[i * 2 + 1] - ticks[i * 2]) & validMask);
+        ZoneStats& zone = stats[slot.stats[i]];
+        zone.lastMs = elapsed * nsPerTick / 1e6;
+        zone.totalMs += zone.lastMs;
+        zone.samples++;
+      }
+    }
+  }
+
+  slot.count = 0;
+  vkd.vkCmdResetQueryPool(cmd, pool, first, kMaxZones * 2);
+}
+
+uint32_t GpuTimer::begin(VkCommandBuffer cmd, const char* name,
+                         VkPipelineStageFlagBits stage) {
+  if (!supported) return 0;
+  Slot& slot = slots[currentSlot];
+  assert(slot.count < kMaxZones);
+  uint32_t zone = slot.count++;
+  slot.stats[zone] = statsIndex(name);
+  vkd.vkCmdWriteTimestamp(cmd, stage, pool,
+                          (currentSlot * kMaxZones + zone) * 2);
+  return zone;
+}
+
+void GpuTimer::end(VkCommandBuffer cmd, uint32_t zone,
+                   VkPipelineStageFlagBits stage) {
+  if (!supported) return;
+  vkd.vkCmdWriteTimestamp(cmd, stage, pool,
+                          (currentSlot * kMaxZones + zone) * 2 + 1);
+}
+
+void GpuTimer::printStats() const {
+  if (!supported || stats.empty()) return;
+  printf("gpu timings (avg / last):\n");
+  for (const ZoneStats& zone : stats) {
+    printf("  %-20s %7.3fms %7.3fms\n", zone.name,
+           zone.samples ? zone.totalMs / zone.samples : 0.0, zone.lastMs);
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include <vector>
+
+// GPU pass timings from timestamp queries. Each frame in flight owns a slice
+// of the query pool; a slot's results are read back in beginFrame(), right
+// after the renderer waited on that slot's fence, so reading never stalls.
+class GpuTimer {
+ public:
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            uint32_t queueFamilyIndex, uint32_t framesInFlight);
+  void destroy();
+
+  // collects the slot's previous results and resets its queries
+  void beginFrame(VkCommandBuffer cmd, uint32_t slot);
+  // name must outlive the timer; zones with the same name are averaged
+  uint32_t begin(VkCommandBuffer cmd, const char* name,
+                 VkPipelineStageFlagBits stage =
+                     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+  void end(VkCommandBuffer cmd, uint32_t zone,
+           VkPipelineStageFlagBits stage =
+               VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+  // average and last ms per zone
+  void printStats() const;
+
+ private:
+  struct ZoneStats {
+    const char* name;
+    double totalMs;
+    double lastMs;
+    uint64_t samples;
+  };
+
+  static const uint32_t kMaxZones = 16;
+
+  struct Slot {
+    uint32_t count = 0;
+    uint32_t stats[kMaxZones];
+  };
+
+  uint32_t statsIndex(const char* name);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueryPool pool = VK_NULL_HANDLE;
+  double nsPerTick = 1.0;
+  uint64_t validMask = ~0ull;
+  bool supported = false;
+  uint32_t currentSlot = 0;
+  std::vector<Slot> slots;
+  std::vector<ZoneStats> stats;
+};
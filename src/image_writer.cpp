@@ -0,0 +1,204 @@
+#include "image_writer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static uint32_t crcTable[256];
+
+static void initCrcTable() {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    }
+    crcTable[n] = c;
+  }
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+  // function-local static init is thread safe, encoders run on workers
+  static bool initialized = (initCrcTable(), true);
+  (void)initialized;
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void putBE32(std::vector<uint8_t>& out, uint32_t v) {
+  out.push_back((uint8_t)(v >> 24));
+  out.push_back((uint8_t)(v >> 16));
+  out.push_back((uint8_t)(v >> 8));
+  out.push_back((uint8_t)v);
+}
+
+static void putLE32(std::vector<uint8_t>& out, uint32_t v) {
+  out.push_back((uint8_t)v);
+  out.push_back((uint8_t)(v >> 8));
+  out.push_back((uint8_t)(v >> 16));
+  out.push_back((uint8_t)(v >> 24));
+}
+
+static void putLE64(std::vector<uint8_t>& out, uint64_t v) {
+  putLE32(out, (uint32_t)v);
+  putLE32(out, (uint32_t)(v >> 32));
+}
+
+static void putBytes(std::vector<uint8_t>& out, const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  out.insert(out.end(), p, p + size);
+}
+
+static void putString(std::vector<uint8_t>& out, const char* s) {
+  putBytes(out, s, strlen(s) + 1);
+}
+
+static bool writeFile(const char* path, const std::vector<uint8_t>& data) {
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    printf("failed to open file for writing:%s \n", path);
+    return false;
+  }
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  fclose(f);
+  return ok;
+}
+
+static void pngChunk(std::vector<uint8_t>& out, const char* type,
+                     const std::vector<uint8_t>& data) {
+  putBE32(out, (uint32_t)data.size());
+  size_t start = out.size();
+  putBytes(out, type, 4);
+  putBytes(out, data.data(), data.size());
+  putBE32(out, crc32(0, out.data() + start, out.size() - start));
+}
+
+bool writePng(const char* path, const uint8_t* rgb, uint32_t width,
+              uint32_t height) {
+  std::vector<uint8_t> out;
+  const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  putBytes(out, signature, 8);
+
+  std::vector<uint8_t> header;
+  putBE32(header, width);
+  putBE32(header, height);
+  header.push_back(8);  // bit depth
+  header.push_back(2);  // truecolor rgb
+  header.push_back(0);  // deflate
+  header.push_back(0);  // adaptive filtering
+  header.push_back(0);  // no interlace
+  pngChunk(out, "IHDR", header);
+
+  // scanlines with filter type 0, wrapped in zlib stored blocks
+  const size_t rowBytes = (size_t)width * 3;
+  const size_t rawSize = (rowBytes + 1) * height;
+  std::vector<uint8_t> raw(rawSize);
+  for (uint32_t y = 0; y < height; y++) {
+    raw[y * (rowBytes + 1)] = 0;
+    memcpy(&raw[y * (rowBytes + 1) + 1], rgb + y * rowBytes, rowBytes);
+  }
+
+  std::vector<uint8_t> zlib;
+  zlib.reserve(rawSize + rawSize / 65535 * 5 + 16);
+  zlib.push_back(0x78);
+  zlib.push_back(0x01);
+  uint32_t a = 1, b = 0;
+  size_t pos = 0;
+  do {
+    size_t len = rawSize - pos < 65535 ? rawSize - pos : 65535;
+    zlib.push_back(pos + len == rawSize ? 1 : 0);
+    zlib.push_back((uint8_t)len);
+    zlib.push_back((uint8_t)(len >> 8));
+    zlib.push_back((uint8_t)~len);
+    zlib.push_back((uint8_t)(~len >> 8));
+    putBytes(zlib, raw.data() + pos, len);
+    for (size_t i = 0; i < len; i++) {
+      a = (a + raw[pos + i]) % 65521;
+      b = (b + a) % 65521;
+    }
+    pos += len;
+  } while (pos < rawSize);
+  putBE32(zlib, (b << 16) | a);
+  pngChunk(out, "IDAT", zlib);
+  pngChunk(out, "IEND", {});
+
+  return writeFile(path, out);
+}
+
+static void exrAttribute(std::vector<uint8_t>& out, const char* name,
+                         const char* type, const void* value, uint32_t size) {
+  putString(out, name);
+  putString(out, type);
+  putLE32(out, size);
+  putBytes(out, value, size);
+}
+
+bool writeExr(const char* path, const float* rgb, uint32_t width,
+              uint32_t height) {
+  std::vector<uint8_t> out;
+  putLE32(out, 20000630);  // magic
+  putLE32(out, 2);         // version 2, single part scanline
+
+  // channels are stored in alphabetical order
+  std::vector<uint8_t> channels;
+  for (const char* name : {"B", "G", "R"}) {
+    putString(channels, name);
+    putLE32(channels, 2);  // FLOAT
+    putLE32(channels, 0);  // pLinear + reserved
+    putLE32(channels, 1);  // xSampling
+    putLE32(channels, 1);  // ySampling
+  }
+  channels.push_back(0);
+  exrAttribute(out, "channels", "chlist", channels.data(),
+               (uint32_t)channels.size());
+  uint8_t compression = 0;
+  exrAttribute(out, "compression", "compression", &compression, 1);
+  int32_t window[4] = {0, 0, (int32_t)width - 1, (int32_t)height - 1};
+  exrAttribute(out, "dataWindow", "box2i", window, sizeof(window));
+  exrAttribute(out, "displayWindow", "box2i", window, sizeof(window));
+  uint8_t lineOrder = 0;
+  exrAttribute(out, "lineOrder", "lineOrder", &lineOrder, 1);
+  float aspect = 1.0f;
+  exrAttribute(out, "pixelAspectRatio", "float", &aspect, 4);
+  float center[2] = {0.0f, 0.0f};
+  exrAttribute(out, "screenWindowCenter", "v2f", center, sizeof(center));
+  float windowWidth = 1.0f;
+  exrAttribute(out, "screenWindowWidth", "float", &windowWidth, 4);
+  out.push_back(0);
+
+  // one scanline per chunk without compression
+  const uint32_t lineBytes = width * 3 * 4;
+  uint64_t offset = out.size() + (uint64_t)height * 8;
+  for (uint32_t y = 0; y < height; y++) {
+    putLE64(out, offset);
+    offset += 8 + lineBytes;
+  }
+  out.reserve(offset);
+  std::vector<float> line(width * 3);
+  for (uint32_t y = 0; y < height; y++) {
+    putLE32(out, y);
+    putLE32(out, lineBytes);
+    const float* src = rgb + (size_t)y * width * 3;
+    for (uint32_t x = 0; x < width; x++) {
+      line[x] = src[x * 3 + 2];
+      line[width + x] = src[x * 3 + 1];
+      line[width * 2 + x] = src[x * 3 + 0];
+    }
+    putBytes(out, line.data(), lineBytes);
+  }
+
+  return writeFile(path, out);
+}
+
+bool writeRaw(const char* path, const void* data, uint64_t size) {
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    printf("failed to open file for writing:%s \n", path);
+    return false;
+  }
+  bool ok = fwrite(data, 1, (size_t)size, f) == size;
+  fclose(f);
+  return ok;
+}
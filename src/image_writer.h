@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// minimal encoders for frame export. no external deps: png is written with
+// stored (uncompressed) deflate blocks, exr as uncompressed float scanlines.
+// both favour encode speed over file size since they run once per frame.
+
+// rgb8, tightly packed rows
+bool writePng(const char* path, const uint8_t* rgb, uint32_t width,
+              uint32_t height);
+// linear rgb float, tightly packed rows
+bool writeExr(const char* path, const float* rgb, uint32_t width,
+              uint32_t height);
+// raw bytes as-is
+bool writeRaw(const char* path, const void* data, uint64_t size);
@@ -0,0 +1,399 @@
+#include "instanced_props.h"
+
+#include "file_io.h"
+#include "memory_budget.h"
+#include "profiler.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PROPS_SSE 1
+#include <emmintrin.h>
+#endif
+
+// radians per second of each spin class; most props stand still
+static const float kSpinRates[] = {0.0f, 0.4f, -0.9f, 2.0f};
+
+// sides of a regular prism or pyramid standing on the origin, counter
+// clockwise from outside; the bottom is never seen and left open
+void InstancedProps::addPrism(std::vector<Vertex>& vertices,
+                              std::vector<uint16_t>& indices, uint32_t sides,
+                              float bottomRadius, float topRadius,
+                              float height, MeshRange& range) {
+  range.firstIndex = (uint32_t)indices.size();
+  range.vertexOffset = (int32_t)vertices.size();
+  range.radius = sqrtf(std::max(bottomRadius, topRadius) *
+                           std::max(bottomRadius, topRadius) +
+                       height * height);
+
+  // indices are relative to vertexOffset
+  uint16_t base = 0;
+  auto corner = [&](uint32_t k, float r, float y) {
+    float angle = (k + 0.5f) * 6.2831853f / sides;
+    return glm::vec3(cosf(angle) * r, y, sinf(angle) * r);
+  };
+  for (uint32_t k = 0; k < sides; k++) {
+    glm::vec3 quad[4] = {corner(k, bottomRadius, 0.0f),
+                         corner(k, topRadius, height),
+                         corner(k + 1, topRadius, height),
+                         corner(k + 1, bottomRadius, 0.0f)};
+    glm::vec3 normal =
+        glm::normalize(glm::cross(quad[1] - quad[0], quad[3] - quad[0]));
+    for (const glm::vec3& p : quad) vertices.push_back({p, normal});
+    const uint16_t order[6] = {0, 1, 2, 0, 2, 3};
+    for (uint16_t i : order) indices.push_back(base + i);
+    base += 4;
+  }
+  if (topRadius > 0.0f) {
+    const glm::vec3 up(0.0f, 1.0f, 0.0f);
+    uint16_t center = base++;
+    vertices.push_back({glm::vec3(0.0f, height, 0.0f), up});
+    for (uint32_t k = 0; k < sides; k++) {
+      vertices.push_back({corner(k, topRadius, height), up});
+    }
+    for (uint32_t k = 0; k < sides; k++) {
+      indices.push_back(center);
+      indices.push_back(base + (uint16_t)((k + 1) % sides));
+      indices.push_back(base + (uint16_t)k);
+    }
+  }
+  range.indexCount = (uint32_t)indices.size() - range.firstIndex;
+}
+
+void InstancedProps::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                          uint32_t propCount, uint32_t framesInFlight) {
+  this->device = device;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  std::vector<Vertex> vertices;
+  std::vector<uint16_t> meshIndices;
+  addPrism(vertices, meshIndices, 4, 0.7071f, 0.7071f, 1.0f,
+           meshes[MESH_CRATE]);
+  addPrism(vertices, meshIndices, 8, 0.3f, 0.25f, 2.0f, meshes[MESH_COLUMN]);
+  addPrism(vertices, meshIndices, 4, 0.5f, 0.0f, 1.6f, meshes[MESH_SPIRE]);
+  materialColors[MATERIAL_STONE] = glm::vec4(0.55f, 0.53f, 0.5f, 1.0f);
+  materialColors[MATERIAL_WOOD] = glm::vec4(0.55f, 0.36f, 0.2f, 1.0f);
+  materialColors[MATERIAL_COPPER] = glm::vec4(0.72f, 0.45f, 0.3f, 1.0f);
+  materialColors[MATERIAL_PAINT] = glm::vec4(0.2f, 0.4f, 0.75f, 1.0f);
+
+  // scattered over a wide field in front of the camera, in whatever order;
+  // a counting sort by mesh and material then groups them for drawing
+  struct Prop {
+    uint32_t key;
+    glm::vec3 position;
+    float scale;
+    float yaw;
+    float tint;
+    uint8_t spin;
+  };
+  std::vector<Prop> props(propCount);
+  uint32_t seed = 0x2545f491u;
+  uint32_t offsets[MESH_COUNT * MATERIAL_COUNT + 1] = {};
+  for (Prop& p : props) {
+    uint32_t mesh = std::min((uint32_t)(randomFloat(seed) * MESH_COUNT),
+                             (uint32_t)MESH_COUNT - 1);
+    uint32_t material =
+        std::min((uint32_t)(randomFloat(seed) * MATERIAL_COUNT),
+                 (uint32_t)MATERIAL_COUNT - 1);
+    p.key = mesh * MATERIAL_COUNT + material;
+    p.position = glm::vec3(randomFloat(seed) * 120.0f - 60.0f, 0.0f,
+                           randomFloat(seed) * -95.0f - 2.0f);
+    p.scale = 0.2f + randomFloat(seed) * 0.4f;
+    p.yaw = randomFloat(seed) * 6.2831853f;
+    p.tint = 0.75f + randomFloat(seed) * 0.25f;
+    float spin = randomFloat(seed);
+    p.spin = spin < 0.75f
+                 ? 0
+                 : (uint8_t)(1 + std::min((uint32_t)((spin - 0.75f) * 12.0f),
+                                          kSpinClasses - 2));
+    offsets[p.key + 1]++;
+  }
+  for (uint32_t k = 0; k < MESH_COUNT * MATERIAL_COUNT; k++) {
+    offsets[k + 1] += offsets[k];
+  }
+
+  positionX.resize(propCount);
+  positionY.resize(propCount);
+  positionZ.resize(propCount);
+  scale.resize(propCount);
+  radius.resize(propCount);
+  yawCos.resize(propCount);
+  yawSin.resize(propCount);
+  tint.resize(propCount);
+  spinClass.resize(propCount);
+  uint32_t cursors[MESH_COUNT * MATERIAL_COUNT];
+  memcpy(cursors, offsets, sizeof(cursors));
+  for (const Prop& p : props) {
+    uint32_t i = cursors[p.key]++;
+    positionX[i] = p.position.x;
+    positionY[i] = p.position.y;
+    positionZ[i] = p.position.z;
+    scale[i] = p.scale;
+    radius[i] = meshes[p.key / MATERIAL_COUNT].radius * p.scale;
+    yawCos[i] = cosf(p.yaw);
+    yawSin[i] = sinf(p.yaw);
+    tint[i] = p.tint;
+    spinClass[i] = p.spin;
+  }
+  for (uint32_t k = 0; k < MESH_COUNT * MATERIAL_COUNT; k++) {
+    for (uint32_t first = offsets[k]; first < offsets[k + 1];
+         first += kChunkSize) {
+      uint32_t count = offsets[k + 1] - first;
+      if (count > kChunkSize) count = kChunkSize;
+      chunks.push_back({k / MATERIAL_COUNT, k % MATERIAL_COUNT, first, count});
+    }
+  }
+  visibleCounts.assign(chunks.size() * framesInFlight, 0);
+
+  const VkMemoryPropertyFlags hostFlags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  VkDeviceSize vertexBytes = vertices.size() * sizeof(Vertex);
+  VkDeviceSize indexBytes = meshIndices.size() * sizeof(uint16_t);
+  indexOffset = vertexBytes;
+  meshBuffer = createBuffer(
+      device, memoryProperties, vertexBytes + indexBytes,
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 0,
+      hostFlags, MEMORY_BUFFER, meshMemory);
+  uint8_t* mapped;
+  VK_CHECK(vkd.vkMapMemory(device, meshMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&mapped));
+  memcpy(mapped, vertices.data(), vertexBytes);
+  memcpy(mapped + indexOffset, meshIndices.data(), indexBytes);
+  vkd.vkUnmapMemory(device, meshMemory);
+
+  // written once by the CPU and read once by the GPU, so device local +
+  // host visible is worth having where it exists
+  instanceStride = ((VkDeviceSize)propCount * sizeof(Instance) + 255) &
+                   ~(VkDeviceSize)255;
+  instanceBuffer = createBuffer(
+      device, memoryProperties, instanceStride * framesInFlight,
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      hostFlags, MEMORY_BUFFER, instanceMemory);
+  VK_CHECK(vkd.vkMapMemory(device, instanceMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&instanceMapped));
+
+  VkPushConstantRange colorRange = {VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                                    sizeof(glm::vec4)};
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &colorRange;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout));
+
+  vertexShader = createShaderRef(device, readFile("shaders/props_vert.spv"));
+  fragmentShader = createShaderRef(device, readFile("shaders/props_frag.spv"));
+
+  drawDesc = GraphicsPipelineDesc();
+  drawDesc.vertexShader = vertexShader;
+  drawDesc.fragmentShader = fragmentShader;
+  drawDesc.bindingCount = 2;
+  drawDesc.bindings[0] = {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX};
+  drawDesc.bindings[1] = {1, sizeof(Instance), VK_VERTEX_INPUT_RATE_INSTANCE};
+  drawDesc.attributeCount = 7;
+  drawDesc.attributes[0] = {0, 0, VK_FORMAT_R32G32B32_SFLOAT,
+                            offsetof(Vertex, position)};
+  drawDesc.attributes[1] = {1, 0, VK_FORMAT_R32G32B32_SFLOAT,
+                            offsetof(Vertex, normal)};
+  // the matrix takes a location per column
+  for (uint32_t c = 0; c < 4; c++) {
+    drawDesc.attributes[2 + c] = {
+        2 + c, 1, VK_FORMAT_R32G32B32A32_SFLOAT,
+        (uint32_t)(offsetof(Instance, mvp) + c * sizeof(glm::vec4))};
+  }
+  drawDesc.attributes[6] = {6, 1, VK_FORMAT_R32G32B32A32_SFLOAT,
+                            offsetof(Instance, rotation)};
+  // y is flipped in the projection, so counter clockwise stays front facing
+  drawDesc.cullMode = VK_CULL_MODE_BACK_BIT;
+  drawDesc.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  drawDesc.depthTestEnable = VK_TRUE;
+  drawDesc.depthWriteEnable = VK_TRUE;
+  drawDesc.layout = layout;
+
+  printf("instanced props: %u props in %u chunks, %.1fmb of instances per "
+         "frame\n",
+         propCount, (uint32_t)chunks.size(),
+         instanceStride / (1024.0 * 1024.0));
+}
+
+void InstancedProps::destroy() {
+  // jobs of a dropped last frame may still be writing instances
+  while (!transformed.done()) std::this_thread::yield();
+  vkd.vkDestroyShaderModule(device, vertexShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, fragmentShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(device, layout, nullptr);
+  vkd.vkUnmapMemory(device, instanceMemory);
+  vkd.vkDestroyBuffer(device, instanceBuffer, nullptr);
+  freeTrackedMemory(device, instanceMemory);
+  vkd.vkDestroyBuffer(device, meshBuffer, nullptr);
+  freeTrackedMemory(device, meshMemory);
+}
+
+// model = translate * rotateY * scale, so with c/s the spun yaw
+//   mvp[0] = vp[0] * (scale * c) - vp[2] * (scale * s)
+//   mvp[1] = vp[1] * scale
+//   mvp[2] = vp[0] * (scale * s) + vp[2] * (scale * c)
+//   mvp[3] = vp * position
+// and mvp[3] is the prop's origin in clip space, which is all the frustum
+// test needs: its distance to a plane is a sum of two of its components.
+void InstancedProps::transformChunk(uint32_t chunkIndex, uint32_t slot,
+                                    const FrameConstants& frame) {
+  PROFILE_SCOPE("transform props");
+  uint64_t begin = profilerNow();
+  const Chunk& chunk = chunks[chunkIndex];
+  // mapped memory is likely write combined: only ever write it, in order
+  Instance* out = (Instance*)(instanceMapped + slot * instanceStride) +
+                  chunk.first;
+  uint32_t visible = 0;
+  const glm::mat4& vp = frame.viewProj;
+
+#ifdef PROPS_SSE
+  const __m128 vp0 = _mm_loadu_ps(&vp[0][0]);
+  const __m128 vp1 = _mm_loadu_ps(&vp[1][0]);
+  const __m128 vp2 = _mm_loadu_ps(&vp[2][0]);
+  const __m128 vp3 = _mm_loadu_ps(&vp[3][0]);
+  // w + x, w - x, w + y, w - y against -radius * planeScale
+  const __m128 sideSigns = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+  const __m128 sideScale =
+      _mm_setr_ps(frame.planeScale[0], frame.planeScale[1],
+                  frame.planeScale[2], frame.planeScale[3]);
+#endif
+
+  for (uint32_t i = chunk.first; i < chunk.first + chunk.count; i++) {
+    uint32_t spin = spinClass[i];
+    float c = yawCos[i] * frame.spinCos[spin] - yawSin[i] * frame.spinSin[spin];
+    float s = yawSin[i] * frame.spinCos[spin] + yawCos[i] * frame.spinSin[spin];
+    float r = radius[i];
+#ifdef PROPS_SSE
+    __m128 origin = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(vp0, _mm_set1_ps(positionX[i])),
+                   _mm_mul_ps(vp1, _mm_set1_ps(positionY[i]))),
+        _mm_add_ps(_mm_mul_ps(vp2, _mm_set1_ps(positionZ[i])), vp3));
+    __m128 w = _mm_shuffle_ps(origin, origin, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128 xxyy = _mm_shuffle_ps(origin, origin, _MM_SHUFFLE(1, 1, 0, 0));
+    __m128 sides = _mm_add_ps(w, _mm_mul_ps(xxyy, sideSigns));
+    __m128 limit = _mm_mul_ps(_mm_set1_ps(-r), sideScale);
+    if (_mm_movemask_ps(_mm_cmplt_ps(sides, limit))) continue;
+    float clipZ = _mm_cvtss_f32(_mm_shuffle_ps(origin, origin,
+                                               _MM_SHUFFLE(2, 2, 2, 2)));
+    float clipW = _mm_cvtss_f32(w);
+    if (clipZ < -r * frame.planeScale[4] ||
+        clipW - clipZ < -r * frame.planeScale[5])
+      continue;
+
+    __m128 sc = _mm_set1_ps(scale[i] * c);
+    __m128 ss = _mm_set1_ps(scale[i] * s);
+    Instance* dst = out + visible++;
+    _mm_stream_ps(&dst->mvp[0][0],
+                  _mm_sub_ps(_mm_mul_ps(vp0, sc), _mm_mul_ps(vp2, ss)));
+    _mm_stream_ps(&dst->mvp[1][0], _mm_mul_ps(vp1, _mm_set1_ps(scale[i])));
+    _mm_stream_ps(&dst->mvp[2][0],
+                  _mm_add_ps(_mm_mul_ps(vp0, ss), _mm_mul_ps(vp2, sc)));
+    _mm_stream_ps(&dst->mvp[3][0], origin);
+    _mm_stream_ps(&dst->rotation[0], _mm_setr_ps(c, s, tint[i], 0.0f));
+#else
+    glm::vec4 origin = vp[0] * positionX[i] + vp[1] * positionY[i] +
+                       vp[2] * positionZ[i] + vp[3];
+    if (origin.w + origin.x < -r * frame.planeScale[0] ||
+        origin.w - origin.x < -r * frame.planeScale[1] ||
+        origin.w + origin.y < -r * frame.planeScale[2] ||
+        origin.w - origin.y < -r * frame.planeScale[3] ||
+        origin.z < -r * frame.planeScale[4] ||
+        origin.w - origin.z < -r * frame.planeScale[5])
+      continue;
+    float sc = scale[i] * c;
+    float ss = scale[i] * s;
+    Instance* dst = out + visible++;
+    dst->mvp[0] = vp[0] * sc - vp[2] * ss;
+    dst->mvp[1] = vp[1] * scale[i];
+    dst->mvp[2] = vp[0] * ss + vp[2] * sc;
+    dst->mvp[3] = origin;
+    dst->rotation = glm::vec4(c, s, tint[i], 0.0f);
+#endif
+  }
+#ifdef PROPS_SSE
+  // streaming stores aren't ordered with the counter below
+  _mm_sfence();
+#endif
+  visibleCounts[slot * chunks.size() + chunkIndex] = visible;
+  transformNanoseconds += profilerNow() - begin;
+}
+
+void InstancedProps::update(JobSystem& jobs, uint32_t slot, float time,
+                            const glm::mat4& viewProj) {
+  // a frame dropped after update() (swapchain out of date) never drew
+  if (transforming) jobs.wait(&transformed);
+  frames++;
+
+  // the jobs read this until draw() waits for them; capturing it instead
+  // would put every job's closure on the heap
+  FrameConstants& frame = frameConstants;
+  frame.viewProj = viewProj;
+  glm::vec4 x(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+  glm::vec4 y(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+  glm::vec4 z(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+  glm::vec4 w(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+  const glm::vec4 planes[6] = {w + x, w - x, w + y, w - y, z, w - z};
+  for (uint32_t p = 0; p < 6; p++) {
+    frame.planeScale[p] = glm::length(glm::vec3(planes[p]));
+  }
+  for (uint32_t k = 0; k < kSpinClasses; k++) {
+    frame.spinCos[k] = cosf(kSpinRates[k] * time);
+    frame.spinSin[k] = sinf(kSpinRates[k] * time);
+  }
+
+  for (uint32_t c = 0; c < chunks.size(); c++) {
+    jobs.run(&transformed, [this, c, slot] {
+      transformChunk(c, slot, frameConstants);
+    }, "transform props");
+  }
+  transforming = true;
+}
+
+void InstancedProps::draw(VkCommandBuffer cmd, JobSystem& jobs, uint32_t slot,
+                          PipelineVariantCache& pipelines) {
+  if (transforming) {
+    PROFILE_SCOPE("wait props");
+    jobs.wait(&transformed);
+    transforming = false;
+  }
+  VkPipeline pipeline = pipelines.request(drawDesc);
+  if (!pipeline) return;
+
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  VkBuffer buffers[2] = {meshBuffer, instanceBuffer};
+  VkDeviceSize offsets[2] = {0, slot * instanceStride};
+  vkd.vkCmdBindVertexBuffers(cmd, 0, 2, buffers, offsets);
+  vkd.vkCmdBindIndexBuffer(cmd, meshBuffer, indexOffset, VK_INDEX_TYPE_UINT16);
+
+  uint32_t material = UINT32_MAX;
+  const uint32_t* visible = &visibleCounts[slot * chunks.size()];
+  for (uint32_t c = 0; c < chunks.size(); c++) {
+    const Chunk& chunk = chunks[c];
+    if (!visible[c]) continue;
+    if (chunk.material != material) {
+      material = chunk.material;
+      vkd.vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                             sizeof(glm::vec4), &materialColors[material]);
+    }
+    const MeshRange& mesh = meshes[chunk.mesh];
+    vkd.vkCmdDrawIndexed(cmd, mesh.indexCount, visible[c], mesh.firstIndex,
+                         mesh.vertexOffset, chunk.first);
+    drawCalls++;
+    drawnProps += visible[c];
+  }
+}
+
+void InstancedProps::printStats() const {
+  if (!frames) return;
+  printf("instanced props: %.3f ms of transform jobs per frame in chunks of "
+         "%u, %.0f of %u props drawn with %.1f draws per frame\n",
+         transformNanoseconds.load() / 1e6 / frames, kChunkSize,
+         (double)drawnProps / frames, (uint32_t)positionX.size(),
+         (double)drawCalls / frames);
+}
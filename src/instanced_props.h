@@ -0,0 +1,137 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "job_system.h"
+#include "pipeline_cache.h"
+
+#include <atomic>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Lots of small static props drawn with hardware instancing.
+//
+// Props that share a mesh and a material are sorted next to each other at
+// init, so each (mesh, material) pair is one contiguous instance range; the
+// ranges are cut into chunks of kChunkSize. Every frame update() hands the
+// chunks to the job workers, which build each prop's model-view-projection
+// matrix with SSE, frustum cull it and stream the survivors straight into
+// this frame's mapped instance buffer. draw() then issues one instanced draw
+// per chunk, reading the matrices through a second, per-instance vertex
+// binding - 100k props of a few kinds are a few dozen draws.
+class InstancedProps {
+ public:
+  // props per transform job, and the most one draw call covers
+  static const uint32_t kChunkSize = 8192;
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            uint32_t propCount, uint32_t framesInFlight);
+  void destroy();
+
+  // starts this frame's transform jobs; call once the slot's fence was
+  // waited on
+  void update(JobSystem& jobs, uint32_t slot, float time,
+              const glm::mat4& viewProj);
+  // waits for update() and draws the visible props, inside the main pass
+  void draw(VkCommandBuffer cmd, JobSystem& jobs, uint32_t slot,
+            PipelineVariantCache& pipelines);
+
+  void printStats() const;
+
+  // the owner fills in renderPassKey like for any other pipeline
+  GraphicsPipelineDesc drawDesc;
+
+ private:
+  enum Mesh { MESH_CRATE, MESH_COLUMN, MESH_SPIRE, MESH_COUNT };
+  enum Material {
+    MATERIAL_STONE,
+    MATERIAL_WOOD,
+    MATERIAL_COPPER,
+    MATERIAL_PAINT,
+    MATERIAL_COUNT
+  };
+  // props turn at one of these rates, so the frame only needs a sin/cos
+  // per class rather than per prop
+  static const uint32_t kSpinClasses = 4;
+
+  struct Vertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+  };
+
+  // binding 1, one per visible prop. mirrors the inputs in props.vert.
+  struct Instance {
+    glm::vec4 mvp[4];  // columns
+    glm::vec4 rotation;  // cos and sin of the yaw for the normal, tint
+  };
+
+  struct MeshRange {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+    float radius;  // of a bounding sphere around the origin
+  };
+
+  // a run of props with the same mesh and material
+  struct Chunk {
+    uint32_t mesh;
+    uint32_t material;
+    uint32_t first;
+    uint32_t count;
+  };
+
+  // what every transform job needs from the frame
+  struct FrameConstants {
+    glm::mat4 viewProj;
+    // |xyz| of the left, right, bottom, top, near and far planes of
+    // viewProj, for comparing clip space distances with a radius
+    float planeScale[6];
+    float spinCos[kSpinClasses];
+    float spinSin[kSpinClasses];
+  };
+
+  void transformChunk(uint32_t chunk, uint32_t slot,
+                      const FrameConstants& frame);
+  void addPrism(std::vector<Vertex>& vertices, std::vector<uint16_t>& indices,
+                uint32_t sides, float bottomRadius, float topRadius,
+                float height, MeshRange& range);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+
+  MeshRange meshes[MESH_COUNT] = {};
+  glm::vec4 materialColors[MATERIAL_COUNT];
+  std::vector<Chunk> chunks;
+
+  // per prop, sorted by mesh and material; SoA so the job loops stream
+  std::vector<float> positionX, positionY, positionZ;
+  std::vector<float> scale;
+  std::vector<float> radius;  // mesh radius * scale
+  std::vector<float> yawCos, yawSin;
+  std::vector<float> tint;
+  std::vector<uint8_t> spinClass;
+
+  // visible props per chunk, per slot; written by the jobs
+  std::vector<uint32_t> visibleCounts;
+  FrameConstants frameConstants;
+  JobCounter transformed;
+  bool transforming = false;
+
+  VkBuffer meshBuffer = VK_NULL_HANDLE;  // vertices, then indices
+  VkDeviceMemory meshMemory = VK_NULL_HANDLE;
+  VkDeviceSize indexOffset = 0;
+  // per slot instances, persistently mapped
+  VkBuffer instanceBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory instanceMemory = VK_NULL_HANDLE;
+  uint8_t* instanceMapped = nullptr;
+  VkDeviceSize instanceStride = 0;
+
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+
+  uint64_t frames = 0;
+  std::atomic<uint64_t> transformNanoseconds{0};  // summed over all chunks
+  uint64_t drawCalls = 0;
+  uint64_t drawnProps = 0;
+};
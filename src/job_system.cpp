@@ -0,0 +1,117 @@
+#include "job_system.h"
+
+#include "profiler.h"
+
+#include <stdio.h>
+
+static const char* kWorkerNames[] = {
+    "worker 0",  "worker 1",  "worker 2",  "worker 3",  "worker 4",
+    "worker 5",  "worker 6",  "worker 7",  "worker 8",  "worker 9",
+    "worker 10", "worker 11", "worker 12", "worker 13", "worker 14",
+    "worker 15"};
+
+void JobSystem::start(uint32_t workerCount) {
+  if (workerCount == 0) {
+    uint32_t hw = std::thread::hardware_concurrency();
+    workerCount = hw > 1 ? hw - 1 : 1;
+  }
+  stopping = false;
+  for (uint32_t i = 0; i < workerCount; i++) {
+    workers.emplace_back(&JobSystem::workerLoop, this, i);
+  }
+}
+
+void JobSystem::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+void JobSystem::run(JobCounter* counter, std::function<void()> fn,
+                    const char* name) {
+  if (counter) {
+    counter->pending.fetch_add(1, std::memory_order_relaxed);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (queueCount == queue.size()) {
+      std::vector<Job> grown(queue.empty() ? 256 : queue.size() * 2);
+      for (size_t i = 0; i < queueCount; i++) {
+        grown[i] = std::move(queue[(queueHead + i) % queue.size()]);
+      }
+      queue.swap(grown);
+      queueHead = 0;
+    }
+    queue[(queueHead + queueCount++) % queue.size()] = {std::move(fn), counter,
+                                                        name};
+  }
+  workAvailable.notify_one();
+}
+
+void JobSystem::wait(JobCounter* counter) {
+  while (!counter->done()) {
+    if (tryRunOne()) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    jobFinished.wait(lock, [&] { return counter->done() || queueCount; });
+  }
+}
+
+bool JobSystem::pop(Job& job) {
+  if (!queueCount) {
+    return false;
+  }
+  job = std::move(queue[queueHead]);
+  queueHead = (queueHead + 1) % queue.size();
+  queueCount--;
+  return true;
+}
+
+bool JobSystem::tryRunOne() {
+  Job job;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pop(job)) {
+      return false;
+    }
+  }
+  execute(job);
+  return true;
+}
+
+void JobSystem::execute(Job& job) {
+  {
+    ProfileScope scope(job.name ? job.name : "job");
+    job.fn();
+  }
+  if (job.counter) {
+    job.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+  }
+  // take the lock so a waiter can't miss the wakeup between its check and wait
+  { std::lock_guard<std::mutex> lock(mutex); }
+  jobFinished.notify_all();
+}
+
+void JobSystem::workerLoop(uint32_t index) {
+  if (index < sizeof(kWorkerNames) / sizeof(kWorkerNames[0])) {
+    profilerSetThreadName(kWorkerNames[index]);
+  }
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      workAvailable.wait(lock, [&] { return stopping || queueCount; });
+      if (!pop(job)) {
+        return;
+      }
+    }
+    execute(job);
+  }
+}
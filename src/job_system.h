@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// counts outstanding jobs; a job group is done when pending drops to zero
+struct JobCounter {
+  std::atomic<int> pending{0};
+
+  bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+// fixed pool of worker threads pulling from one FIFO. wait() runs queued jobs
+// on the calling thread instead of sleeping so nested waits can't deadlock.
+// the FIFO is a ring that only ever grows, and a job's function is stored
+// inline when its captures fit in two pointers, so steady state frames
+// queue jobs without touching the heap.
+class JobSystem {
+ public:
+  // 0 picks hardware_concurrency - 1 (at least one worker)
+  void start(uint32_t workerCount = 0);
+  void stop();
+
+  void run(JobCounter* counter, std::function<void()> fn,
+           const char* name = nullptr);
+  void wait(JobCounter* counter);
+
+  uint32_t workerCount() const { return (uint32_t)workers.size(); }
+
+ private:
+  struct Job {
+    std::function<void()> fn;
+    JobCounter* counter;
+    const char* name;
+  };
+
+  bool pop(Job& job);  // with mutex held
+  bool tryRunOne();
+  void execute(Job& job);
+  void workerLoop(uint32_t index);
+
+  std::vector<std::thread> workers;
+  std::vector<Job> queue;  // ring of queueCount jobs from queueHead
+  size_t queueHead = 0;
+  size_t queueCount = 0;
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable jobFinished;
+  bool stopping = false;
+};
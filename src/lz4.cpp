@@ -0,0 +1,154 @@
+#include "lz4.h"
+
+#include <string.h>
+#include <vector>
+
+namespace {
+
+const size_t kMinMatch = 4;
+// the format's end of block rules: the last 5 bytes are always literals and
+// the last match starts at least 12 bytes before the end
+const size_t kLastLiterals = 5;
+const size_t kMatchFindLimit = 12;
+const size_t kMaxOffset = 65535;
+const uint32_t kHashBits = 14;
+
+uint32_t read32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+uint32_t hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+// 15 in the token, then 255s, then the remainder
+bool writeLength(uint8_t*& op, const uint8_t* end, size_t length) {
+  while (length >= 255) {
+    if (op >= end) return false;
+    *op++ = 255;
+    length -= 255;
+  }
+  if (op >= end) return false;
+  *op++ = (uint8_t)length;
+  return true;
+}
+
+bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+  uint8_t b;
+  do {
+    if (ip >= end) return false;
+    b = *ip++;
+    length += b;
+  } while (b == 255);
+  return true;
+}
+
+// literals [anchor, anchor + literals) then, if matchLength, the match
+bool writeSequence(uint8_t*& op, const uint8_t* end, const uint8_t* anchor,
+                   size_t literals, size_t offset, size_t matchLength) {
+  if (op >= end) return false;
+  uint8_t* token = op++;
+  *token = (uint8_t)((literals < 15 ? literals : 15) << 4);
+  if (literals >= 15 && !writeLength(op, end, literals - 15)) return false;
+  if ((size_t)(end - op) < literals) return false;
+  if (literals) memcpy(op, anchor, literals);
+  op += literals;
+  if (!matchLength) return true;
+
+  if (end - op < 2) return false;
+  *op++ = (uint8_t)offset;
+  *op++ = (uint8_t)(offset >> 8);
+  size_t length = matchLength - kMinMatch;
+  *token |= (uint8_t)(length < 15 ? length : 15);
+  if (length >= 15 && !writeLength(op, end, length - 15)) return false;
+  return true;
+}
+
+}  // namespace
+
+size_t lz4CompressBound(size_t size) { return size + size / 255 + 16; }
+
+size_t lz4Compress(const void* src, size_t size, void* dst, size_t capacity) {
+  const uint8_t* base = (const uint8_t*)src;
+  uint8_t* op = (uint8_t*)dst;
+  const uint8_t* end = op + capacity;
+  size_t anchor = 0;
+
+  if (size > kMatchFindLimit) {
+    // positions + 1, 0 is empty
+    std::vector<uint32_t> table(1u << kHashBits, 0);
+    size_t matchLimit = size - kLastLiterals;
+    size_t ip = 0;
+    while (ip + kMatchFindLimit <= size) {
+      uint32_t sequence = read32(base + ip);
+      uint32_t& slot = table[hash(sequence)];
+      size_t candidate = slot;
+      slot = (uint32_t)(ip + 1);
+      if (!candidate || ip - (candidate - 1) > kMaxOffset ||
+          read32(base + candidate - 1) != sequence) {
+        ip++;
+        continue;
+      }
+      size_t ref = candidate - 1;
+      size_t length = kMinMatch;
+      while (ip + length < matchLimit && base[ref + length] == base[ip + length])
+        length++;
+      // extending backwards into pending literals is cheap and helps a lot
+      // on repetitive data like SPIR-V
+      while (ip > anchor && ref > 0 && base[ip - 1] == base[ref - 1]) {
+        ip--;
+        ref--;
+        length++;
+      }
+      if (!writeSequence(op, end, base + anchor, ip - anchor, ip - ref, length))
+        return 0;
+      ip += length;
+      anchor = ip;
+    }
+  }
+
+  if (!writeSequence(op, end, base + anchor, size - anchor, 0, 0)) return 0;
+  return (size_t)(op - (uint8_t*)dst);
+}
+
+bool lz4Decompress(const void* src, size_t size, void* dst, size_t dstSize) {
+  const uint8_t* ip = (const uint8_t*)src;
+  const uint8_t* ipEnd = ip + size;
+  uint8_t* base = (uint8_t*)dst;
+  uint8_t* op = base;
+  uint8_t* opEnd = base + dstSize;
+
+  while (ip < ipEnd) {
+    uint8_t token = *ip++;
+    size_t literals = token >> 4;
+    if (literals == 15 && !readLength(ip, ipEnd, literals)) return false;
+    if ((size_t)(ipEnd - ip) < literals || (size_t)(opEnd - op) < literals)
+      return false;
+    if (literals) memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+    // the last sequence has no match
+    if (ip == ipEnd) break;
+
+    if (ipEnd - ip < 2) return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (!offset || offset > (size_t)(op - base)) return false;
+    size_t length = token & 15;
+    if (length == 15 && !readLength(ip, ipEnd, length)) return false;
+    length += kMinMatch;
+    if ((size_t)(opEnd - op) < length) return false;
+
+    const uint8_t* match = op - offset;
+    if (offset >= length) {
+      memcpy(op, match, length);
+      op += length;
+    } else {
+      // overlapping, the match repeats the bytes it's writing
+      for (size_t i = 0; i < length; i++) *op++ = *match++;
+    }
+  }
+  return op == opEnd;
+}
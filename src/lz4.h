@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+// written from the spec so the archive needs no third party code. Blocks
+// are interchangeable with the reference implementation's
+// LZ4_compress_default / LZ4_decompress_safe. The compressor is the simple
+// greedy single hash kind: a fraction of lz4 -9's ratio, but cooking isn't
+// on anyone's critical path, and decompression speed doesn't depend on it.
+
+// worst case compressed size of size bytes
+size_t lz4CompressBound(size_t size);
+// returns the compressed size, or 0 if it doesn't fit in capacity
+size_t lz4Compress(const void* src, size_t size, void* dst, size_t capacity);
+// dst must be exactly the decompressed size; false if src is malformed or
+// doesn't decompress to exactly that many bytes
+bool lz4Decompress(const void* src, size_t size, void* dst, size_t dstSize);
@@ -1,30 +1,50 @@
 
 
-#include <vulkan/vulkan.h>
+#include "vk_common.h"
 
 #include <GLFW/glfw3.h>
-#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <optional>
 #include <set>
+#include <thread>
 #include <vector>
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <array>
-#define _DEBUG
-#define VK_CHECK(call)        \
-  do {                        \
-    VkResult _r = call;       \
-    assert(_r == VK_SUCCESS); \
-  } while (0)
-
-void keyCallBack(GLFWwindow* win, int key, int scancode, int actions,
-                 int mods) {
-  if (key == GLFW_KEY_ESCAPE && actions == GLFW_PRESS) {
-    glfwSetWindowShouldClose(win, GLFW_TRUE);
-  }
-}
 
+#include "alloc_counter.h"
+#include "asset_archive.h"
+#include "clustered_lighting.h"
+#include "command_capture.h"
+#include "debug_draw.h"
+#include "deletion_queue.h"
+#include "file_io.h"
+#include "frame_arena.h"
+#include "frame_readback.h"
+#include "gpu_timer.h"
+#include "instanced_props.h"
+#include "meshlet_renderer.h"
+#include "job_system.h"
+#include "memory_budget.h"
+#include "particles.h"
+#include "pipeline_cache.h"
+#include "post_process.h"
+#include "profiler.h"
+#include "residency_manager.h"
+#include "shadow_maps.h"
+#include "simulation.h"
+#include "skinned_meshes.h"
+#include "terrain_renderer.h"
+#include "transient_attachments.h"
+#include "virtual_texture.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+#define _DEBUG
 
 struct Vertex {
     glm::vec2 pos;
@@ -94,7 +114,11 @@ struct PhysicalDeviceInfo {
 
 
 GLFWwindow* win;
-bool is_resized = false;
+// glfw window queries are main-thread only; cached here for swapchain workers
+int framebufferWidth = 0, framebufferHeight = 0;
+// set by the resize callback on the main thread, read by the render thread
+std::atomic<bool> is_resized{false};
+std::atomic<int> reportedWidth{0}, reportedHeight{0};
 VkInstance instance = 0;
 
 VkSwapchainKHR swapChain;
@@ -110,18 +134,124 @@ VkFormat swapChainImageFormat;
 VkExtent2D swapChainExtent;
 VkRenderPass renderPass;
 VkPipelineLayout pipelineLayout;
-VkPipeline graphicsPipeline;
 VkCommandPool commandPool;
 std::vector<VkCommandBuffer> commandBuffers;
 
 size_t currentFrame = 0;
 const int MAX_FRAMES_IN_FLIGHT = 2;
+// per frame in flight; grows if a frame ever needs more
+const size_t FRAME_ARENA_BYTES = 4 * 1024 * 1024;
 std::vector<VkSemaphore> imageAvailableSemaphores;
 std::vector<VkSemaphore> renderFinshedSemaphores;
 
 std::vector<VkFence> inFlightFences; 
 std::vector<VkFence> imagesInFlight;
 
+// monotonic count of submitted frames; inFlightFrameNumbers[i] is the frame
+// last submitted with inFlightFences[i], so once that fence signals every
+// object retired at or before it can go
+uint64_t frameNumber = 0;
+uint64_t inFlightFrameNumbers[MAX_FRAMES_IN_FLIGHT] = {};
+DeletionQueue deletionQueue;
+
+// --export: every presented frame is copied back and written to disk
+bool exportFrames = false;
+FrameReadback frameReadback;
+
+// --particles: gpu particle fountain, 0 = off
+uint32_t particleCount = 0;
+ParticleSystem particles;
+
+// --post: the scene renders to an hdr target that the compute post chain
+// tonemaps and blits into the swapchain image
+bool postEnabled = false;
+PostProcess post;
+
+GpuTimer gpuTimer;
+
+// --lights: clustered forward lit ground plane with this many lights
+uint32_t lightCount = 0;
+ClusteredLighting lighting;
+// --validate-clusters: compare the GPU light lists with the CPU reference
+bool validateClusters = false;
+bool clusterValidationFailed = false;
+// --shadows: cascaded sun shadows over a field of box casters
+bool shadowsEnabled = false;
+ShadowMaps shadows;
+// --skinned: a crowd of this many compute skinned characters
+uint32_t skinnedCount = 0;
+SkinnedMeshes skinned;
+std::vector<ShadowMaps::WorldCaster> skinnedCasters;
+// --props: this many instanced static props
+uint32_t propCount = 0;
+InstancedProps props;
+// --meshlets: this many dense meshes drawn as GPU culled clusters
+uint32_t meshletCount = 0;
+MeshletRenderer meshlets;
+// --virtual-texture: a ground plane virtually textured from this tile file
+const char* virtualTexturePath = nullptr;
+VirtualTexture virtualTexture;
+// --terrain: side of a streamed CDLOD heightfield terrain, in world units
+float terrainSize = 0.0f;
+TerrainRenderer terrain;
+// game state ticks at a fixed rate on its own thread; every frame samples it
+Simulation simulation;
+uint32_t simTickRate = 60;
+float sceneTime = 0.0f;
+
+// --debug-draw: immediate mode lines over the scene
+bool debugDrawEnabled = false;
+DebugDraw debugDraw;
+
+// VK_EXT_memory_budget is enabled when the device has it
+bool memoryBudgetExtension = false;
+// --memory-budget: cap on device local memory in MB, 0 = what the driver says
+uint64_t memoryBudgetMB = 0;
+ResidencyManager residency;
+
+float frameDt = 0.0f;
+double lastFrameTime = 0.0;
+
+// camera for the 3d subsystems, taken from the simulation every frame; the
+// quad is still drawn in clip space
+glm::vec3 cameraPosition = glm::vec3(0.0f, 2.0f, 6.0f);
+glm::vec3 cameraTarget = glm::vec3(0.0f, 1.5f, 0.0f);
+const float cameraNear = 0.1f;
+const float cameraFar = 100.0f;
+
+glm::mat4 cameraView() {
+  return glm::lookAt(cameraPosition, cameraTarget, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+// vulkan clip space: depth 0..1 and y down
+glm::mat4 cameraProjection() {
+  float aspect = (float)swapChainExtent.width / (float)swapChainExtent.height;
+  glm::mat4 proj =
+      glm::perspectiveRH_ZO(glm::radians(60.0f), aspect, cameraNear, cameraFar);
+  proj[1][1] *= -1.0f;
+  return proj;
+}
+
+// pass indices used to compute transient attachment lifetimes, in the order
+// the frame records them. a target only aliases targets of other passes, so
+// each pass that keeps its own targets gets its own index.
+enum FramePass { PASS_MAIN = 0, PASS_DEPTH_PYRAMID, PASS_POST };
+
+TransientAttachmentPool transientAttachments;
+uint32_t depthAttachment;
+uint32_t hdrAttachment;
+VkFormat depthFormat;
+
+JobSystem jobs;
+std::vector<char> vertShaderCode;
+std::vector<char> fragShaderCode;
+
+PipelineVariantCache pipelineVariants;
+ShaderRef vertShader;
+ShaderRef fragShader;
+uint64_t renderPassKey;
+GraphicsPipelineDesc mainPipelineDesc;
+
 bool checkValidationLayerSupport() {
   uint32_t layerCount;
 
@@ -181,8 +311,7 @@ VkResult CreateDebugUtilsMessengerEXT(
     VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo,
     const VkAllocationCallbacks* pAllocator,
     VkDebugUtilsMessengerEXT* pDebugMessenger) {
-  auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(
-      instance, "vkCreateDebugUtilsMessengerEXT");
+  auto func = vki.vkCreateDebugUtilsMessengerEXT;
   if (func != nullptr) {
     return func(instance, pCreateInfo, pAllocator, pDebugMessenger);
   } else {
@@ -193,8 +322,7 @@ VkResult CreateDebugUtilsMessengerEXT(
 void DestroyDebugUtilsMessengerEXT(VkInstance instance,
                                    VkDebugUtilsMessengerEXT debugMessenger,
                                    const VkAllocationCallbacks* pAllocator) {
-  auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(
-      instance, "vkDestroyDebugUtilsMessengerEXT");
+  auto func = vki.vkDestroyDebugUtilsMessengerEXT;
   if (func != nullptr) {
     func(instance, debugMessenger, pAllocator);
   }
@@ -223,6 +351,7 @@ void initInstance(VkInstance& instance,
   createInfo.enabledExtensionCount = extensions.size();
 
   VK_CHECK(vkCreateInstance(&createInfo, 0, &instance));
+  loadInstanceDispatch(vki, instance);
 
 #ifdef _DEBUG
   VK_CHECK(CreateDebugUtilsMessengerEXT(instance, &debugCreateInfo, 0,
@@ -232,30 +361,32 @@ void initInstance(VkInstance& instance,
 
 bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
   uint32_t extensionCount;
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+  vki.vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                        nullptr);
-  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+  FrameVector<VkExtensionProperties> availableExtensions(extensionCount);
+  vki.vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                        availableExtensions.data());
 
-  std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                           deviceExtensions.end());
-
-  for (const auto& extension : availableExtensions) {
-    // printf("deviceExtenionName: %s\n ", extension.extensionName);
-    requiredExtensions.erase(extension.extensionName);
+  for (const char* required : deviceExtensions) {
+    bool found = false;
+    for (const auto& extension : availableExtensions) {
+      if (strcmp(extension.extensionName, required) == 0) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) return false;
   }
-
-  return requiredExtensions.empty();
+  return true;
 }
 
 QueueFamilyIndices getPhysicalDeviceQueueFamilies(VkPhysicalDevice device,
                                                   VkSurfaceKHR surface) {
   uint32_t queueFamilyCount = 0;
   QueueFamilyIndices indices;
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, 0);
-  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
+  vki.vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, 0);
+  FrameVector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vki.vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
                                            queueFamilies.data());
   uint32_t i = 0;
   for (const auto& queueFamily : queueFamilies) {
@@ -265,7 +396,7 @@ QueueFamilyIndices getPhysicalDeviceQueueFamilies(VkPhysicalDevice device,
         queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
       indices.graphicsFamilyIndex = i;
     }
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+    vki.vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
                                          &presentIsSUpported);
     if (queueFamily.queueCount > 0 && presentIsSUpported) {
       indices.presentFamilyIndex = i;
@@ -282,37 +413,40 @@ QueueFamilyIndices getPhysicalDeviceQueueFamilies(VkPhysicalDevice device,
 
 struct SwapChainSupportDetails {
   VkSurfaceCapabilitiesKHR capabilities;
-  std::vector<VkSurfaceFormatKHR> formats;
-  std::vector<VkPresentModeKHR> presentModes;
+  // scratch, only looked at while picking the swapchain settings
+  FrameVector<VkSurfaceFormatKHR> formats;
+  FrameVector<VkPresentModeKHR> presentModes;
 };
 
 SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device,
                                               VkSurfaceKHR surface) {
   SwapChainSupportDetails details;
-  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
+  vki.vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
                                             &details.capabilities);
 
   uint32_t formatCount;
-  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+  vki.vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
+                                           nullptr);
   assert(formatCount);
 
   details.formats.resize(formatCount);
-  vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
+  vki.vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
                                        details.formats.data());
 
   uint32_t presentModeCount;
-  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount,
-                                            nullptr);
+  vki.vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
+                                                &presentModeCount, nullptr);
   assert(presentModeCount);
   details.presentModes.resize(presentModeCount);
-  vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount,
-                                            details.presentModes.data());
+  vki.vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
+                                                &presentModeCount,
+                                                details.presentModes.data());
 
   return details;
 }
 
 VkSurfaceFormatKHR chooseSwapSurfaceFormat(
-    const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+    const FrameVector<VkSurfaceFormatKHR>& availableFormats) {
   for (const auto& availableFormat : availableFormats) {
     if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM &&
         availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
@@ -323,7 +457,7 @@ VkSurfaceFormatKHR chooseSwapSurfaceFormat(
 }
 
 VkPresentModeKHR chooseSwapPresentMode(
-    const std::vector<VkPresentModeKHR>& availablePresentModes) {
+    const FrameVector<VkPresentModeKHR>& availablePresentModes) {
   for (const auto& availablePresentMode : availablePresentModes) {
     if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
       return availablePresentMode;
@@ -336,9 +470,7 @@ VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
   if (capabilities.currentExtent.width != UINT32_MAX)
     return capabilities.currentExtent;
   else {
-      int w, h;
-      glfwGetFramebufferSize(win, &w, &h);
-      return { (uint32_t)w,(uint32_t)h };
+      return { (uint32_t)framebufferWidth,(uint32_t)framebufferHeight };
 
   }
   assert(0);
@@ -347,17 +479,24 @@ VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
 PhysicalDeviceInfo pickPhysicalDevice(VkInstance& instance,
                                       VkSurfaceKHR surface) {
   uint32_t deviceCount = 0;
-  vkEnumeratePhysicalDevices(instance, &deviceCount, 0);
+  vki.vkEnumeratePhysicalDevices(instance, &deviceCount, 0);
   assert(deviceCount);
   std::vector<VkPhysicalDevice> devices(deviceCount);
-  vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+  vki.vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
   int i = 0;
   PhysicalDeviceInfo chosen;
   for (const auto& device : devices) {
     VkPhysicalDeviceProperties deviceprop;
-    vkGetPhysicalDeviceProperties(device, &deviceprop);
-    printf("GPU[%d]:%s Vram: %dmb\n", i, deviceprop.deviceName,
-           deviceprop.limits.maxMemoryAllocationCount);
+    vki.vkGetPhysicalDeviceProperties(device, &deviceprop);
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vki.vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
+    VkDeviceSize vram = 0;
+    for (uint32_t h = 0; h < memProperties.memoryHeapCount; h++) {
+      if (memProperties.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        vram += memProperties.memoryHeaps[h].size;
+    }
+    printf("GPU[%d]:%s Vram: %llumb\n", i, deviceprop.deviceName,
+           (unsigned long long)(vram >> 20));
     QueueFamilyIndices queueIndices =
         getPhysicalDeviceQueueFamilies(device, surface);
     bool isDeviceextAvailable = checkDeviceExtensionSupport(device);
@@ -373,11 +512,24 @@ PhysicalDeviceInfo pickPhysicalDevice(VkInstance& instance,
   }
 
   VkPhysicalDeviceProperties deviceprop;
-  vkGetPhysicalDeviceProperties(chosen.phyDevice, &deviceprop);
+  vki.vkGetPhysicalDeviceProperties(chosen.phyDevice, &deviceprop);
   printf("chosen device: %s\n", deviceprop.deviceName);
   return chosen;
 }
 
+bool hasDeviceExtension(VkPhysicalDevice device, const char* name) {
+  uint32_t extensionCount;
+  vki.vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       nullptr);
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vki.vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       availableExtensions.data());
+  for (const auto& extension : availableExtensions) {
+    if (strcmp(extension.extensionName, name) == 0) return true;
+  }
+  return false;
+}
+
 void createLogicalDeviceAndQueueFamilies(VkInstance instance,
                                          PhysicalDeviceInfo& phydeviceInfo,
                                          VkDevice& device) {
@@ -406,7 +558,9 @@ void createLogicalDeviceAndQueueFamilies(VkInstance instance,
   deviceInfo.enabledExtensionCount =
       static_cast<uint32_t>(deviceExtensions.size());
   deviceInfo.ppEnabledExtensionNames = deviceExtensions.data();
-  VK_CHECK(vkCreateDevice(phydeviceInfo.phyDevice, &deviceInfo, 0, &device));
+  VK_CHECK(vki.vkCreateDevice(phydeviceInfo.phyDevice, &deviceInfo, 0,
+                              &device));
+  loadDeviceDispatch(vkd, vki, device);
 }
 
 void createSurface(const VkInstance& instance, GLFWwindow* window,
@@ -431,12 +585,13 @@ void createImageViews() {
     createInfo.subresourceRange.levelCount = 1;
     createInfo.subresourceRange.baseArrayLayer = 0;
     createInfo.subresourceRange.layerCount = 1;
-    VK_CHECK(vkCreateImageView(logicalDevice, &createInfo, nullptr,
+    VK_CHECK(vkd.vkCreateImageView(logicalDevice, &createInfo, nullptr,
                                &swapChainImageViews[i]));
   }
 }
 
-void createSwapChain(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface) {
+void createSwapChain(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface,
+                     VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE) {
   SwapChainSupportDetails swapChainSupport =
       querySwapChainSupport(physicalDevice, surface);
   VkSurfaceFormatKHR surfaceFormat =
@@ -460,6 +615,19 @@ void createSwapChain(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface) {
   createInfo.imageExtent = extent;
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  // support was checked before the render pass was built
+  if (postEnabled) {
+    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  }
+  if (exportFrames) {
+    if (swapChainSupport.capabilities.supportedUsageFlags &
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT) {
+      createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    } else {
+      printf("frame export: surface doesn't support transfer src, disabled\n");
+      exportFrames = false;
+    }
+  }
   QueueFamilyIndices indices =
       getPhysicalDeviceQueueFamilies(physicalDevice, surface);
 
@@ -479,215 +647,189 @@ void createSwapChain(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface) {
   createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   createInfo.presentMode = presentMode;
   createInfo.clipped = VK_TRUE;
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  createInfo.oldSwapchain = oldSwapchain;
   VK_CHECK(
-      vkCreateSwapchainKHR(logicalDevice, &createInfo, nullptr, &swapChain));
+      vkd.vkCreateSwapchainKHR(logicalDevice, &createInfo, nullptr,
+                               &swapChain));
 
   VK_CHECK(
-      vkGetSwapchainImagesKHR(logicalDevice, swapChain, &imageCount, nullptr));
+      vkd.vkGetSwapchainImagesKHR(logicalDevice, swapChain, &imageCount,
+                                  nullptr));
   assert(imageCount);
   swapChainImages.resize(imageCount);
-  VK_CHECK(vkGetSwapchainImagesKHR(logicalDevice, swapChain, &imageCount,
+  VK_CHECK(vkd.vkGetSwapchainImagesKHR(logicalDevice, swapChain, &imageCount,
                                    swapChainImages.data()));
 
   swapChainExtent = extent;
   swapChainImageFormat = surfaceFormat.format;
 }
 
-static std::vector<char> readFile(const std::string& filename) {
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
+VkFormat findDepthFormat(VkPhysicalDevice physicalDevice) {
+  const VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT,
+                                 VK_FORMAT_D32_SFLOAT_S8_UINT,
+                                 VK_FORMAT_D24_UNORM_S8_UINT};
+  // the meshlets' depth pyramid is reduced from the depth buffer
+  VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  if (meshletCount) needed |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+  for (VkFormat format : candidates) {
+    VkFormatProperties props;
+    vki.vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+    if ((props.optimalTilingFeatures & needed) == needed) {
+      return format;
+    }
+  }
+  assert(0);
+  return VK_FORMAT_UNDEFINED;
+}
 
-  if (!file.is_open()) {
-    printf("failed to open file:%s \n", filename.c_str());
-    assert(0);
+// the hdr target is rendered to, written by compute and blitted from; the
+// swapchain has to accept blits. all of it is checked before the render pass
+// is built since post changes its color format.
+bool checkPostSupport() {
+  VkFormatProperties hdrProps, swapProps;
+  vki.vkGetPhysicalDeviceFormatProperties(
+      deviceInfo.phyDevice, PostProcess::kHdrFormat, &hdrProps);
+  vki.vkGetPhysicalDeviceFormatProperties(deviceInfo.phyDevice,
+                                          swapChainImageFormat, &swapProps);
+  const VkFormatFeatureFlags hdrNeeded =
+      VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT |
+      VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+      VK_FORMAT_FEATURE_BLIT_SRC_BIT;
+  if ((hdrProps.optimalTilingFeatures & hdrNeeded) != hdrNeeded ||
+      !(swapProps.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+    printf("post: hdr or swapchain format lacks the needed features, disabled\n");
+    return false;
   }
-  size_t fsize = file.tellg();
-  std::vector<char> buffer(fsize);
-  file.seekg(0);
-  file.read(buffer.data(), fsize);
-  file.close();
-  return buffer;
+  SwapChainSupportDetails support =
+      querySwapChainSupport(deviceInfo.phyDevice, surface);
+  if (!(support.capabilities.supportedUsageFlags &
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+    printf("post: surface doesn't support transfer dst, disabled\n");
+    return false;
+  }
+  return true;
 }
 
-VkShaderModule createShaderModule(const std::vector<char>& code) {
-  VkShaderModuleCreateInfo createInfo = {
-      VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
-  createInfo.codeSize = code.size();
-  createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-  VkShaderModule shaderModule;
-  VK_CHECK(
-      vkCreateShaderModule(logicalDevice, &createInfo, nullptr, &shaderModule));
-  return shaderModule;
+// formats and lifetimes are known before the swapchain exists, so the render
+// pass can be built while the swapchain is still being created
+void registerTransientAttachments() {
+  depthFormat = findDepthFormat(deviceInfo.phyDevice);
+
+  TransientAttachmentDesc depth = {};
+  depth.name = "depth";
+  depth.format = depthFormat;
+  depth.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  depth.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+  depth.firstPass = PASS_MAIN;
+  depth.lastPass = PASS_MAIN;
+  // kept past the main pass for the meshlets' depth pyramid
+  if (meshletCount) {
+    depth.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+    depth.lastPass = PASS_DEPTH_PYRAMID;
+  }
+  depthAttachment = addTransientAttachment(transientAttachments, depth);
+
+  if (postEnabled) {
+    TransientAttachmentDesc hdr = {};
+    hdr.name = "hdr color";
+    hdr.format = PostProcess::kHdrFormat;
+    hdr.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    hdr.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    hdr.firstPass = PASS_MAIN;
+    hdr.lastPass = PASS_POST + PostProcess::kFramePasses - 1;
+    hdrAttachment = addTransientAttachment(transientAttachments, hdr);
+    post.registerTargets(transientAttachments, PASS_POST);
+  }
+}
+
+void createTransientAttachments() {
+  for (TransientAttachment& a : transientAttachments.attachments) {
+    a.desc.extent = swapChainExtent;
+  }
+  if (postEnabled) {
+    post.sizeTargets(transientAttachments, swapChainExtent);
+  }
+  allocateTransientAttachments(transientAttachments, deviceInfo.phyDevice,
+                               logicalDevice);
+  printTransientAttachmentStats(transientAttachments);
 }
 
+// the pipeline layout and shaders live for the whole run; variants of the
+// pipeline itself come from pipelineVariants and survive render pass
+// recreation as long as the attachment formats don't change
 void createGraphicsPipeline() {
-  auto vertShaderCode = readFile("shaders/vert.spv");
-  auto fragShaderCode = readFile("shaders/frag.spv");
-
-  VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-  VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo = {
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
-  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertShaderStageInfo.module = vertShaderModule;
-  vertShaderStageInfo.pName = "main";
-
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo = {
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
-  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragShaderStageInfo.module = fragShaderModule;
-  fragShaderStageInfo.pName = "main";
-
-  VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
-                                                    fragShaderStageInfo};
-
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {
-      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
-
-
-  auto bindingDescription = Vertex::getbindingDescription();
-  auto attributeDescriptions = Vertex::getAttributeDescriptions();
-
-  vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-  vertexInputInfo.vertexBindingDescriptionCount = 1;
-  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-  vertexInputInfo.pVertexBindingDescriptions =&bindingDescription;
-
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly = {
-      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-  VkViewport viewport = {};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = swapChainExtent.width;
-  viewport.height = swapChainExtent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  VkRect2D scissor = {};
-  scissor.offset = {0, 0};
-  scissor.extent = swapChainExtent;
-
-  VkPipelineViewportStateCreateInfo viewportState = {
-      VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
-  viewportState.pScissors = &scissor;
-  viewportState.pViewports = &viewport;
-  viewportState.viewportCount = 1;
-  viewportState.scissorCount = 1;
-
-  VkPipelineRasterizationStateCreateInfo rasterizer = {
-      VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
-  rasterizer.depthClampEnable = VK_FALSE;
-  rasterizer.rasterizerDiscardEnable = VK_FALSE;
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterizer.lineWidth = 1.0f;
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-  rasterizer.depthBiasEnable = VK_FALSE;
-  rasterizer.depthBiasConstantFactor = 0.0f;
-  rasterizer.depthBiasClamp = 0.0f;
-  rasterizer.depthBiasSlopeFactor = 0.0;
-
-  VkPipelineMultisampleStateCreateInfo multisampling = {};
-  multisampling.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-  multisampling.minSampleShading = 1.0f;
-  multisampling.pSampleMask = nullptr;
-  multisampling.alphaToCoverageEnable = VK_FALSE;
-  multisampling.alphaToOneEnable = VK_FALSE;
-
-  VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-  colorBlendAttachment.colorWriteMask =
-      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  colorBlendAttachment.blendEnable = VK_FALSE;
-  colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-  colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-  colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-  colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-  colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-  colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-
-  VkPipelineColorBlendStateCreateInfo colorBlending = {
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
-  colorBlending.logicOpEnable = VK_FALSE;
-  colorBlending.logicOp = VK_LOGIC_OP_COPY;
-  colorBlending.attachmentCount = 1;
-  colorBlending.pAttachments = &colorBlendAttachment;
-  colorBlending.blendConstants[0] = 0.0f;
-  colorBlending.blendConstants[1] = 0.0f;
-  colorBlending.blendConstants[2] = 0.0f;
-  colorBlending.blendConstants[3] = 0.0f;
-
-  VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT,
-                                    VK_DYNAMIC_STATE_LINE_WIDTH};
-
-  VkPipelineDynamicStateCreateInfo dynamicState = {};
-  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamicState.dynamicStateCount = 2;
-  dynamicState.pDynamicStates = dynamicStates;
-
-  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 0;
-  pipelineLayoutInfo.pSetLayouts = nullptr;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;
-  pipelineLayoutInfo.pPushConstantRanges = nullptr;
-
-  VK_CHECK(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr,
-                                  &pipelineLayout));
-
-  VkGraphicsPipelineCreateInfo pipelineInfo = {
-      VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
-  pipelineInfo.stageCount = 2;
-  pipelineInfo.pStages = shaderStages;
-  pipelineInfo.pVertexInputState = &vertexInputInfo;
-  pipelineInfo.pInputAssemblyState = &inputAssembly;
-  pipelineInfo.pViewportState = &viewportState;
-  pipelineInfo.pRasterizationState = &rasterizer;
-  pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pDepthStencilState = nullptr;
-  pipelineInfo.pDynamicState = nullptr;
-  pipelineInfo.pColorBlendState = &colorBlending;
-
-  pipelineInfo.layout = pipelineLayout;
-  pipelineInfo.renderPass = renderPass;
-  pipelineInfo.subpass = 0;
-  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-  pipelineInfo.basePipelineIndex = -1;
-
-  VK_CHECK(vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1,
-                                     &pipelineInfo, nullptr,
-                                     &graphicsPipeline));
-
-  vkDestroyShaderModule(logicalDevice, vertShaderModule, nullptr);
-  vkDestroyShaderModule(logicalDevice, fragShaderModule, nullptr);
+  if (!vertShader.module) {
+    vertShader = createShaderRef(logicalDevice, vertShaderCode);
+    fragShader = createShaderRef(logicalDevice, fragShaderCode);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 0;
+    pipelineLayoutInfo.pSetLayouts = nullptr;
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pPushConstantRanges = nullptr;
+
+    VK_CHECK(vkd.vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo,
+                                        nullptr, &pipelineLayout));
+  }
+
+  mainPipelineDesc = GraphicsPipelineDesc();
+  mainPipelineDesc.vertexShader = vertShader;
+  mainPipelineDesc.fragmentShader = fragShader;
+  mainPipelineDesc.setVertexLayout<Vertex>();
+  mainPipelineDesc.cullMode = VK_CULL_MODE_BACK_BIT;
+  mainPipelineDesc.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  mainPipelineDesc.depthTestEnable = VK_TRUE;
+  mainPipelineDesc.depthWriteEnable = VK_TRUE;
+  mainPipelineDesc.depthCompareOp = VK_COMPARE_OP_LESS;
+  mainPipelineDesc.layout = pipelineLayout;
+  mainPipelineDesc.renderPassKey = renderPassKey;
+
+  // the default variant is needed for the first frame, build it now
+  pipelineVariants.getBlocking(mainPipelineDesc);
 }
 
 void createRenderPass() {
   VkAttachmentDescription colorAttachment = {};
-  colorAttachment.format = swapChainImageFormat;
+  colorAttachment.format =
+      postEnabled ? PostProcess::kHdrFormat : swapChainImageFormat;
   colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
   colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
   colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
   colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  colorAttachment.finalLayout = postEnabled ? VK_IMAGE_LAYOUT_GENERAL
+                                            : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  // depth is only written back when the meshlets read it after the pass
+  const TransientAttachment& depth =
+      transientAttachments.attachments[depthAttachment];
+  VkAttachmentDescription depthAttachmentDesc = {};
+  depthAttachmentDesc.format = depthFormat;
+  depthAttachmentDesc.samples = VK_SAMPLE_COUNT_1_BIT;
+  depthAttachmentDesc.loadOp = transientLoadOp(depth, PASS_MAIN, true);
+  depthAttachmentDesc.storeOp = transientStoreOp(depth, PASS_MAIN);
+  depthAttachmentDesc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachmentDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachmentDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  depthAttachmentDesc.finalLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
   VkAttachmentReference colorAttachmentRef = {};
   colorAttachmentRef.attachment = 0;
   colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+  VkAttachmentReference depthAttachmentRef = {};
+  depthAttachmentRef.attachment = 1;
+  depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
   VkSubpassDescription subpass = {};
   subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
   subpass.colorAttachmentCount = 1;
   subpass.pColorAttachments = &colorAttachmentRef;
+  subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
 
 
@@ -695,39 +837,72 @@ void createRenderPass() {
   VkSubpassDependency dependency = {};
   dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
   dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
-
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  // the hdr target is shared by every frame in flight: the previous frame's
+  // post passes must be done reading it before this one clears it. depth
+  // shares memory with the post targets they wrote.
+  if (postEnabled) {
+    dependency.srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                               VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependency.srcAccessMask |= VK_ACCESS_SHADER_WRITE_BIT;
+  }
+  // and so is depth, which the previous frame's pyramid pass reads
+  if (meshletCount) {
+    dependency.srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  }
 
+  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+  // scene writes visible to the post compute passes
+  VkSubpassDependency postDependency = {};
+  postDependency.srcSubpass = 0;
+  postDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+  postDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  postDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  postDependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  postDependency.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  VkSubpassDependency dependencies[] = {dependency, postDependency};
+
+  VkAttachmentDescription attachments[] = {colorAttachment,
+                                           depthAttachmentDesc};
 
   VkRenderPassCreateInfo renderPassInfo = {
       VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
-  renderPassInfo.attachmentCount = 1;
-  renderPassInfo.pAttachments = &colorAttachment;
+  renderPassInfo.attachmentCount = 2;
+  renderPassInfo.pAttachments = attachments;
   renderPassInfo.pSubpasses = &subpass;
   renderPassInfo.subpassCount = 1;
-  renderPassInfo.dependencyCount = 1;
-  renderPassInfo.pDependencies = &dependency;
+  renderPassInfo.dependencyCount = postEnabled ? 2 : 1;
+  renderPassInfo.pDependencies = dependencies;
   VK_CHECK(
-      vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, &renderPass));
+      vkd.vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr,
+                             &renderPass));
+  renderPassKey = pipelineVariants.registerRenderPass(renderPassInfo);
 }
 
 void createFramebuffers() {
   swapChainFramebuffers.resize(swapChainImageViews.size());
   for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-    VkImageView attachments[] = {swapChainImageViews[i]};
+    VkImageView attachments[] = {
+        postEnabled ? transientAttachments.attachments[hdrAttachment].view
+                    : swapChainImageViews[i],
+        transientAttachments.attachments[depthAttachment].view};
     VkFramebufferCreateInfo framebufferInfo = {
         VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
     framebufferInfo.renderPass = renderPass;
-    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.attachmentCount = 2;
     framebufferInfo.pAttachments = attachments;
     framebufferInfo.width = swapChainExtent.width;
     framebufferInfo.height = swapChainExtent.height;
     framebufferInfo.layers = 1;
 
-    VK_CHECK(vkCreateFramebuffer(logicalDevice, &framebufferInfo, nullptr,
+    VK_CHECK(vkd.vkCreateFramebuffer(logicalDevice, &framebufferInfo, nullptr,
                                  &swapChainFramebuffers[i]));
   }
 }
@@ -738,58 +913,222 @@ void createCommandPool() {
 
   VkCommandPoolCreateInfo poolInfo = {
       VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
   poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamilyIndex.value();
 
   VK_CHECK(
-      vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &commandPool));
+      vkd.vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &commandPool));
 }
 
+// one command buffer per frame in flight, re-recorded every frame so draws can
+// pick up pipeline variants as they finish compiling
 void createCommandBuffers() {
-  commandBuffers.resize(swapChainFramebuffers.size());
+  commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
   VkCommandBufferAllocateInfo allocInfo = {
       VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
   allocInfo.commandPool = commandPool;
   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
   allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
-  VK_CHECK(vkAllocateCommandBuffers(logicalDevice, &allocInfo,
+  VK_CHECK(vkd.vkAllocateCommandBuffers(logicalDevice, &allocInfo,
                                     commandBuffers.data()));
+}
+
+// ground grid, axes, a probe camera's frustum and, spread over the job
+// workers, a marker per light
+void drawDebugScene() {
+  const uint32_t gridColor = DebugDraw::color(80, 80, 80);
+  for (int i = -10; i <= 10; i++) {
+    debugDraw.line(glm::vec3((float)i, 0.0f, -10.0f),
+                   glm::vec3((float)i, 0.0f, 10.0f), gridColor);
+    debugDraw.line(glm::vec3(-10.0f, 0.0f, (float)i),
+                   glm::vec3(10.0f, 0.0f, (float)i), gridColor);
+  }
+  debugDraw.axes(glm::mat4(1.0f), 1.0f);
+
+  glm::vec3 probe(cosf(sceneTime * 0.3f) * 4.0f, 2.0f,
+                  sinf(sceneTime * 0.3f) * 4.0f - 4.0f);
+  glm::mat4 probeView =
+      glm::lookAt(probe, glm::vec3(0.0f, 0.5f, -4.0f), glm::vec3(0, 1, 0));
+  glm::mat4 probeProj =
+      glm::perspectiveRH_ZO(glm::radians(40.0f), 1.5f, 0.5f, 4.0f);
+  debugDraw.frustum(glm::inverse(probeProj * probeView),
+                    DebugDraw::color(255, 200, 0));
+
+  if (particleCount) {
+    debugDraw.box(glm::vec3(-0.5f, 0.0f, -0.5f), glm::vec3(0.5f, 0.2f, 0.5f),
+                  DebugDraw::color(0, 200, 255));
+  }
+
+  if (lightCount) {
+    const std::vector<ClusteredLighting::Light>& lights = lighting.lightList();
+    const uint32_t kChunk = 256;
+    JobCounter markersDone;
+    for (uint32_t first = 0; first < lights.size(); first += kChunk) {
+      jobs.run(&markersDone, [&lights, first, kChunk] {
+        uint32_t last = std::min(first + kChunk, (uint32_t)lights.size());
+        for (uint32_t i = first; i < last; i++) {
+          glm::vec4 c = lights[i].color / 2.0f * 255.0f;
+          debugDraw.cross(glm::vec3(lights[i].positionRadius), 0.1f,
+                          DebugDraw::color((uint32_t)c.r, (uint32_t)c.g,
+                                           (uint32_t)c.b));
+        }
+      }, "debug light markers");
+    }
+    jobs.wait(&markersDone);
+  }
+}
 
-  for (size_t i = 0; i < commandBuffers.size(); i++) {
+void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
     VkCommandBufferBeginInfo beginInfo = {
         VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     beginInfo.pInheritanceInfo = nullptr;
 	
-    VK_CHECK(vkBeginCommandBuffer(commandBuffers[i], &beginInfo));
+    VK_CHECK(vkd.vkBeginCommandBuffer(commandBuffer, &beginInfo));
+    captureFrameBegin(commandBuffer, frameNumber + 1);
+    // this slot's fence was just waited on, its timestamps are ready
+    gpuTimer.beginFrame(commandBuffer, (uint32_t)currentFrame);
+
+    if (particleCount) {
+      uint32_t zone = gpuTimer.begin(commandBuffer, "particles");
+      particles.update(commandBuffer, frameDt, cameraView(),
+                       cameraProjection(), cameraPosition);
+      gpuTimer.end(commandBuffer, zone);
+    }
+    if (lightCount) {
+      lighting.update(commandBuffer, (uint32_t)currentFrame, sceneTime,
+                      cameraView(), cameraProjection(), cameraNear, cameraFar,
+                      swapChainExtent, gpuTimer);
+    }
+    if (skinnedCount) {
+      skinned.skin(commandBuffer, jobs, (uint32_t)currentFrame, gpuTimer);
+    }
+    if (shadowsEnabled && skinnedCount) {
+      // the characters cast from the vertices skinned above
+      skinnedCasters.resize(skinned.characterCount());
+      for (uint32_t i = 0; i < skinned.characterCount(); i++) {
+        glm::vec4 b = skinned.bounds(i);
+        skinnedCasters[i] = {glm::vec3(b), b.w,
+                             (int32_t)(i * skinned.verticesPerCharacter())};
+      }
+      shadows.setWorldCasters(skinned.outputBuffer(), skinned.indexBuffer(),
+                              skinned.indexCount(), skinnedCasters.data(),
+                              (uint32_t)skinnedCasters.size());
+    }
+    if (shadowsEnabled) {
+      shadows.update(commandBuffer, (uint32_t)currentFrame, sceneTime,
+                     cameraView(), cameraProjection(), cameraNear, cameraFar,
+                     gpuTimer);
+    }
+    if (meshletCount) {
+      meshlets.cull(commandBuffer, (uint32_t)currentFrame, cameraView(),
+                    cameraProjection(), gpuTimer);
+    }
+    if (virtualTexturePath) {
+      virtualTexture.record(commandBuffer, (uint32_t)currentFrame,
+                            cameraProjection() * cameraView(), gpuTimer);
+    }
+    if (terrainSize > 0.0f) {
+      terrain.record(commandBuffer, (uint32_t)currentFrame, gpuTimer);
+    }
+    if (debugDrawEnabled) {
+      drawDebugScene();
+    }
+
+    uint32_t sceneZone = gpuTimer.begin(commandBuffer, "scene");
 
     VkRenderPassBeginInfo renderPassInfo = {
         VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
     renderPassInfo.renderPass = renderPass;
-    renderPassInfo.framebuffer = swapChainFramebuffers[i];
+    renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
     renderPassInfo.renderArea.offset = {0, 0};
     renderPassInfo.renderArea.extent = swapChainExtent;
-    VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
-    vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
+    VkClearValue clearValues[2] = {};
+    clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
+    clearValues[1].depthStencil = {1.0f, 0};
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
+    vkd.vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
                          VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      graphicsPipeline);
 
-    //vertex buffer
-    VkBuffer vertexBuffers[] = { vertexBuffer };
-    VkDeviceSize offsets[] = { 0 };
-    vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-    //index buffer 
-    vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+    VkViewport viewport = {};
+    viewport.width = (float)swapChainExtent.width;
+    viewport.height = (float)swapChainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    VkRect2D scissor = {{0, 0}, swapChainExtent};
+    vkd.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkd.vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    // null means neither the variant nor a compatible one is built yet;
+    // the draw is skipped this frame rather than stalling on the compile
+    VkPipeline pipeline = pipelineVariants.request(mainPipelineDesc);
+    if (pipeline) {
+      vkd.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        pipeline);
+
+      //vertex buffer
+      VkBuffer vertexBuffers[] = { vertexBuffer };
+      VkDeviceSize offsets[] = { 0 };
+      vkd.vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+      //index buffer 
+      vkd.vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0,
+                               VK_INDEX_TYPE_UINT16);
+
+      vkd.vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()),
+                           1, 0, 0, 0);
+    }
 
-    vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+    if (lightCount) {
+      lighting.draw(commandBuffer, (uint32_t)currentFrame, pipelineVariants);
+    }
+    if (shadowsEnabled) {
+      shadows.draw(commandBuffer, (uint32_t)currentFrame, pipelineVariants);
+    }
+    if (skinnedCount) {
+      skinned.draw(commandBuffer, cameraProjection() * cameraView(),
+                   pipelineVariants);
+    }
+    if (propCount) {
+      props.draw(commandBuffer, jobs, (uint32_t)currentFrame, pipelineVariants);
+    }
+    if (meshletCount) {
+      meshlets.draw(commandBuffer, (uint32_t)currentFrame,
+                    cameraProjection() * cameraView(), pipelineVariants);
+    }
+    if (virtualTexturePath) {
+      virtualTexture.draw(commandBuffer, cameraProjection() * cameraView(),
+                          pipelineVariants);
+    }
+    if (terrainSize > 0.0f) {
+      terrain.draw(commandBuffer, (uint32_t)currentFrame,
+                   cameraProjection() * cameraView(), pipelineVariants);
+    }
 
-    //vkCmdDraw(commandBuffers[i], (uint32_t)vertices.size(), 1, 0, 0);
-   // vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);//
-    vkCmdEndRenderPass(commandBuffers[i]);
-    VK_CHECK(vkEndCommandBuffer(commandBuffers[i]));
-  }
+    // blended, so after the opaque geometry
+    if (particleCount) {
+      particles.draw(commandBuffer, pipelineVariants);
+    }
+    if (debugDrawEnabled) {
+      debugDraw.draw(commandBuffer, cameraProjection() * cameraView(),
+                     pipelineVariants);
+    }
+
+    vkd.vkCmdEndRenderPass(commandBuffer);
+    gpuTimer.end(commandBuffer, sceneZone,
+                 VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    if (meshletCount) {
+      meshlets.buildDepthPyramid(commandBuffer, gpuTimer);
+    }
+    if (postEnabled) {
+      post.record(commandBuffer, swapChainImages[imageIndex], frameDt,
+                  gpuTimer);
+    }
+    if (exportFrames) {
+      frameReadback.capture(commandBuffer, swapChainImages[imageIndex],
+                            swapChainImageFormat, swapChainExtent);
+    }
+    VK_CHECK(vkd.vkEndCommandBuffer(commandBuffer));
 }
 
 
@@ -807,69 +1146,156 @@ void createSyncObjects() {
   VkFenceCreateInfo fenceInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
   fenceInfo.flags = VkFenceCreateFlagBits::VK_FENCE_CREATE_SIGNALED_BIT;
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      VK_CHECK(vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr,
+      VK_CHECK(vkd.vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr,
           &imageAvailableSemaphores[i]));
-      VK_CHECK(vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr,
+      VK_CHECK(vkd.vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr,
           &renderFinshedSemaphores[i]));
-      VK_CHECK(vkCreateFence(logicalDevice, &fenceInfo, nullptr,
+      VK_CHECK(vkd.vkCreateFence(logicalDevice, &fenceInfo, nullptr,
           &inFlightFences[i]));
   }
 }
 
 
-void cleanupSwapChain() {
+// every pipeline drawn in the main pass is keyed on its render pass
+void setSceneRenderPassKey() {
+  mainPipelineDesc.renderPassKey = renderPassKey;
+  particles.drawDesc.renderPassKey = renderPassKey;
+  lighting.drawDesc.renderPassKey = renderPassKey;
+  shadows.drawDesc.renderPassKey = renderPassKey;
+  skinned.drawDesc.renderPassKey = renderPassKey;
+  props.drawDesc.renderPassKey = renderPassKey;
+  meshlets.drawDesc.renderPassKey = renderPassKey;
+  virtualTexture.drawDesc.renderPassKey = renderPassKey;
+  terrain.drawDesc.renderPassKey = renderPassKey;
+  debugDraw.setRenderPassKey(renderPassKey);
+}
 
-    vkFreeCommandBuffers(logicalDevice, commandPool, commandBuffers.size(),commandBuffers.data());
+// frames still in flight may reference these, so they go through the
+// deletion queue tagged with the last submitted frame
+void retireSwapChain() {
 
     for (auto framebuffer : swapChainFramebuffers) {
-        vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+        deletionQueue.push(framebuffer);
     }
-    vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
-    vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+    deletionQueue.push(renderPass);
 
     for (auto imageView : swapChainImageViews) {
-        vkDestroyImageView(logicalDevice, imageView, nullptr);
+        deletionQueue.push(imageView);
     }
-    vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
+    retireTransientAttachments(transientAttachments, deletionQueue);
+    deletionQueue.push(swapChain);
 }
 
 
 void recreateSwapChain() {
     
-    // to handle minimization
-    int width = 0, height = 0;
-    glfwGetFramebufferSize(win, &width, &height);
+    // to handle minimization. glfw is main thread only, so wait for its
+    // callback to report a size
+    int width = reportedWidth.load(), height = reportedHeight.load();
     while (width == 0 || height == 0) {
-        glfwGetFramebufferSize(win ,&width,&height);
-        glfwPollEvents();
+        if (glfwWindowShouldClose(win)) return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        width = reportedWidth.load();
+        height = reportedHeight.load();
     }
+    framebufferWidth = width;
+    framebufferHeight = height;
     
-    
-    vkDeviceWaitIdle(logicalDevice);
 
-    cleanupSwapChain();
-    createSwapChain(deviceInfo.phyDevice, surface);
+    // no device idle: the old swapchain is handed to the new one and retired
+    // along with everything built on it
+    VkSwapchainKHR oldSwapChain = swapChain;
+    retireSwapChain();
+    createSwapChain(deviceInfo.phyDevice, surface, oldSwapChain);
+    imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
     createImageViews();
+    createTransientAttachments();
+    if (postEnabled) {
+      const TransientAttachment& hdr =
+          transientAttachments.attachments[hdrAttachment];
+      post.resize(transientAttachments, hdr.image, hdr.view, deletionQueue);
+    }
+    if (meshletCount) {
+      const TransientAttachment& depth =
+          transientAttachments.attachments[depthAttachment];
+      meshlets.resize(swapChainExtent, depth.image, depth.view, depthFormat,
+                      deletionQueue);
+    }
+    if (virtualTexturePath) {
+      virtualTexture.resize(swapChainExtent, deletionQueue);
+    }
+    // the cache compiles against its own render pass per key, so the draw
+    // descs only change if the new pass isn't compatible with the old one
+    uint64_t previousKey = renderPassKey;
     createRenderPass();
-    createGraphicsPipeline();
+    if (renderPassKey != previousKey) {
+      setSceneRenderPassKey();
+    }
     createFramebuffers();
-    createCommandBuffers();
 
 }
 static int l = 0;
 void drawFrame() {
-
-
-
-    VkResult fence_state =vkGetFenceStatus(logicalDevice, inFlightFences[currentFrame]);
+    double now = glfwGetTime();
+    frameDt = lastFrameTime > 0.0 ? (float)std::min(now - lastFrameTime, 0.1) : 0.0f;
+    lastFrameTime = now;
+    // whatever the simulation last published, never waiting for a tick
+    SimState sim = simulation.sample(profilerNow());
+    sceneTime = (float)sim.time;
+    cameraPosition = sim.cameraPosition;
+    cameraTarget = sim.cameraTarget;
+
+
+    VkResult fence_state =vkd.vkGetFenceStatus(logicalDevice,
+                                               inFlightFences[currentFrame]);
     if (fence_state == VK_NOT_READY)
     std::cout << fence_state << std::endl;
-      VK_CHECK(vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrame],VK_FALSE, UINT64_MAX));
+      VK_CHECK(vkd.vkWaitForFences(logicalDevice, 1,
+                                   &inFlightFences[currentFrame], VK_FALSE,
+                                   UINT64_MAX));
+    deletionQueue.collect(inFlightFrameNumbers[currentFrame]);
+    // nothing recorded for this slot's last frame is referenced any more
+    frameArenaBeginFrame((uint32_t)currentFrame);
+    memoryBudgetUpdate();
+    residency.update(frameNumber);
+    memoryBudgetRecordCounters();
+    if (exportFrames) {
+        frameReadback.poll(inFlightFrameNumbers[currentFrame]);
+    }
+    if (debugDrawEnabled) {
+        debugDraw.beginFrame((uint32_t)currentFrame);
+    }
+    if (lightCount) {
+        if (!lighting.retire((uint32_t)currentFrame)) {
+            clusterValidationFailed = true;
+        }
+        if (validateClusters && frameNumber % 100 == 0) {
+            lighting.requestValidation();
+        }
+    }
+    // poses are sampled on the workers while this thread acquires and records
+    if (skinnedCount) {
+        skinned.animate(jobs, (uint32_t)currentFrame, sceneTime);
+    }
+    if (propCount) {
+        props.update(jobs, (uint32_t)currentFrame, sceneTime,
+                     cameraProjection() * cameraView());
+    }
+    if (meshletCount) {
+        meshlets.update((uint32_t)currentFrame);
+    }
+    if (virtualTexturePath) {
+        virtualTexture.update((uint32_t)currentFrame);
+    }
+    if (terrainSize > 0.0f) {
+        terrain.update((uint32_t)currentFrame, sceneTime, cameraPosition,
+                       cameraProjection() * cameraView());
+    }
 
 	uint32_t imageIndex;
-VkResult img_result = 	vkAcquireNextImageKHR(logicalDevice, swapChain, UINT64_MAX,
-		imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+VkResult img_result = 	vkd.vkAcquireNextImageKHR(
+    logicalDevice, swapChain, UINT64_MAX,
+    imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
     
     if (img_result == VK_ERROR_OUT_OF_DATE_KHR) {
         std::cout << "recreating SwapChain "<< "\n";
@@ -877,9 +1303,20 @@ VkResult img_result = 	vkAcquireNextImageKHR(logicalDevice, swapChain, UINT64_MA
         return;
     }
 
+    // the image may still be in use by a frame from another slot
+    if (imagesInFlight[imageIndex] != VK_NULL_HANDLE &&
+        imagesInFlight[imageIndex] != inFlightFences[currentFrame]) {
+        VK_CHECK(vkd.vkWaitForFences(logicalDevice, 1,
+                                     &imagesInFlight[imageIndex], VK_TRUE,
+                                     UINT64_MAX));
+    }
     imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 
-    VK_CHECK(vkResetFences(logicalDevice, 1, &inFlightFences[currentFrame]));
+    VK_CHECK(vkd.vkResetFences(logicalDevice, 1,
+                               &inFlightFences[currentFrame]));
+
+    VK_CHECK(vkd.vkResetCommandBuffer(commandBuffers[currentFrame], 0));
+    recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
 
 
 	VkSubmitInfo submitInfo = {};
@@ -891,13 +1328,19 @@ VkResult img_result = 	vkAcquireNextImageKHR(logicalDevice, swapChain, UINT64_MA
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+	submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
 
 	VkSemaphore signalSemaphores[] = { renderFinshedSemaphores[currentFrame] };
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]));
+	VK_CHECK(vkd.vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+                            inFlightFences[currentFrame]));
+    inFlightFrameNumbers[currentFrame] = ++frameNumber;
+    deletionQueue.setCurrentFrame(frameNumber);
+    if (exportFrames) {
+        frameReadback.submitted(frameNumber);
+    }
 
 	VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
 	presentInfo.waitSemaphoreCount = 1;
@@ -909,12 +1352,11 @@ VkResult img_result = 	vkAcquireNextImageKHR(logicalDevice, swapChain, UINT64_MA
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = nullptr;
 
-    VkResult queue_result = (vkQueuePresentKHR(presentQueue, &presentInfo));
+    VkResult queue_result = (vkd.vkQueuePresentKHR(presentQueue, &presentInfo));
 
 
-    if (is_resized || queue_result==VK_SUBOPTIMAL_KHR || queue_result ==VK_ERROR_OUT_OF_DATE_KHR) {
+    if (is_resized.exchange(false) || queue_result==VK_SUBOPTIMAL_KHR || queue_result ==VK_ERROR_OUT_OF_DATE_KHR) {
         std::cout << "is resized!" <<"\n";
-        is_resized = false;
         recreateSwapChain();
     }
 
@@ -925,141 +1367,289 @@ VkResult img_result = 	vkAcquireNextImageKHR(logicalDevice, swapChain, UINT64_MA
 
 static void framebufferResizeCallback(GLFWwindow* window , int width , int hegiht) {
 
-
+    reportedWidth = width;
+    reportedHeight = hegiht;
     is_resized = true;
 }
 
-uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags proprties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(deviceInfo.phyDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if (typeFilter & (1 << i)&&(memProperties.memoryTypes[i].propertyFlags&proprties)==proprties) {
-            return i;
-        }
-    }
-    assert(0);
+// main thread; the simulation reads the keys on its next tick
+void keyCallBack(GLFWwindow* win, int key, int scancode, int actions,
+                 int mods) {
+  if (key == GLFW_KEY_ESCAPE && actions == GLFW_PRESS) {
+    glfwSetWindowShouldClose(win, GLFW_TRUE);
+  }
+  if (actions == GLFW_REPEAT) return;
+  uint32_t bits = 0;
+  switch (key) {
+    case GLFW_KEY_A:
+    case GLFW_KEY_LEFT:
+      bits = SIM_INPUT_LEFT;
+      break;
+    case GLFW_KEY_D:
+    case GLFW_KEY_RIGHT:
+      bits = SIM_INPUT_RIGHT;
+      break;
+    case GLFW_KEY_W:
+    case GLFW_KEY_UP:
+      bits = SIM_INPUT_FORWARD;
+      break;
+    case GLFW_KEY_S:
+    case GLFW_KEY_DOWN:
+      bits = SIM_INPUT_BACK;
+      break;
+  }
+  if (bits) simulation.setInput(bits, actions == GLFW_PRESS);
 }
 
-void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags proprerties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-
-    VkBufferCreateInfo bufferInfo{};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO; 
-    bufferInfo.size = size; 
-    bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; 
-   
-    VK_CHECK(vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &buffer));
-
-   VkMemoryRequirements memReq; 
-   vkGetBufferMemoryRequirements(logicalDevice, buffer, &memReq);
-
-   VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-   allocInfo.allocationSize = memReq.size;
-   allocInfo.memoryTypeIndex = findMemoryType(memReq.memoryTypeBits, proprerties);
-
-   VK_CHECK(vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &bufferMemory));
-
-   vkBindBufferMemory(logicalDevice, buffer, bufferMemory, 0);
-
-
+void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags proprerties, MemoryCategory category, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vki.vkGetPhysicalDeviceMemoryProperties(deviceInfo.phyDevice,
+                                            &memProperties);
+    buffer = createBuffer(logicalDevice, memProperties, size, usage, 0,
+                         proprerties, category, bufferMemory);
 }
 
-void copyBuffer(VkBuffer src,VkBuffer dst,VkDeviceSize size) {
+// uploads recorded into one command buffer and submitted once, so startup
+// doesn't stall on the queue per buffer. runs on its own command pool so it can
+// be recorded from a worker while the main thread creates other objects.
+struct UploadBatch {
+    VkCommandPool pool = VK_NULL_HANDLE;
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    std::vector<std::pair<VkBuffer, VkDeviceMemory>> staging;
+};
 
+void beginUploadBatch(UploadBatch& batch) {
+    VkCommandPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = deviceInfo.queuefamilyindices.graphicsFamilyIndex.value();
+    VK_CHECK(vkd.vkCreateCommandPool(logicalDevice, &poolInfo, nullptr,
+                                     &batch.pool));
 
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    VkCommandBufferAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
+    allocInfo.commandPool = batch.pool;
     allocInfo.commandBufferCount = 1;
+    VK_CHECK(vkd.vkAllocateCommandBuffers(logicalDevice, &allocInfo,
+                                          &batch.cmd));
 
-    VkCommandBuffer commandBuffer; 
-    vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer);
-
-
-    VkCommandBufferBeginInfo info= {};
-    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    VkCommandBufferBeginInfo info = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
     info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkd.vkBeginCommandBuffer(batch.cmd, &info));
+}
 
-    vkBeginCommandBuffer(commandBuffer, &info);
+void uploadToBuffer(UploadBatch& batch, const void* src, VkDeviceSize size, VkBuffer dst) {
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEMORY_STAGING, stagingBuffer, stagingBufferMemory);
+
+    void* data;
+    VK_CHECK(vkd.vkMapMemory(logicalDevice, stagingBufferMemory, 0, size, 0,
+                             &data));
+    memcpy(data, src, (size_t)size);
+    vkd.vkUnmapMemory(logicalDevice, stagingBufferMemory);
 
     VkBufferCopy copyRegion{};
     copyRegion.srcOffset = 0;
     copyRegion.dstOffset = 0;
     copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, src, dst, 1,&copyRegion);
-
-    vkEndCommandBuffer(commandBuffer);
-
-    
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphicsQueue);
-
-    vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
-
+    vkd.vkCmdCopyBuffer(batch.cmd, stagingBuffer, dst, 1, &copyRegion);
 
+    batch.staging.push_back({stagingBuffer, stagingBufferMemory});
 }
 
-void   createVertexBuffer() {
+void submitUploadBatch(UploadBatch& batch) {
+    VK_CHECK(vkd.vkEndCommandBuffer(batch.cmd));
 
-  VkDeviceSize bufferSize= vertices.size() * sizeof(vertices[0]);
-  
-  //create staging buffer 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    VkFenceCreateInfo fenceInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    VK_CHECK(vkd.vkCreateFence(logicalDevice, &fenceInfo, nullptr,
+                               &batch.fence));
 
-  //filling the vertex 
-  void* data;
-  vkMapMemory(logicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-  memcpy(data, vertices.data(), (size_t)bufferSize);
-  vkUnmapMemory(logicalDevice, stagingBufferMemory);
+    VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.cmd;
+    VK_CHECK(vkd.vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch.fence));
+}
 
+void finishUploadBatch(UploadBatch& batch) {
+    VK_CHECK(vkd.vkWaitForFences(logicalDevice, 1, &batch.fence, VK_TRUE,
+                                 UINT64_MAX));
+    for (auto& staging : batch.staging) {
+        vkd.vkDestroyBuffer(logicalDevice, staging.first, nullptr);
+        freeTrackedMemory(logicalDevice, staging.second);
+    }
+    batch.staging.clear();
+    vkd.vkDestroyFence(logicalDevice, batch.fence, nullptr);
+    vkd.vkDestroyCommandPool(logicalDevice, batch.pool, nullptr);
+    batch = UploadBatch();
+}
 
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,vertexBuffer,vertexbufferMemory);
-   
-  copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+void createVertexBuffer(UploadBatch& batch) {
+  VkDeviceSize bufferSize = vertices.size() * sizeof(vertices[0]);
 
-  vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-  vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_BUFFER, vertexBuffer,vertexbufferMemory);
 
+  uploadToBuffer(batch, vertices.data(), bufferSize, vertexBuffer);
 }
 
-void createIndexBuffer() {
+void createIndexBuffer(UploadBatch& batch) {
     VkDeviceSize bufferSize = indices.size() * sizeof(indices[0]);
 
-    //create staging buffer 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_BUFFER, indexBuffer, indexBufferMemory);
 
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    uploadToBuffer(batch, indices.data(), bufferSize, indexBuffer);
+}
 
-    //filling the vertex 
-    void* data;
-    vkMapMemory(logicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t)bufferSize);
-    vkUnmapMemory(logicalDevice, stagingBufferMemory);
 
+// records the same draw-heavy command buffer through the loader exports and
+// through the device table and reports the per call cost of each. the buffer
+// is never submitted.
+void benchmarkDispatch() {
+  const uint32_t kDraws = 100000;
+  const int kRuns = 5;
 
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, vertexbufferMemory);
+  VkPipeline pipeline = pipelineVariants.getBlocking(mainPipelineDesc);
+  VkCommandBuffer cmd;
+  VkCommandBufferAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = 1;
+  VK_CHECK(vkd.vkAllocateCommandBuffers(logicalDevice, &allocInfo, &cmd));
+
+  VkCommandBufferBeginInfo beginInfo = {
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+  VkRenderPassBeginInfo renderPassInfo = {
+      VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+  renderPassInfo.renderPass = renderPass;
+  renderPassInfo.framebuffer = swapChainFramebuffers[0];
+  renderPassInfo.renderArea.extent = swapChainExtent;
+  VkClearValue clearValues[2] = {};
+  renderPassInfo.clearValueCount = 2;
+  renderPassInfo.pClearValues = clearValues;
+  VkDeviceSize offset = 0;
+  uint32_t indexCount = static_cast<uint32_t>(indices.size());
+
+  uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+  for (int run = 0; run < kRuns; run++) {
+    for (int direct = 0; direct < 2; direct++) {
+      VK_CHECK(vkd.vkResetCommandBuffer(cmd, 0));
+      VK_CHECK(vkd.vkBeginCommandBuffer(cmd, &beginInfo));
+      vkd.vkCmdBeginRenderPass(cmd, &renderPassInfo,
+                               VK_SUBPASS_CONTENTS_INLINE);
+      vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+      vkd.vkCmdBindIndexBuffer(cmd, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+      // bind + draw per object, like a naive scene loop
+      uint64_t begin = profilerNow();
+      if (direct) {
+        for (uint32_t i = 0; i < kDraws; i++) {
+          vkd.vkCmdBindVertexBuffers(cmd, 0, 1, &vertexBuffer, &offset);
+          vkd.vkCmdDrawIndexed(cmd, indexCount, 1, 0, 0, 0);
+        }
+      } else {
+        for (uint32_t i = 0; i < kDraws; i++) {
+          vkCmdBindVertexBuffers(cmd, 0, 1, &vertexBuffer, &offset);
+          vkCmdDrawIndexed(cmd, indexCount, 1, 0, 0, 0);
+        }
+      }
+      uint64_t elapsed = profilerNow() - begin;
+      if (elapsed < best[direct]) best[direct] = elapsed;
 
-    copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+      vkd.vkCmdEndRenderPass(cmd);
+      VK_CHECK(vkd.vkEndCommandBuffer(cmd));
+    }
+  }
+  vkd.vkFreeCommandBuffers(logicalDevice, commandPool, 1, &cmd);
+
+  const double calls = kDraws * 2.0;
+  printf("dispatch benchmark: %u draws x2 calls, best of %d\n", kDraws, kRuns);
+  printf("  loader trampoline: %7.2fms  %6.2fns/call\n", best[0] / 1e6,
+         best[0] / calls);
+  printf("  device table:      %7.2fms  %6.2fns/call\n", best[1] / 1e6,
+         best[1] / calls);
+  printf("  saved:             %6.2fns/call\n",
+         ((double)best[0] - (double)best[1]) / calls);
+}
 
-    vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-    vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+int main(int argc, char** argv) {
+  const char* tracePath = nullptr;
+  const char* capturePath = nullptr;
+  const char* archivePath = nullptr;
+  bool benchDispatch = false;
+  const char* exportDir = nullptr;
+  ExportFormat exportFormat = EXPORT_PNG;
+  uint64_t frameLimit = 0;
+  bool checkAllocs = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--bench-dispatch") == 0) {
+      benchDispatch = true;
+    } else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+      exportDir = argv[++i];
+    } else if (strcmp(argv[i], "--export-format") == 0 && i + 1 < argc) {
+      if (!parseExportFormat(argv[++i], exportFormat)) {
+        printf("unknown export format:%s (png, raw or exr)\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frameLimit = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+      particleCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--post") == 0) {
+      postEnabled = true;
+    } else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+      lightCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--validate-clusters") == 0) {
+      validateClusters = true;
+    } else if (strcmp(argv[i], "--skinned") == 0 && i + 1 < argc) {
+      skinnedCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--props") == 0 && i + 1 < argc) {
+      propCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--meshlets") == 0 && i + 1 < argc) {
+      meshletCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--virtual-texture") == 0 && i + 1 < argc) {
+      virtualTexturePath = argv[++i];
+    } else if (strcmp(argv[i], "--terrain") == 0 && i + 1 < argc) {
+      terrainSize = strtof(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--shadows") == 0) {
+      shadowsEnabled = true;
+    } else if (strcmp(argv[i], "--debug-draw") == 0) {
+      debugDrawEnabled = true;
+    } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+      memoryBudgetMB = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      capturePath = argv[++i];
+    } else if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc) {
+      archivePath = argv[++i];
+    } else if (strcmp(argv[i], "--check-allocs") == 0) {
+      checkAllocs = true;
+    } else if (strcmp(argv[i], "--sim-hz") == 0 && i + 1 < argc) {
+      simTickRate = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    }
+  }
 
-}
+  // before anything is read
+  if (archivePath && !mountArchive(archivePath)) {
+    printf("failed to open archive:%s\n", archivePath);
+    return 1;
+  }
+  if (virtualTexturePath && !virtualTexture.open(virtualTexturePath)) {
+    return 1;
+  }
+  frameArenaInit(MAX_FRAMES_IN_FLIGHT, FRAME_ARENA_BYTES);
 
+  profilerSetThreadName("main");
+  jobs.start();
 
+  // shader bytecode doesn't need vulkan, start reading it immediately
+  JobCounter shaderFilesLoaded;
+  jobs.run(&shaderFilesLoaded, [] { vertShaderCode = readFile("shaders/vert.spv"); }, "read vert.spv");
+  jobs.run(&shaderFilesLoaded, [] { fragShaderCode = readFile("shaders/frag.spv"); }, "read frag.spv");
 
-int main() {
+  {
+    PROFILE_SCOPE("create window");
 	int rc = glfwInit();
     glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -1069,82 +1659,404 @@ int main() {
     glfwSetFramebufferSizeCallback(win, framebufferResizeCallback);
 
 	assert(win);
+    glfwGetFramebufferSize(win, &framebufferWidth, &framebufferHeight);
+    reportedWidth = framebufferWidth;
+    reportedHeight = framebufferHeight;
+  }
 	
 	VkDebugUtilsMessengerEXT debugMessenger;
+  {
+    PROFILE_SCOPE("initInstance");
 	initInstance(instance, debugMessenger);
-
+  }
+  {
+    PROFILE_SCOPE("createSurface");
 	createSurface(instance, win, surface);
+  }
+  {
+    PROFILE_SCOPE("pickPhysicalDevice");
 	deviceInfo = pickPhysicalDevice(instance, surface);
-
+    memoryBudgetExtension = hasDeviceExtension(
+        deviceInfo.phyDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudgetExtension) {
+      deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+  }
+  {
+    PROFILE_SCOPE("createLogicalDevice");
 	createLogicalDeviceAndQueueFamilies(instance, deviceInfo, logicalDevice);
 
-	vkGetDeviceQueue(logicalDevice,
+	vkd.vkGetDeviceQueue(logicalDevice,
 		deviceInfo.queuefamilyindices.graphicsFamilyIndex.value(), 0,
 		&graphicsQueue);
-	vkGetDeviceQueue(logicalDevice,
+	vkd.vkGetDeviceQueue(logicalDevice,
 		deviceInfo.queuefamilyindices.presentFamilyIndex.value(), 0,
 		&presentQueue);
+  }
+  // before anything allocates, so every allocation is accounted for
+  memoryBudgetInit(deviceInfo.phyDevice, memoryBudgetExtension);
+  memoryBudgetSetLimit((VkDeviceSize)memoryBudgetMB << 20);
+  residency.init(MAX_FRAMES_IN_FLIGHT);
 
 	VkPhysicalDeviceProperties dp = {};
 
-	vkGetPhysicalDeviceProperties(deviceInfo.phyDevice, &dp);
+	vki.vkGetPhysicalDeviceProperties(deviceInfo.phyDevice, &dp);
 	printf("vulkan api version:%d\n", dp.apiVersion);
-  
-  createSwapChain(deviceInfo.phyDevice, surface);
-  createImageViews();
-  createRenderPass();
-  createGraphicsPipeline();
-  createFramebuffers();
-  createCommandPool();
-  createVertexBuffer();
-  createIndexBuffer();
-  createCommandBuffers();
-  createSyncObjects();
+  // before anything is created, the replay needs every object
+  if (capturePath) {
+    captureOpen(capturePath, deviceInfo.phyDevice, vkd);
+  }
+
+  // everything below only depends on the device. the render pass needs the
+  // surface and depth formats but not the swapchain itself, so pipeline
+  // compilation, the swapchain and the buffer uploads all run side by side.
+  swapChainImageFormat =
+      chooseSwapSurfaceFormat(
+          querySwapChainSupport(deviceInfo.phyDevice, surface).formats)
+          .format;
+  if (postEnabled && !checkPostSupport()) {
+    postEnabled = false;
+  }
+  registerTransientAttachments();
+  deletionQueue.init(logicalDevice);
+  if (exportDir) {
+    exportFrames = frameReadback.init(deviceInfo.phyDevice, logicalDevice,
+                                      &jobs, exportDir, exportFormat);
+  }
+  pipelineVariants.init(logicalDevice, &jobs, "pipeline_cache.bin");
+  gpuTimer.init(deviceInfo.phyDevice, logicalDevice,
+                deviceInfo.queuefamilyindices.graphicsFamilyIndex.value(),
+                MAX_FRAMES_IN_FLIGHT);
+
+  JobCounter swapChainReady;
+  jobs.run(&swapChainReady, [] {
+    createSwapChain(deviceInfo.phyDevice, surface);
+    createImageViews();
+    createTransientAttachments();
+  }, "createSwapChain");
+
+  JobCounter pipelineReady;
+  jobs.run(&pipelineReady, [&shaderFilesLoaded] {
+    {
+      PROFILE_SCOPE("wait shader files");
+      jobs.wait(&shaderFilesLoaded);
+    }
+    createRenderPass();
+    createGraphicsPipeline();
+  }, "createGraphicsPipeline");
+
+  JobCounter particlesReady;
+  if (particleCount) {
+    jobs.run(&particlesReady, [] {
+      particles.init(deviceInfo.phyDevice, logicalDevice,
+                     pipelineVariants.pipelineCache(), particleCount,
+                     particleCount / 4.0f);
+    }, "createParticles");
+  }
+
+  JobCounter lightingReady;
+  if (lightCount) {
+    jobs.run(&lightingReady, [] {
+      lighting.init(deviceInfo.phyDevice, logicalDevice,
+                    pipelineVariants.pipelineCache(), lightCount,
+                    MAX_FRAMES_IN_FLIGHT);
+    }, "createLighting");
+  }
+
+  // the clustered ground already covers the receiver when --lights is on
+  JobCounter shadowsReady;
+  if (shadowsEnabled) {
+    jobs.run(&shadowsReady, [] {
+      shadows.init(deviceInfo.phyDevice, logicalDevice,
+                   pipelineVariants.pipelineCache(), MAX_FRAMES_IN_FLIGHT,
+                   lightCount == 0);
+    }, "createShadows");
+  }
+
+  JobCounter skinnedReady;
+  if (skinnedCount) {
+    jobs.run(&skinnedReady, [] {
+      skinned.init(deviceInfo.phyDevice, logicalDevice,
+                   pipelineVariants.pipelineCache(), skinnedCount,
+                   MAX_FRAMES_IN_FLIGHT);
+    }, "createSkinnedMeshes");
+  }
+
+  JobCounter propsReady;
+  if (propCount) {
+    jobs.run(&propsReady, [] {
+      props.init(deviceInfo.phyDevice, logicalDevice, propCount,
+                 MAX_FRAMES_IN_FLIGHT);
+    }, "createInstancedProps");
+  }
+
+  JobCounter meshletsReady;
+  if (meshletCount) {
+    jobs.run(&meshletsReady, [] {
+      meshlets.init(deviceInfo.phyDevice, logicalDevice,
+                    pipelineVariants.pipelineCache(), meshletCount,
+                    MAX_FRAMES_IN_FLIGHT);
+    }, "createMeshlets");
+  }
+
+  JobCounter virtualTextureReady;
+  if (virtualTexturePath) {
+    jobs.run(&virtualTextureReady, [] {
+      virtualTexture.init(deviceInfo.phyDevice, logicalDevice,
+                          pipelineVariants.pipelineCache(), jobs,
+                          MAX_FRAMES_IN_FLIGHT, residency, deletionQueue);
+    }, "createVirtualTexture");
+  }
+
+  JobCounter terrainReady;
+  if (terrainSize > 0.0f) {
+    jobs.run(&terrainReady, [] {
+      terrain.init(deviceInfo.phyDevice, logicalDevice,
+                   pipelineVariants.pipelineCache(), jobs, terrainSize,
+                   MAX_FRAMES_IN_FLIGHT, residency, deletionQueue);
+    }, "createTerrain");
+  }
+
+  JobCounter debugDrawReady;
+  if (debugDrawEnabled) {
+    jobs.run(&debugDrawReady, [] {
+      debugDraw.init(deviceInfo.phyDevice, logicalDevice, MAX_FRAMES_IN_FLIGHT,
+                     65536);
+    }, "createDebugDraw");
+  }
+
+  JobCounter postReady;
+  if (postEnabled) {
+    jobs.run(&postReady, [] {
+      post.init(deviceInfo.phyDevice, logicalDevice,
+                pipelineVariants.pipelineCache());
+    }, "createPostProcess");
+  }
+
+  UploadBatch uploads;
+  JobCounter uploadsRecorded;
+  jobs.run(&uploadsRecorded, [&uploads] {
+    beginUploadBatch(uploads);
+    createVertexBuffer(uploads);
+    createIndexBuffer(uploads);
+    submitUploadBatch(uploads);
+  }, "record uploads");
+
+  {
+    PROFILE_SCOPE("wait swapchain + pipeline");
+    jobs.wait(&swapChainReady);
+    jobs.wait(&pipelineReady);
+    jobs.wait(&particlesReady);
+    jobs.wait(&postReady);
+    jobs.wait(&lightingReady);
+    jobs.wait(&shadowsReady);
+    jobs.wait(&skinnedReady);
+    jobs.wait(&propsReady);
+    jobs.wait(&meshletsReady);
+    jobs.wait(&virtualTextureReady);
+    jobs.wait(&terrainReady);
+    jobs.wait(&debugDrawReady);
+  }
+  setSceneRenderPassKey();
+  if (postEnabled) {
+    const TransientAttachment& hdr =
+        transientAttachments.attachments[hdrAttachment];
+    post.resize(transientAttachments, hdr.image, hdr.view, deletionQueue);
+  }
+  if (meshletCount) {
+    const TransientAttachment& depth =
+        transientAttachments.attachments[depthAttachment];
+    meshlets.resize(swapChainExtent, depth.image, depth.view, depthFormat,
+                    deletionQueue);
+  }
+  if (virtualTexturePath) {
+    virtualTexture.resize(swapChainExtent, deletionQueue);
+  }
+  {
+    PROFILE_SCOPE("createFramebuffers");
+    createFramebuffers();
+  }
+  {
+    PROFILE_SCOPE("wait upload recording");
+    jobs.wait(&uploadsRecorded);
+  }
+  {
+    PROFILE_SCOPE("createCommandBuffers");
+    createCommandPool();
+    createCommandBuffers();
+    createSyncObjects();
+  }
+  {
+    PROFILE_SCOPE("wait uploads on gpu");
+    finishUploadBatch(uploads);
+  }
   glfwSetKeyCallback(win, keyCallBack);
 
-  while (!glfwWindowShouldClose(win)) {
-    glfwPollEvents();
-    drawFrame();
+  // --check-allocs: once caches, rings and pools have settled, a frame
+  // shouldn't touch the heap at all
+  const uint64_t kAllocWarmupFrames = 100;
+  uint64_t checkedFrames = 0, allocatingFrames = 0;
+  uint64_t frameAllocs = 0, maxFrameAllocs = 0;
+
+  // glfw has to stay on this thread, so from here on it only pumps events.
+  // frames are recorded and presented on the render thread while the game
+  // ticks on the simulation thread; they only meet in the snapshot.
+  simulation.start(simTickRate);
+  std::atomic<bool> renderFinished{false};
+  std::thread renderThread([&] {
+    profilerSetThreadName("render");
+    bool firstFrame = true;
+    while (!glfwWindowShouldClose(win) &&
+           (frameLimit == 0 || frameNumber < frameLimit)) {
+      uint64_t allocsBefore = allocationCount();
+      drawFrame();
+      if (checkAllocs && frameNumber > kAllocWarmupFrames) {
+        uint64_t allocs = allocationCount() - allocsBefore;
+        checkedFrames++;
+        if (allocs) allocatingFrames++;
+        frameAllocs += allocs;
+        maxFrameAllocs = std::max(maxFrameAllocs, allocs);
+      }
+
+      if (firstFrame) {
+        firstFrame = false;
+        profilerRecordInstant("first frame presented");
+        printf("time to first frame: %.2fms\n", profilerNow() / 1e6);
+        profilerPrintSummary();
+        if (tracePath) {
+          profilerWriteTrace(tracePath);
+        }
+        profilerSetEnabled(false);
+        if (benchDispatch) {
+          benchmarkDispatch();
+        }
+      }
+    }
+    renderFinished = true;
+    glfwPostEmptyEvent();
+  });
+  while (!renderFinished) {
+    glfwWaitEvents();
   }
+  renderThread.join();
+  simulation.stop();
 
-  vkDeviceWaitIdle(logicalDevice);
+  vkd.vkDeviceWaitIdle(logicalDevice);
   // clean up
+  deletionQueue.flush();
+  memoryBudgetUpdate();
+  memoryBudgetPrintStats();
+  residency.printStats();
+  captureClose();
+  if (exportDir) {
+    frameReadback.poll(frameNumber);
+    frameReadback.finish();
+    frameReadback.destroy();
+  }
 
   //delete vertex buffer
-  vkDestroyBuffer(logicalDevice, vertexBuffer, nullptr);
-  vkFreeMemory(logicalDevice, vertexbufferMemory, nullptr);
+  vkd.vkDestroyBuffer(logicalDevice, vertexBuffer, nullptr);
+  freeTrackedMemory(logicalDevice, vertexbufferMemory);
   // delete index buffer
-  vkDestroyBuffer(logicalDevice, indexBuffer, nullptr);
-  vkFreeMemory(logicalDevice, indexBufferMemory, nullptr);
+  vkd.vkDestroyBuffer(logicalDevice, indexBuffer, nullptr);
+  freeTrackedMemory(logicalDevice, indexBufferMemory);
 
 
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      vkDestroySemaphore(logicalDevice, renderFinshedSemaphores[i], nullptr);
-      vkDestroySemaphore(logicalDevice, imageAvailableSemaphores[i], nullptr);
-      vkDestroyFence(logicalDevice, inFlightFences[i], nullptr);
+      vkd.vkDestroySemaphore(logicalDevice, renderFinshedSemaphores[i],
+                             nullptr);
+      vkd.vkDestroySemaphore(logicalDevice, imageAvailableSemaphores[i],
+                             nullptr);
+      vkd.vkDestroyFence(logicalDevice, inFlightFences[i], nullptr);
   }
   
-  vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+  vkd.vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 
   for (auto framebuffer : swapChainFramebuffers) {
-    vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+    vkd.vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+  }
+  if (particleCount) {
+    particles.destroy();
+  }
+  if (postEnabled) {
+    post.destroy();
+  }
+  if (lightCount) {
+    // a check recorded in the last frames would otherwise never run
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      if (!lighting.retire(i)) clusterValidationFailed = true;
+    }
+    lighting.destroy();
+  }
+  if (skinnedCount) {
+    skinned.printStats();
+    skinned.destroy();
+  }
+  if (propCount) {
+    props.printStats();
+    props.destroy();
   }
-  vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
-  vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
-  vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+  if (meshletCount) {
+    meshlets.printStats();
+    meshlets.destroy();
+  }
+  if (virtualTexturePath) {
+    virtualTexture.printStats();
+    virtualTexture.destroy();
+  }
+  if (terrainSize > 0.0f) {
+    terrain.printStats();
+    terrain.destroy();
+  }
+  if (shadowsEnabled) {
+    shadows.printStats();
+    shadows.destroy();
+  }
+  if (debugDrawEnabled) {
+    debugDraw.printStats();
+    debugDraw.destroy();
+  }
+  gpuTimer.printStats();
+  gpuTimer.destroy();
+  pipelineVariants.printStats();
+  pipelineVariants.destroy();
+  if (const AssetArchive* archive = mountedArchive()) {
+    archive->printStats();
+    unmountArchive();
+  }
+  vkd.vkDestroyShaderModule(logicalDevice, vertShader.module, nullptr);
+  vkd.vkDestroyShaderModule(logicalDevice, fragShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+  vkd.vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
 
   for (auto imageView : swapChainImageViews) {
-    vkDestroyImageView(logicalDevice, imageView, nullptr);
+    vkd.vkDestroyImageView(logicalDevice, imageView, nullptr);
   }
-  vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
-  vkDestroySurfaceKHR(instance, surface, 0);
-  vkDestroyDevice(logicalDevice, 0);
+  destroyTransientAttachments(transientAttachments, true);
+  vkd.vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
+  vki.vkDestroySurfaceKHR(instance, surface, 0);
+  vkd.vkDestroyDevice(logicalDevice, 0);
   DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
-  vkDestroyInstance(instance, 0);
+  vki.vkDestroyInstance(instance, 0);
+
+  jobs.stop();
+  simulation.printStats();
+  frameArenaPrintStats();
+  frameArenaShutdown();
+  bool allocCheckFailed = false;
+  if (checkAllocs) {
+    printf("heap: %llu of %llu steady state frames allocated, %llu "
+           "allocations, at most %llu in one frame\n",
+           (unsigned long long)allocatingFrames,
+           (unsigned long long)checkedFrames,
+           (unsigned long long)frameAllocs,
+           (unsigned long long)maxFrameAllocs);
+    allocCheckFailed = allocatingFrames != 0;
+  }
 
   glfwDestroyWindow(win);
   glfwTerminate();
 
   system("pause");
-  return 0;
+  return clusterValidationFailed || allocCheckFailed ? 1 : 0;
 }
@@ -0,0 +1,193 @@
+#include "memory_budget.h"
+
+#include "profiler.h"
+#include "vk_dispatch.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+// without VK_EXT_memory_budget: the driver, the compositor and other
+// processes need some of the heap too
+const double kFallbackBudgetShare = 0.8;
+
+struct Allocation {
+  VkDeviceSize size;
+  uint32_t heap;
+  MemoryCategory category;
+};
+
+VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+VkPhysicalDeviceMemoryProperties memoryProperties = {};
+bool hasBudgetExtension = false;
+VkDeviceSize budgetLimit = 0;
+
+std::mutex mutex;
+std::unordered_map<VkDeviceMemory, Allocation> allocations;
+MemoryHeapStats heaps[VK_MAX_MEMORY_HEAPS];
+VkDeviceSize categoryBytes[MEMORY_CATEGORY_COUNT] = {};
+VkDeviceSize peakCategoryBytes[MEMORY_CATEGORY_COUNT] = {};
+uint64_t failedAllocations = 0;
+
+const char* const kCategoryNames[MEMORY_CATEGORY_COUNT] = {
+    "buffers", "textures", "render targets", "staging"};
+// counter names have to outlive the profiler
+const char* const kCategoryCounters[MEMORY_CATEGORY_COUNT] = {
+    "memory: buffers MB", "memory: textures MB", "memory: render targets MB",
+    "memory: staging MB"};
+
+double toMB(VkDeviceSize bytes) { return bytes / (1024.0 * 1024.0); }
+
+// with mutex held
+void refreshHeaps() {
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
+  if (hasBudgetExtension) {
+    VkPhysicalDeviceMemoryProperties2 props = {
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2};
+    props.pNext = &budgetProps;
+    vki.vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &props);
+  }
+  for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+    MemoryHeapStats& heap = heaps[i];
+    if (hasBudgetExtension) {
+      heap.budget = budgetProps.heapBudget[i];
+      heap.usage = budgetProps.heapUsage[i];
+    } else {
+      heap.budget = (VkDeviceSize)(heap.size * kFallbackBudgetShare);
+      heap.usage = heap.tracked;
+    }
+    if (budgetLimit && heap.deviceLocal && heap.budget > budgetLimit) {
+      heap.budget = budgetLimit;
+    }
+  }
+}
+
+}  // namespace
+
+const char* memoryCategoryName(MemoryCategory category) {
+  return kCategoryNames[category];
+}
+
+void memoryBudgetInit(VkPhysicalDevice device, bool budgetExtension) {
+  std::lock_guard<std::mutex> lock(mutex);
+  physicalDevice = device;
+  hasBudgetExtension = budgetExtension;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+    heaps[i].size = memoryProperties.memoryHeaps[i].size;
+    heaps[i].deviceLocal = (memoryProperties.memoryHeaps[i].flags &
+                            VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+  }
+  refreshHeaps();
+}
+
+void memoryBudgetSetLimit(VkDeviceSize bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  budgetLimit = bytes;
+  refreshHeaps();
+}
+
+void memoryBudgetUpdate() {
+  std::lock_guard<std::mutex> lock(mutex);
+  refreshHeaps();
+}
+
+VkResult allocateTrackedMemory(VkDevice device,
+                               const VkMemoryAllocateInfo& allocInfo,
+                               MemoryCategory category,
+                               VkDeviceMemory& memory) {
+  VkResult result = vkd.vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (result != VK_SUCCESS) {
+      failedAllocations++;
+      return result;
+    }
+    uint32_t heap =
+        memoryProperties.memoryTypes[allocInfo.memoryTypeIndex].heapIndex;
+    allocations[memory] = {allocInfo.allocationSize, heap, category};
+    // keep usage current between driver queries
+    heaps[heap].tracked += allocInfo.allocationSize;
+    heaps[heap].usage += allocInfo.allocationSize;
+    categoryBytes[category] += allocInfo.allocationSize;
+    if (categoryBytes[category] > peakCategoryBytes[category]) {
+      peakCategoryBytes[category] = categoryBytes[category];
+    }
+  }
+  // startup traces show where the memory went
+  memoryBudgetRecordCounters();
+  return result;
+}
+
+void freeTrackedMemory(VkDevice device, VkDeviceMemory memory) {
+  if (memory == VK_NULL_HANDLE) return;
+  vkd.vkFreeMemory(device, memory, nullptr);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = allocations.find(memory);
+    if (it == allocations.end()) return;
+    const Allocation& allocation = it->second;
+    MemoryHeapStats& heap = heaps[allocation.heap];
+    heap.tracked -= allocation.size;
+    heap.usage -= std::min(heap.usage, allocation.size);
+    categoryBytes[allocation.category] -= allocation.size;
+    allocations.erase(it);
+  }
+  memoryBudgetRecordCounters();
+}
+
+uint32_t memoryHeapCount() { return memoryProperties.memoryHeapCount; }
+
+uint32_t memoryHeapForType(uint32_t memoryTypeIndex) {
+  return memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+}
+
+MemoryHeapStats memoryHeapStats(uint32_t heap) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return heaps[heap];
+}
+
+VkDeviceSize memoryCategoryBytes(MemoryCategory category) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return categoryBytes[category];
+}
+
+void memoryBudgetRecordCounters() {
+  if (!profilerEnabled()) return;
+  std::lock_guard<std::mutex> lock(mutex);
+  VkDeviceSize usage = 0, budget = 0;
+  for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+    if (!heaps[i].deviceLocal) continue;
+    usage += heaps[i].usage;
+    budget += heaps[i].budget;
+  }
+  profilerRecordCounter("memory: device local usage MB", toMB(usage));
+  profilerRecordCounter("memory: device local budget MB", toMB(budget));
+  for (uint32_t c = 0; c < MEMORY_CATEGORY_COUNT; c++) {
+    profilerRecordCounter(kCategoryCounters[c], toMB(categoryBytes[c]));
+  }
+}
+
+void memoryBudgetPrintStats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  printf("memory budget (%s):\n",
+         hasBudgetExtension ? "VK_EXT_memory_budget" : "heap size estimate");
+  for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+    const MemoryHeapStats& heap = heaps[i];
+    printf("  heap %u%s: %8.1fMB used of %8.1fMB budget (%8.1fMB heap), "
+           "%8.1fMB tracked\n",
+           i, heap.deviceLocal ? " [device local]" : "", toMB(heap.usage),
+           toMB(heap.budget), toMB(heap.size), toMB(heap.tracked));
+  }
+  for (uint32_t c = 0; c < MEMORY_CATEGORY_COUNT; c++) {
+    printf("  %-15s %8.1fMB now, %8.1fMB peak\n", kCategoryNames[c],
+           toMB(categoryBytes[c]), toMB(peakCategoryBytes[c]));
+  }
+  if (failedAllocations) {
+    printf("  %llu allocations failed\n",
+           (unsigned long long)failedAllocations);
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "vk_common.h"
+
+// Per heap and per category accounting of device memory. Every allocation
+// made through allocateTrackedMemory() is attributed to a heap and a
+// category; memoryBudgetUpdate() refreshes each heap's budget and usage from
+// VK_EXT_memory_budget when the device has it (which also sees other
+// processes on the same GPU) and otherwise falls back to a fixed share of the
+// heap size and our own tracked bytes. Thread safe.
+enum MemoryCategory {
+  MEMORY_BUFFER,
+  MEMORY_TEXTURE,
+  MEMORY_RENDER_TARGET,
+  MEMORY_STAGING,
+  MEMORY_CATEGORY_COUNT
+};
+
+struct MemoryHeapStats {
+  VkDeviceSize size = 0;
+  // what we may use before the driver starts paging or failing allocations
+  VkDeviceSize budget = 0;
+  // process usage as reported by the driver, or our tracked bytes
+  VkDeviceSize usage = 0;
+  // bytes allocated through allocateTrackedMemory()
+  VkDeviceSize tracked = 0;
+  bool deviceLocal = false;
+};
+
+const char* memoryCategoryName(MemoryCategory category);
+
+// budgetExtension: VK_EXT_memory_budget is enabled on the device
+void memoryBudgetInit(VkPhysicalDevice physicalDevice, bool budgetExtension);
+// caps the budget of every device local heap, e.g. to share a GPU between
+// several instances; 0 removes the cap
+void memoryBudgetSetLimit(VkDeviceSize bytes);
+// re-queries the driver; once per frame from the main thread is plenty
+void memoryBudgetUpdate();
+
+VkResult allocateTrackedMemory(VkDevice device,
+                               const VkMemoryAllocateInfo& allocInfo,
+                               MemoryCategory category, VkDeviceMemory& memory);
+// frees untracked memory too; VK_NULL_HANDLE is ignored
+void freeTrackedMemory(VkDevice device, VkDeviceMemory memory);
+
+uint32_t memoryHeapCount();
+uint32_t memoryHeapForType(uint32_t memoryTypeIndex);
+MemoryHeapStats memoryHeapStats(uint32_t heap);
+VkDeviceSize memoryCategoryBytes(MemoryCategory category);
+
+// usage and budget of every device local heap plus the category totals as
+// profiler counters, if the profiler is enabled
+void memoryBudgetRecordCounters();
+void memoryBudgetPrintStats();
@@ -0,0 +1,813 @@
+#include "meshlet_renderer.h"
+
+#include "deletion_queue.h"
+#include "file_io.h"
+#include "gpu_timer.h"
+#include "memory_budget.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+// must match the local sizes in meshlet_cull.comp and meshlet_depth_reduce.comp
+static const uint32_t kCullGroupSize = 64;
+static const uint32_t kReduceTile = 8;
+// must match the flags in meshlet_cull.comp
+static const uint32_t kFlagCone = 1;
+static const uint32_t kFlagOcclusion = 2;
+
+// the demo mesh: a rippled torus standing upright, dense enough that most of
+// each instance is either facing away or hidden behind the one in front
+static const uint32_t kRingSegments = 224;  // around the hole
+static const uint32_t kTubeSegments = 84;   // around the tube
+// quads are emitted in kTile x kTile patches, so the greedy split below cuts
+// the mesh into compact meshlets of one patch each
+static const uint32_t kTile = 7;
+static const float kRingRadius = 1.2f;
+static const float kTubeRadius = 0.45f;
+static const float kInstanceSpacing = 3.4f;
+
+static uint32_t divideUp(uint32_t value, uint32_t divisor) {
+  return (value + divisor - 1) / divisor;
+}
+
+// vertices are position, normal pairs; triangles are counter clockwise seen
+// from outside
+void MeshletRenderer::buildMesh(std::vector<glm::vec4>& vertices,
+                                std::vector<uint32_t>& indices) {
+  vertices.resize(kRingSegments * kTubeSegments * 2);
+  for (uint32_t u = 0; u < kRingSegments; u++) {
+    float a = u * 6.2831853f / kRingSegments;
+    for (uint32_t v = 0; v < kTubeSegments; v++) {
+      float b = v * 6.2831853f / kTubeSegments;
+      // ripples, so neighbouring normals spread like on a sculpted asset
+      float r = kTubeRadius * (1.0f + 0.08f * sinf(12.0f * a) * sinf(6.0f * b));
+      float d = kRingRadius + r * cosf(b);
+      vertices[(u * kTubeSegments + v) * 2] =
+          glm::vec4(d * cosf(a), d * sinf(a), r * sinf(b), 1.0f);
+    }
+  }
+
+  auto position = [&](uint32_t i) { return glm::vec3(vertices[i * 2]); };
+  auto addTriangle = [&](uint32_t a, uint32_t b, uint32_t c) {
+    glm::vec3 pa = position(a);
+    glm::vec3 normal = glm::cross(position(b) - pa, position(c) - pa);
+    // the tube's center line is the circle of kRingRadius in z = 0
+    glm::vec3 ring = glm::normalize(glm::vec3(pa.x, pa.y, 0.0f)) * kRingRadius;
+    if (glm::dot(normal, pa - ring) < 0.0f) std::swap(b, c);
+    indices.push_back(a);
+    indices.push_back(b);
+    indices.push_back(c);
+  };
+  for (uint32_t tileU = 0; tileU < kRingSegments; tileU += kTile) {
+    for (uint32_t tileV = 0; tileV < kTubeSegments; tileV += kTile) {
+      for (uint32_t u = tileU; u < std::min(tileU + kTile, kRingSegments);
+           u++) {
+        for (uint32_t v = tileV; v < std::min(tileV + kTile, kTubeSegments);
+             v++) {
+          uint32_t u1 = (u + 1) % kRingSegments;
+          uint32_t v1 = (v + 1) % kTubeSegments;
+          uint32_t i00 = u * kTubeSegments + v, i01 = u * kTubeSegments + v1;
+          uint32_t i10 = u1 * kTubeSegments + v, i11 = u1 * kTubeSegments + v1;
+          addTriangle(i00, i10, i11);
+          addTriangle(i00, i11, i01);
+        }
+      }
+    }
+  }
+
+  // area weighted vertex normals
+  for (size_t t = 0; t < indices.size(); t += 3) {
+    glm::vec3 pa = position(indices[t]);
+    glm::vec3 normal = glm::cross(position(indices[t + 1]) - pa,
+                                  position(indices[t + 2]) - pa);
+    for (size_t k = 0; k < 3; k++) {
+      vertices[indices[t + k] * 2 + 1] += glm::vec4(normal, 0.0f);
+    }
+  }
+  for (size_t i = 1; i < vertices.size(); i += 2) {
+    vertices[i] = glm::vec4(glm::normalize(glm::vec3(vertices[i])), 0.0f);
+  }
+}
+
+// greedy, in index order: a meshlet is closed as soon as the next triangle
+// would push it past kMaxVertices or kMaxTriangles. the bounds are a sphere
+// around the meshlet's box and the narrowest cone around its triangle
+// normals; a triangle with normal n is back facing from every camera
+// position c with dot(n, p - c) >= 0, which over the whole cluster is
+//   dot(center - c, axis) >= cutoff * |center - c| + radius
+// with cutoff the sine of the cone's half angle (the test in the shader).
+void MeshletRenderer::buildMeshlets(const std::vector<glm::vec4>& vertices,
+                                    const std::vector<uint32_t>& indices) {
+  std::vector<uint8_t> local(vertices.size() / 2, 0xff);
+  std::vector<uint32_t> meshletVertices;
+  std::vector<uint32_t> meshletTriangles;
+
+  auto flush = [&]() {
+    if (meshletTriangles.empty()) return;
+    Meshlet m = {};
+    m.vertexOffset = (uint32_t)meshletData.size();
+    m.vertexCount = (uint32_t)meshletVertices.size();
+    meshletData.insert(meshletData.end(), meshletVertices.begin(),
+                       meshletVertices.end());
+    m.triangleOffset = (uint32_t)meshletData.size();
+    m.triangleCount = (uint32_t)meshletTriangles.size();
+    meshletData.insert(meshletData.end(), meshletTriangles.begin(),
+                       meshletTriangles.end());
+
+    glm::vec3 lo(vertices[meshletVertices[0] * 2]), hi = lo;
+    for (uint32_t v : meshletVertices) {
+      lo = glm::min(lo, glm::vec3(vertices[v * 2]));
+      hi = glm::max(hi, glm::vec3(vertices[v * 2]));
+    }
+    glm::vec3 center = (lo + hi) * 0.5f;
+    float radius = 0.0f;
+    for (uint32_t v : meshletVertices) {
+      radius = std::max(radius,
+                        glm::length(glm::vec3(vertices[v * 2]) - center));
+    }
+    m.sphere = glm::vec4(center, radius);
+
+    glm::vec3 normals[kMaxTriangles];
+    glm::vec3 axis(0.0f);
+    for (uint32_t t = 0; t < m.triangleCount; t++) {
+      uint32_t packed = meshletTriangles[t];
+      glm::vec3 p[3];
+      for (uint32_t k = 0; k < 3; k++) {
+        uint32_t v = meshletVertices[(packed >> (8 * k)) & 0xff];
+        p[k] = glm::vec3(vertices[v * 2]);
+      }
+      glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+      float length = glm::length(n);
+      normals[t] = length > 0.0f ? n / length : glm::vec3(0.0f);
+      axis += normals[t];
+    }
+    // a cone of 90 degrees or more doesn't cull anything worth the test
+    float cutoff = 1.0f;
+    if (glm::length(axis) > 0.0f) {
+      axis = glm::normalize(axis);
+      float minDot = 1.0f;
+      for (uint32_t t = 0; t < m.triangleCount; t++) {
+        minDot = std::min(minDot, glm::dot(normals[t], axis));
+      }
+      if (minDot > 0.1f) cutoff = sqrtf(1.0f - minDot * minDot);
+    }
+    m.cone = glm::vec4(axis, cutoff);
+    meshlets.push_back(m);
+
+    for (uint32_t v : meshletVertices) local[v] = 0xff;
+    meshletVertices.clear();
+    meshletTriangles.clear();
+  };
+
+  for (size_t t = 0; t < indices.size(); t += 3) {
+    uint32_t added = 0;
+    for (size_t k = 0; k < 3; k++) added += local[indices[t + k]] == 0xff;
+    if (meshletVertices.size() + added > kMaxVertices ||
+        meshletTriangles.size() == kMaxTriangles) {
+      flush();
+    }
+    uint32_t packed = 0;
+    for (size_t k = 0; k < 3; k++) {
+      uint32_t v = indices[t + k];
+      if (local[v] == 0xff) {
+        local[v] = (uint8_t)meshletVertices.size();
+        meshletVertices.push_back(v);
+      }
+      packed |= (uint32_t)local[v] << (8 * k);
+    }
+    meshletTriangles.push_back(packed);
+  }
+  flush();
+}
+
+void MeshletRenderer::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                           VkPipelineCache cache, uint32_t instanceCount,
+                           uint32_t framesInFlight) {
+  this->device = device;
+  this->framesInFlight = framesInFlight;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  VkPhysicalDeviceProperties properties;
+  vki.vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+  std::vector<glm::vec4> vertices;
+  std::vector<uint32_t> indices;
+  buildMesh(vertices, indices);
+  buildMeshlets(vertices, indices);
+  meshVertexCount = (uint32_t)(vertices.size() / 2);
+  meshTriangleCount = (uint32_t)(indices.size() / 3);
+
+  // the emitted indices address instance * vertexCount + vertex
+  uint32_t maxInstances =
+      std::max(properties.limits.maxDrawIndexedIndexValue / meshVertexCount,
+               1u);
+  if (instanceCount > maxInstances) {
+    printf("meshlets: %u instances is more than one draw can index, using "
+           "%u\n", instanceCount, maxInstances);
+    instanceCount = maxInstances;
+  }
+  // culling is one thread per meshlet of every instance, in one row of
+  // groups
+  uint32_t maxCulled = (uint32_t)std::min<uint64_t>(
+      (uint64_t)properties.limits.maxComputeWorkGroupCount[0] *
+          kCullGroupSize / meshlets.size(),
+      UINT32_MAX / meshlets.size());
+  if (instanceCount > maxCulled) {
+    printf("meshlets: %u instances is more than one cull dispatch covers, "
+           "using %u\n", instanceCount, maxCulled);
+    instanceCount = maxCulled;
+  }
+  this->instanceCount = instanceCount;
+
+  // rows of standing tori behind the origin, facing the camera, so the
+  // front rows hide most of the ones behind
+  std::vector<glm::vec4> instances(instanceCount);
+  uint32_t columns = (uint32_t)ceilf(sqrtf((float)instanceCount));
+  uint32_t seed = 0x3c6ef372u;
+  for (uint32_t i = 0; i < instanceCount; i++) {
+    float x = ((i % columns) - (columns - 1) * 0.5f) * kInstanceSpacing;
+    float z = -8.0f - (i / columns) * kInstanceSpacing;
+    instances[i] = glm::vec4(x + randomFloat(seed) - 0.5f,
+                             2.0f + randomFloat(seed) * 0.6f, z,
+                             0.8f + randomFloat(seed) * 0.4f);
+  }
+
+  const VkMemoryPropertyFlags hostFlags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  struct Upload {
+    VkBuffer* buffer;
+    VkDeviceMemory* memory;
+    const void* data;
+    VkDeviceSize size;
+  };
+  Upload uploads[] = {
+      {&vertexBuffer, &vertexMemory, vertices.data(),
+       vertices.size() * sizeof(glm::vec4)},
+      {&meshletBuffer, &meshletMemory, meshlets.data(),
+       meshlets.size() * sizeof(Meshlet)},
+      {&meshletDataBuffer, &meshletDataMemory, meshletData.data(),
+       meshletData.size() * sizeof(uint32_t)},
+      {&instanceBuffer, &instanceMemory, instances.data(),
+       instances.size() * sizeof(glm::vec4)}};
+  for (const Upload& upload : uploads) {
+    *upload.buffer = createBuffer(
+        device, memoryProperties, upload.size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        hostFlags, MEMORY_BUFFER, *upload.memory);
+    void* mapped;
+    VK_CHECK(vkd.vkMapMemory(device, *upload.memory, 0, VK_WHOLE_SIZE, 0,
+                             &mapped));
+    memcpy(mapped, upload.data, upload.size);
+    vkd.vkUnmapMemory(device, *upload.memory);
+  }
+
+  // per slot, as the cull pass of the next frame may run while this one's
+  // draw still reads its indices. every triangle of every instance would
+  // take hundreds of MB even though most are culled, so the slots hold a
+  // budget and the cull pass drops what doesn't fit.
+  indexCapacity = (uint32_t)std::min<uint64_t>(
+                      (uint64_t)meshTriangleCount * instanceCount,
+                      (uint64_t)kMaxDrawnTriangles) * 3;
+  indexStride = ((VkDeviceSize)indexCapacity * sizeof(uint32_t) + 255) &
+                ~(VkDeviceSize)255;
+  indexBuffer = createBuffer(
+      device, memoryProperties, indexStride * framesInFlight,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, MEMORY_BUFFER, indexMemory);
+  drawBuffer = createBuffer(
+      device, memoryProperties, kSlotStride * framesInFlight,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      0, hostFlags, MEMORY_BUFFER, drawMemory);
+  VK_CHECK(vkd.vkMapMemory(device, drawMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&drawMapped));
+  constantBuffer = createBuffer(device, memoryProperties,
+                                kSlotStride * framesInFlight,
+                                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 0,
+                                hostFlags, MEMORY_BUFFER, constantMemory);
+  VK_CHECK(vkd.vkMapMemory(device, constantMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&constantMapped));
+  slotPending.assign(framesInFlight, false);
+  for (uint32_t slot = 0; slot < framesInFlight; slot++) update(slot);
+
+  VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxLod = (float)kMaxPyramidLevels;
+  VK_CHECK(vkd.vkCreateSampler(device, &samplerInfo, nullptr, &sampler));
+
+  // cull: constants, meshlets, meshlet data, instances, pyramid, indices,
+  // draw
+  VkDescriptorSetLayoutBinding cullBindings[7] = {};
+  for (uint32_t i = 0; i < 7; i++) {
+    cullBindings[i].binding = i;
+    cullBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    cullBindings[i].descriptorCount = 1;
+    cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  cullBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  cullBindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  // reduce: the level above (or depth), the level written
+  VkDescriptorSetLayoutBinding reduceBindings[2] = {};
+  reduceBindings[0] = {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+                       VK_SHADER_STAGE_COMPUTE_BIT, nullptr};
+  reduceBindings[1] = {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+                       VK_SHADER_STAGE_COMPUTE_BIT, nullptr};
+  // draw: vertices, instances
+  VkDescriptorSetLayoutBinding drawBindings[2] = {};
+  for (uint32_t i = 0; i < 2; i++) {
+    drawBindings[i] = {i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                       VK_SHADER_STAGE_VERTEX_BIT, nullptr};
+  }
+  struct SetLayout {
+    VkDescriptorSetLayout* layout;
+    uint32_t bindingCount;
+    const VkDescriptorSetLayoutBinding* bindings;
+  };
+  SetLayout setLayouts[] = {{&cullSetLayout, 7, cullBindings},
+                            {&reduceSetLayout, 2, reduceBindings},
+                            {&drawSetLayout, 2, drawBindings}};
+  for (const SetLayout& s : setLayouts) {
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    setLayoutInfo.bindingCount = s.bindingCount;
+    setLayoutInfo.pBindings = s.bindings;
+    VK_CHECK(vkd.vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr,
+                                             s.layout));
+  }
+
+  VkDescriptorPoolSize drawPoolSize = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2};
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &drawPoolSize;
+  VK_CHECK(vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr, &drawPool));
+  VkDescriptorSetAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  allocInfo.descriptorPool = drawPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &drawSetLayout;
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &allocInfo, &drawSet));
+  VkDescriptorBufferInfo drawInfos[2] = {{vertexBuffer, 0, VK_WHOLE_SIZE},
+                                         {instanceBuffer, 0, VK_WHOLE_SIZE}};
+  VkWriteDescriptorSet drawWrites[2] = {};
+  for (uint32_t i = 0; i < 2; i++) {
+    drawWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    drawWrites[i].dstSet = drawSet;
+    drawWrites[i].dstBinding = i;
+    drawWrites[i].descriptorCount = 1;
+    drawWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    drawWrites[i].pBufferInfo = &drawInfos[i];
+  }
+  vkd.vkUpdateDescriptorSets(device, 2, drawWrites, 0, nullptr);
+
+  VkPipelineLayoutCreateInfo cullLayoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  cullLayoutInfo.setLayoutCount = 1;
+  cullLayoutInfo.pSetLayouts = &cullSetLayout;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &cullLayoutInfo, nullptr,
+                                      &cullLayout));
+
+  // source size, destination size
+  VkPushConstantRange reduceRange = {VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                     4 * sizeof(uint32_t)};
+  VkPipelineLayoutCreateInfo reduceLayoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  reduceLayoutInfo.setLayoutCount = 1;
+  reduceLayoutInfo.pSetLayouts = &reduceSetLayout;
+  reduceLayoutInfo.pushConstantRangeCount = 1;
+  reduceLayoutInfo.pPushConstantRanges = &reduceRange;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &reduceLayoutInfo, nullptr,
+                                      &reduceLayout));
+
+  // viewProj, then the vertex count per instance
+  VkPushConstantRange drawRange = {VK_SHADER_STAGE_VERTEX_BIT, 0,
+                                   sizeof(glm::mat4) + 4 * sizeof(uint32_t)};
+  VkPipelineLayoutCreateInfo drawLayoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  drawLayoutInfo.setLayoutCount = 1;
+  drawLayoutInfo.pSetLayouts = &drawSetLayout;
+  drawLayoutInfo.pushConstantRangeCount = 1;
+  drawLayoutInfo.pPushConstantRanges = &drawRange;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &drawLayoutInfo, nullptr,
+                                      &drawLayout));
+
+  cullShader = createShaderModule(device, readFile("shaders/meshlet_cull.spv"));
+  cullPipeline = compileComputePipeline(device, cache, cullShader, cullLayout);
+  assert(cullPipeline);
+  reduceShader =
+      createShaderModule(device, readFile("shaders/meshlet_depth_reduce.spv"));
+  reducePipeline =
+      compileComputePipeline(device, cache, reduceShader, reduceLayout);
+  assert(reducePipeline);
+
+  vertexShader = createShaderRef(device, readFile("shaders/meshlet_vert.spv"));
+  fragmentShader =
+      createShaderRef(device, readFile("shaders/meshlet_frag.spv"));
+
+  // vertices are pulled from the storage buffer, nothing to bind
+  drawDesc = GraphicsPipelineDesc();
+  drawDesc.vertexShader = vertexShader;
+  drawDesc.fragmentShader = fragmentShader;
+  drawDesc.cullMode = VK_CULL_MODE_BACK_BIT;
+  drawDesc.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  drawDesc.depthTestEnable = VK_TRUE;
+  drawDesc.depthWriteEnable = VK_TRUE;
+  drawDesc.layout = drawLayout;
+
+  // meshletData is every meshlet's vertices, then its triangles
+  printf("meshlets: %u instances of %u triangles in %u meshlets (%.1f "
+         "vertices, %.1f triangles each), %.1fmb of indices per frame\n",
+         instanceCount, meshTriangleCount, (uint32_t)meshlets.size(),
+         (double)(meshletData.size() - meshTriangleCount) / meshlets.size(),
+         (double)meshTriangleCount / meshlets.size(),
+         indexStride / (1024.0 * 1024.0));
+}
+
+VkImageView MeshletRenderer::createPyramidView(uint32_t baseLevel,
+                                               uint32_t levels) {
+  VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+  viewInfo.image = pyramidImage;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = VK_FORMAT_R32_SFLOAT;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, levels, 0,
+                               1};
+  VkImageView view;
+  VK_CHECK(vkd.vkCreateImageView(device, &viewInfo, nullptr, &view));
+  return view;
+}
+
+void MeshletRenderer::resize(VkExtent2D extent, VkImage depthImage,
+                             VkImageView depthView, VkFormat depthFormat,
+                             DeletionQueue& deletionQueue) {
+  deletionQueue.push(resizePool);
+  for (uint32_t i = 0; i < pyramidLevels; i++) {
+    deletionQueue.push(pyramidLevelViews[i]);
+  }
+  deletionQueue.push(pyramidView);
+  deletionQueue.push(pyramidImage);
+  deletionQueue.push(pyramidMemory);
+
+  this->depthImage = depthImage;
+  this->depthView = depthView;
+  depthExtent = extent;
+  depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+  if (depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+      depthFormat == VK_FORMAT_D24_UNORM_S8_UINT ||
+      depthFormat == VK_FORMAT_D16_UNORM_S8_UINT) {
+    depthAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+  }
+
+  // rounded down, so every pyramid texel covers at least one depth texel
+  // and a sphere's rect always fits in two by two texels of some level
+  pyramidExtent = {1, 1};
+  while (pyramidExtent.width * 2 <= extent.width) pyramidExtent.width *= 2;
+  while (pyramidExtent.height * 2 <= extent.height) pyramidExtent.height *= 2;
+  pyramidLevels = 1;
+  while (pyramidLevels < kMaxPyramidLevels &&
+         std::max(pyramidExtent.width, pyramidExtent.height) >> pyramidLevels) {
+    pyramidLevels++;
+  }
+
+  VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = VK_FORMAT_R32_SFLOAT;
+  imageInfo.extent = {pyramidExtent.width, pyramidExtent.height, 1};
+  imageInfo.mipLevels = pyramidLevels;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VK_CHECK(vkd.vkCreateImage(device, &imageInfo, nullptr, &pyramidImage));
+  VkMemoryRequirements memReq;
+  vkd.vkGetImageMemoryRequirements(device, pyramidImage, &memReq);
+  VkMemoryAllocateInfo memoryInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+  memoryInfo.allocationSize = memReq.size;
+  memoryInfo.memoryTypeIndex =
+      findMemoryType(memoryProperties, memReq.memoryTypeBits, 0,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  assert(memoryInfo.memoryTypeIndex != UINT32_MAX);
+  VK_CHECK(allocateTrackedMemory(device, memoryInfo, MEMORY_RENDER_TARGET,
+                                 pyramidMemory));
+  VK_CHECK(vkd.vkBindImageMemory(device, pyramidImage, pyramidMemory, 0));
+  for (uint32_t i = 0; i < pyramidLevels; i++) {
+    pyramidLevelViews[i] = createPyramidView(i, 1);
+  }
+  pyramidView = createPyramidView(0, pyramidLevels);
+
+  VkDescriptorPoolSize poolSizes[] = {
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, framesInFlight},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5 * framesInFlight},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+       framesInFlight + pyramidLevels},
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, pyramidLevels}};
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = framesInFlight + pyramidLevels;
+  poolInfo.poolSizeCount = 4;
+  poolInfo.pPoolSizes = poolSizes;
+  VK_CHECK(vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr, &resizePool));
+
+  std::vector<VkDescriptorSetLayout> layouts(framesInFlight, cullSetLayout);
+  cullSets.resize(framesInFlight);
+  VkDescriptorSetAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  allocInfo.descriptorPool = resizePool;
+  allocInfo.descriptorSetCount = framesInFlight;
+  allocInfo.pSetLayouts = layouts.data();
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &allocInfo, cullSets.data()));
+  layouts.assign(pyramidLevels, reduceSetLayout);
+  allocInfo.descriptorSetCount = pyramidLevels;
+  allocInfo.pSetLayouts = layouts.data();
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &allocInfo, reduceSets));
+
+  VkDescriptorImageInfo pyramidInfo = {sampler, pyramidView,
+                                       VK_IMAGE_LAYOUT_GENERAL};
+  for (uint32_t slot = 0; slot < framesInFlight; slot++) {
+    VkDescriptorBufferInfo bufferInfos[7] = {
+        {constantBuffer, slot * kSlotStride, sizeof(CullConstants)},
+        {meshletBuffer, 0, VK_WHOLE_SIZE},
+        {meshletDataBuffer, 0, VK_WHOLE_SIZE},
+        {instanceBuffer, 0, VK_WHOLE_SIZE},
+        {},
+        {indexBuffer, slot * indexStride, indexStride},
+        {drawBuffer, slot * kSlotStride, sizeof(DrawArgs)}};
+    VkWriteDescriptorSet writes[7] = {};
+    for (uint32_t i = 0; i < 7; i++) {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = cullSets[slot];
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writes[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[4].pBufferInfo = nullptr;
+    writes[4].pImageInfo = &pyramidInfo;
+    vkd.vkUpdateDescriptorSets(device, 7, writes, 0, nullptr);
+  }
+
+  // level 0 reduces the depth buffer, every other level the one above
+  for (uint32_t i = 0; i < pyramidLevels; i++) {
+    VkDescriptorImageInfo imageInfos[2] = {
+        i == 0 ? VkDescriptorImageInfo{sampler, depthView,
+                                       VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}
+               : VkDescriptorImageInfo{sampler, pyramidLevelViews[i - 1],
+                                       VK_IMAGE_LAYOUT_GENERAL},
+        {VK_NULL_HANDLE, pyramidLevelViews[i], VK_IMAGE_LAYOUT_GENERAL}};
+    VkWriteDescriptorSet writes[2] = {};
+    for (uint32_t k = 0; k < 2; k++) {
+      writes[k].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[k].dstSet = reduceSets[i];
+      writes[k].dstBinding = k;
+      writes[k].descriptorCount = 1;
+      writes[k].pImageInfo = &imageInfos[k];
+    }
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    vkd.vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+  }
+
+  // the new pyramid starts out UNDEFINED, and there is no depth yet to
+  // test against
+  pyramidInitialized = false;
+  pyramidValid = false;
+}
+
+void MeshletRenderer::destroy() {
+  vkd.vkDestroyPipeline(device, cullPipeline, nullptr);
+  vkd.vkDestroyPipeline(device, reducePipeline, nullptr);
+  vkd.vkDestroyShaderModule(device, cullShader, nullptr);
+  vkd.vkDestroyShaderModule(device, reduceShader, nullptr);
+  vkd.vkDestroyShaderModule(device, vertexShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, fragmentShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(device, cullLayout, nullptr);
+  vkd.vkDestroyPipelineLayout(device, reduceLayout, nullptr);
+  vkd.vkDestroyPipelineLayout(device, drawLayout, nullptr);
+  vkd.vkDestroyDescriptorPool(device, resizePool, nullptr);
+  vkd.vkDestroyDescriptorPool(device, drawPool, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, cullSetLayout, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, reduceSetLayout, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, drawSetLayout, nullptr);
+  for (uint32_t i = 0; i < pyramidLevels; i++) {
+    vkd.vkDestroyImageView(device, pyramidLevelViews[i], nullptr);
+  }
+  vkd.vkDestroyImageView(device, pyramidView, nullptr);
+  vkd.vkDestroyImage(device, pyramidImage, nullptr);
+  freeTrackedMemory(device, pyramidMemory);
+  vkd.vkDestroySampler(device, sampler, nullptr);
+  vkd.vkUnmapMemory(device, drawMemory);
+  vkd.vkUnmapMemory(device, constantMemory);
+  VkBuffer buffers[] = {vertexBuffer,   meshletBuffer, meshletDataBuffer,
+                        instanceBuffer, indexBuffer,   drawBuffer,
+                        constantBuffer};
+  VkDeviceMemory memories[] = {vertexMemory,   meshletMemory, meshletDataMemory,
+                               instanceMemory, indexMemory,   drawMemory,
+                               constantMemory};
+  for (uint32_t i = 0; i < 7; i++) {
+    vkd.vkDestroyBuffer(device, buffers[i], nullptr);
+    freeTrackedMemory(device, memories[i]);
+  }
+}
+
+void MeshletRenderer::update(uint32_t slot) {
+  DrawArgs* args = (DrawArgs*)(drawMapped + slot * kSlotStride);
+  if (slotPending[slot]) {
+    frames++;
+    drawnTriangles += args->indexCount / 3;
+    visibleClusters += args->visibleClusters;
+    frustumCulled += args->frustumCulled;
+    backfaceCulled += args->backfaceCulled;
+    occlusionCulled += args->occlusionCulled;
+    droppedTriangles += args->droppedTriangles;
+    slotPending[slot] = false;
+  }
+  // the cull pass appends to indexCount and the counters
+  DrawArgs reset = {};
+  reset.instanceCount = 1;
+  memcpy(args, &reset, sizeof(reset));
+}
+
+void MeshletRenderer::cull(VkCommandBuffer cmd, uint32_t slot,
+                           const glm::mat4& view, const glm::mat4& projection,
+                           GpuTimer& timer) {
+  // frustum planes, pointing inwards; depth is zero to one
+  glm::mat4 viewProj = projection * view;
+  CullConstants c = {};
+  for (int i = 0; i < 4; i++) {
+    glm::vec4 row(viewProj[0][i / 2], viewProj[1][i / 2], viewProj[2][i / 2],
+                  viewProj[3][i / 2]);
+    glm::vec4 w(viewProj[0][3], viewProj[1][3], viewProj[2][3],
+                viewProj[3][3]);
+    c.planes[i] = i % 2 ? w - row : w + row;
+  }
+  c.planes[4] = glm::vec4(viewProj[0][2], viewProj[1][2], viewProj[2][2],
+                          viewProj[3][2]);
+  c.planes[5] = glm::vec4(viewProj[0][3], viewProj[1][3], viewProj[2][3],
+                          viewProj[3][3]) - c.planes[4];
+  for (glm::vec4& plane : c.planes) plane /= glm::length(glm::vec3(plane));
+  c.cameraPosition = glm::inverse(view)[3];
+  c.pyramidView = pyramidCameraView;
+  c.pyramidProjection =
+      glm::vec4(pyramidCameraProjection[0][0], pyramidCameraProjection[1][1],
+                pyramidCameraProjection[2][2], pyramidCameraProjection[3][2]);
+  c.pyramidSize = glm::vec4((float)pyramidExtent.width,
+                            (float)pyramidExtent.height, (float)pyramidLevels,
+                            0.0f);
+  c.meshletCount = (uint32_t)meshlets.size();
+  c.instanceCount = instanceCount;
+  c.vertexCount = meshVertexCount;
+  c.flags = kFlagCone | (pyramidValid ? kFlagOcclusion : 0);
+  c.indexCapacity = indexCapacity;
+  memcpy(constantMapped + slot * kSlotStride, &c, sizeof(c));
+  lastView = view;
+  lastProjection = projection;
+  slotPending[slot] = true;
+
+  uint32_t zone = timer.begin(cmd, "meshlet cull");
+  // the last pyramid was written by compute; a new one is bound already,
+  // so it needs its layout even though nothing samples it yet
+  VkMemoryBarrier reduced = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  reduced.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  reduced.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  VkImageMemoryBarrier toGeneral = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+  toGeneral.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  toGeneral.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  toGeneral.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  toGeneral.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toGeneral.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toGeneral.image = pyramidImage;
+  toGeneral.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels, 0,
+                                1};
+  uint32_t imageBarriers = pyramidInitialized ? 0 : 1;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &reduced,
+                           0, nullptr, imageBarriers, &toGeneral);
+  pyramidInitialized = true;
+
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullLayout,
+                              0, 1, &cullSets[slot], 0, nullptr);
+  uint32_t groups = divideUp(c.meshletCount * instanceCount, kCullGroupSize);
+  vkd.vkCmdDispatch(cmd, groups, 1, 1);
+
+  VkMemoryBarrier culled = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  culled.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  culled.dstAccessMask =
+      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+  vkd.vkCmdPipelineBarrier(
+      cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+      0, 1, &culled, 0, nullptr, 0, nullptr);
+  timer.end(cmd, zone, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+
+void MeshletRenderer::draw(VkCommandBuffer cmd, uint32_t slot,
+                           const glm::mat4& viewProj,
+                           PipelineVariantCache& pipelines) {
+  VkPipeline pipeline = pipelines.request(drawDesc);
+  if (!pipeline) return;
+
+  struct {
+    glm::mat4 viewProj;
+    uint32_t vertexCount;
+    uint32_t pad[3];
+  } constants = {viewProj, meshVertexCount, {}};
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, drawLayout,
+                              0, 1, &drawSet, 0, nullptr);
+  vkd.vkCmdPushConstants(cmd, drawLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                         sizeof(constants), &constants);
+  vkd.vkCmdBindIndexBuffer(cmd, indexBuffer, slot * indexStride,
+                           VK_INDEX_TYPE_UINT32);
+  vkd.vkCmdDrawIndexedIndirect(cmd, drawBuffer, slot * kSlotStride, 1, 0);
+}
+
+void MeshletRenderer::buildDepthPyramid(VkCommandBuffer cmd,
+                                        GpuTimer& timer) {
+  uint32_t zone = timer.begin(cmd, "depth pyramid");
+
+  // depth becomes readable; the pyramid is still read by this frame's cull
+  VkImageMemoryBarrier barriers[2] = {};
+  barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  barriers[0].image = depthImage;
+  barriers[0].subresourceRange = {depthAspect, 0, 1, 0, 1};
+  barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[1].srcAccessMask = 0;
+  barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barriers[1].image = pyramidImage;
+  barriers[1].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels,
+                                  0, 1};
+  for (uint32_t i = 0; i < 2; i++) {
+    barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  }
+  const VkPipelineStageFlags srcStages =
+      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  vkd.vkCmdPipelineBarrier(cmd, srcStages, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           0, 0, nullptr, 0, nullptr, 2, barriers);
+
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, reducePipeline);
+  uint32_t sourceWidth = depthExtent.width, sourceHeight = depthExtent.height;
+  for (uint32_t i = 0; i < pyramidLevels; i++) {
+    uint32_t width = std::max(pyramidExtent.width >> i, 1u);
+    uint32_t height = std::max(pyramidExtent.height >> i, 1u);
+    if (i > 0) {
+      VkMemoryBarrier level = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+      level.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      level.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                               &level, 0, nullptr, 0, nullptr);
+    }
+    uint32_t sizes[4] = {sourceWidth, sourceHeight, width, height};
+    vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                reduceLayout, 0, 1, &reduceSets[i], 0, nullptr);
+    vkd.vkCmdPushConstants(cmd, reduceLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(sizes), sizes);
+    vkd.vkCmdDispatch(cmd, divideUp(width, kReduceTile),
+                      divideUp(height, kReduceTile), 1);
+    sourceWidth = width;
+    sourceHeight = height;
+  }
+  timer.end(cmd, zone, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  // the next frame's cull tests against what this frame's camera saw
+  pyramidCameraView = lastView;
+  pyramidCameraProjection = lastProjection;
+  pyramidValid = true;
+}
+
+void MeshletRenderer::printStats() const {
+  if (!frames) return;
+  uint64_t clusters = (uint64_t)meshlets.size() * instanceCount * frames;
+  uint64_t triangles = (uint64_t)meshTriangleCount * instanceCount;
+  printf("meshlets: %.0f of %llu triangles drawn per frame (%.1f%%); of the "
+         "clusters %.1f%% visible, %.1f%% outside the frustum, %.1f%% "
+         "facing away, %.1f%% occluded\n",
+         (double)drawnTriangles / frames, (unsigned long long)triangles,
+         100.0 * drawnTriangles / frames / triangles,
+         100.0 * visibleClusters / clusters, 100.0 * frustumCulled / clusters,
+         100.0 * backfaceCulled / clusters, 100.0 * occlusionCulled / clusters);
+  if (droppedTriangles) {
+    printf("meshlets: %.0f triangles per frame dropped past the %u triangle "
+           "budget\n",
+           (double)droppedTriangles / frames, indexCapacity / 3);
+  }
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "pipeline_cache.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+class DeletionQueue;
+class GpuTimer;
+
+// Dense meshes drawn as clusters ("meshlets") culled on the GPU, with core
+// compute only - no mesh shaders.
+//
+// At load the mesh is cut into meshlets of at most kMaxVertices vertices and
+// kMaxTriangles triangles, each with a bounding sphere and a cone around its
+// triangle normals. Every frame cull() tests each meshlet of each instance in
+// a compute pass:
+//   frustum    the sphere against the six planes
+//   backface   the normal cone: every triangle faces away from the camera
+//   occlusion  the sphere's screen rect against a max depth pyramid built
+//              from the previous frame's depth buffer, reprojected with the
+//              camera that rendered it
+// and the survivors append their triangles to this frame's index buffer,
+// which draw() renders with one indexed indirect draw. It holds at most
+// kMaxDrawnTriangles per frame; triangles past that are dropped and counted.
+// The pyramid is rebuilt by buildDepthPyramid() after the main pass; a
+// cluster that comes out from behind an occluder shows up a frame late.
+class MeshletRenderer {
+ public:
+  static const uint32_t kMaxVertices = 64;
+  static const uint32_t kMaxTriangles = 124;
+  static const uint32_t kMaxDrawnTriangles = 1u << 21;  // per frame
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            VkPipelineCache cache, uint32_t instanceCount,
+            uint32_t framesInFlight);
+  void destroy();
+
+  // (re)builds the depth pyramid for a new depth buffer; the old one goes
+  // through the deletion queue. the depth image needs SAMPLED usage and has
+  // to be stored at the end of the main pass.
+  void resize(VkExtent2D extent, VkImage depthImage, VkImageView depthView,
+              VkFormat depthFormat, DeletionQueue& deletionQueue);
+
+  // once the slot's fence was waited on: collects the slot's last counts
+  // and resets its draw
+  void update(uint32_t slot);
+  // outside a render pass, before the main pass
+  void cull(VkCommandBuffer cmd, uint32_t slot, const glm::mat4& view,
+            const glm::mat4& projection, GpuTimer& timer);
+  // inside the main pass
+  void draw(VkCommandBuffer cmd, uint32_t slot, const glm::mat4& viewProj,
+            PipelineVariantCache& pipelines);
+  // after the main pass; expects depth in DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+  // and leaves it in DEPTH_STENCIL_READ_ONLY_OPTIMAL
+  void buildDepthPyramid(VkCommandBuffer cmd, GpuTimer& timer);
+
+  void printStats() const;
+
+  // the owner fills in renderPassKey like for any other pipeline
+  GraphicsPipelineDesc drawDesc;
+
+ private:
+  // mirrors the structs in meshlet_cull.comp
+  struct Meshlet {
+    glm::vec4 sphere;  // center, radius
+    glm::vec4 cone;    // axis, cutoff; a cutoff of 1 never culls
+    uint32_t vertexOffset;    // into meshletData: global vertex indices
+    uint32_t triangleOffset;  // into meshletData: three 8 bit local indices
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+  };
+
+  struct CullConstants {
+    glm::vec4 planes[6];  // normalized, pointing inwards
+    glm::vec4 cameraPosition;
+    glm::mat4 pyramidView;
+    glm::vec4 pyramidProjection;  // P00, P11, P22, P32
+    glm::vec4 pyramidSize;        // width, height, levels, unused
+    uint32_t meshletCount;
+    uint32_t instanceCount;
+    uint32_t vertexCount;  // per instance
+    uint32_t flags;
+    uint32_t indexCapacity;  // per slot
+  };
+
+  // VkDrawIndexedIndirectCommand, then what the cull pass counted
+  struct DrawArgs {
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstInstance;
+    uint32_t visibleClusters;
+    uint32_t frustumCulled;
+    uint32_t backfaceCulled;
+    uint32_t occlusionCulled;
+    uint32_t droppedTriangles;  // past indexCapacity
+  };
+
+  static const uint32_t kMaxPyramidLevels = 16;
+
+  void buildMesh(std::vector<glm::vec4>& vertices,
+                 std::vector<uint32_t>& indices);
+  void buildMeshlets(const std::vector<glm::vec4>& vertices,
+                     const std::vector<uint32_t>& indices);
+  VkImageView createPyramidView(uint32_t baseLevel, uint32_t levels);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  uint32_t framesInFlight = 0;
+
+  std::vector<Meshlet> meshlets;
+  std::vector<uint32_t> meshletData;
+  uint32_t meshVertexCount = 0;
+  uint32_t meshTriangleCount = 0;
+  uint32_t instanceCount = 0;
+
+  VkBuffer vertexBuffer = VK_NULL_HANDLE;  // position, normal per vertex
+  VkDeviceMemory vertexMemory = VK_NULL_HANDLE;
+  VkBuffer meshletBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory meshletMemory = VK_NULL_HANDLE;
+  VkBuffer meshletDataBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory meshletDataMemory = VK_NULL_HANDLE;
+  VkBuffer instanceBuffer = VK_NULL_HANDLE;  // position, scale
+  VkDeviceMemory instanceMemory = VK_NULL_HANDLE;
+  // per slot: the compacted indices, and the draw plus counters (mapped)
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory indexMemory = VK_NULL_HANDLE;
+  VkDeviceSize indexStride = 0;
+  uint32_t indexCapacity = 0;  // whole triangles' worth
+  VkBuffer drawBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory drawMemory = VK_NULL_HANDLE;
+  uint8_t* drawMapped = nullptr;
+  VkBuffer constantBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory constantMemory = VK_NULL_HANDLE;
+  uint8_t* constantMapped = nullptr;
+  static const VkDeviceSize kSlotStride = 256;
+
+  // the max depth pyramid; mip 0 is the depth buffer's size rounded down to
+  // powers of two
+  VkImage depthImage = VK_NULL_HANDLE;
+  VkImageView depthView = VK_NULL_HANDLE;
+  VkImageAspectFlags depthAspect = 0;
+  VkExtent2D depthExtent = {};
+  VkImage pyramidImage = VK_NULL_HANDLE;
+  VkDeviceMemory pyramidMemory = VK_NULL_HANDLE;
+  VkImageView pyramidView = VK_NULL_HANDLE;
+  VkImageView pyramidLevelViews[kMaxPyramidLevels] = {};
+  VkExtent2D pyramidExtent = {};
+  uint32_t pyramidLevels = 0;
+  bool pyramidInitialized = false;
+  // set once a pyramid was built; the camera it was built with
+  bool pyramidValid = false;
+  glm::mat4 pyramidCameraView = glm::mat4(1.0f);
+  glm::mat4 pyramidCameraProjection = glm::mat4(1.0f);
+  glm::mat4 lastView = glm::mat4(1.0f);
+  glm::mat4 lastProjection = glm::mat4(1.0f);
+  VkSampler sampler = VK_NULL_HANDLE;
+
+  VkDescriptorSetLayout cullSetLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout reduceSetLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout drawSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool drawPool = VK_NULL_HANDLE;
+  VkDescriptorSet drawSet = VK_NULL_HANDLE;
+  // rebuilt with the pyramid
+  VkDescriptorPool resizePool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> cullSets;
+  VkDescriptorSet reduceSets[kMaxPyramidLevels] = {};
+
+  VkPipelineLayout cullLayout = VK_NULL_HANDLE;
+  VkPipelineLayout reduceLayout = VK_NULL_HANDLE;
+  VkPipelineLayout drawLayout = VK_NULL_HANDLE;
+  VkShaderModule cullShader = VK_NULL_HANDLE;
+  VkShaderModule reduceShader = VK_NULL_HANDLE;
+  VkPipeline cullPipeline = VK_NULL_HANDLE;
+  VkPipeline reducePipeline = VK_NULL_HANDLE;
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+
+  std::vector<bool> slotPending;
+  uint64_t frames = 0;
+  uint64_t drawnTriangles = 0;
+  uint64_t visibleClusters = 0;
+  uint64_t frustumCulled = 0;
+  uint64_t backfaceCulled = 0;
+  uint64_t occlusionCulled = 0;
+  uint64_t droppedTriangles = 0;
+};
@@ -0,0 +1,280 @@
+#include "particles.h"
+
+#include "file_io.h"
+#include "memory_budget.h"
+#include "profiler.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+// must match particle_common.glsl
+static const uint32_t kGroupSize = 256;
+static const uint32_t kSortBlock = 512;
+static const uint32_t kArgsEmit = 0;
+static const uint32_t kArgsSimulate = 3;
+static const uint32_t kArgsDraw = 6;
+static const uint32_t kArgsSort = 10;
+static const uint32_t kArgsCount = 13;
+static const uint32_t kCounterCount = 5;
+
+static const char* kComputeShaderPaths[] = {
+    "shaders/particle_init.spv",     "shaders/particle_kickoff.spv",
+    "shaders/particle_emit.spv",     "shaders/particle_simulate.spv",
+    "shaders/particle_finalize.spv", "shaders/particle_sort.spv"};
+
+void ParticleSystem::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                          VkPipelineCache cache, uint32_t capacity,
+                          float emitPerSecond) {
+  this->device = device;
+  this->emitPerSecond = emitPerSecond;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  particleCapacity = kSortBlock;
+  while (particleCapacity < capacity) particleCapacity <<= 1;
+
+  const VkBufferUsageFlags storage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  const VkDeviceSize sizes[BUFFER_COUNT] = {
+      (VkDeviceSize)particleCapacity * 48, (VkDeviceSize)particleCapacity * 4,
+      (VkDeviceSize)particleCapacity * 4 * 2,
+      (VkDeviceSize)particleCapacity * 4, kCounterCount * 4, kArgsCount * 4};
+  for (uint32_t i = 0; i < BUFFER_COUNT; i++) {
+    VkBufferUsageFlags usage = storage;
+    if (i == BUFFER_INDIRECT) usage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    buffers[i] = createBuffer(device, memoryProperties, sizes[i], usage,
+                              0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                              MEMORY_BUFFER, memory[i]);
+  }
+
+  VkDescriptorSetLayoutBinding bindings[BUFFER_COUNT] = {};
+  for (uint32_t i = 0; i < BUFFER_COUNT; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags =
+        VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+  setLayoutInfo.bindingCount = BUFFER_COUNT;
+  setLayoutInfo.pBindings = bindings;
+  VK_CHECK(vkd.vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr,
+                                           &setLayout));
+
+  VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                   BUFFER_COUNT};
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  VK_CHECK(vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                      &descriptorPool));
+
+  VkDescriptorSetAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
+
+  VkDescriptorBufferInfo bufferInfos[BUFFER_COUNT];
+  VkWriteDescriptorSet writes[BUFFER_COUNT] = {};
+  for (uint32_t i = 0; i < BUFFER_COUNT; i++) {
+    bufferInfos[i] = {buffers[i], 0, VK_WHOLE_SIZE};
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = descriptorSet;
+    writes[i].dstBinding = i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[i].pBufferInfo = &bufferInfos[i];
+  }
+  vkd.vkUpdateDescriptorSets(device, BUFFER_COUNT, writes, 0, nullptr);
+
+  VkPushConstantRange pushRange = {
+      VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 0,
+      sizeof(Constants)};
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushRange;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout));
+
+  for (uint32_t i = 0; i < PASS_COUNT; i++) {
+    computeShaders[i] =
+        createShaderModule(device, readFile(kComputeShaderPaths[i]));
+    computePipelines[i] =
+        compileComputePipeline(device, cache, computeShaders[i], layout);
+    assert(computePipelines[i]);
+  }
+
+  vertexShader = createShaderRef(device, readFile("shaders/particle_vert.spv"));
+  fragmentShader =
+      createShaderRef(device, readFile("shaders/particle_frag.spv"));
+
+  // no vertex input, quads are expanded from gl_VertexIndex
+  drawDesc = GraphicsPipelineDesc();
+  drawDesc.vertexShader = vertexShader;
+  drawDesc.fragmentShader = fragmentShader;
+  drawDesc.cullMode = VK_CULL_MODE_NONE;
+  drawDesc.depthTestEnable = VK_TRUE;
+  drawDesc.depthWriteEnable = VK_FALSE;
+  drawDesc.blendEnable = VK_TRUE;
+  drawDesc.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  drawDesc.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  drawDesc.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  drawDesc.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  drawDesc.layout = layout;
+
+  printf("particles: capacity %u, %.2fmb of buffers\n", particleCapacity,
+         particleCapacity * (48 + 4 + 8 + 4) / (1024.0 * 1024.0));
+}
+
+void ParticleSystem::destroy() {
+  for (uint32_t i = 0; i < PASS_COUNT; i++) {
+    vkd.vkDestroyPipeline(device, computePipelines[i], nullptr);
+    vkd.vkDestroyShaderModule(device, computeShaders[i], nullptr);
+  }
+  vkd.vkDestroyShaderModule(device, vertexShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, fragmentShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(device, layout, nullptr);
+  vkd.vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  for (uint32_t i = 0; i < BUFFER_COUNT; i++) {
+    vkd.vkDestroyBuffer(device, buffers[i], nullptr);
+    freeTrackedMemory(device, memory[i]);
+  }
+}
+
+void ParticleSystem::computeBarrier(VkCommandBuffer cmd,
+                                    VkPipelineStageFlags dstStages) {
+  VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                          VK_ACCESS_SHADER_WRITE_BIT |
+                          VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStages,
+                           0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void ParticleSystem::dispatch(VkCommandBuffer cmd, Pass pass,
+                              uint32_t groups) {
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                        computePipelines[pass]);
+  vkd.vkCmdPushConstants(cmd, layout,
+                         VK_SHADER_STAGE_COMPUTE_BIT |
+                             VK_SHADER_STAGE_VERTEX_BIT,
+                         0, sizeof(Constants), &constants);
+  vkd.vkCmdDispatch(cmd, groups, 1, 1);
+}
+
+void ParticleSystem::dispatchIndirect(VkCommandBuffer cmd, Pass pass,
+                                      uint32_t argsOffset) {
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                        computePipelines[pass]);
+  vkd.vkCmdPushConstants(cmd, layout,
+                         VK_SHADER_STAGE_COMPUTE_BIT |
+                             VK_SHADER_STAGE_VERTEX_BIT,
+                         0, sizeof(Constants), &constants);
+  vkd.vkCmdDispatchIndirect(cmd, buffers[BUFFER_INDIRECT], argsOffset * 4);
+}
+
+void ParticleSystem::update(VkCommandBuffer cmd, float dt,
+                            const glm::mat4& view, const glm::mat4& proj,
+                            const glm::vec3& cameraPosition) {
+  const VkPipelineStageFlags computeAndIndirect =
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+
+  time += dt;
+  emitAccumulator += emitPerSecond * dt;
+  uint32_t emitRequest = (uint32_t)emitAccumulator;
+  emitAccumulator -= (float)emitRequest;
+
+  constants.viewProj = proj * view;
+  constants.emitterPosition = glm::vec4(0.0f, 0.0f, 0.0f, proj[0][0]);
+  constants.cameraPosition = glm::vec4(cameraPosition, proj[1][1]);
+  constants.dt = dt;
+  constants.time = time;
+  constants.parity = parity;
+  constants.emitRequest = emitRequest;
+  constants.capacity = particleCapacity;
+  constants.frame = frame++;
+  constants.sortK = 0;
+  constants.sortJ = 0;
+
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1,
+                              &descriptorSet, 0, nullptr);
+
+  // the previous frame's draw still reads these buffers
+  VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkd.vkCmdPipelineBarrier(cmd,
+                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                               VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                           0, nullptr, 0, nullptr);
+
+  if (!initialized) {
+    dispatch(cmd, PASS_INIT, particleCapacity / kGroupSize);
+    computeBarrier(cmd, computeAndIndirect);
+    initialized = true;
+  }
+
+  dispatch(cmd, PASS_KICKOFF, 1);
+  computeBarrier(cmd, computeAndIndirect);
+  dispatchIndirect(cmd, PASS_EMIT, kArgsEmit);
+  computeBarrier(cmd, computeAndIndirect);
+  dispatchIndirect(cmd, PASS_SIMULATE, kArgsSimulate);
+  computeBarrier(cmd, computeAndIndirect);
+  dispatch(cmd, PASS_FINALIZE, 1);
+  computeBarrier(cmd, computeAndIndirect);
+
+  // bitonic sort: blocks sorted in shared memory, then every larger stage as
+  // global steps down to the block size plus one shared memory merge
+  dispatchIndirect(cmd, PASS_SORT, kArgsSort);
+  computeBarrier(cmd, computeAndIndirect);
+  for (uint32_t k = kSortBlock * 2; k <= particleCapacity; k <<= 1) {
+    for (uint32_t j = k >> 1; j >= kSortBlock; j >>= 1) {
+      constants.sortK = k;
+      constants.sortJ = j;
+      dispatchIndirect(cmd, PASS_SORT, kArgsSort);
+      computeBarrier(cmd, computeAndIndirect);
+    }
+    constants.sortK = k;
+    constants.sortJ = kSortBlock >> 1;
+    dispatchIndirect(cmd, PASS_SORT, kArgsSort);
+    computeBarrier(cmd, computeAndIndirect);
+  }
+
+  // the draw reads the alive list written this frame
+  VkMemoryBarrier toDraw = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  toDraw.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  toDraw.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                               VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                           0, 1, &toDraw, 0, nullptr, 0, nullptr);
+
+  parity ^= 1;
+}
+
+void ParticleSystem::draw(VkCommandBuffer cmd,
+                          PipelineVariantCache& pipelines) {
+  if (!initialized) return;
+  VkPipeline pipeline = pipelines.request(drawDesc);
+  if (!pipeline) return;
+
+  // constants still hold the parity update() ran with
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0,
+                              1, &descriptorSet, 0, nullptr);
+  vkd.vkCmdPushConstants(cmd, layout,
+                         VK_SHADER_STAGE_COMPUTE_BIT |
+                             VK_SHADER_STAGE_VERTEX_BIT,
+                         0, sizeof(Constants), &constants);
+  vkd.vkCmdDrawIndirect(cmd, buffers[BUFFER_INDIRECT], kArgsDraw * 4, 1, 0);
+}
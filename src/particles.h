@@ -0,0 +1,95 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "pipeline_cache.h"
+
+#include <glm/glm.hpp>
+
+// Particles that live entirely on the GPU. Fixed capacity storage buffers hold
+// the particles, a dead list of free slots and two alive lists that swap every
+// frame. Each update runs kickoff -> emit -> simulate -> finalize -> sort in
+// compute: emit pops dead slots, simulate compacts survivors into the other
+// alive list and pushes expired slots back, and the dispatch/draw sizes are
+// written by the GPU into an indirect args buffer. The CPU only records the
+// same fixed command sequence and never reads anything back.
+class ParticleSystem {
+ public:
+  // capacity is rounded up to a power of two of at least 512 for the sort
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            VkPipelineCache cache, uint32_t capacity, float emitPerSecond);
+  void destroy();
+
+  // compute passes; record outside a render pass, before draw()
+  void update(VkCommandBuffer cmd, float dt, const glm::mat4& view,
+              const glm::mat4& proj, const glm::vec3& cameraPosition);
+  // sorted, alpha blended draw inside the main render pass
+  void draw(VkCommandBuffer cmd, PipelineVariantCache& pipelines);
+
+  uint32_t capacity() const { return particleCapacity; }
+
+  // the owner fills in renderPassKey like for any other pipeline
+  GraphicsPipelineDesc drawDesc;
+
+ private:
+  // mirrors the push constant block in particle_common.glsl
+  struct Constants {
+    glm::mat4 viewProj;
+    glm::vec4 emitterPosition;  // w: projection x scale
+    glm::vec4 cameraPosition;   // w: projection y scale
+    float dt;
+    float time;
+    uint32_t parity;
+    uint32_t emitRequest;
+    uint32_t capacity;
+    uint32_t frame;
+    uint32_t sortK;
+    uint32_t sortJ;
+  };
+
+  enum Pass {
+    PASS_INIT,
+    PASS_KICKOFF,
+    PASS_EMIT,
+    PASS_SIMULATE,
+    PASS_FINALIZE,
+    PASS_SORT,
+    PASS_COUNT
+  };
+
+  enum BufferIndex {
+    BUFFER_PARTICLES,
+    BUFFER_DEAD,
+    BUFFER_ALIVE,
+    BUFFER_SORT_KEYS,
+    BUFFER_COUNTERS,
+    BUFFER_INDIRECT,
+    BUFFER_COUNT
+  };
+
+  void dispatch(VkCommandBuffer cmd, Pass pass, uint32_t groups);
+  void dispatchIndirect(VkCommandBuffer cmd, Pass pass, uint32_t argsOffset);
+  void computeBarrier(VkCommandBuffer cmd, VkPipelineStageFlags dstStages);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  uint32_t particleCapacity = 0;
+  float emitPerSecond = 0.0f;
+  float emitAccumulator = 0.0f;
+  float time = 0.0f;
+  uint32_t frame = 0;
+  uint32_t parity = 0;
+  bool initialized = false;
+  Constants constants = {};
+
+  VkBuffer buffers[BUFFER_COUNT] = {};
+  VkDeviceMemory memory[BUFFER_COUNT] = {};
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkShaderModule computeShaders[PASS_COUNT] = {};
+  VkPipeline computePipelines[PASS_COUNT] = {};
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+};
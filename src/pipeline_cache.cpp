@@ -0,0 +1,440 @@
+#include "pipeline_cache.h"
+
+#include "job_system.h"
+#include "profiler.h"
+#include "vk_dispatch.h"
+
+#include <fstream>
+
+static uint64_t fnv1a(const void* data, size_t size,
+                      uint64_t hash = 14695981039346656037ull) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+ShaderRef createShaderRef(VkDevice device, const std::vector<char>& code) {
+  VkShaderModuleCreateInfo createInfo = {
+      VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+  createInfo.codeSize = code.size();
+  createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  ShaderRef ref;
+  VK_CHECK(vkd.vkCreateShaderModule(device, &createInfo, nullptr, &ref.module));
+  ref.hash = fnv1a(code.data(), code.size());
+  return ref;
+}
+
+static uint64_t hashReferences(const VkAttachmentReference* refs,
+                               uint32_t count, uint64_t hash) {
+  hash = fnv1a(&count, sizeof(count), hash);
+  for (uint32_t i = 0; i < count; i++) {
+    hash = fnv1a(&refs[i].attachment, sizeof(refs[i].attachment), hash);
+  }
+  return hash;
+}
+
+uint64_t renderPassCompatKey(const VkRenderPassCreateInfo& info) {
+  uint64_t hash = fnv1a(&info.attachmentCount, sizeof(info.attachmentCount));
+  for (uint32_t i = 0; i < info.attachmentCount; i++) {
+    uint32_t fields[2] = {(uint32_t)info.pAttachments[i].format,
+                          (uint32_t)info.pAttachments[i].samples};
+    hash = fnv1a(fields, sizeof(fields), hash);
+  }
+  // layouts don't matter for compatibility, the attachment indices do
+  hash = fnv1a(&info.subpassCount, sizeof(info.subpassCount), hash);
+  for (uint32_t i = 0; i < info.subpassCount; i++) {
+    const VkSubpassDescription& subpass = info.pSubpasses[i];
+    hash = fnv1a(&subpass.pipelineBindPoint, sizeof(subpass.pipelineBindPoint),
+                 hash);
+    hash = hashReferences(subpass.pInputAttachments,
+                          subpass.inputAttachmentCount, hash);
+    hash = hashReferences(subpass.pColorAttachments,
+                          subpass.colorAttachmentCount, hash);
+    uint32_t resolveCount =
+        subpass.pResolveAttachments ? subpass.colorAttachmentCount : 0;
+    hash = hashReferences(subpass.pResolveAttachments, resolveCount, hash);
+    hash = hashReferences(subpass.pDepthStencilAttachment,
+                          subpass.pDepthStencilAttachment ? 1 : 0, hash);
+  }
+  return hash;
+}
+
+PipelineKey makePipelineKey(const GraphicsPipelineDesc& d) {
+  PipelineKey key = {};
+  size_t n = 0;
+  key[n++] = d.vertexShader.hash;
+  key[n++] = d.fragmentShader.hash;
+  key[n++] = d.bindingCount;
+  for (uint32_t i = 0; i < 4; i++) {
+    const VkVertexInputBindingDescription& b = d.bindings[i];
+    bool used = i < d.bindingCount;
+    key[n++] = used ? b.binding : 0;
+    key[n++] = used ? b.stride : 0;
+    key[n++] = used ? (uint64_t)b.inputRate : 0;
+  }
+  key[n++] = d.attributeCount;
+  for (uint32_t i = 0; i < 8; i++) {
+    const VkVertexInputAttributeDescription& a = d.attributes[i];
+    bool used = i < d.attributeCount;
+    key[n++] = used ? a.location : 0;
+    key[n++] = used ? a.binding : 0;
+    key[n++] = used ? (uint64_t)a.format : 0;
+    key[n++] = used ? a.offset : 0;
+  }
+  key[n++] = d.topology;
+  key[n++] = d.polygonMode;
+  key[n++] = d.cullMode;
+  key[n++] = d.frontFace;
+  key[n++] = d.depthBiasEnable;
+  key[n++] = d.depthTestEnable;
+  key[n++] = d.depthWriteEnable;
+  key[n++] = d.depthCompareOp;
+  key[n++] = d.blendEnable;
+  key[n++] = d.srcColorBlendFactor;
+  key[n++] = d.dstColorBlendFactor;
+  key[n++] = d.colorBlendOp;
+  key[n++] = d.srcAlphaBlendFactor;
+  key[n++] = d.dstAlphaBlendFactor;
+  key[n++] = d.alphaBlendOp;
+  key[n++] = d.colorAttachmentCount;
+  key[n++] = d.samples;
+  key[n++] = (uint64_t)(uintptr_t)d.layout;
+  key[n++] = d.renderPassKey;
+  key[n++] = d.subpass;
+  assert(n <= key.size());
+  return key;
+}
+
+uint64_t pipelineCompatKey(const GraphicsPipelineDesc& d) {
+  GraphicsPipelineDesc compat;
+  compat.bindingCount = d.bindingCount;
+  for (uint32_t i = 0; i < 4; i++) compat.bindings[i] = d.bindings[i];
+  compat.attributeCount = d.attributeCount;
+  for (uint32_t i = 0; i < 8; i++) compat.attributes[i] = d.attributes[i];
+  compat.topology = d.topology;
+  compat.colorAttachmentCount = d.colorAttachmentCount;
+  compat.samples = d.samples;
+  compat.layout = d.layout;
+  compat.renderPassKey = d.renderPassKey;
+  compat.subpass = d.subpass;
+  PipelineKey key = makePipelineKey(compat);
+  return fnv1a(key.data(), sizeof(key));
+}
+
+VkPipeline compileGraphicsPipeline(VkDevice device, VkPipelineCache cache,
+                                   const GraphicsPipelineDesc& desc) {
+  VkPipelineShaderStageCreateInfo stages[2] = {};
+  uint32_t stageCount = 0;
+  if (desc.vertexShader.module) {
+    VkPipelineShaderStageCreateInfo& stage = stages[stageCount++];
+    stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stage.module = desc.vertexShader.module;
+    stage.pName = "main";
+  }
+  if (desc.fragmentShader.module) {
+    VkPipelineShaderStageCreateInfo& stage = stages[stageCount++];
+    stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stage.module = desc.fragmentShader.module;
+    stage.pName = "main";
+  }
+
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+  vertexInputInfo.vertexBindingDescriptionCount = desc.bindingCount;
+  vertexInputInfo.pVertexBindingDescriptions = desc.bindings;
+  vertexInputInfo.vertexAttributeDescriptionCount = desc.attributeCount;
+  vertexInputInfo.pVertexAttributeDescriptions = desc.attributes;
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly = {
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
+  inputAssembly.topology = desc.topology;
+  inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+  VkPipelineViewportStateCreateInfo viewportState = {
+      VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
+  viewportState.viewportCount = 1;
+  viewportState.scissorCount = 1;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer = {
+      VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+  rasterizer.depthClampEnable = VK_FALSE;
+  rasterizer.rasterizerDiscardEnable = VK_FALSE;
+  rasterizer.polygonMode = desc.polygonMode;
+  rasterizer.lineWidth = 1.0f;
+  rasterizer.cullMode = desc.cullMode;
+  rasterizer.frontFace = desc.frontFace;
+  rasterizer.depthBiasEnable = desc.depthBiasEnable;
+
+  VkPipelineMultisampleStateCreateInfo multisampling = {
+      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+  multisampling.rasterizationSamples = desc.samples;
+  multisampling.minSampleShading = 1.0f;
+
+  VkPipelineDepthStencilStateCreateInfo depthStencil = {
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+  depthStencil.depthTestEnable = desc.depthTestEnable;
+  depthStencil.depthWriteEnable = desc.depthWriteEnable;
+  depthStencil.depthCompareOp = desc.depthCompareOp;
+
+  VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+  colorBlendAttachment.colorWriteMask =
+      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  colorBlendAttachment.blendEnable = desc.blendEnable;
+  colorBlendAttachment.srcColorBlendFactor = desc.srcColorBlendFactor;
+  colorBlendAttachment.dstColorBlendFactor = desc.dstColorBlendFactor;
+  colorBlendAttachment.colorBlendOp = desc.colorBlendOp;
+  colorBlendAttachment.srcAlphaBlendFactor = desc.srcAlphaBlendFactor;
+  colorBlendAttachment.dstAlphaBlendFactor = desc.dstAlphaBlendFactor;
+  colorBlendAttachment.alphaBlendOp = desc.alphaBlendOp;
+
+  VkPipelineColorBlendStateCreateInfo colorBlending = {
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+  colorBlending.logicOpEnable = VK_FALSE;
+  colorBlending.logicOp = VK_LOGIC_OP_COPY;
+  colorBlending.attachmentCount = desc.colorAttachmentCount;
+  colorBlending.pAttachments = &colorBlendAttachment;
+
+  VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT,
+                                    VK_DYNAMIC_STATE_SCISSOR,
+                                    VK_DYNAMIC_STATE_DEPTH_BIAS};
+  VkPipelineDynamicStateCreateInfo dynamicState = {
+      VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+  dynamicState.dynamicStateCount = desc.depthBiasEnable ? 3 : 2;
+  dynamicState.pDynamicStates = dynamicStates;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo = {
+      VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+  pipelineInfo.stageCount = stageCount;
+  pipelineInfo.pStages = stages;
+  pipelineInfo.pVertexInputState = &vertexInputInfo;
+  pipelineInfo.pInputAssemblyState = &inputAssembly;
+  pipelineInfo.pViewportState = &viewportState;
+  pipelineInfo.pRasterizationState = &rasterizer;
+  pipelineInfo.pMultisampleState = &multisampling;
+  pipelineInfo.pDepthStencilState = &depthStencil;
+  pipelineInfo.pColorBlendState =
+      desc.colorAttachmentCount ? &colorBlending : nullptr;
+  pipelineInfo.pDynamicState = &dynamicState;
+  pipelineInfo.layout = desc.layout;
+  pipelineInfo.renderPass = desc.renderPass;
+  pipelineInfo.subpass = desc.subpass;
+  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+  pipelineInfo.basePipelineIndex = -1;
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkResult result = vkd.vkCreateGraphicsPipelines(device, cache, 1,
+                                                  &pipelineInfo, nullptr,
+                                                  &pipeline);
+  if (result != VK_SUCCESS) {
+    printf("failed to compile pipeline: %d\n", result);
+    return VK_NULL_HANDLE;
+  }
+  return pipeline;
+}
+
+VkPipeline compileComputePipeline(VkDevice device, VkPipelineCache cache,
+                                  VkShaderModule shader,
+                                  VkPipelineLayout layout) {
+  VkComputePipelineCreateInfo pipelineInfo = {
+      VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shader;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = layout;
+  pipelineInfo.basePipelineIndex = -1;
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkResult result = vkd.vkCreateComputePipelines(device, cache, 1,
+                                                 &pipelineInfo, nullptr,
+                                                 &pipeline);
+  if (result != VK_SUCCESS) {
+    printf("failed to compile compute pipeline: %d\n", result);
+    return VK_NULL_HANDLE;
+  }
+  return pipeline;
+}
+
+size_t PipelineVariantCache::KeyHash::operator()(const PipelineKey& key) const {
+  return (size_t)fnv1a(key.data(), sizeof(key));
+}
+
+void PipelineVariantCache::init(VkDevice device, JobSystem* jobs,
+                                const char* diskCachePath) {
+  this->device = device;
+  this->jobs = jobs;
+  this->diskCachePath = diskCachePath;
+  pendingCompiles = new JobCounter();
+
+  // seed the driver cache from the previous run so variants seen before
+  // compile from cache instead of from scratch
+  std::vector<char> initialData;
+  if (diskCachePath) {
+    std::ifstream file(diskCachePath, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+      initialData.resize((size_t)file.tellg());
+      file.seekg(0);
+      file.read(initialData.data(), initialData.size());
+    }
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+  cacheInfo.initialDataSize = initialData.size();
+  cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+  if (vkd.vkCreatePipelineCache(device, &cacheInfo, nullptr, &driverCache) !=
+      VK_SUCCESS) {
+    // stale or foreign cache data, start empty
+    cacheInfo.initialDataSize = 0;
+    cacheInfo.pInitialData = nullptr;
+    VK_CHECK(vkd.vkCreatePipelineCache(device, &cacheInfo, nullptr,
+                                       &driverCache));
+  }
+}
+
+void PipelineVariantCache::destroy() {
+  jobs->wait(pendingCompiles);
+  delete pendingCompiles;
+  pendingCompiles = nullptr;
+
+  if (diskCachePath) {
+    size_t size = 0;
+    if (vkd.vkGetPipelineCacheData(device, driverCache, &size, nullptr) ==
+            VK_SUCCESS &&
+        size) {
+      std::vector<char> data(size);
+      VK_CHECK(vkd.vkGetPipelineCacheData(device, driverCache, &size,
+                                          data.data()));
+      std::ofstream file(diskCachePath, std::ios::binary);
+      file.write(data.data(), size);
+    }
+  }
+
+  for (Shard& shard : shards) {
+    for (auto& it : shard.entries) {
+      vkd.vkDestroyPipeline(device, it.second->pipeline.load(), nullptr);
+    }
+    shard.entries.clear();
+  }
+  fallbacks.clear();
+  for (auto& it : renderPasses) {
+    vkd.vkDestroyRenderPass(device, it.second, nullptr);
+  }
+  renderPasses.clear();
+  vkd.vkDestroyPipelineCache(device, driverCache, nullptr);
+}
+
+uint64_t PipelineVariantCache::registerRenderPass(
+    const VkRenderPassCreateInfo& info) {
+  uint64_t key = renderPassCompatKey(info);
+  std::lock_guard<std::mutex> lock(renderPassMutex);
+  if (!renderPasses.count(key)) {
+    VkRenderPass renderPass;
+    VK_CHECK(vkd.vkCreateRenderPass(device, &info, nullptr, &renderPass));
+    renderPasses.emplace(key, renderPass);
+  }
+  return key;
+}
+
+PipelineVariantCache::Entry* PipelineVariantCache::findOrInsert(
+    const GraphicsPipelineDesc& desc, bool& inserted) {
+  PipelineKey key = makePipelineKey(desc);
+  Shard& shard = shards[KeyHash()(key) % kShardCount];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it != shard.entries.end()) {
+    inserted = false;
+    return it->second.get();
+  }
+  std::unique_ptr<Entry> entry(new Entry());
+  entry->desc = desc;
+  Entry* result = entry.get();
+  shard.entries.emplace(key, std::move(entry));
+  inserted = true;
+  return result;
+}
+
+void PipelineVariantCache::compile(Entry* entry) {
+  GraphicsPipelineDesc desc = entry->desc;
+  {
+    std::lock_guard<std::mutex> lock(renderPassMutex);
+    auto it = renderPasses.find(desc.renderPassKey);
+    desc.renderPass = it == renderPasses.end() ? VK_NULL_HANDLE : it->second;
+  }
+  if (!desc.renderPass) {
+    printf("pipeline variant for an unregistered render pass\n");
+    entry->state.store(STATE_FAILED, std::memory_order_release);
+    return;
+  }
+
+  uint64_t begin = profilerNow();
+  VkPipeline pipeline = compileGraphicsPipeline(device, driverCache, desc);
+  compileNs += profilerNow() - begin;
+  compiled++;
+
+  if (pipeline == VK_NULL_HANDLE) {
+    entry->state.store(STATE_FAILED, std::memory_order_release);
+    return;
+  }
+  entry->pipeline.store(pipeline, std::memory_order_release);
+  entry->state.store(STATE_READY, std::memory_order_release);
+
+  std::lock_guard<std::mutex> lock(fallbackMutex);
+  fallbacks.emplace(pipelineCompatKey(entry->desc), pipeline);
+}
+
+VkPipeline PipelineVariantCache::fallback(uint64_t compatKey) {
+  std::lock_guard<std::mutex> lock(fallbackMutex);
+  auto it = fallbacks.find(compatKey);
+  return it == fallbacks.end() ? VK_NULL_HANDLE : it->second;
+}
+
+VkPipeline PipelineVariantCache::request(const GraphicsPipelineDesc& desc) {
+  bool inserted;
+  Entry* entry = findOrInsert(desc, inserted);
+  if (entry->state.load(std::memory_order_acquire) == STATE_READY) {
+    return entry->pipeline.load(std::memory_order_acquire);
+  }
+  if (inserted) {
+    jobs->run(pendingCompiles, [this, entry] { compile(entry); },
+              "compile pipeline variant");
+  }
+
+  VkPipeline substitute = fallback(pipelineCompatKey(desc));
+  if (substitute) {
+    fallbackDraws++;
+  } else {
+    deferredDraws++;
+  }
+  return substitute;
+}
+
+VkPipeline PipelineVariantCache::getBlocking(const GraphicsPipelineDesc& desc) {
+  bool inserted;
+  Entry* entry = findOrInsert(desc, inserted);
+  if (inserted) {
+    compile(entry);
+  }
+  // already queued by request(), wait for the worker to finish it
+  while (entry->state.load(std::memory_order_acquire) == STATE_PENDING) {
+    std::this_thread::yield();
+  }
+  return entry->pipeline.load(std::memory_order_acquire);
+}
+
+void PipelineVariantCache::printStats() const {
+  uint64_t count = compiled.load();
+  printf("pipeline variants: %llu compiled (avg %.2fms), %llu fallback draws, "
+         "%llu deferred draws\n",
+         (unsigned long long)count,
+         count ? compileNs.load() / 1e6 / count : 0.0,
+         (unsigned long long)fallbackDraws.load(),
+         (unsigned long long)deferredDraws.load());
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class JobSystem;
+struct JobCounter;
+
+struct ShaderRef {
+  VkShaderModule module = VK_NULL_HANDLE;
+  uint64_t hash = 0;  // hash of the SPIR-V, identifies the shader in keys
+};
+
+ShaderRef createShaderRef(VkDevice device, const std::vector<char>& code);
+
+// attachment formats and sample counts, and which attachments each subpass
+// references; pipelines built against one render pass can be used with any
+// other render pass that has the same key
+uint64_t renderPassCompatKey(const VkRenderPassCreateInfo& info);
+
+// everything that goes into a graphics pipeline. viewport and scissor are
+// always dynamic. renderPass is only used by compileGraphicsPipeline(); the
+// variant cache keys on renderPassKey and compiles against its own render
+// pass for that key, so variants survive swapchain recreation.
+struct GraphicsPipelineDesc {
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+
+  uint32_t bindingCount = 0;
+  VkVertexInputBindingDescription bindings[4] = {};
+  uint32_t attributeCount = 0;
+  VkVertexInputAttributeDescription attributes[8] = {};
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+  VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+  VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+  VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+  VkBool32 depthBiasEnable = VK_FALSE;
+
+  VkBool32 depthTestEnable = VK_TRUE;
+  VkBool32 depthWriteEnable = VK_TRUE;
+  VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+
+  VkBool32 blendEnable = VK_FALSE;
+  VkBlendFactor srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+  VkBlendFactor dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+  VkBlendOp colorBlendOp = VK_BLEND_OP_ADD;
+  VkBlendFactor srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  VkBlendFactor dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  VkBlendOp alphaBlendOp = VK_BLEND_OP_ADD;
+  uint32_t colorAttachmentCount = 1;
+
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  uint64_t renderPassKey = 0;
+  uint32_t subpass = 0;
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+
+  template <class Vertex>
+  void setVertexLayout() {
+    auto binding = Vertex::getbindingDescription();
+    auto attrs = Vertex::getAttributeDescriptions();
+    assert(attrs.size() <= 8);
+    bindingCount = 1;
+    bindings[0] = binding;
+    attributeCount = (uint32_t)attrs.size();
+    for (uint32_t i = 0; i < attributeCount; i++) attributes[i] = attrs[i];
+  }
+};
+
+// canonical flattened form of a desc, used for both hashing and equality so
+// struct padding never leaks into the key
+using PipelineKey = std::array<uint64_t, 72>;
+PipelineKey makePipelineKey(const GraphicsPipelineDesc& desc);
+// the subset a draw needs to be valid: layout, vertex input, topology and
+// render pass. variants that only differ in shaders/raster/blend/depth share it
+uint64_t pipelineCompatKey(const GraphicsPipelineDesc& desc);
+
+VkPipeline compileGraphicsPipeline(VkDevice device, VkPipelineCache cache,
+                                   const GraphicsPipelineDesc& desc);
+// compute pipelines have no state worth caching variants of; callers own them
+VkPipeline compileComputePipeline(VkDevice device, VkPipelineCache cache,
+                                  VkShaderModule shader,
+                                  VkPipelineLayout layout);
+
+// pipeline variants keyed by state. request() never blocks: a missing variant
+// is queued on the job system and the caller gets the first compiled variant
+// with the same compat key, or VK_NULL_HANDLE meaning "skip this draw".
+class PipelineVariantCache {
+ public:
+  void init(VkDevice device, JobSystem* jobs, const char* diskCachePath);
+  void destroy();
+
+  // the cache keeps a render pass of its own per compat key for compiles,
+  // created from the first info registered under the key, so background
+  // compiles never see a render pass the caller already destroyed. returns
+  // the key for GraphicsPipelineDesc::renderPassKey.
+  uint64_t registerRenderPass(const VkRenderPassCreateInfo& info);
+
+  VkPipeline request(const GraphicsPipelineDesc& desc);
+  VkPipeline getBlocking(const GraphicsPipelineDesc& desc);
+
+  void printStats() const;
+  // driver cache shared with standalone (compute) pipeline creation
+  VkPipelineCache pipelineCache() const { return driverCache; }
+
+ private:
+  enum State { STATE_PENDING, STATE_READY, STATE_FAILED };
+
+  struct Entry {
+    GraphicsPipelineDesc desc;
+    std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+    std::atomic<int> state{STATE_PENDING};
+  };
+
+  struct KeyHash {
+    size_t operator()(const PipelineKey& key) const;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<PipelineKey, std::unique_ptr<Entry>, KeyHash> entries;
+  };
+
+  static const uint32_t kShardCount = 16;
+
+  Entry* findOrInsert(const GraphicsPipelineDesc& desc, bool& inserted);
+  void compile(Entry* entry);
+  VkPipeline fallback(uint64_t compatKey);
+
+  VkDevice device = VK_NULL_HANDLE;
+  JobSystem* jobs = nullptr;
+  JobCounter* pendingCompiles = nullptr;
+  VkPipelineCache driverCache = VK_NULL_HANDLE;
+  const char* diskCachePath = nullptr;
+
+  Shard shards[kShardCount];
+
+  std::mutex fallbackMutex;
+  std::unordered_map<uint64_t, VkPipeline> fallbacks;
+
+  std::mutex renderPassMutex;
+  std::unordered_map<uint64_t, VkRenderPass> renderPasses;
+
+  std::atomic<uint64_t> compiled{0};
+  std::atomic<uint64_t> compileNs{0};
+  std::atomic<uint64_t> fallbackDraws{0};
+  std::atomic<uint64_t> deferredDraws{0};
+};
@@ -0,0 +1,390 @@
+#include "post_process.h"
+
+#include "deletion_queue.h"
+#include "file_io.h"
+#include "gpu_timer.h"
+#include "memory_budget.h"
+#include "pipeline_cache.h"
+#include "transient_attachments.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+#include <algorithm>
+
+// must match post_common.glsl and the local sizes in the shaders
+static const uint32_t kDownsampleTile = 32;
+static const uint32_t kBlurLine = 128;
+static const uint32_t kTonemapTile = 16;
+static const uint32_t kBindingCount = 13;
+static const uint32_t kBindingBloomMips = 1;
+static const uint32_t kBindingBloomTexture = 9;
+static const uint32_t kBindingBlurTemp = 10;
+static const uint32_t kBindingState = 11;
+static const uint32_t kBindingBlurMip = 12;
+static const uint32_t kStateSize = 16;
+
+static uint32_t divideUp(uint32_t value, uint32_t divisor) {
+  return (value + divisor - 1) / divisor;
+}
+
+void PostProcess::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                       VkPipelineCache cache) {
+  this->device = device;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  // the luminance reduction only needs basic + arithmetic in compute
+  VkPhysicalDeviceSubgroupProperties subgroup = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES};
+  VkPhysicalDeviceProperties2 props = {
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+  props.pNext = &subgroup;
+  vki.vkGetPhysicalDeviceProperties2(physicalDevice, &props);
+  const VkSubgroupFeatureFlags needed =
+      VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+  subgroupTonemap =
+      (subgroup.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+      (subgroup.supportedOperations & needed) == needed;
+
+  stateBuffer = createBuffer(
+      device, memoryProperties, kStateSize,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_BUFFER, stateMemory);
+
+  VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxLod = (float)kMaxMips;
+  VK_CHECK(vkd.vkCreateSampler(device, &samplerInfo, nullptr, &sampler));
+
+  VkDescriptorSetLayoutBinding bindings[kBindingCount] = {};
+  for (uint32_t i = 0; i < kBindingCount; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  bindings[kBindingBloomTexture].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[kBindingState].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+  setLayoutInfo.bindingCount = kBindingCount;
+  setLayoutInfo.pBindings = bindings;
+  VK_CHECK(vkd.vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr,
+                                           &setLayout));
+
+  VkPushConstantRange pushRange = {VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                   sizeof(Constants)};
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushRange;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout));
+
+  const char* paths[PASS_COUNT] = {
+      "shaders/post_exposure.spv", "shaders/post_downsample.spv",
+      "shaders/post_blur.spv",
+      subgroupTonemap ? "shaders/post_tonemap_subgroup.spv"
+                      : "shaders/post_tonemap.spv"};
+  for (uint32_t i = 0; i < PASS_COUNT; i++) {
+    shaders[i] = createShaderModule(device, readFile(paths[i]));
+    pipelines[i] = compileComputePipeline(device, cache, shaders[i], layout);
+    assert(pipelines[i]);
+  }
+
+  printf("post: compute chain, %s luminance reduction\n",
+         subgroupTonemap ? "subgroup" : "shared memory");
+}
+
+VkImageView PostProcess::createView(VkImage image, uint32_t baseMip,
+                                    uint32_t mips) {
+  VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = kHdrFormat;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, baseMip, mips, 0, 1};
+  VkImageView view;
+  VK_CHECK(vkd.vkCreateImageView(device, &viewInfo, nullptr, &view));
+  return view;
+}
+
+void PostProcess::registerTargets(TransientAttachmentPool& pool,
+                                  uint32_t firstPass) {
+  TransientAttachmentDesc bloom = {};
+  bloom.name = "bloom";
+  bloom.format = kHdrFormat;
+  bloom.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  bloom.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+  bloom.firstPass = firstPass + PASS_DOWNSAMPLE;
+  bloom.lastPass = firstPass + PASS_TONEMAP;
+  bloomTarget = addTransientAttachment(pool, bloom);
+
+  TransientAttachmentDesc blur = bloom;
+  blur.name = "blur temp";
+  blur.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+  blur.firstPass = firstPass + PASS_BLUR;
+  blur.lastPass = firstPass + PASS_BLUR;
+  blurTarget = addTransientAttachment(pool, blur);
+}
+
+void PostProcess::sizeTargets(TransientAttachmentPool& pool,
+                              VkExtent2D extent) {
+  hdrExtent = extent;
+  mip0Extent = {std::max(extent.width / 2, 1u),
+                std::max(extent.height / 2, 1u)};
+  mipCount = 1;
+  while (mipCount < kMaxMips &&
+         std::max(mip0Extent.width, mip0Extent.height) >> mipCount) {
+    mipCount++;
+  }
+  // the wide, cheap end of the pyramid: blur a small mip and let bilinear
+  // upsampling of every coarser mip in the tonemap pass do the rest
+  blurMip = std::min(2u, mipCount - 1);
+  blurExtent = {std::max(mip0Extent.width >> blurMip, 1u),
+                std::max(mip0Extent.height >> blurMip, 1u)};
+  downsampleGroups[0] = divideUp(mip0Extent.width, kDownsampleTile);
+  downsampleGroups[1] = divideUp(mip0Extent.height, kDownsampleTile);
+
+  TransientAttachmentDesc& bloom = pool.attachments[bloomTarget].desc;
+  bloom.extent = mip0Extent;
+  bloom.mipLevels = mipCount;
+  TransientAttachmentDesc& blur = pool.attachments[blurTarget].desc;
+  blur.extent = blurExtent;
+}
+
+void PostProcess::resize(const TransientAttachmentPool& pool,
+                         VkImage hdrImage, VkImageView hdrView,
+                         DeletionQueue& deletionQueue) {
+  deletionQueue.push(descriptorPool);
+  for (uint32_t i = 0; i < kMaxMips; i++) {
+    deletionQueue.push(bloomMipViews[i]);
+    bloomMipViews[i] = VK_NULL_HANDLE;
+  }
+
+  this->hdrImage = hdrImage;
+  const TransientAttachment& bloom = pool.attachments[bloomTarget];
+  const TransientAttachment& blur = pool.attachments[blurTarget];
+  bloomImage = bloom.image;
+  blurImage = blur.image;
+  for (uint32_t i = 0; i < mipCount; i++) {
+    bloomMipViews[i] = createView(bloomImage, i, 1);
+  }
+
+  VkDescriptorPoolSize poolSizes[] = {
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, kBindingCount - 2},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}};
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 3;
+  poolInfo.pPoolSizes = poolSizes;
+  VK_CHECK(vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                      &descriptorPool));
+
+  VkDescriptorSetAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
+
+  // mip bindings past the end of a short pyramid alias the last mip, the
+  // shaders never touch them
+  VkDescriptorImageInfo imageInfos[kBindingCount] = {};
+  imageInfos[0] = {VK_NULL_HANDLE, hdrView, VK_IMAGE_LAYOUT_GENERAL};
+  for (uint32_t i = 0; i < kMaxMips; i++) {
+    imageInfos[kBindingBloomMips + i] = {
+        VK_NULL_HANDLE, bloomMipViews[std::min(i, mipCount - 1)],
+        VK_IMAGE_LAYOUT_GENERAL};
+  }
+  imageInfos[kBindingBloomTexture] = {sampler, bloom.view,
+                                      VK_IMAGE_LAYOUT_GENERAL};
+  imageInfos[kBindingBlurTemp] = {VK_NULL_HANDLE, blur.view,
+                                  VK_IMAGE_LAYOUT_GENERAL};
+  imageInfos[kBindingBlurMip] = {VK_NULL_HANDLE, bloomMipViews[blurMip],
+                                 VK_IMAGE_LAYOUT_GENERAL};
+  VkDescriptorBufferInfo stateInfo = {stateBuffer, 0, VK_WHOLE_SIZE};
+
+  VkWriteDescriptorSet writes[kBindingCount] = {};
+  for (uint32_t i = 0; i < kBindingCount; i++) {
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = descriptorSet;
+    writes[i].dstBinding = i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    writes[i].pImageInfo = &imageInfos[i];
+  }
+  writes[kBindingBloomTexture].descriptorType =
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  writes[kBindingState].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  writes[kBindingState].pImageInfo = nullptr;
+  writes[kBindingState].pBufferInfo = &stateInfo;
+  vkd.vkUpdateDescriptorSets(device, kBindingCount, writes, 0, nullptr);
+}
+
+void PostProcess::destroy() {
+  for (uint32_t i = 0; i < PASS_COUNT; i++) {
+    vkd.vkDestroyPipeline(device, pipelines[i], nullptr);
+    vkd.vkDestroyShaderModule(device, shaders[i], nullptr);
+  }
+  vkd.vkDestroyPipelineLayout(device, layout, nullptr);
+  vkd.vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  for (uint32_t i = 0; i < mipCount; i++) {
+    vkd.vkDestroyImageView(device, bloomMipViews[i], nullptr);
+  }
+  vkd.vkDestroySampler(device, sampler, nullptr);
+  vkd.vkDestroyBuffer(device, stateBuffer, nullptr);
+  freeTrackedMemory(device, stateMemory);
+}
+
+void PostProcess::computeBarrier(VkCommandBuffer cmd) {
+  VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                           0, nullptr, 0, nullptr);
+}
+
+void PostProcess::dispatch(VkCommandBuffer cmd, Pass pass, uint32_t x,
+                           uint32_t y) {
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[pass]);
+  vkd.vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                         sizeof(Constants), &constants);
+  vkd.vkCmdDispatch(cmd, x, y, 1);
+}
+
+void PostProcess::record(VkCommandBuffer cmd, VkImage target, float dt,
+                         GpuTimer& timer) {
+  constants.hdrSize[0] = (int32_t)hdrExtent.width;
+  constants.hdrSize[1] = (int32_t)hdrExtent.height;
+  constants.mip0Size[0] = (int32_t)mip0Extent.width;
+  constants.mip0Size[1] = (int32_t)mip0Extent.height;
+  constants.blurSize[0] = (int32_t)blurExtent.width;
+  constants.blurSize[1] = (int32_t)blurExtent.height;
+  constants.mipCount = mipCount;
+  constants.groupCount = downsampleGroups[0] * downsampleGroups[1];
+  constants.blurDirection = 0;
+  constants.blurMip = blurMip;
+  constants.dt = dt;
+  constants.bloomStrength = bloomStrength;
+  constants.bloomThreshold = bloomThreshold;
+
+  // the state buffer survives resizes, adapted exposure carries over
+  if (!stateCleared) {
+    vkd.vkCmdFillBuffer(cmd, stateBuffer, 0, kStateSize, 0);
+    stateCleared = true;
+  }
+  // the pyramid and the blur target share memory with earlier passes'
+  // targets, so their contents are gone every frame: back from UNDEFINED
+  // once the main pass's depth writes and the depth pyramid's reads are
+  // done. the same barrier keeps this frame off last frame's tonemap.
+  VkImageMemoryBarrier toGeneral[2] = {};
+  VkImage images[2] = {bloomImage, blurImage};
+  for (uint32_t i = 0; i < 2; i++) {
+    toGeneral[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toGeneral[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT |
+                                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    toGeneral[i].dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    toGeneral[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    toGeneral[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    toGeneral[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toGeneral[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toGeneral[i].image = images[i];
+    toGeneral[i].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+                                     i == 0 ? mipCount : 1u, 0, 1};
+  }
+  VkMemoryBarrier state = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  state.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  state.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  const VkPipelineStageFlags srcStages =
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  vkd.vkCmdPipelineBarrier(cmd, srcStages, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           0, 1, &state, 0, nullptr, 2, toGeneral);
+
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1,
+                              &descriptorSet, 0, nullptr);
+
+  // no barrier in between: exposure only touches the luminance sums and the
+  // exposure value, downsample only the pyramid and its counter
+  uint32_t zone = timer.begin(cmd, "post exposure+downsample");
+  dispatch(cmd, PASS_EXPOSURE, 1, 1);
+  dispatch(cmd, PASS_DOWNSAMPLE, downsampleGroups[0], downsampleGroups[1]);
+  computeBarrier(cmd);
+  timer.end(cmd, zone);
+
+  zone = timer.begin(cmd, "post blur");
+  constants.blurDirection = 0;
+  dispatch(cmd, PASS_BLUR, divideUp(blurExtent.width, kBlurLine),
+           blurExtent.height);
+  computeBarrier(cmd);
+  constants.blurDirection = 1;
+  dispatch(cmd, PASS_BLUR, divideUp(blurExtent.height, kBlurLine),
+           blurExtent.width);
+  computeBarrier(cmd);
+  timer.end(cmd, zone);
+
+  zone = timer.begin(cmd, "post tonemap");
+  dispatch(cmd, PASS_TONEMAP, divideUp(hdrExtent.width, kTonemapTile),
+           divideUp(hdrExtent.height, kTonemapTile));
+  timer.end(cmd, zone);
+
+  // the swapchain transition waits on color output, which is where the
+  // acquire semaphore wait is, so the blit can't race the presentation engine
+  zone = timer.begin(cmd, "post blit");
+  VkImageMemoryBarrier toBlit[2] = {};
+  toBlit[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  toBlit[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  toBlit[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  toBlit[0].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  toBlit[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  toBlit[0].image = hdrImage;
+  toBlit[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  toBlit[1].srcAccessMask = 0;
+  toBlit[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toBlit[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  toBlit[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  toBlit[1].image = target;
+  for (uint32_t i = 0; i < 2; i++) {
+    toBlit[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toBlit[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toBlit[i].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  }
+  vkd.vkCmdPipelineBarrier(cmd,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                               VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                           nullptr, 2, toBlit);
+
+  // same size, so nearest is an exact copy plus the format conversion
+  VkImageBlit blit = {};
+  blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  blit.srcOffsets[1] = {(int32_t)hdrExtent.width, (int32_t)hdrExtent.height, 1};
+  blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  blit.dstOffsets[1] = {(int32_t)hdrExtent.width, (int32_t)hdrExtent.height, 1};
+  vkd.vkCmdBlitImage(cmd, hdrImage, VK_IMAGE_LAYOUT_GENERAL, target,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                     VK_FILTER_NEAREST);
+
+  VkImageMemoryBarrier toPresent = toBlit[1];
+  toPresent.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toPresent.dstAccessMask = 0;
+  toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  toPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  // transfer rather than bottom of pipe so a readback copy recorded right
+  // after chains onto this barrier
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                           nullptr, 1, &toPresent);
+  timer.end(cmd, zone, VK_PIPELINE_STAGE_TRANSFER_BIT);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "vk_common.h"
+
+class DeletionQueue;
+class GpuTimer;
+struct TransientAttachmentPool;
+
+// HDR post chain in compute, run after the main render pass:
+//   exposure   adapts exposure from last frame's luminance (one thread)
+//   downsample bright pass + the whole bloom pyramid in one dispatch
+//   blur       separable gaussian on one bloom mip, shared memory line cache
+//   tonemap    bloom composite, exposure and ACES in place on the hdr image
+// and the result is blitted into the swapchain image. exposure and
+// downsample touch disjoint data and run without a barrier between them.
+// The bloom pyramid and the blur target only live inside the chain, so they
+// come from the frame's transient attachment pool and share memory with
+// targets of earlier passes.
+class PostProcess {
+ public:
+  static const VkFormat kHdrFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+  // frame passes the chain takes from the one given to registerTargets(),
+  // the blit included; the hdr target has to live through all of them
+  static const uint32_t kFramePasses = 5;
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            VkPipelineCache cache);
+  void destroy();
+
+  // adds the bloom pyramid and the blur target to the pool, their lifetimes
+  // counted from firstPass
+  void registerTargets(TransientAttachmentPool& pool, uint32_t firstPass);
+  // sizes them for a new hdr extent, before the pool is allocated
+  void sizeTargets(TransientAttachmentPool& pool, VkExtent2D extent);
+  // once the pool is allocated: rebuilds the views and descriptors for the
+  // new targets; the old ones go through the deletion queue
+  void resize(const TransientAttachmentPool& pool, VkImage hdrImage,
+              VkImageView hdrView, DeletionQueue& deletionQueue);
+
+  // expects the hdr image in GENERAL with the render pass writes made
+  // visible to compute; leaves target in PRESENT_SRC
+  void record(VkCommandBuffer cmd, VkImage target, float dt, GpuTimer& timer);
+
+  float bloomStrength = 0.06f;
+  float bloomThreshold = 1.0f;
+
+ private:
+  // mirrors the push constant block in post_common.glsl
+  struct Constants {
+    int32_t hdrSize[2];
+    int32_t mip0Size[2];
+    int32_t blurSize[2];
+    uint32_t mipCount;
+    uint32_t groupCount;
+    uint32_t blurDirection;
+    uint32_t blurMip;
+    float dt;
+    float bloomStrength;
+    float bloomThreshold;
+  };
+
+  enum Pass {
+    PASS_EXPOSURE,
+    PASS_DOWNSAMPLE,
+    PASS_BLUR,
+    PASS_TONEMAP,
+    PASS_COUNT
+  };
+
+  static const uint32_t kMaxMips = 8;
+
+  VkImageView createView(VkImage image, uint32_t baseMip, uint32_t mips);
+  void dispatch(VkCommandBuffer cmd, Pass pass, uint32_t x, uint32_t y);
+  void computeBarrier(VkCommandBuffer cmd);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  bool subgroupTonemap = false;
+  bool stateCleared = false;
+  Constants constants = {};
+
+  VkExtent2D hdrExtent = {};
+  VkImage hdrImage = VK_NULL_HANDLE;
+  VkExtent2D mip0Extent = {};
+  VkExtent2D blurExtent = {};
+  uint32_t mipCount = 0;
+  uint32_t blurMip = 0;
+  uint32_t downsampleGroups[2] = {};
+
+  // indices into the transient pool, which owns the images and full views
+  uint32_t bloomTarget = 0;
+  uint32_t blurTarget = 0;
+  VkImage bloomImage = VK_NULL_HANDLE;
+  VkImageView bloomMipViews[kMaxMips] = {};
+  VkImage blurImage = VK_NULL_HANDLE;
+
+  VkBuffer stateBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory stateMemory = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkShaderModule shaders[PASS_COUNT] = {};
+  VkPipeline pipelines[PASS_COUNT] = {};
+};
@@ -0,0 +1,141 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+namespace {
+
+enum EventKind : uint8_t { EVENT_ZONE, EVENT_INSTANT, EVENT_COUNTER };
+
+struct ZoneEvent {
+  const char* name;
+  uint64_t begin;
+  uint64_t end;  // == begin for instant and counter events
+  uint32_t thread;
+  EventKind kind;
+  double value;  // counters only
+};
+
+struct ThreadInfo {
+  uint32_t id;
+  const char* name;
+};
+
+const auto processStart = std::chrono::steady_clock::now();
+
+std::atomic<bool> enabled{true};
+std::atomic<uint32_t> nextThreadId{0};
+std::mutex eventsMutex;
+std::vector<ZoneEvent> events;
+std::vector<ThreadInfo> threads;
+
+uint32_t currentThreadId() {
+  thread_local uint32_t id = nextThreadId.fetch_add(1);
+  return id;
+}
+
+}  // namespace
+
+uint64_t profilerNow() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - processStart)
+             .count();
+}
+
+void profilerSetEnabled(bool value) { enabled.store(value); }
+
+bool profilerEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+void profilerSetThreadName(const char* name) {
+  std::lock_guard<std::mutex> lock(eventsMutex);
+  threads.push_back({currentThreadId(), name});
+}
+
+void profilerRecordZone(const char* name, uint64_t begin, uint64_t end) {
+  if (!profilerEnabled()) return;
+  uint32_t thread = currentThreadId();
+  std::lock_guard<std::mutex> lock(eventsMutex);
+  events.push_back({name, begin, end, thread, EVENT_ZONE, 0.0});
+}
+
+void profilerRecordInstant(const char* name) {
+  uint64_t now = profilerNow();
+  uint32_t thread = currentThreadId();
+  std::lock_guard<std::mutex> lock(eventsMutex);
+  events.push_back({name, now, now, thread, EVENT_INSTANT, 0.0});
+}
+
+void profilerRecordCounter(const char* name, double value) {
+  if (!profilerEnabled()) return;
+  uint64_t now = profilerNow();
+  uint32_t thread = currentThreadId();
+  std::lock_guard<std::mutex> lock(eventsMutex);
+  events.push_back({name, now, now, thread, EVENT_COUNTER, value});
+}
+
+bool profilerWriteTrace(const char* path) {
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    printf("failed to open trace file:%s \n", path);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(eventsMutex);
+  fprintf(f, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (const ThreadInfo& t : threads) {
+    fprintf(f,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+            "\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", t.id, t.name);
+    first = false;
+  }
+  for (const ZoneEvent& e : events) {
+    if (e.kind == EVENT_INSTANT) {
+      fprintf(f,
+              "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,"
+              "\"tid\":%u,\"ts\":%.3f}",
+              first ? "" : ",\n", e.name, e.thread, e.begin / 1000.0);
+    } else if (e.kind == EVENT_COUNTER) {
+      fprintf(f,
+              "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,"
+              "\"args\":{\"value\":%.3f}}",
+              first ? "" : ",\n", e.name, e.begin / 1000.0, e.value);
+    } else {
+      fprintf(f,
+              "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              first ? "" : ",\n", e.name, e.thread, e.begin / 1000.0,
+              (e.end - e.begin) / 1000.0);
+    }
+    first = false;
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  printf("wrote trace: %s (%zu events)\n", path, events.size());
+  return true;
+}
+
+void profilerPrintSummary() {
+  std::lock_guard<std::mutex> lock(eventsMutex);
+  std::vector<ZoneEvent> sorted = events;
+  std::sort(sorted.begin(), sorted.end(),
+            [](const ZoneEvent& a, const ZoneEvent& b) {
+              return a.begin < b.begin;
+            });
+  for (const ZoneEvent& e : sorted) {
+    if (e.kind == EVENT_COUNTER) {
+      // counters are for the trace viewer, they would drown the summary
+      continue;
+    }
+    if (e.kind == EVENT_INSTANT) {
+      printf("  [t%u] %8.2fms  %s\n", e.thread, e.begin / 1e6, e.name);
+    } else {
+      printf("  [t%u] %8.2fms +%7.2fms  %s\n", e.thread, e.begin / 1e6,
+             (e.end - e.begin) / 1e6, e.name);
+    }
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+// CPU trace zones written out in the chrome://tracing (Trace Event) JSON
+// format. Zones are only collected while the profiler is enabled; startup
+// enables it by default so time-to-first-frame and the critical path can be
+// read off the trace.
+
+uint64_t profilerNow();  // nanoseconds since process start
+
+void profilerSetEnabled(bool enabled);
+bool profilerEnabled();
+
+// names must be string literals or otherwise outlive the profiler
+void profilerSetThreadName(const char* name);
+void profilerRecordZone(const char* name, uint64_t begin, uint64_t end);
+void profilerRecordInstant(const char* name);
+// a sample of a named value over time, drawn as a graph in the trace viewer
+void profilerRecordCounter(const char* name, double value);
+
+bool profilerWriteTrace(const char* path);
+void profilerPrintSummary();
+
+class ProfileScope {
+ public:
+  explicit ProfileScope(const char* name)
+      : name(name), begin(profilerEnabled() ? profilerNow() : 0) {}
+  ~ProfileScope() {
+    if (begin) profilerRecordZone(name, begin, profilerNow());
+  }
+
+ private:
+  const char* name;
+  uint64_t begin;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+  ProfileScope PROFILE_CONCAT(_profileScope, __LINE__)(name)
@@ -0,0 +1,159 @@
+#include "residency_manager.h"
+
+#include "frame_arena.h"
+
+#include <algorithm>
+
+uint32_t ResidencyManager::add(const ResourceDesc& desc) {
+  assert(desc.evict);
+  std::lock_guard<std::mutex> lock(mutex);
+  uint32_t id;
+  if (!freeIds.empty()) {
+    id = freeIds.back();
+    freeIds.pop_back();
+  } else {
+    id = (uint32_t)resources.size();
+    resources.emplace_back();
+  }
+  resources[id].desc = desc;
+  resources[id].lastUsed = 0;
+  resources[id].live = true;
+  return id;
+}
+
+void ResidencyManager::remove(uint32_t id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  resources[id] = Resource();
+  freeIds.push_back(id);
+}
+
+void ResidencyManager::touch(uint32_t id, uint64_t frame) {
+  std::lock_guard<std::mutex> lock(mutex);
+  resources[id].lastUsed = std::max(resources[id].lastUsed, frame);
+}
+
+void ResidencyManager::setBytes(uint32_t id, VkDeviceSize bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  resources[id].desc.bytes = bytes;
+}
+
+VkDeviceSize ResidencyManager::projectedUsage(uint32_t heap) const {
+  MemoryHeapStats stats = memoryHeapStats(heap);
+  std::lock_guard<std::mutex> lock(mutex);
+  VkDeviceSize pending = 0;
+  for (const PendingRelease& release : pendingReleases) {
+    if (release.heap == heap) pending += release.bytes;
+  }
+  return stats.usage - std::min(stats.usage, pending);
+}
+
+bool ResidencyManager::canAllocate(uint32_t heap, VkDeviceSize bytes) const {
+  VkDeviceSize budget = memoryHeapStats(heap).budget;
+  return projectedUsage(heap) + bytes <= (VkDeviceSize)(budget * highWater);
+}
+
+void ResidencyManager::update(uint64_t frame) {
+  {
+    // by now the deletion queue has freed these and the usage shows it
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingReleases.erase(
+        std::remove_if(pendingReleases.begin(), pendingReleases.end(),
+                       [&](const PendingRelease& release) {
+                         return release.frame + framesInFlight < frame;
+                       }),
+        pendingReleases.end());
+  }
+
+  bool overBudget = false;
+  for (uint32_t heap = 0; heap < memoryHeapCount(); heap++) {
+    VkDeviceSize budget = memoryHeapStats(heap).budget;
+    VkDeviceSize usage = projectedUsage(heap);
+    if (usage <= (VkDeviceSize)(budget * highWater)) continue;
+    overBudget = true;
+    // aim for the low water mark in one go so we don't release a little
+    // more every frame and hover right at the edge
+    VkDeviceSize target = usage - (VkDeviceSize)(budget * lowWater);
+    VkDeviceSize released = release(heap, target, frame, false);
+    if (released < target) {
+      released += release(heap, target - released, frame, true);
+    }
+    if (released) {
+      std::lock_guard<std::mutex> lock(mutex);
+      pendingReleases.push_back({frame, heap, released});
+    }
+  }
+  if (overBudget) {
+    std::lock_guard<std::mutex> lock(mutex);
+    overBudgetFrames++;
+  }
+}
+
+VkDeviceSize ResidencyManager::release(uint32_t heap, VkDeviceSize target,
+                                       uint64_t frame, bool evict) {
+  struct Candidate {
+    uint32_t id;
+    uint32_t priority;
+    uint64_t lastUsed;
+    std::function<VkDeviceSize()> release;
+  };
+  FrameVector<Candidate> candidates;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t id = 0; id < resources.size(); id++) {
+      const Resource& resource = resources[id];
+      const std::function<VkDeviceSize()>& fn =
+          evict ? resource.desc.evict : resource.desc.downgrade;
+      if (!resource.live || resource.desc.heap != heap ||
+          resource.desc.bytes == 0 || !fn) {
+        continue;
+      }
+      if (resource.lastUsed + framesInFlight > frame) continue;
+      candidates.push_back(
+          {id, resource.desc.priority, resource.lastUsed, fn});
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate& a, const Candidate& b) {
+              if (a.priority != b.priority) return a.priority < b.priority;
+              return a.lastUsed < b.lastUsed;
+            });
+
+  // callbacks run without the lock so they may call back into us
+  VkDeviceSize released = 0;
+  for (const Candidate& candidate : candidates) {
+    if (released >= target) break;
+    VkDeviceSize bytes = candidate.release();
+    if (bytes == 0) continue;
+    released += bytes;
+    std::lock_guard<std::mutex> lock(mutex);
+    Resource& resource = resources[candidate.id];
+    if (resource.live) {
+      resource.desc.bytes =
+          evict ? 0 : resource.desc.bytes - std::min(resource.desc.bytes, bytes);
+    }
+    releasedBytes += bytes;
+    if (evict) {
+      evictions++;
+    } else {
+      downgrades++;
+    }
+  }
+  return released;
+}
+
+void ResidencyManager::printStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  VkDeviceSize resident = 0;
+  uint32_t live = 0;
+  for (const Resource& resource : resources) {
+    if (!resource.live) continue;
+    live++;
+    resident += resource.desc.bytes;
+  }
+  printf("residency: %u streamable resources, %.1fMB resident, %llu "
+         "downgrades, %llu evictions, %.1fMB released, %llu frames over "
+         "budget\n",
+         live, resident / (1024.0 * 1024.0), (unsigned long long)downgrades,
+         (unsigned long long)evictions, releasedBytes / (1024.0 * 1024.0),
+         (unsigned long long)overBudgetFrames);
+}
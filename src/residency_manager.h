@@ -0,0 +1,83 @@
+#pragma once
+
+#include "memory_budget.h"
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Keeps streamable resources (textures, mesh LODs, streamed pages) inside the
+// memory budget. Owners register a resource with its heap, size, priority
+// and two callbacks: downgrade drops detail (e.g. the top mips) and evict
+// drops the resource entirely. Both return the bytes they released, or 0 if
+// there was nothing left to give up, and must hand the memory to the
+// deletion queue since the GPU may still be reading it. Once per frame
+// update() compares each heap's usage with its budget and, past the high
+// water mark, downgrades and then evicts the lowest priority, least recently
+// used resources until the projected usage is back under the low water mark.
+// Owners bring resources back themselves, after checking canAllocate().
+class ResidencyManager {
+ public:
+  struct ResourceDesc {
+    const char* name = nullptr;
+    uint32_t heap = 0;
+    VkDeviceSize bytes = 0;
+    // lower goes first
+    uint32_t priority = 0;
+    std::function<VkDeviceSize()> downgrade;  // optional
+    std::function<VkDeviceSize()> evict;
+  };
+
+  // fractions of the budget
+  float highWater = 0.9f;
+  float lowWater = 0.8f;
+
+  // resources used in the last framesInFlight frames are left alone while
+  // anything older can go
+  void init(uint32_t framesInFlight) { this->framesInFlight = framesInFlight; }
+
+  uint32_t add(const ResourceDesc& desc);
+  void remove(uint32_t id);
+  // marks the resource as used by the given frame
+  void touch(uint32_t id, uint64_t frame);
+  // after the owner resized or reloaded it
+  void setBytes(uint32_t id, VkDeviceSize bytes);
+
+  // would an allocation of this size keep the heap under the high water mark
+  bool canAllocate(uint32_t heap, VkDeviceSize bytes) const;
+
+  // main thread, after memoryBudgetUpdate()
+  void update(uint64_t frame);
+
+  void printStats() const;
+
+ private:
+  struct Resource {
+    ResourceDesc desc;
+    uint64_t lastUsed = 0;
+    bool live = false;
+  };
+
+  // released memory only goes away once the deletion queue frees it
+  struct PendingRelease {
+    uint64_t frame;
+    uint32_t heap;
+    VkDeviceSize bytes;
+  };
+
+  VkDeviceSize release(uint32_t heap, VkDeviceSize target, uint64_t frame,
+                       bool evict);
+  // heap usage minus releases the driver hasn't seen yet
+  VkDeviceSize projectedUsage(uint32_t heap) const;
+
+  uint32_t framesInFlight = 2;
+  mutable std::mutex mutex;
+  std::vector<Resource> resources;
+  std::vector<uint32_t> freeIds;
+  std::vector<PendingRelease> pendingReleases;
+
+  uint64_t downgrades = 0;
+  uint64_t evictions = 0;
+  VkDeviceSize releasedBytes = 0;
+  uint64_t overBudgetFrames = 0;
+};
@@ -0,0 +1,643 @@
+#include "shadow_maps.h"
+
+#include "file_io.h"
+#include "gpu_timer.h"
+#include "memory_budget.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+static const VkFormat kDepthFormat = VK_FORMAT_D32_SFLOAT;
+// casters farther away than this (or the far plane) throw no shadow
+static const float kShadowDistance = 40.0f;
+// 0 splits the distance evenly, 1 logarithmically
+static const float kSplitLambda = 0.8f;
+// light space depth covered on either side of a cascade's center; wide
+// enough that casters behind the view frustum still land in the map
+static const float kDepthRange = 50.0f;
+static const uint32_t kCubeVertexCount = 36;
+static const uint32_t kGroundVertexCount = 6;
+static const float kGroundExtent = 20.0f;
+
+// unit cube around the origin, then the ground quad
+static void buildVertices(std::vector<glm::vec3>& out) {
+  static const glm::vec3 normals[6] = {{1, 0, 0},  {-1, 0, 0}, {0, 1, 0},
+                                       {0, -1, 0}, {0, 0, 1},  {0, 0, -1}};
+  for (uint32_t face = 0; face < 6; face++) {
+    glm::vec3 n = normals[face];
+    glm::vec3 u = glm::vec3(n.y, n.z, n.x);
+    glm::vec3 v = glm::cross(n, u);
+    glm::vec3 corners[4] = {(n - u - v) * 0.5f, (n + u - v) * 0.5f,
+                            (n + u + v) * 0.5f, (n - u + v) * 0.5f};
+    const uint32_t order[6] = {0, 1, 2, 0, 2, 3};
+    for (uint32_t i = 0; i < 6; i++) {
+      out.push_back(corners[order[i]]);
+      out.push_back(n);
+    }
+  }
+  const glm::vec2 ground[6] = {{-1, -1}, {1, -1}, {1, 1},
+                               {-1, -1}, {1, 1},  {-1, 1}};
+  for (uint32_t i = 0; i < 6; i++) {
+    out.push_back(glm::vec3(ground[i].x, 0.0f, ground[i].y) * kGroundExtent);
+    out.push_back(glm::vec3(0.0f, 1.0f, 0.0f));
+  }
+}
+
+void ShadowMaps::setCaster(Caster& caster, const glm::mat4& model) {
+  caster.model = model;
+  caster.center = glm::vec3(model[3]);
+  caster.radius = 0.5f * glm::length(glm::vec3(glm::length(glm::vec3(model[0])),
+                                               glm::length(glm::vec3(model[1])),
+                                               glm::length(glm::vec3(model[2]))));
+}
+
+VkImageView ShadowMaps::createView(VkImage image, VkImageViewType type,
+                                   uint32_t firstLayer, uint32_t layers) {
+  VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+  viewInfo.image = image;
+  viewInfo.viewType = type;
+  viewInfo.format = kDepthFormat;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, firstLayer,
+                               layers};
+  VkImageView view;
+  VK_CHECK(vkd.vkCreateImageView(device, &viewInfo, nullptr, &view));
+  return view;
+}
+
+void ShadowMaps::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                      VkPipelineCache cache, uint32_t framesInFlight,
+                      bool drawGround) {
+  this->device = device;
+  this->drawGround = drawGround;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  setSunDirection(sunDirection);
+
+  // a grid of pillars in front of the camera, plus boxes circling among them
+  uint32_t seed = 0x2545f491u;
+  for (uint32_t z = 0; z < 8; z++) {
+    for (uint32_t x = 0; x < 12; x++) {
+      float height = 0.5f + randomFloat(seed) * 3.5f;
+      float width = 0.4f + randomFloat(seed) * 0.6f;
+      glm::vec3 position(-18.0f + x * 3.2f + randomFloat(seed),
+                         height * 0.5f,
+                         -30.0f + z * 4.4f + randomFloat(seed));
+      float shade = 0.6f + randomFloat(seed) * 0.3f;
+      Caster caster;
+      caster.color = glm::vec4(shade, shade * 0.95f, shade * 0.85f, 1.0f);
+      setCaster(caster, glm::scale(glm::translate(glm::mat4(1.0f), position),
+                                   glm::vec3(width, height, width)));
+      casters.push_back(caster);
+    }
+  }
+  staticCount = (uint32_t)casters.size();
+  for (uint32_t i = 0; i < 6; i++) {
+    Caster caster;
+    caster.color = glm::vec4(0.9f, 0.35f + 0.1f * i, 0.2f, 1.0f);
+    setCaster(caster, glm::mat4(1.0f));
+    casters.push_back(caster);
+  }
+
+  // both layer sets: attachments while rendering, arrays while sampling
+  VkImage* images[2] = {&staticImage, &dynamicImage};
+  VkDeviceMemory* memories[2] = {&staticMemory, &dynamicMemory};
+  VkDeviceSize imageBytes = 0;
+  for (uint32_t i = 0; i < 2; i++) {
+    VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = kDepthFormat;
+    imageInfo.extent = {kResolution, kResolution, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = kCascadeCount;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VK_CHECK(vkd.vkCreateImage(device, &imageInfo, nullptr, images[i]));
+
+    VkMemoryRequirements memReq;
+    vkd.vkGetImageMemoryRequirements(device, *images[i], &memReq);
+    VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    allocInfo.allocationSize = memReq.size;
+    allocInfo.memoryTypeIndex =
+        findMemoryType(memoryProperties, memReq.memoryTypeBits, 0,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    assert(allocInfo.memoryTypeIndex != UINT32_MAX);
+    VK_CHECK(allocateTrackedMemory(device, allocInfo, MEMORY_RENDER_TARGET,
+                                   *memories[i]));
+    VK_CHECK(vkd.vkBindImageMemory(device, *images[i], *memories[i], 0));
+    imageBytes += memReq.size;
+  }
+  staticArrayView = createView(staticImage, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0,
+                               kCascadeCount);
+  dynamicArrayView = createView(dynamicImage, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0,
+                                kCascadeCount);
+  for (uint32_t c = 0; c < kCascadeCount; c++) {
+    layerViews[c] = createView(staticImage, VK_IMAGE_VIEW_TYPE_2D, c, 1);
+    layerViews[kCascadeCount + c] =
+        createView(dynamicImage, VK_IMAGE_VIEW_TYPE_2D, c, 1);
+  }
+
+  // every pass clears its layer and leaves it ready for sampling. a static
+  // layer is only rendered again once nothing reads it, and the dependency
+  // on fragment shading covers the previous frame's receivers.
+  VkAttachmentDescription depthAttachment = {};
+  depthAttachment.format = kDepthFormat;
+  depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  VkAttachmentReference depthRef = {
+      0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.pDepthStencilAttachment = &depthRef;
+
+  VkSubpassDependency dependencies[2] = {};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[0].srcAccessMask = 0;
+  dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  VkRenderPassCreateInfo renderPassInfo = {
+      VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+  renderPassInfo.attachmentCount = 1;
+  renderPassInfo.pAttachments = &depthAttachment;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = 2;
+  renderPassInfo.pDependencies = dependencies;
+  VK_CHECK(vkd.vkCreateRenderPass(device, &renderPassInfo, nullptr,
+                                  &renderPass));
+
+  for (uint32_t i = 0; i < 2 * kCascadeCount; i++) {
+    VkFramebufferCreateInfo framebufferInfo = {
+        VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &layerViews[i];
+    framebufferInfo.width = kResolution;
+    framebufferInfo.height = kResolution;
+    framebufferInfo.layers = 1;
+    VkFramebuffer& framebuffer = i < kCascadeCount
+                                     ? staticFramebuffers[i]
+                                     : dynamicFramebuffers[i - kCascadeCount];
+    VK_CHECK(vkd.vkCreateFramebuffer(device, &framebufferInfo, nullptr,
+                                     &framebuffer));
+  }
+
+  // hardware depth comparison; outside the cascade counts as lit
+  VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  samplerInfo.compareEnable = VK_TRUE;
+  samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+  VK_CHECK(vkd.vkCreateSampler(device, &samplerInfo, nullptr, &sampler));
+
+  std::vector<glm::vec3> vertices;
+  buildVertices(vertices);
+  VkDeviceSize vertexBytes = vertices.size() * sizeof(glm::vec3);
+  const VkMemoryPropertyFlags hostFlags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  slotStride = (sizeof(FrameConstants) + 255) & ~(VkDeviceSize)255;
+  VkBuffer* buffers[2] = {&vertexBuffer, &frameBuffer};
+  VkDeviceMemory* bufferMemories[2] = {&vertexMemory, &frameMemory};
+  VkDeviceSize sizes[2] = {vertexBytes, slotStride * framesInFlight};
+  VkBufferUsageFlags usages[2] = {VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT};
+  for (uint32_t i = 0; i < 2; i++) {
+    VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = sizes[i];
+    bufferInfo.usage = usages[i];
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK(vkd.vkCreateBuffer(device, &bufferInfo, nullptr, buffers[i]));
+
+    VkMemoryRequirements memReq;
+    vkd.vkGetBufferMemoryRequirements(device, *buffers[i], &memReq);
+    VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    allocInfo.allocationSize = memReq.size;
+    allocInfo.memoryTypeIndex =
+        findMemoryType(memoryProperties, memReq.memoryTypeBits, 0, hostFlags);
+    assert(allocInfo.memoryTypeIndex != UINT32_MAX);
+    VK_CHECK(allocateTrackedMemory(device, allocInfo, MEMORY_BUFFER,
+                                   *bufferMemories[i]));
+    VK_CHECK(vkd.vkBindBufferMemory(device, *buffers[i], *bufferMemories[i],
+                                    0));
+  }
+  void* mapped;
+  VK_CHECK(vkd.vkMapMemory(device, vertexMemory, 0, VK_WHOLE_SIZE, 0, &mapped));
+  memcpy(mapped, vertices.data(), vertexBytes);
+  vkd.vkUnmapMemory(device, vertexMemory);
+  VK_CHECK(vkd.vkMapMemory(device, frameMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&frameMapped));
+
+  VkDescriptorSetLayoutBinding bindings[3] = {};
+  for (uint32_t i = 0; i < 3; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  }
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  bindings[0].stageFlags =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+  setLayoutInfo.bindingCount = 3;
+  setLayoutInfo.pBindings = bindings;
+  VK_CHECK(vkd.vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr,
+                                           &setLayout));
+
+  VkDescriptorPoolSize poolSizes[] = {
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, framesInFlight},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * framesInFlight}};
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = framesInFlight;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  VK_CHECK(vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                      &descriptorPool));
+
+  std::vector<VkDescriptorSetLayout> setLayouts(framesInFlight, setLayout);
+  descriptorSets.resize(framesInFlight);
+  VkDescriptorSetAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = framesInFlight;
+  allocInfo.pSetLayouts = setLayouts.data();
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &allocInfo,
+                                        descriptorSets.data()));
+
+  for (uint32_t slot = 0; slot < framesInFlight; slot++) {
+    VkDescriptorBufferInfo bufferInfo = {frameBuffer, slot * slotStride,
+                                         sizeof(FrameConstants)};
+    VkDescriptorImageInfo imageInfos[2] = {
+        {sampler, staticArrayView,
+         VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL},
+        {sampler, dynamicArrayView,
+         VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}};
+    VkWriteDescriptorSet writes[3] = {};
+    for (uint32_t i = 0; i < 3; i++) {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = descriptorSets[slot];
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = bindings[i].descriptorType;
+      if (i == 0) {
+        writes[i].pBufferInfo = &bufferInfo;
+      } else {
+        writes[i].pImageInfo = &imageInfos[i - 1];
+      }
+    }
+    vkd.vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+  }
+
+  VkPushConstantRange depthRange = {VK_SHADER_STAGE_VERTEX_BIT, 0,
+                                    sizeof(glm::mat4)};
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &depthRange;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr,
+                                      &depthLayout));
+
+  VkPushConstantRange drawRange = {
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+      sizeof(DrawConstants)};
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout;
+  layoutInfo.pPushConstantRanges = &drawRange;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout));
+
+  depthShader = createShaderRef(device, readFile("shaders/shadow_depth_vert.spv"));
+  vertexShader = createShaderRef(device, readFile("shaders/shadow_lit_vert.spv"));
+  fragmentShader =
+      createShaderRef(device, readFile("shaders/shadow_lit_frag.spv"));
+
+  // the boxes are closed, so both faces can go into the map and the bias
+  // alone keeps lit faces from shadowing themselves
+  GraphicsPipelineDesc depthDesc;
+  depthDesc.vertexShader = depthShader;
+  depthDesc.bindingCount = 1;
+  depthDesc.bindings[0] = {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX};
+  depthDesc.attributeCount = 1;
+  depthDesc.attributes[0] = {0, 0, VK_FORMAT_R32G32B32_SFLOAT,
+                             offsetof(Vertex, position)};
+  depthDesc.cullMode = VK_CULL_MODE_NONE;
+  depthDesc.depthBiasEnable = VK_TRUE;
+  depthDesc.colorAttachmentCount = 0;
+  depthDesc.layout = depthLayout;
+  depthDesc.renderPass = renderPass;
+  depthPipeline = compileGraphicsPipeline(device, cache, depthDesc);
+  assert(depthPipeline);
+
+  drawDesc = GraphicsPipelineDesc();
+  drawDesc.vertexShader = vertexShader;
+  drawDesc.fragmentShader = fragmentShader;
+  drawDesc.bindingCount = 1;
+  drawDesc.bindings[0] = depthDesc.bindings[0];
+  drawDesc.attributeCount = 2;
+  drawDesc.attributes[0] = depthDesc.attributes[0];
+  drawDesc.attributes[1] = {1, 0, VK_FORMAT_R32G32B32_SFLOAT,
+                            offsetof(Vertex, normal)};
+  drawDesc.cullMode = VK_CULL_MODE_NONE;
+  drawDesc.depthTestEnable = VK_TRUE;
+  drawDesc.depthWriteEnable = VK_TRUE;
+  drawDesc.layout = layout;
+
+  printf("shadows: %u cascades of %ux%u, %.1fmb, %u static and %u dynamic "
+         "casters\n",
+         kCascadeCount, kResolution, kResolution,
+         imageBytes / (1024.0 * 1024.0), staticCount,
+         (uint32_t)casters.size() - staticCount);
+}
+
+void ShadowMaps::destroy() {
+  vkd.vkDestroyPipeline(device, depthPipeline, nullptr);
+  vkd.vkDestroyShaderModule(device, depthShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, vertexShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, fragmentShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(device, depthLayout, nullptr);
+  vkd.vkDestroyPipelineLayout(device, layout, nullptr);
+  vkd.vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  vkd.vkUnmapMemory(device, frameMemory);
+  vkd.vkDestroyBuffer(device, frameBuffer, nullptr);
+  freeTrackedMemory(device, frameMemory);
+  vkd.vkDestroyBuffer(device, vertexBuffer, nullptr);
+  freeTrackedMemory(device, vertexMemory);
+  vkd.vkDestroySampler(device, sampler, nullptr);
+  for (uint32_t c = 0; c < kCascadeCount; c++) {
+    vkd.vkDestroyFramebuffer(device, staticFramebuffers[c], nullptr);
+    vkd.vkDestroyFramebuffer(device, dynamicFramebuffers[c], nullptr);
+  }
+  vkd.vkDestroyRenderPass(device, renderPass, nullptr);
+  for (uint32_t i = 0; i < 2 * kCascadeCount; i++) {
+    vkd.vkDestroyImageView(device, layerViews[i], nullptr);
+  }
+  vkd.vkDestroyImageView(device, staticArrayView, nullptr);
+  vkd.vkDestroyImageView(device, dynamicArrayView, nullptr);
+  vkd.vkDestroyImage(device, staticImage, nullptr);
+  freeTrackedMemory(device, staticMemory);
+  vkd.vkDestroyImage(device, dynamicImage, nullptr);
+  freeTrackedMemory(device, dynamicMemory);
+}
+
+void ShadowMaps::setSunDirection(const glm::vec3& direction) {
+  sunDirection = glm::normalize(direction);
+  glm::vec3 up = fabsf(sunDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f)
+                                               : glm::vec3(0.0f, 1.0f, 0.0f);
+  lightRotation = glm::lookAt(glm::vec3(0.0f), sunDirection, up);
+  for (uint32_t c = 0; c < kCascadeCount; c++) cascades[c].staticValid = false;
+}
+
+void ShadowMaps::setWorldCasters(VkBuffer vertexBuffer, VkBuffer indexBuffer,
+                                 uint32_t indexCount,
+                                 const WorldCaster* casters, uint32_t count) {
+  worldVertexBuffer = vertexBuffer;
+  worldIndexBuffer = indexBuffer;
+  worldIndexCount = indexCount;
+  worldCasters.assign(casters, casters + count);
+}
+
+void ShadowMaps::moveStaticCaster(uint32_t index, const glm::mat4& model) {
+  assert(index < staticCount);
+  Caster before = casters[index];
+  setCaster(casters[index], model);
+  for (uint32_t c = 0; c < kCascadeCount; c++) {
+    if (touches(cascades[c], before.center, before.radius) ||
+        touches(cascades[c], casters[index].center, casters[index].radius)) {
+      cascades[c].staticValid = false;
+    }
+  }
+}
+
+// sphere against the cascade's light space box
+bool ShadowMaps::touches(const Cascade& cascade, const glm::vec3& center,
+                         float radius) const {
+  glm::vec3 p =
+      glm::vec3(lightRotation * glm::vec4(center, 1.0f)) - cascade.center;
+  float extent = cascade.halfExtent + radius;
+  return fabsf(p.x) <= extent && fabsf(p.y) <= extent &&
+         fabsf(p.z) <= kDepthRange + radius;
+}
+
+void ShadowMaps::fitCascades(const glm::mat4& view, const glm::mat4& proj,
+                             float nearPlane, float farPlane) {
+  float shadowFar = std::min(farPlane, kShadowDistance);
+  glm::mat4 invView = glm::inverse(view);
+  float tanX = 1.0f / fabsf(proj[0][0]);
+  float tanY = 1.0f / fabsf(proj[1][1]);
+
+  float begin = nearPlane;
+  for (uint32_t c = 0; c < kCascadeCount; c++) {
+    float t = (float)(c + 1) / (float)kCascadeCount;
+    float uniform = nearPlane + (shadowFar - nearPlane) * t;
+    float logarithmic = nearPlane * powf(shadowFar / nearPlane, t);
+    float end = uniform + (logarithmic - uniform) * kSplitLambda;
+
+    glm::vec3 corners[8];
+    glm::vec3 center(0.0f);
+    for (uint32_t i = 0; i < 8; i++) {
+      float depth = i < 4 ? begin : end;
+      glm::vec3 p((i & 1 ? 1.0f : -1.0f) * depth * tanX,
+                  (i & 2 ? 1.0f : -1.0f) * depth * tanY, -depth);
+      corners[i] = glm::vec3(invView * glm::vec4(p, 1.0f));
+      center += corners[i] * 0.125f;
+    }
+    float radius = 0.0f;
+    for (uint32_t i = 0; i < 8; i++) {
+      radius = std::max(radius, glm::length(corners[i] - center));
+    }
+    // rounded so float noise can't change the projection by itself
+    radius = ceilf(radius * 16.0f) / 16.0f;
+
+    // room for the center to sit up to one snap step off the slice's center
+    Cascade& cascade = cascades[c];
+    cascade.halfExtent =
+        radius / (1.0f - 2.0f * kCacheSnapTexels / (float)kResolution);
+    cascade.texelSize = 2.0f * cascade.halfExtent / kResolution;
+    float step = cascade.texelSize * kCacheSnapTexels;
+    glm::vec3 lightCenter =
+        glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+    cascade.center = glm::floor(lightCenter / step + 0.5f) * step;
+
+    const glm::vec3& s = cascade.center;
+    glm::mat4 ortho = glm::orthoRH_ZO(
+        s.x - cascade.halfExtent, s.x + cascade.halfExtent,
+        s.y - cascade.halfExtent, s.y + cascade.halfExtent,
+        -s.z - kDepthRange, -s.z + kDepthRange);
+    cascade.viewProj = ortho * lightRotation;
+
+    constants.cascades[c] = cascade.viewProj;
+    constants.splits[c] = end;
+    constants.texelSizes[c] = cascade.texelSize;
+    begin = end;
+  }
+}
+
+void ShadowMaps::renderLayer(VkCommandBuffer cmd, VkFramebuffer framebuffer,
+                             const Cascade& cascade, const Caster* layerCasters,
+                             uint32_t count, bool drawWorldCasters,
+                             uint32_t& draws) {
+  VkClearValue clear = {};
+  clear.depthStencil = {1.0f, 0};
+  VkRenderPassBeginInfo beginInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+  beginInfo.renderPass = renderPass;
+  beginInfo.framebuffer = framebuffer;
+  beginInfo.renderArea.extent = {kResolution, kResolution};
+  beginInfo.clearValueCount = 1;
+  beginInfo.pClearValues = &clear;
+  vkd.vkCmdBeginRenderPass(cmd, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+  VkViewport viewport = {0.0f, 0.0f, (float)kResolution, (float)kResolution,
+                         0.0f, 1.0f};
+  VkRect2D scissor = {{0, 0}, {kResolution, kResolution}};
+  vkd.vkCmdSetViewport(cmd, 0, 1, &viewport);
+  vkd.vkCmdSetScissor(cmd, 0, 1, &scissor);
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPipeline);
+  vkd.vkCmdSetDepthBias(cmd, 1.25f, 0.0f, 1.75f);
+  VkDeviceSize offset = 0;
+  vkd.vkCmdBindVertexBuffers(cmd, 0, 1, &vertexBuffer, &offset);
+
+  for (uint32_t i = 0; i < count; i++) {
+    const Caster& caster = layerCasters[i];
+    if (!touches(cascade, caster.center, caster.radius)) continue;
+    glm::mat4 mvp = cascade.viewProj * caster.model;
+    vkd.vkCmdPushConstants(cmd, depthLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                           sizeof(mvp), &mvp);
+    vkd.vkCmdDraw(cmd, kCubeVertexCount, 1, 0, 0);
+    draws++;
+  }
+
+  if (drawWorldCasters && !worldCasters.empty()) {
+    vkd.vkCmdBindVertexBuffers(cmd, 0, 1, &worldVertexBuffer, &offset);
+    vkd.vkCmdBindIndexBuffer(cmd, worldIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
+    vkd.vkCmdPushConstants(cmd, depthLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                           sizeof(glm::mat4), &cascade.viewProj);
+    for (const WorldCaster& caster : worldCasters) {
+      if (!touches(cascade, caster.center, caster.radius)) continue;
+      vkd.vkCmdDrawIndexed(cmd, worldIndexCount, 1, 0, caster.vertexOffset, 0);
+      draws++;
+    }
+  }
+
+  vkd.vkCmdEndRenderPass(cmd);
+}
+
+void ShadowMaps::update(VkCommandBuffer cmd, uint32_t slot, float time,
+                        const glm::mat4& view, const glm::mat4& proj,
+                        float nearPlane, float farPlane, GpuTimer& timer) {
+  frames++;
+  uint32_t dynamicCount = (uint32_t)casters.size() - staticCount;
+  for (uint32_t i = 0; i < dynamicCount; i++) {
+    float phase = 6.2831853f * i / dynamicCount;
+    float angle = time * 0.4f + phase;
+    glm::vec3 p(cosf(angle) * 7.0f, 1.2f + 0.8f * sinf(time * 1.3f + phase),
+                sinf(angle) * 7.0f - 10.0f);
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), p);
+    model = glm::rotate(model, time + phase, glm::vec3(0.3f, 1.0f, 0.2f));
+    setCaster(casters[staticCount + i], glm::scale(model, glm::vec3(0.8f)));
+  }
+
+  fitCascades(view, proj, nearPlane, farPlane);
+  constants.viewProj = proj * view;
+  constants.view = view;
+  constants.sunDirection = glm::vec4(-sunDirection, 0.0f);
+
+  // host writes before the submit are visible to the device without barriers
+  uint8_t* dst = frameMapped + slot * slotStride;
+  memcpy(dst, &constants, sizeof(constants));
+
+  uint32_t zone = timer.begin(cmd, "shadows");
+  for (uint32_t c = 0; c < kCascadeCount; c++) {
+    Cascade& cascade = cascades[c];
+    if (!cascade.staticValid || cascade.staticViewProj != cascade.viewProj) {
+      uint32_t draws = 0;
+      renderLayer(cmd, staticFramebuffers[c], cascade, casters.data(),
+                  staticCount, false, draws);
+      cascade.staticValid = true;
+      cascade.staticViewProj = cascade.viewProj;
+      staticRenders++;
+      staticDraws += draws;
+    }
+
+    bool anyDynamic = false;
+    for (uint32_t i = staticCount; i < casters.size() && !anyDynamic; i++) {
+      anyDynamic = touches(cascade, casters[i].center, casters[i].radius);
+    }
+    for (uint32_t i = 0; i < worldCasters.size() && !anyDynamic; i++) {
+      anyDynamic =
+          touches(cascade, worldCasters[i].center, worldCasters[i].radius);
+    }
+    // an empty layer still has to be cleared once after its casters leave
+    if (anyDynamic || cascade.dynamicDrawn) {
+      uint32_t draws = 0;
+      renderLayer(cmd, dynamicFramebuffers[c], cascade,
+                  casters.data() + staticCount, dynamicCount, true, draws);
+      cascade.dynamicDrawn = anyDynamic;
+      dynamicRenders++;
+      dynamicDraws += draws;
+    }
+  }
+  timer.end(cmd, zone, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+}
+
+void ShadowMaps::draw(VkCommandBuffer cmd, uint32_t slot,
+                      PipelineVariantCache& pipelines) {
+  VkPipeline pipeline = pipelines.request(drawDesc);
+  if (!pipeline) return;
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0,
+                              1, &descriptorSets[slot], 0, nullptr);
+  VkDeviceSize offset = 0;
+  vkd.vkCmdBindVertexBuffers(cmd, 0, 1, &vertexBuffer, &offset);
+
+  const VkShaderStageFlags stages =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  for (const Caster& caster : casters) {
+    DrawConstants c = {caster.model, caster.color};
+    vkd.vkCmdPushConstants(cmd, layout, stages, 0, sizeof(c), &c);
+    vkd.vkCmdDraw(cmd, kCubeVertexCount, 1, 0, 0);
+  }
+  if (drawGround) {
+    DrawConstants c = {glm::mat4(1.0f), glm::vec4(0.5f, 0.5f, 0.55f, 1.0f)};
+    vkd.vkCmdPushConstants(cmd, layout, stages, 0, sizeof(c), &c);
+    vkd.vkCmdDraw(cmd, kGroundVertexCount, 1, kCubeVertexCount, 0);
+  }
+}
+
+void ShadowMaps::printStats() const {
+  if (!frames) return;
+  printf("shadows: %llu frames, static layers redrawn %llu times (%.1f "
+         "casters each), dynamic layers %.2f per frame (%.1f casters each)\n",
+         (unsigned long long)frames, (unsigned long long)staticRenders,
+         staticRenders ? (double)staticDraws / staticRenders : 0.0,
+         (double)dynamicRenders / frames,
+         dynamicRenders ? (double)dynamicDraws / dynamicRenders : 0.0);
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "pipeline_cache.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+class GpuTimer;
+
+// Cascaded shadow maps for a directional sun, with a small scene of box
+// casters to throw them: a field of static pillars and a few dynamic boxes.
+//
+// Cascades are fitted to bounding spheres of the view frustum slices, so
+// their size doesn't change as the camera turns, and their centers are
+// snapped to a grid of kCacheSnapTexels shadow texels. That keeps the
+// texels stable (no shimmering) and means a cascade's projection only
+// changes when the camera has moved a good way.
+//
+// Each cascade has two depth layers, sampled together by the receivers:
+// static casters render into a cached layer that's only redrawn when the
+// cascade's projection, the sun or a static caster inside it changes;
+// dynamic casters render into a layer that's redrawn every frame, or not at
+// all while no dynamic caster touches the cascade. Both are culled per
+// cascade on the CPU, so a frame's shadow cost follows what moved, not the
+// size of the scene.
+class ShadowMaps {
+ public:
+  static const uint32_t kCascadeCount = 4;
+  static const uint32_t kResolution = 2048;
+  // cascade centers move in steps of this many texels
+  static const uint32_t kCacheSnapTexels = 64;
+
+  // mirror the std140 block in shadow_common.glsl
+  struct FrameConstants {
+    glm::mat4 viewProj;
+    glm::mat4 view;
+    glm::mat4 cascades[kCascadeCount];
+    glm::vec4 splits;        // view depth where each cascade ends
+    glm::vec4 texelSizes;    // world size of a shadow texel per cascade
+    glm::vec4 sunDirection;  // xyz towards the sun
+  };
+
+  // drawGround: also draw the receiving ground plane in draw()
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            VkPipelineCache cache, uint32_t framesInFlight, bool drawGround);
+  void destroy();
+
+  // direction the light travels in; invalidates every cached cascade
+  void setSunDirection(const glm::vec3& direction);
+  uint32_t staticCasterCount() const { return staticCount; }
+  // static casters may move, but only through here so the cascades they
+  // leave and enter are redrawn
+  void moveStaticCaster(uint32_t index, const glm::mat4& model);
+
+  // indexed meshes that are already in world space, like skinned
+  // characters; they cast into the dynamic layers. every caster draws the
+  // same range of 16 bit indices from its own vertexOffset; vertices start
+  // with a vec3 position and are Vertex sized.
+  struct WorldCaster {
+    glm::vec3 center;
+    float radius;
+    int32_t vertexOffset;
+  };
+  // replaces the previous set; call before update() every frame they move
+  void setWorldCasters(VkBuffer vertexBuffer, VkBuffer indexBuffer,
+                       uint32_t indexCount, const WorldCaster* casters,
+                       uint32_t count);
+
+  // animates the dynamic casters, fits the cascades and renders whatever
+  // changed. record outside a render pass, before draw(); the planes must
+  // match proj.
+  void update(VkCommandBuffer cmd, uint32_t slot, float time,
+              const glm::mat4& view, const glm::mat4& proj, float nearPlane,
+              float farPlane, GpuTimer& timer);
+  // the casters and ground, sun lit and shadowed, inside the main pass
+  void draw(VkCommandBuffer cmd, uint32_t slot,
+            PipelineVariantCache& pipelines);
+
+  void printStats() const;
+
+  // the owner fills in renderPassKey like for any other pipeline
+  GraphicsPipelineDesc drawDesc;
+
+ private:
+  struct Vertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+  };
+
+  struct Caster {
+    glm::mat4 model;
+    glm::vec4 color;
+    // bounding sphere in world space
+    glm::vec3 center;
+    float radius;
+  };
+
+  struct Cascade {
+    glm::mat4 viewProj;
+    // light space center and half extent, for culling
+    glm::vec3 center;
+    float halfExtent;
+    float texelSize;
+    // the static layer holds the static casters for this projection
+    bool staticValid = false;
+    glm::mat4 staticViewProj;
+    // the dynamic layer has anything in it
+    bool dynamicDrawn = true;
+  };
+
+  struct DrawConstants {
+    glm::mat4 model;
+    glm::vec4 color;
+  };
+
+  void setCaster(Caster& caster, const glm::mat4& model);
+  void fitCascades(const glm::mat4& view, const glm::mat4& proj,
+                   float nearPlane, float farPlane);
+  bool touches(const Cascade& cascade, const glm::vec3& center,
+               float radius) const;
+  void renderLayer(VkCommandBuffer cmd, VkFramebuffer framebuffer,
+                   const Cascade& cascade, const Caster* casters,
+                   uint32_t count, bool worldCasters, uint32_t& draws);
+  VkImageView createView(VkImage image, VkImageViewType type,
+                         uint32_t firstLayer, uint32_t layers);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  bool drawGround = true;
+
+  glm::vec3 sunDirection = glm::normalize(glm::vec3(-0.4f, -1.0f, -0.3f));
+  glm::mat4 lightRotation = glm::mat4(1.0f);
+  // casters[0, staticCount) are static, the rest dynamic
+  std::vector<Caster> casters;
+  uint32_t staticCount = 0;
+  std::vector<WorldCaster> worldCasters;
+  VkBuffer worldVertexBuffer = VK_NULL_HANDLE;
+  VkBuffer worldIndexBuffer = VK_NULL_HANDLE;
+  uint32_t worldIndexCount = 0;
+  Cascade cascades[kCascadeCount];
+  FrameConstants constants = {};
+
+  // layer i of staticImage/dynamicImage is cascade i
+  VkImage staticImage = VK_NULL_HANDLE;
+  VkImage dynamicImage = VK_NULL_HANDLE;
+  VkDeviceMemory staticMemory = VK_NULL_HANDLE;
+  VkDeviceMemory dynamicMemory = VK_NULL_HANDLE;
+  VkImageView staticArrayView = VK_NULL_HANDLE;
+  VkImageView dynamicArrayView = VK_NULL_HANDLE;
+  VkImageView layerViews[2 * kCascadeCount] = {};
+  VkFramebuffer staticFramebuffers[kCascadeCount] = {};
+  VkFramebuffer dynamicFramebuffers[kCascadeCount] = {};
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+
+  // cube then ground quad, plain triangle lists
+  VkBuffer vertexBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory vertexMemory = VK_NULL_HANDLE;
+  // per slot FrameConstants, persistently mapped
+  VkBuffer frameBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory frameMemory = VK_NULL_HANDLE;
+  uint8_t* frameMapped = nullptr;
+  VkDeviceSize slotStride = 0;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> descriptorSets;
+  VkPipelineLayout depthLayout = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  ShaderRef depthShader;
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+  VkPipeline depthPipeline = VK_NULL_HANDLE;
+
+  uint64_t frames = 0;
+  uint64_t staticRenders = 0;
+  uint64_t staticDraws = 0;
+  uint64_t dynamicRenders = 0;
+  uint64_t dynamicDraws = 0;
+};
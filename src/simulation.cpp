@@ -0,0 +1,137 @@
+#include "simulation.h"
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+
+namespace {
+
+// a stall longer than this (a debugger, a hitch) is skipped, not replayed
+const uint32_t kMaxCatchUpTicks = 8;
+
+const glm::vec3 kCameraTarget(0.0f, 1.5f, 0.0f);
+const float kCameraHeight = 0.5f;  // above the target
+const float kTurnRate = 1.5f;  // radians per second
+const float kZoomRate = 4.0f;  // meters per second
+const float kMinDistance = 2.0f;
+const float kMaxDistance = 30.0f;
+
+}  // namespace
+
+void Simulation::start(uint32_t tickRate) {
+  tickNanoseconds = 1000000000ull / std::max(tickRate, 1u);
+  tickSeconds = tickNanoseconds / 1e9f;
+
+  state = {};
+  state.cameraTarget = kCameraTarget;
+  step(state);
+  state.tick = 0;
+  state.time = 0.0;
+  ticks = 0;
+  Snapshot& first = snapshots.back();
+  first.previous = state;
+  first.current = state;
+  first.publishedAt = profilerNow();
+  snapshots.publish();
+
+  stopping.store(false);
+  thread = std::thread([this] { run(); });
+}
+
+void Simulation::stop() {
+  if (!thread.joinable()) return;
+  stopping.store(true);
+  thread.join();
+}
+
+void Simulation::setInput(uint32_t bits, bool down) {
+  if (down) {
+    input.fetch_or(bits, std::memory_order_relaxed);
+  } else {
+    input.fetch_and(~bits, std::memory_order_relaxed);
+  }
+}
+
+void Simulation::run() {
+  profilerSetThreadName("simulation");
+  uint64_t next = profilerNow() + tickNanoseconds;
+  while (!stopping.load(std::memory_order_relaxed)) {
+    uint64_t now = profilerNow();
+    if (now < next) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(next - now));
+      continue;
+    }
+    if (now - next > kMaxCatchUpTicks * tickNanoseconds) {
+      droppedTicks += (now - next) / tickNanoseconds;
+      next = now;
+    }
+
+    // catch up to now, then hand over only the last step
+    SimState previous = state;
+    while (next <= now) {
+      previous = state;
+      step(state);
+      next += tickNanoseconds;
+    }
+    uint64_t end = profilerNow();
+    tickCostNanoseconds += end - now;
+
+    Snapshot& snapshot = snapshots.back();
+    snapshot.previous = previous;
+    snapshot.current = state;
+    snapshot.publishedAt = end;
+    snapshots.publish();
+  }
+}
+
+void Simulation::step(SimState& s) {
+  uint32_t keys = input.load(std::memory_order_relaxed);
+  float turn = ((keys & SIM_INPUT_RIGHT) ? 1.0f : 0.0f) -
+               ((keys & SIM_INPUT_LEFT) ? 1.0f : 0.0f);
+  float zoom = ((keys & SIM_INPUT_BACK) ? 1.0f : 0.0f) -
+               ((keys & SIM_INPUT_FORWARD) ? 1.0f : 0.0f);
+  cameraYaw += turn * kTurnRate * tickSeconds;
+  cameraDistance = std::min(
+      std::max(cameraDistance + zoom * kZoomRate * tickSeconds, kMinDistance),
+      kMaxDistance);
+
+  s.tick++;
+  s.time += tickSeconds;
+  s.cameraTarget = kCameraTarget;
+  s.cameraPosition =
+      kCameraTarget + glm::vec3(sinf(cameraYaw) * cameraDistance, kCameraHeight,
+                                cosf(cameraYaw) * cameraDistance);
+  ticks++;
+}
+
+SimState Simulation::sample(uint64_t now) {
+  samples++;
+  if (snapshots.acquire()) freshSamples++;
+  const Snapshot& snapshot = snapshots.front();
+
+  float alpha = 1.0f;
+  if (now < snapshot.publishedAt + tickNanoseconds) {
+    alpha = now > snapshot.publishedAt
+                ? (float)(now - snapshot.publishedAt) / tickNanoseconds
+                : 0.0f;
+  }
+  const SimState& a = snapshot.previous;
+  const SimState& b = snapshot.current;
+  SimState s = b;
+  s.time = a.time + (b.time - a.time) * alpha;
+  s.cameraPosition = glm::mix(a.cameraPosition, b.cameraPosition, alpha);
+  s.cameraTarget = glm::mix(a.cameraTarget, b.cameraTarget, alpha);
+  return s;
+}
+
+void Simulation::printStats() const {
+  if (!ticks) return;
+  printf("simulation: %llu ticks at %.0fHz, %.3fms per tick, %llu dropped, "
+         "%llu of %llu frames got a new tick\n",
+         (unsigned long long)ticks, 1e9 / tickNanoseconds,
+         tickCostNanoseconds / 1e6 / ticks, (unsigned long long)droppedTicks,
+         (unsigned long long)freshSamples, (unsigned long long)samples);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "triple_buffer.h"
+
+#include <atomic>
+#include <glm/glm.hpp>
+#include <thread>
+
+// keys the main thread forwards from glfw, as bits
+enum SimInput {
+  SIM_INPUT_LEFT = 1 << 0,
+  SIM_INPUT_RIGHT = 1 << 1,
+  SIM_INPUT_FORWARD = 1 << 2,
+  SIM_INPUT_BACK = 1 << 3,
+};
+
+// what one tick leaves for the renderer
+struct SimState {
+  uint64_t tick;
+  double time;  // simulated seconds
+  glm::vec3 cameraPosition;
+  glm::vec3 cameraTarget;
+};
+
+// The game side of the engine, on its own thread at a fixed tick rate. Each
+// tick publishes the state before and after it through a triple buffer;
+// the render thread picks up whatever is newest when it starts a frame and
+// interpolates between the two by how far it is past the tick, so motion is
+// smooth at any present rate and neither thread waits for the other.
+class Simulation {
+ public:
+  // publishes the initial state before the thread starts, so sample() has
+  // something from the first frame on
+  void start(uint32_t tickRate);
+  void stop();
+
+  // main thread, from the key callback
+  void setInput(uint32_t bits, bool down);
+
+  // render thread: the state at `now` (a profilerNow() time), one tick
+  // behind the simulation
+  SimState sample(uint64_t now);
+
+  void printStats() const;
+
+ private:
+  struct Snapshot {
+    SimState previous;
+    SimState current;
+    uint64_t publishedAt;
+  };
+
+  void run();
+  void step(SimState& state);
+
+  uint64_t tickNanoseconds = 0;
+  float tickSeconds = 0.0f;
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+  std::atomic<uint32_t> input{0};
+  TripleBuffer<Snapshot> snapshots;
+
+  // simulation thread only
+  SimState state = {};
+  float cameraYaw = 0.0f;
+  float cameraDistance = 6.0f;
+  uint64_t ticks = 0;
+  uint64_t droppedTicks = 0;
+  uint64_t tickCostNanoseconds = 0;
+
+  // render thread only
+  uint64_t samples = 0;
+  uint64_t freshSamples = 0;
+};
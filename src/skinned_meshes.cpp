@@ -0,0 +1,504 @@
+#include "skinned_meshes.h"
+
+#include "file_io.h"
+#include "gpu_timer.h"
+#include "memory_budget.h"
+#include "profiler.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+// must match local_size_x in skin.comp
+static const uint32_t kSkinGroupSize = 64;
+static const uint32_t kMaxGroups = 65535;
+// one palette entry is three vec4 rows
+static const VkDeviceSize kPaletteEntrySize = 12 * sizeof(float);
+// walking speed the walk clip was authored for, in m/s
+static const float kWalkSpeed = 1.2f;
+
+enum Joint {
+  JOINT_HIPS,
+  JOINT_SPINE,
+  JOINT_CHEST,
+  JOINT_NECK,
+  JOINT_HEAD,
+  JOINT_LEFT_SHOULDER,
+  JOINT_LEFT_ELBOW,
+  JOINT_LEFT_HAND,
+  JOINT_RIGHT_SHOULDER,
+  JOINT_RIGHT_ELBOW,
+  JOINT_RIGHT_HAND,
+  JOINT_LEFT_HIP,
+  JOINT_LEFT_KNEE,
+  JOINT_LEFT_FOOT,
+  JOINT_RIGHT_HIP,
+  JOINT_RIGHT_KNEE,
+  JOINT_RIGHT_FOOT,
+  JOINT_COUNT
+};
+
+// a box from a joint to its child joint, or to tip when it has none
+struct Segment {
+  int32_t joint;
+  int32_t child;
+  glm::vec3 tip;
+  float width;
+  float depth;
+};
+
+static const Segment kSegments[] = {
+    {JOINT_HIPS, JOINT_SPINE, {}, 0.30f, 0.18f},
+    {JOINT_SPINE, JOINT_CHEST, {}, 0.30f, 0.18f},
+    {JOINT_CHEST, JOINT_NECK, {}, 0.38f, 0.20f},
+    {JOINT_NECK, JOINT_HEAD, {}, 0.08f, 0.08f},
+    {JOINT_HEAD, -1, {0.0f, 0.24f, 0.0f}, 0.18f, 0.20f},
+    {JOINT_LEFT_SHOULDER, JOINT_LEFT_ELBOW, {}, 0.09f, 0.09f},
+    {JOINT_LEFT_ELBOW, JOINT_LEFT_HAND, {}, 0.08f, 0.08f},
+    {JOINT_LEFT_HAND, -1, {0.0f, -0.12f, 0.0f}, 0.06f, 0.09f},
+    {JOINT_RIGHT_SHOULDER, JOINT_RIGHT_ELBOW, {}, 0.09f, 0.09f},
+    {JOINT_RIGHT_ELBOW, JOINT_RIGHT_HAND, {}, 0.08f, 0.08f},
+    {JOINT_RIGHT_HAND, -1, {0.0f, -0.12f, 0.0f}, 0.06f, 0.09f},
+    {JOINT_LEFT_HIP, JOINT_LEFT_KNEE, {}, 0.13f, 0.13f},
+    {JOINT_LEFT_KNEE, JOINT_LEFT_FOOT, {}, 0.10f, 0.10f},
+    {JOINT_LEFT_FOOT, -1, {0.0f, -0.02f, 0.16f}, 0.09f, 0.06f},
+    {JOINT_RIGHT_HIP, JOINT_RIGHT_KNEE, {}, 0.13f, 0.13f},
+    {JOINT_RIGHT_KNEE, JOINT_RIGHT_FOOT, {}, 0.10f, 0.10f},
+    {JOINT_RIGHT_FOOT, -1, {0.0f, -0.02f, 0.16f}, 0.09f, 0.06f},
+};
+
+static uint32_t packJoints(uint32_t a, uint32_t b) { return a | (b << 8); }
+
+static uint32_t packWeights(float a, float b) {
+  return (uint32_t)(a * 255.0f + 0.5f) | ((uint32_t)(b * 255.0f + 0.5f) << 8);
+}
+
+static void buildSkeleton(Skeleton& s) {
+  s.addJoint(-1, {0.0f, 0.95f, 0.0f});
+  s.addJoint(JOINT_HIPS, {0.0f, 0.20f, 0.0f});
+  s.addJoint(JOINT_SPINE, {0.0f, 0.25f, 0.0f});
+  s.addJoint(JOINT_CHEST, {0.0f, 0.22f, 0.0f});
+  s.addJoint(JOINT_NECK, {0.0f, 0.10f, 0.0f});
+  for (float side : {1.0f, -1.0f}) {
+    uint32_t shoulder = s.addJoint(JOINT_CHEST, {0.2f * side, 0.18f, 0.0f});
+    uint32_t elbow = s.addJoint(shoulder, {0.0f, -0.28f, 0.0f});
+    s.addJoint(elbow, {0.0f, -0.26f, 0.0f});
+  }
+  for (float side : {1.0f, -1.0f}) {
+    uint32_t hip = s.addJoint(JOINT_HIPS, {0.1f * side, -0.02f, 0.0f});
+    uint32_t knee = s.addJoint(hip, {0.0f, -0.44f, 0.0f});
+    s.addJoint(knee, {0.0f, -0.44f, 0.0f});
+  }
+  assert(s.jointCount() == JOINT_COUNT);
+}
+
+// facing +z, one stride per second
+static void walkPose(float time, glm::quat* r, glm::vec3& root) {
+  const glm::vec3 x(1.0f, 0.0f, 0.0f);
+  float phase = time * 6.2831853f;
+  float swing = sinf(phase);
+  r[JOINT_LEFT_HIP] = glm::angleAxis(0.5f * swing, x);
+  r[JOINT_RIGHT_HIP] = glm::angleAxis(-0.5f * swing, x);
+  float bend = sinf(phase + 1.2f);
+  r[JOINT_LEFT_KNEE] = glm::angleAxis(0.9f * std::max(bend, 0.0f), x);
+  r[JOINT_RIGHT_KNEE] = glm::angleAxis(0.9f * std::max(-bend, 0.0f), x);
+  r[JOINT_LEFT_SHOULDER] = glm::angleAxis(-0.4f * swing, x);
+  r[JOINT_RIGHT_SHOULDER] = glm::angleAxis(0.4f * swing, x);
+  r[JOINT_LEFT_ELBOW] = glm::angleAxis(-0.3f, x);
+  r[JOINT_RIGHT_ELBOW] = glm::angleAxis(-0.3f, x);
+  r[JOINT_SPINE] = glm::angleAxis(0.1f * swing, glm::vec3(0.0f, 1.0f, 0.0f));
+  root = glm::vec3(0.0f, 0.03f * cosf(2.0f * phase), 0.0f);
+}
+
+// standing, right arm up and waving, over two seconds
+static void wavePose(float time, glm::quat* r, glm::vec3& root) {
+  const glm::vec3 x(1.0f, 0.0f, 0.0f), z(0.0f, 0.0f, 1.0f);
+  float phase = time * 3.14159265f;
+  r[JOINT_RIGHT_SHOULDER] = glm::angleAxis(-2.5f, z);
+  r[JOINT_RIGHT_ELBOW] = glm::angleAxis(0.5f * sinf(4.0f * phase), z);
+  r[JOINT_LEFT_SHOULDER] = glm::angleAxis(0.1f, z);
+  r[JOINT_HEAD] = glm::angleAxis(0.1f * sinf(phase), x);
+  r[JOINT_LEFT_KNEE] = glm::angleAxis(0.05f, x);
+  r[JOINT_RIGHT_KNEE] = glm::angleAxis(0.05f, x);
+  root = glm::vec3(0.0f, 0.01f * sinf(2.0f * phase), 0.0f);
+}
+
+// a box per segment. the ends where two segments meet are weighted half to
+// each joint, so elbows, knees and the spine bend instead of breaking apart
+void SkinnedMeshes::buildCharacter(std::vector<RestVertex>& vertices,
+                                   std::vector<uint16_t>& meshIndices) {
+  static const glm::vec3 normals[6] = {{1, 0, 0},  {-1, 0, 0}, {0, 1, 0},
+                                       {0, -1, 0}, {0, 0, 1},  {0, 0, -1}};
+  for (const Segment& segment : kSegments) {
+    glm::vec3 a = skeleton.restPosition(segment.joint);
+    glm::vec3 b = segment.child >= 0 ? skeleton.restPosition(segment.child)
+                                     : a + segment.tip;
+    glm::vec3 axis = b - a;
+    float length = glm::length(axis);
+    glm::vec3 dir = axis / length;
+    glm::vec3 ref = fabsf(dir.y) > 0.7f ? glm::vec3(0.0f, 0.0f, 1.0f)
+                                        : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::vec3 side = glm::normalize(glm::cross(ref, dir));
+    glm::vec3 up = glm::cross(dir, side);
+
+    int32_t parent = skeleton.parents[segment.joint];
+    uint32_t startJoints = packJoints(segment.joint, parent >= 0 ? parent : 0);
+    uint32_t startWeights = packWeights(parent >= 0 ? 0.5f : 1.0f,
+                                        parent >= 0 ? 0.5f : 0.0f);
+    uint32_t endJoints =
+        packJoints(segment.joint, segment.child >= 0 ? segment.child : 0);
+    uint32_t endWeights = packWeights(segment.child >= 0 ? 0.5f : 1.0f,
+                                      segment.child >= 0 ? 0.5f : 0.0f);
+
+    for (uint32_t face = 0; face < 6; face++) {
+      glm::vec3 n = normals[face];
+      glm::vec3 u = glm::vec3(n.y, n.z, n.x);
+      glm::vec3 v = glm::cross(n, u);
+      glm::vec3 corners[4] = {(n - u - v) * 0.5f, (n + u - v) * 0.5f,
+                              (n + u + v) * 0.5f, (n - u + v) * 0.5f};
+      uint16_t base = (uint16_t)vertices.size();
+      for (const glm::vec3& c : corners) {
+        RestVertex vertex;
+        vertex.position = a + dir * ((c.x + 0.5f) * length) +
+                          side * (c.y * segment.width) +
+                          up * (c.z * segment.depth);
+        vertex.normal = dir * n.x + side * n.y + up * n.z;
+        vertex.joints = c.x > 0.0f ? endJoints : startJoints;
+        vertex.weights = c.x > 0.0f ? endWeights : startWeights;
+        vertices.push_back(vertex);
+      }
+      const uint16_t order[6] = {0, 1, 2, 0, 2, 3};
+      for (uint16_t i : order) meshIndices.push_back(base + i);
+    }
+  }
+}
+
+void SkinnedMeshes::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                         VkPipelineCache cache, uint32_t characterCount,
+                         uint32_t framesInFlight) {
+  this->device = device;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  buildSkeleton(skeleton);
+  walk = bakeClip(skeleton, 1.0f, 30.0f, walkPose);
+  wave = bakeClip(skeleton, 2.0f, 30.0f, wavePose);
+  std::vector<RestVertex> vertices;
+  std::vector<uint16_t> meshIndices;
+  buildCharacter(vertices, meshIndices);
+  meshVertexCount = (uint32_t)vertices.size();
+  meshIndexCount = (uint32_t)meshIndices.size();
+
+  // the dispatch is one dimensional
+  uint32_t maxCharacters = kMaxGroups * kSkinGroupSize / meshVertexCount;
+  if (characterCount > maxCharacters) {
+    printf("skinned meshes: %u characters is more than one dispatch can "
+           "skin, using %u\n", characterCount, maxCharacters);
+    characterCount = maxCharacters;
+  }
+
+  // walking circles scattered over the ground in front of the camera
+  characters.resize(characterCount);
+  uint32_t seed = 0x6c8e9cf5u;
+  for (Character& c : characters) {
+    c.center = glm::vec3(randomFloat(seed) * 36.0f - 18.0f, 0.0f,
+                         randomFloat(seed) * 32.0f - 30.0f);
+    c.radius = 1.0f + randomFloat(seed) * 3.0f;
+    c.speed = kWalkSpeed * (0.7f + randomFloat(seed) * 0.6f);
+    c.phase = randomFloat(seed) * 6.2831853f;
+    c.waveRate = 0.1f + randomFloat(seed) * 0.3f;
+    c.color = glm::vec4(0.3f + randomFloat(seed) * 0.6f,
+                        0.3f + randomFloat(seed) * 0.6f,
+                        0.3f + randomFloat(seed) * 0.6f, 1.0f);
+    c.bounds = glm::vec4(c.center, 1.1f);
+  }
+
+  const VkMemoryPropertyFlags hostFlags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  VkDeviceSize restBytes = vertices.size() * sizeof(RestVertex);
+  VkDeviceSize indexBytes = meshIndices.size() * sizeof(uint16_t);
+  restBuffer = createBuffer(device, memoryProperties, restBytes,
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0, hostFlags,
+                            MEMORY_BUFFER, restMemory);
+  indices = createBuffer(device, memoryProperties, indexBytes,
+                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 0, hostFlags,
+                         MEMORY_BUFFER, indexMemory);
+  void* mapped;
+  VK_CHECK(vkd.vkMapMemory(device, restMemory, 0, VK_WHOLE_SIZE, 0, &mapped));
+  memcpy(mapped, vertices.data(), restBytes);
+  vkd.vkUnmapMemory(device, restMemory);
+  VK_CHECK(vkd.vkMapMemory(device, indexMemory, 0, VK_WHOLE_SIZE, 0, &mapped));
+  memcpy(mapped, meshIndices.data(), indexBytes);
+  vkd.vkUnmapMemory(device, indexMemory);
+
+  paletteStride = ((VkDeviceSize)characterCount * JOINT_COUNT *
+                       kPaletteEntrySize + 255) & ~(VkDeviceSize)255;
+  paletteBuffer = createBuffer(device, memoryProperties,
+                               paletteStride * framesInFlight,
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0, hostFlags,
+                               MEMORY_BUFFER, paletteMemory);
+  VK_CHECK(vkd.vkMapMemory(device, paletteMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&paletteMapped));
+
+  // one buffer for every frame in flight: skin() orders its writes after
+  // the previous frame's draws
+  VkDeviceSize skinnedBytes =
+      (VkDeviceSize)characterCount * meshVertexCount * sizeof(OutputVertex);
+  skinnedBuffer = createBuffer(
+      device, memoryProperties, skinnedBytes,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 0,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_BUFFER, skinnedMemory);
+
+  VkDescriptorSetLayoutBinding bindings[3] = {};
+  for (uint32_t i = 0; i < 3; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+  setLayoutInfo.bindingCount = 3;
+  setLayoutInfo.pBindings = bindings;
+  VK_CHECK(vkd.vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr,
+                                           &setLayout));
+
+  VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                   3 * framesInFlight};
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = framesInFlight;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  VK_CHECK(vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                      &descriptorPool));
+
+  std::vector<VkDescriptorSetLayout> setLayouts(framesInFlight, setLayout);
+  descriptorSets.resize(framesInFlight);
+  VkDescriptorSetAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = framesInFlight;
+  allocInfo.pSetLayouts = setLayouts.data();
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &allocInfo,
+                                        descriptorSets.data()));
+
+  for (uint32_t slot = 0; slot < framesInFlight; slot++) {
+    VkDescriptorBufferInfo bufferInfos[3] = {
+        {restBuffer, 0, VK_WHOLE_SIZE},
+        {paletteBuffer, slot * paletteStride, paletteStride},
+        {skinnedBuffer, 0, VK_WHOLE_SIZE}};
+    VkWriteDescriptorSet writes[3] = {};
+    for (uint32_t i = 0; i < 3; i++) {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = descriptorSets[slot];
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    vkd.vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+  }
+
+  VkPushConstantRange skinRange = {VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                   sizeof(SkinConstants)};
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &skinRange;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr,
+                                      &skinLayout));
+
+  // viewProj for the vertex stage, the character's color after it
+  VkPushConstantRange drawRanges[2] = {
+      {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4)},
+      {VK_SHADER_STAGE_FRAGMENT_BIT, offsetof(DrawConstants, color),
+       sizeof(glm::vec4)}};
+  VkPipelineLayoutCreateInfo drawLayoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  drawLayoutInfo.pushConstantRangeCount = 2;
+  drawLayoutInfo.pPushConstantRanges = drawRanges;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &drawLayoutInfo, nullptr,
+                                      &drawLayout));
+
+  skinShader = createShaderModule(device, readFile("shaders/skin.spv"));
+  skinPipeline = compileComputePipeline(device, cache, skinShader, skinLayout);
+  assert(skinPipeline);
+
+  vertexShader = createShaderRef(device, readFile("shaders/skinned_vert.spv"));
+  fragmentShader =
+      createShaderRef(device, readFile("shaders/skinned_frag.spv"));
+
+  drawDesc = GraphicsPipelineDesc();
+  drawDesc.vertexShader = vertexShader;
+  drawDesc.fragmentShader = fragmentShader;
+  drawDesc.bindingCount = 1;
+  drawDesc.bindings[0] = {0, sizeof(OutputVertex), VK_VERTEX_INPUT_RATE_VERTEX};
+  drawDesc.attributeCount = 2;
+  drawDesc.attributes[0] = {0, 0, VK_FORMAT_R32G32B32_SFLOAT,
+                            offsetof(OutputVertex, position)};
+  drawDesc.attributes[1] = {1, 0, VK_FORMAT_R32G32B32_SFLOAT,
+                            offsetof(OutputVertex, normal)};
+  drawDesc.cullMode = VK_CULL_MODE_NONE;
+  drawDesc.depthTestEnable = VK_TRUE;
+  drawDesc.depthWriteEnable = VK_TRUE;
+  drawDesc.layout = drawLayout;
+
+  printf("skinned meshes: %u characters, %u joints and %u vertices each, "
+         "%.1fmb skinned, %.1fmb of palettes per frame\n",
+         characterCount, JOINT_COUNT, meshVertexCount,
+         skinnedBytes / (1024.0 * 1024.0), paletteStride / (1024.0 * 1024.0));
+}
+
+void SkinnedMeshes::destroy() {
+  // batches of a dropped last frame may still be writing palettes
+  while (!animated.done()) std::this_thread::yield();
+  vkd.vkDestroyPipeline(device, skinPipeline, nullptr);
+  vkd.vkDestroyShaderModule(device, skinShader, nullptr);
+  vkd.vkDestroyShaderModule(device, vertexShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, fragmentShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(device, skinLayout, nullptr);
+  vkd.vkDestroyPipelineLayout(device, drawLayout, nullptr);
+  vkd.vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  vkd.vkUnmapMemory(device, paletteMemory);
+  VkBuffer buffers[] = {restBuffer, indices, paletteBuffer, skinnedBuffer};
+  VkDeviceMemory memories[] = {restMemory, indexMemory, paletteMemory,
+                               skinnedMemory};
+  for (uint32_t i = 0; i < 4; i++) {
+    vkd.vkDestroyBuffer(device, buffers[i], nullptr);
+    freeTrackedMemory(device, memories[i]);
+  }
+}
+
+void SkinnedMeshes::animateBatch(uint32_t first, uint32_t count, uint32_t slot,
+                                 float time) {
+  PROFILE_SCOPE("animate characters");
+  uint64_t begin = profilerNow();
+  float* palette = (float*)(paletteMapped + slot * paletteStride) +
+                   (size_t)first * JOINT_COUNT * 12;
+  for (uint32_t i = first; i < first + count; i++) {
+    Character& c = characters[i];
+    // drifts between walking and waving, and mostly does one or the other
+    float waving = glm::clamp(sinf(time * c.waveRate + c.phase) * 2.0f - 0.5f,
+                              0.0f, 1.0f);
+    float angle = c.phase + time * c.speed / c.radius;
+    glm::vec3 position =
+        c.center + glm::vec3(cosf(angle), 0.0f, sinf(angle)) * c.radius;
+    // +z is forward, turned along the circle
+    glm::mat4 world = glm::rotate(glm::translate(glm::mat4(1.0f), position),
+                                  -angle, glm::vec3(0.0f, 1.0f, 0.0f));
+    samplePalette(skeleton, walk, time * c.speed / kWalkSpeed + c.phase, wave,
+                  time + c.phase, waving, world, palette);
+    c.bounds = glm::vec4(position + glm::vec3(0.0f, 0.9f, 0.0f), 1.1f);
+    palette += JOINT_COUNT * 12;
+  }
+  animateNanoseconds += profilerNow() - begin;
+}
+
+void SkinnedMeshes::animate(JobSystem& jobs, uint32_t slot, float time) {
+  // a frame dropped after animate() (swapchain out of date) never skinned
+  if (animating) jobs.wait(&animated);
+  frames++;
+  // read by the batches; small captures keep the jobs off the heap
+  animateTime = time;
+  for (uint32_t first = 0; first < characters.size(); first += kBatchSize) {
+    jobs.run(&animated, [this, first, slot] {
+      uint32_t count = (uint32_t)characters.size() - first;
+      if (count > kBatchSize) count = kBatchSize;
+      animateBatch(first, count, slot, animateTime);
+    }, "animate");
+  }
+  animating = true;
+}
+
+void SkinnedMeshes::skin(VkCommandBuffer cmd, JobSystem& jobs, uint32_t slot,
+                         GpuTimer& timer) {
+  if (animating) {
+    PROFILE_SCOPE("wait animation");
+    jobs.wait(&animated);
+    animating = false;
+  }
+  uint32_t zone = timer.begin(cmd, "skinning");
+
+  // the previous frame's draws still read the skinned vertices
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                           0, nullptr, 0, nullptr);
+
+  SkinConstants constants = {meshVertexCount, JOINT_COUNT,
+                             meshVertexCount * (uint32_t)characters.size(), 0};
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, skinPipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, skinLayout,
+                              0, 1, &descriptorSets[slot], 0, nullptr);
+  vkd.vkCmdPushConstants(cmd, skinLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                         sizeof(constants), &constants);
+  uint32_t groups =
+      (constants.totalVertices + kSkinGroupSize - 1) / kSkinGroupSize;
+  vkd.vkCmdDispatch(cmd, groups, 1, 1);
+
+  VkMemoryBarrier skinned = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  skinned.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  skinned.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &skinned,
+                           0, nullptr, 0, nullptr);
+  timer.end(cmd, zone, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+
+void SkinnedMeshes::draw(VkCommandBuffer cmd, const glm::mat4& viewProj,
+                         PipelineVariantCache& pipelines) {
+  VkPipeline pipeline = pipelines.request(drawDesc);
+  if (!pipeline) return;
+
+  // frustum planes, pointing inwards; depth is zero to one
+  glm::vec4 planes[6];
+  for (int i = 0; i < 4; i++) {
+    glm::vec4 row(viewProj[0][i / 2], viewProj[1][i / 2], viewProj[2][i / 2],
+                  viewProj[3][i / 2]);
+    glm::vec4 w(viewProj[0][3], viewProj[1][3], viewProj[2][3],
+                viewProj[3][3]);
+    planes[i] = i % 2 ? w - row : w + row;
+  }
+  planes[4] = glm::vec4(viewProj[0][2], viewProj[1][2], viewProj[2][2],
+                        viewProj[3][2]);
+  planes[5] = glm::vec4(viewProj[0][3], viewProj[1][3], viewProj[2][3],
+                        viewProj[3][3]) - planes[4];
+
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  VkDeviceSize offset = 0;
+  vkd.vkCmdBindVertexBuffers(cmd, 0, 1, &skinnedBuffer, &offset);
+  vkd.vkCmdBindIndexBuffer(cmd, indices, 0, VK_INDEX_TYPE_UINT16);
+  vkd.vkCmdPushConstants(cmd, drawLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                         sizeof(glm::mat4), &viewProj);
+
+  for (uint32_t i = 0; i < characters.size(); i++) {
+    const glm::vec4& b = characters[i].bounds;
+    bool visible = true;
+    for (int p = 0; p < 6 && visible; p++) {
+      visible = glm::dot(glm::vec3(planes[p]), glm::vec3(b)) + planes[p].w >=
+                -b.w * glm::length(glm::vec3(planes[p]));
+    }
+    if (!visible) continue;
+    vkd.vkCmdPushConstants(cmd, drawLayout, VK_SHADER_STAGE_FRAGMENT_BIT,
+                           offsetof(DrawConstants, color), sizeof(glm::vec4),
+                           &characters[i].color);
+    int32_t vertexOffset = (int32_t)(i * meshVertexCount);
+    vkd.vkCmdDrawIndexed(cmd, meshIndexCount, 1, 0, vertexOffset, 0);
+    drawnCharacters++;
+  }
+}
+
+void SkinnedMeshes::printStats() const {
+  if (!frames) return;
+  printf("skinned meshes: %.3f ms of animation jobs per frame in batches of "
+         "%u, %.0f of %u characters drawn per frame\n",
+         animateNanoseconds.load() / 1e6 / frames, kBatchSize,
+         (double)drawnCharacters / frames, (uint32_t)characters.size());
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "animation.h"
+#include "job_system.h"
+#include "pipeline_cache.h"
+
+#include <atomic>
+#include <glm/glm.hpp>
+#include <vector>
+
+class GpuTimer;
+
+// A crowd of animated characters, skinned once per frame in compute.
+//
+// animate() splits the characters into batches on the job workers; each
+// batch samples and blends its characters' clips (animation.h) and writes
+// their palettes straight into this frame's mapped palette buffer. skin()
+// waits for them and records one dispatch that skins every character into
+// a shared, world space vertex buffer. Everything that draws the crowd
+// afterwards - the main pass here, the shadow cascades through
+// ShadowMaps::setWorldCasters - reads that buffer instead of skinning again.
+class SkinnedMeshes {
+ public:
+  // characters per animation job
+  static const uint32_t kBatchSize = 64;
+
+  // layout of the skinned output, matches ShadowMaps' caster vertices
+  struct OutputVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+  };
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            VkPipelineCache cache, uint32_t characterCount,
+            uint32_t framesInFlight);
+  void destroy();
+
+  // starts building this frame's palettes on the workers; call once the
+  // slot's fence was waited on
+  void animate(JobSystem& jobs, uint32_t slot, float time);
+  // waits for animate() and records the skinning dispatch. record outside a
+  // render pass, before anything that reads outputBuffer().
+  void skin(VkCommandBuffer cmd, JobSystem& jobs, uint32_t slot,
+            GpuTimer& timer);
+  // the characters inside the view frustum, inside the main pass
+  void draw(VkCommandBuffer cmd, const glm::mat4& viewProj,
+            PipelineVariantCache& pipelines);
+
+  // every character uses the same index range; character i's vertices
+  // start at i * verticesPerCharacter() in outputBuffer()
+  VkBuffer outputBuffer() const { return skinnedBuffer; }
+  VkBuffer indexBuffer() const { return indices; }
+  uint32_t indexCount() const { return meshIndexCount; }
+  uint32_t verticesPerCharacter() const { return meshVertexCount; }
+  uint32_t characterCount() const { return (uint32_t)characters.size(); }
+  // world space bounding sphere (xyz center, w radius) of character i,
+  // valid after skin()
+  glm::vec4 bounds(uint32_t i) const { return characters[i].bounds; }
+
+  void printStats() const;
+
+  // the owner fills in renderPassKey like for any other pipeline
+  GraphicsPipelineDesc drawDesc;
+
+ private:
+  // mirrors RestVertex in skin.comp
+  struct RestVertex {
+    glm::vec3 position;
+    uint32_t joints;  // four 8 bit joint indices
+    glm::vec3 normal;
+    uint32_t weights;  // four unorm8 weights
+  };
+
+  struct Character {
+    glm::vec3 center;  // of the circle it walks around
+    float radius;
+    float speed;
+    float phase;
+    float waveRate;  // how fast it drifts between walking and waving
+    glm::vec4 color;
+    glm::vec4 bounds;
+  };
+
+  // mirrors the push constants in skin.comp
+  struct SkinConstants {
+    uint32_t vertexCount;  // per character
+    uint32_t jointCount;
+    uint32_t totalVertices;
+    uint32_t reserved;
+  };
+
+  struct DrawConstants {
+    glm::mat4 viewProj;
+    glm::vec4 color;
+  };
+
+  void animateBatch(uint32_t first, uint32_t count, uint32_t slot, float time);
+  void buildCharacter(std::vector<RestVertex>& vertices,
+                      std::vector<uint16_t>& meshIndices);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+
+  Skeleton skeleton;
+  AnimationClip walk;
+  AnimationClip wave;
+  std::vector<Character> characters;
+  uint32_t meshVertexCount = 0;
+  uint32_t meshIndexCount = 0;
+  JobCounter animated;
+  bool animating = false;
+  float animateTime = 0.0f;
+
+  VkBuffer restBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory restMemory = VK_NULL_HANDLE;
+  VkBuffer indices = VK_NULL_HANDLE;
+  VkDeviceMemory indexMemory = VK_NULL_HANDLE;
+  // per slot 3x4 palettes, persistently mapped
+  VkBuffer paletteBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory paletteMemory = VK_NULL_HANDLE;
+  uint8_t* paletteMapped = nullptr;
+  VkDeviceSize paletteStride = 0;
+  VkBuffer skinnedBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory skinnedMemory = VK_NULL_HANDLE;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> descriptorSets;
+  VkPipelineLayout skinLayout = VK_NULL_HANDLE;
+  VkPipelineLayout drawLayout = VK_NULL_HANDLE;
+  VkShaderModule skinShader = VK_NULL_HANDLE;
+  VkPipeline skinPipeline = VK_NULL_HANDLE;
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+
+  uint64_t frames = 0;
+  std::atomic<uint64_t> animateNanoseconds{0};  // summed over all batches
+  uint64_t drawnCharacters = 0;
+};
@@ -0,0 +1,325 @@
+#include "streaming_atlas.h"
+
+#include "deletion_queue.h"
+#include "memory_budget.h"
+#include "residency_manager.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+#include <algorithm>
+
+void StreamingAtlas::init(
+    VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties,
+    JobSystem& jobs, ResidencyManager& residency, DeletionQueue& deletionQueue,
+    const Desc& desc) {
+  this->device = device;
+  this->memoryProperties = memoryProperties;
+  this->jobs = &jobs;
+  this->residency = &residency;
+  this->deletionQueue = &deletionQueue;
+  this->desc = desc;
+
+  const uint32_t slotCount = desc.columns * desc.columns;
+  slotKeys.assign(slotCount, kNoKey);
+  slotUsed.assign(slotCount, 0);
+  copies.reserve(kStagingTiles);
+
+  stagingTileBytes =
+      (VkDeviceSize)desc.tileTexels * desc.tileTexels * desc.texelBytes;
+  stagingBuffer = createBuffer(
+      device, memoryProperties, stagingTileBytes * kStagingTiles,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 0,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MEMORY_STAGING, stagingMemory);
+  VK_CHECK(vkd.vkMapMemory(device, stagingMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&stagingMapped));
+  for (uint32_t i = 0; i < kStagingTiles; i++) {
+    staging[i].data = stagingMapped + i * stagingTileBytes;
+  }
+
+  rowBytes = (VkDeviceSize)desc.columns * stagingTileBytes;
+  atlasRows = desc.columns;
+  heap = createImage(atlasRows);
+
+  // sampled every frame, so it's never touched and can always give up rows
+  ResidencyManager::ResourceDesc resource;
+  resource.name = desc.name;
+  resource.heap = heap;
+  resource.bytes = rowBytes * atlasRows;
+  resource.downgrade = [this] { return shrink(atlasRows / 2); };
+  resource.evict = [this] { return shrink(1); };
+  residencyId = residency.add(resource);
+}
+
+uint32_t StreamingAtlas::createImage(uint32_t rows) {
+  VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = desc.format;
+  imageInfo.extent = {desc.columns * desc.tileTexels, rows * desc.tileTexels,
+                      1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  // a resized image is copied out of
+  imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                    VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VK_CHECK(vkd.vkCreateImage(device, &imageInfo, nullptr, &atlasImage));
+  VkMemoryRequirements memReq;
+  vkd.vkGetImageMemoryRequirements(device, atlasImage, &memReq);
+  VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+  allocInfo.allocationSize = memReq.size;
+  allocInfo.memoryTypeIndex =
+      findMemoryType(memoryProperties, memReq.memoryTypeBits, 0,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  assert(allocInfo.memoryTypeIndex != UINT32_MAX);
+  VK_CHECK(allocateTrackedMemory(device, allocInfo, MEMORY_TEXTURE,
+                                 atlasMemory));
+  VK_CHECK(vkd.vkBindImageMemory(device, atlasImage, atlasMemory, 0));
+
+  VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+  viewInfo.image = atlasImage;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = desc.format;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  VK_CHECK(vkd.vkCreateImageView(device, &viewInfo, nullptr, &atlasView));
+  atlasImageRows = rows;
+  return memoryHeapForType(allocInfo.memoryTypeIndex);
+}
+
+void StreamingAtlas::destroy() {
+  // loads still running write into the staging buffer
+  for (StagingTile& tile : staging) jobs->wait(&tile.loaded);
+  residency->remove(residencyId);
+  vkd.vkDestroyImageView(device, atlasView, nullptr);
+  vkd.vkDestroyImage(device, atlasImage, nullptr);
+  freeTrackedMemory(device, atlasMemory);
+  vkd.vkDestroyImageView(device, retiredView, nullptr);
+  vkd.vkDestroyImage(device, retiredImage, nullptr);
+  freeTrackedMemory(device, retiredMemory);
+  vkd.vkUnmapMemory(device, stagingMemory);
+  vkd.vkDestroyBuffer(device, stagingBuffer, nullptr);
+  freeTrackedMemory(device, stagingMemory);
+}
+
+void StreamingAtlas::update(uint32_t slot, uint64_t frame) {
+  this->frame = frame;
+  // the frame that copied out of it was submitted since
+  if (retiredImage) {
+    deletionQueue->push(retiredView);
+    deletionQueue->push(retiredImage);
+    deletionQueue->push(retiredMemory);
+    retiredView = VK_NULL_HANDLE;
+    retiredImage = VK_NULL_HANDLE;
+    retiredMemory = VK_NULL_HANDLE;
+  }
+  for (StagingTile& tile : staging) {
+    if (tile.state == STAGING_COPYING && tile.slot == slot) {
+      tile.state = STAGING_FREE;
+    }
+  }
+}
+
+bool StreamingAtlas::startLoad(uint64_t key) {
+  StagingTile* s = staging;
+  while (s < staging + kStagingTiles && s->state != STAGING_FREE) s++;
+  if (s == staging + kStagingTiles) return false;
+  s->state = STAGING_LOADING;
+  s->key = key;
+  s->ok = false;
+  // two captures, so the job doesn't allocate
+  jobs->run(&s->loaded, [this, s] {
+    s->ok = desc.load(s->key, (uint32_t)(s - staging), s->data);
+  }, desc.name);
+  return true;
+}
+
+bool StreamingAtlas::loadNow(uint64_t key) {
+  StagingTile* s = staging;
+  while (s < staging + kStagingTiles && s->state != STAGING_FREE) s++;
+  assert(s < staging + kStagingTiles);
+  s->state = STAGING_LOADING;
+  s->key = key;
+  s->ok = desc.load(key, (uint32_t)(s - staging), s->data);
+  return s->ok;
+}
+
+uint32_t StreamingAtlas::residentCount() const {
+  uint32_t resident = 0;
+  for (uint64_t key : slotKeys) {
+    if (key != kNoKey) resident++;
+  }
+  return resident;
+}
+
+// a free slot, or the one touched longest ago. kNoSlot if there's none.
+uint32_t StreamingAtlas::findSlot() const {
+  uint32_t victim = kNoSlot;
+  uint64_t oldest = frame;
+  for (uint32_t i = 0; i < atlasRows * desc.columns; i++) {
+    if (slotKeys[i] == kNoKey) return i;
+    if (slotKeys[i] != desc.pinnedKey && slotUsed[i] < oldest) {
+      oldest = slotUsed[i];
+      victim = i;
+    }
+  }
+  return victim;
+}
+
+VkDeviceSize StreamingAtlas::shrink(uint32_t rows) {
+  rows = std::max(rows, 1u);
+  if (rows >= atlasRows) return 0;
+  for (uint32_t i = rows * desc.columns; i < atlasRows * desc.columns; i++) {
+    if (slotKeys[i] == kNoKey) continue;
+    desc.evicted(slotKeys[i]);
+    slotKeys[i] = kNoKey;
+    counters.evicted++;
+  }
+  VkDeviceSize released = (atlasRows - rows) * rowBytes;
+  atlasRows = rows;
+  counters.shrinks++;
+  return released;
+}
+
+void StreamingAtlas::grow() {
+  if (!full || atlasRows == desc.columns) return;
+  uint32_t rows = std::min(atlasRows * 2, desc.columns);
+  // the old image lives on until the deletion queue frees it
+  if (!residency->canAllocate(heap, rows * rowBytes)) return;
+  atlasRows = rows;
+  counters.grows++;
+}
+
+void StreamingAtlas::resize(VkCommandBuffer cmd) {
+  assert(!retiredImage);
+  retiredImage = atlasImage;
+  retiredMemory = atlasMemory;
+  retiredView = atlasView;
+  uint32_t keptRows = std::min(atlasImageRows, atlasRows);
+  heap = createImage(atlasRows);
+  // before the first upload there's nothing to keep, and the new image
+  // leaves UNDEFINED like the old one would have
+  if (!initialized) return;
+
+  VkImageMemoryBarrier in[2] = {};
+  for (VkImageMemoryBarrier& barrier : in) {
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  }
+  in[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  in[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  in[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  in[0].image = retiredImage;
+  in[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  in[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  in[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  in[1].image = atlasImage;
+  vkd.vkCmdPipelineBarrier(cmd, desc.stages, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           0, 0, nullptr, 0, nullptr, 2, in);
+  VkImageCopy region = {};
+  region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.dstSubresource = region.srcSubresource;
+  region.extent = {desc.columns * desc.tileTexels, keptRows * desc.tileTexels,
+                   1};
+  vkd.vkCmdCopyImage(cmd, retiredImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                     atlasImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                     &region);
+  // where upload() expects the image after the first frame
+  VkImageMemoryBarrier out = in[1];
+  out.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  out.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  out.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  out.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, desc.stages,
+                           0, 0, nullptr, 0, nullptr, 1, &out);
+}
+
+void StreamingAtlas::copyLoaded(uint32_t slot) {
+  copies.clear();
+  for (uint32_t i = 0; i < kStagingTiles; i++) {
+    StagingTile& s = staging[i];
+    if (s.state != STAGING_LOADING || !s.loaded.done()) continue;
+    if (!s.ok) {
+      // the owner never hears back, so it doesn't ask for the key again
+      counters.failed++;
+      s.state = STAGING_FREE;
+      continue;
+    }
+    uint32_t atlasSlot = findSlot();
+    if (atlasSlot == kNoSlot) {
+      full = true;
+      break;  // all in use, next frame
+    }
+    if (slotKeys[atlasSlot] != kNoKey) {
+      full = true;
+      desc.evicted(slotKeys[atlasSlot]);
+      counters.evicted++;
+    }
+    slotKeys[atlasSlot] = s.key;
+    slotUsed[atlasSlot] = frame;
+    desc.placed(s.key, atlasSlot, i);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = i * stagingTileBytes;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageOffset = {
+        (int32_t)(atlasSlot % desc.columns * desc.tileTexels),
+        (int32_t)(atlasSlot / desc.columns * desc.tileTexels), 0};
+    region.imageExtent = {desc.tileTexels, desc.tileTexels, 1};
+    copies.push_back(region);
+    s.state = STAGING_COPYING;
+    s.slot = slot;
+    counters.loaded++;
+  }
+}
+
+// the barrier in waits for the shaders of earlier frames, which may still
+// sample the slots that are overwritten
+void StreamingAtlas::upload(VkCommandBuffer cmd) {
+  // the first frame also moves the image out of UNDEFINED
+  if (copies.empty() && initialized) return;
+  VkImageMemoryBarrier barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = initialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                  : VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = atlasImage;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkd.vkCmdPipelineBarrier(cmd, desc.stages, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           0, 0, nullptr, 0, nullptr, 1, &barrier);
+  if (!copies.empty()) {
+    vkd.vkCmdCopyBufferToImage(cmd, stagingBuffer, atlasImage,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               (uint32_t)copies.size(), copies.data());
+  }
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, desc.stages,
+                           0, 0, nullptr, 0, nullptr, 1, &barrier);
+  initialized = true;
+}
+
+bool StreamingAtlas::record(VkCommandBuffer cmd, uint32_t slot) {
+  grow();
+  bool replaced = atlasImageRows != atlasRows;
+  if (replaced) {
+    resize(cmd);
+    // an eviction reports the atlas as gone, but it keeps a row
+    residency->setBytes(residencyId, atlasRows * rowBytes);
+  }
+  full = false;
+  copyLoaded(slot);
+  upload(cmd);
+  return replaced;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "job_system.h"
+
+#include <functional>
+#include <vector>
+
+class DeletionQueue;
+class ResidencyManager;
+
+// A texture atlas of equally sized square tiles that are streamed in from
+// the job workers, for the virtual texture's pages and the terrain's height
+// tiles.
+//
+// The owner names tiles with 64 bit keys and keeps its own key -> slot
+// mapping up to date through the placed and evicted callbacks. startLoad()
+// runs the load callback on a worker, straight into one of kStagingTiles
+// persistently mapped staging tiles; record() copies the finished ones into
+// free atlas slots or over the slot used longest ago. Slots touched this
+// frame and the pinned key's stay.
+//
+// The atlas is registered with the ResidencyManager and gives up rows of
+// tiles over budget: a downgrade halves the rows in use, an eviction keeps
+// only the first, and the tiles in the rows that go are evicted. Once loads
+// are waiting on a full atlas and the heap has room again, record() doubles
+// the rows back towards all of them. Either way it moves what's left into
+// an image of the new size; the one it replaces goes through the deletion
+// queue once the frame that copied out of it was submitted.
+class StreamingAtlas {
+ public:
+  static const uint32_t kStagingTiles = 32;
+  static constexpr uint32_t kNoSlot = ~0u;
+  static constexpr uint64_t kNoKey = ~0ull;
+
+  struct Desc {
+    const char* name = nullptr;  // for the ResidencyManager
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t texelBytes = 0;
+    uint32_t tileTexels = 0;  // per side
+    uint32_t columns = 0;     // tiles per row, and the most rows there are
+    // the shader stages that sample the atlas
+    VkPipelineStageFlags stages = 0;
+    // never evicted; has to be the first tile loaded so it lands in slot 0,
+    // which every row count keeps
+    uint64_t pinnedKey = kNoKey;
+    // on a worker: the tile for key into data, tileBytes() of staging
+    // memory; false if it can't be loaded
+    std::function<bool(uint64_t key, uint32_t staging, uint8_t* data)> load;
+    // main thread: the tile of key loaded from staging is in slot now
+    std::function<void(uint64_t key, uint32_t slot, uint32_t staging)> placed;
+    // main thread: key's tile is gone, evicted or in a row that was dropped
+    std::function<void(uint64_t key)> evicted;
+  };
+
+  struct Stats {
+    uint64_t loaded = 0;
+    uint64_t evicted = 0;
+    uint64_t failed = 0;
+    uint64_t shrinks = 0;
+    uint64_t grows = 0;
+  };
+
+  void init(VkDevice device,
+            const VkPhysicalDeviceMemoryProperties& memoryProperties,
+            JobSystem& jobs, ResidencyManager& residency,
+            DeletionQueue& deletionQueue, const Desc& desc);
+  // waits for the loads still running
+  void destroy();
+
+  // once the slot's fence was waited on: retires the image record()
+  // replaced and releases the staging tiles the slot's last frame copied
+  void update(uint32_t slot, uint64_t frame);
+  // false if every staging tile is busy
+  bool startLoad(uint64_t key);
+  // loads key on the calling thread; the next record() copies it like any
+  // other load. false if it couldn't be loaded.
+  bool loadNow(uint64_t key);
+  // keeps the slot's tile for another frame
+  void touch(uint32_t slot) { slotUsed[slot] = frame; }
+  // outside a render pass, before the atlas is sampled: resizes the image
+  // if the rows changed or can grow and copies the finished loads. true if
+  // the image and view were replaced, so descriptors pointing at them have
+  // to be rewritten.
+  bool record(VkCommandBuffer cmd, uint32_t slot);
+
+  VkImageView view() const { return atlasView; }
+  VkDeviceSize tileBytes() const { return stagingTileBytes; }
+  uint32_t rows() const { return atlasRows; }  // in use
+  uint32_t imageRows() const { return atlasImageRows; }
+  uint32_t residentCount() const;
+  const Stats& stats() const { return counters; }
+
+ private:
+  enum StagingState {
+    STAGING_FREE,
+    STAGING_LOADING,  // a worker loads the tile into it
+    STAGING_COPYING,  // recorded into `slot`'s frame
+  };
+
+  struct StagingTile {
+    uint8_t* data = nullptr;  // in the mapped staging buffer
+    uint32_t state = STAGING_FREE;
+    uint64_t key = kNoKey;
+    uint32_t slot = 0;
+    bool ok = false;
+    JobCounter loaded;
+  };
+
+  uint32_t findSlot() const;
+  // evicts the tiles in the rows past `rows`; the bytes the smaller image
+  // saves
+  VkDeviceSize shrink(uint32_t rows);
+  // returns the heap it's in
+  uint32_t createImage(uint32_t rows);
+  // doubles atlasRows if the atlas was full and the heap has room for it
+  void grow();
+  // the rows of the old image that are still in use into one of atlasRows
+  void resize(VkCommandBuffer cmd);
+  void copyLoaded(uint32_t slot);
+  void upload(VkCommandBuffer cmd);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  JobSystem* jobs = nullptr;
+  ResidencyManager* residency = nullptr;
+  DeletionQueue* deletionQueue = nullptr;
+  uint32_t residencyId = 0;
+  uint32_t heap = 0;  // the atlas image's
+  Desc desc;
+  uint64_t frame = 0;
+
+  // per slot: its tile (kNoKey if free) and the last frame it was touched
+  std::vector<uint64_t> slotKeys;
+  std::vector<uint64_t> slotUsed;
+  std::vector<VkBufferImageCopy> copies;  // this frame's, by record()
+
+  VkImage atlasImage = VK_NULL_HANDLE;
+  VkDeviceMemory atlasMemory = VK_NULL_HANDLE;
+  VkImageView atlasView = VK_NULL_HANDLE;
+  bool initialized = false;  // out of UNDEFINED
+  uint32_t atlasRows = 0;       // of tiles in use
+  uint32_t atlasImageRows = 0;  // atlasImage's, until record() catches up
+  // the last copyLoaded() had to evict or leave loads waiting
+  bool full = false;
+  VkDeviceSize rowBytes = 0;
+  // replaced by resize(), until update() hands them to the deletion queue
+  VkImage retiredImage = VK_NULL_HANDLE;
+  VkDeviceMemory retiredMemory = VK_NULL_HANDLE;
+  VkImageView retiredView = VK_NULL_HANDLE;
+
+  VkBuffer stagingBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+  uint8_t* stagingMapped = nullptr;
+  VkDeviceSize stagingTileBytes = 0;
+  StagingTile staging[kStagingTiles];
+
+  Stats counters;
+};
@@ -0,0 +1,573 @@
+#include "terrain_renderer.h"
+
+#include "deletion_queue.h"
+#include "file_io.h"
+#include "gpu_timer.h"
+#include "profiler.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+static const VkFormat kHeightFormat = VK_FORMAT_R32_SFLOAT;
+// level 0 nodes, in world units; with kGridCells that's a vertex every
+// 6cm up close
+static const float kLeafSize = 2.0f;
+// a level's range in its own node sizes. has to stay above 2 * sqrt(2) so
+// a node is fully morphed where its coarser neighbour starts
+static const float kRangeNodes = 4.0f;
+// fraction of the gap to the finer level's range where morphing starts
+static const float kMorphStart = 0.7f;
+// the ridged noise's largest features, and the highest it gets
+static const float kBaseWavelength = 600.0f;
+static const float kMaxHeight = 45.0f;
+static const uint32_t kOctaves = 9;
+// the flattened valley the camera orbits in; terrain heights start at
+// kBaseHeight outside it. a little below the other demos' ground planes.
+static const float kValleyFloor = -0.05f;
+static const float kBaseHeight = -4.0f;
+static const float kValleyInner = 14.0f;
+static const float kValleyOuter = 45.0f;
+static const float kDriftSpeed = 4.0f;  // world units per second
+
+static float latticeValue(int32_t x, int32_t y) {
+  uint32_t h = (uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u;
+  h = (h ^ (h >> 13)) * 0x5bd1e995u;
+  return (float)((h ^ (h >> 15)) & 0xffffff) / 16777216.0f;
+}
+
+static float valueNoise(float x, float y) {
+  float fx = floorf(x);
+  float fy = floorf(y);
+  int32_t ix = (int32_t)fx;
+  int32_t iy = (int32_t)fy;
+  float tx = x - fx;
+  float ty = y - fy;
+  tx = tx * tx * (3.0f - 2.0f * tx);
+  ty = ty * ty * (3.0f - 2.0f * ty);
+  float a = latticeValue(ix, iy);
+  float b = latticeValue(ix + 1, iy);
+  float c = latticeValue(ix, iy + 1);
+  float d = latticeValue(ix + 1, iy + 1);
+  return a + (b - a) * tx + (c - a) * ty + (a - b - c + d) * tx * ty;
+}
+
+// ridged fbm: sharp crests where the noise crosses its middle, with each
+// octave weighted by the one above so valleys stay smooth. every level's
+// tiles sample this same function, so the heights of shared vertices match.
+static float terrainHeight(float x, float z) {
+  float height = 0.0f;
+  float total = 0.0f;
+  float amplitude = 1.0f;
+  float frequency = 1.0f / kBaseWavelength;
+  float weight = 1.0f;
+  for (uint32_t o = 0; o < kOctaves; o++) {
+    float n = 1.0f - fabsf(valueNoise(x * frequency, z * frequency) * 2.0f -
+                           1.0f);
+    n *= n * weight;
+    weight = std::min(std::max(n * 2.0f, 0.0f), 1.0f);
+    height += n * amplitude;
+    total += amplitude;
+    amplitude *= 0.5f;
+    frequency *= 2.0f;
+  }
+  return height / total * kMaxHeight;
+}
+
+static uint32_t hashKey(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  return (uint32_t)key;
+}
+
+void TerrainRenderer::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                           VkPipelineCache cache, JobSystem& jobs, float size,
+                           uint32_t framesInFlight,
+                           ResidencyManager& residency,
+                           DeletionQueue& deletionQueue) {
+  this->device = device;
+  this->framesInFlight = framesInFlight;
+  this->deletionQueue = &deletionQueue;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  // keys have 24 bits per coordinate
+  leafSize = kLeafSize;
+  uint32_t leaves = 1;
+  while (leaves < (1u << 20) && leaves * leafSize < size) leaves *= 2;
+  levelCount = 1;
+  while ((1u << (levelCount - 1)) < leaves) levelCount++;
+  ranges.resize(levelCount);
+  morphStarts.resize(levelCount);
+  for (uint32_t l = 0; l < levelCount; l++) {
+    ranges[l] = kRangeNodes * nodeSize(l);
+    float finer = l ? ranges[l - 1] : 0.0f;
+    morphStarts[l] = finer + (ranges[l] - finer) * kMorphStart;
+  }
+  tileSamples = kGridCells + 3;
+
+  const uint32_t slotCount = kAtlasTiles * kAtlasTiles;
+  tableKeys.assign(slotCount * 2, kNoKey);
+  tableValues.assign(slotCount * 2, kNotResident);
+  slotMin.assign(slotCount, 0.0f);
+  slotMax.assign(slotCount, 0.0f);
+  // reserved up front so steady state frames don't allocate
+  requests.reserve(kMaxNodes * 4);
+  for (std::vector<Instance>& part : parts) part.reserve(kMaxNodes);
+
+  // the atlas is all the height memory there is, however big the terrain
+  StreamingAtlas::Desc atlasDesc;
+  atlasDesc.name = "terrain atlas";
+  atlasDesc.format = kHeightFormat;
+  atlasDesc.texelBytes = sizeof(float);
+  atlasDesc.tileTexels = tileSamples;
+  atlasDesc.columns = kAtlasTiles;
+  atlasDesc.stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+  atlasDesc.pinnedKey = tileKey(levelCount - 1, 0, 0);
+  atlasDesc.load = [this](uint64_t key, uint32_t staging, uint8_t* data) {
+    generateTile(key, (float*)data, stagingMin[staging], stagingMax[staging]);
+    return true;
+  };
+  // the bounds cover the valley's floor and the base height offset the
+  // vertex shader applies
+  atlasDesc.placed = [this](uint64_t key, uint32_t slot, uint32_t staging) {
+    slotMin[slot] = std::min(stagingMin[staging] + kBaseHeight, kValleyFloor);
+    slotMax[slot] = std::max(stagingMax[staging] + kBaseHeight, kValleyFloor);
+    insert(key, slot);
+  };
+  atlasDesc.evicted = [this](uint64_t key) { erase(key); };
+  atlas.init(device, memoryProperties, jobs, residency, deletionQueue,
+             atlasDesc);
+  uint32_t atlasSize = kAtlasTiles * tileSamples;
+
+  // only ever fetched; the vertex shader filters heights itself
+  VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  VK_CHECK(vkd.vkCreateSampler(device, &samplerInfo, nullptr, &atlasSampler));
+
+  const VkMemoryPropertyFlags hostFlags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  // the grid quarter by quarter, so a node can draw one child's quarter on
+  // its own. y is flipped in the projection, so counter clockwise seen from
+  // above stays front facing.
+  std::vector<uint16_t> indices;
+  const uint32_t half = kGridCells / 2;
+  for (uint32_t q = 0; q < 4; q++) {
+    uint32_t x0 = (q & 1) * half;
+    uint32_t y0 = (q >> 1) * half;
+    for (uint32_t y = y0; y < y0 + half; y++) {
+      for (uint32_t x = x0; x < x0 + half; x++) {
+        uint16_t a = (uint16_t)(y * (kGridCells + 1) + x);
+        uint16_t b = (uint16_t)(a + 1);
+        uint16_t c = (uint16_t)(a + kGridCells + 1);
+        uint16_t d = (uint16_t)(c + 1);
+        uint16_t quad[6] = {a, c, b, b, c, d};
+        indices.insert(indices.end(), quad, quad + 6);
+      }
+    }
+  }
+  quarterIndexCount = (uint32_t)indices.size() / 4;
+  VkDeviceSize indexBytes = indices.size() * sizeof(uint16_t);
+  indexBuffer = createBuffer(device, memoryProperties, indexBytes,
+                             VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 0, hostFlags,
+                             MEMORY_BUFFER, indexMemory);
+  void* mapped;
+  VK_CHECK(vkd.vkMapMemory(device, indexMemory, 0, VK_WHOLE_SIZE, 0, &mapped));
+  memcpy(mapped, indices.data(), indexBytes);
+  vkd.vkUnmapMemory(device, indexMemory);
+
+  instanceStride = ((VkDeviceSize)kMaxNodes * sizeof(Instance) + 255) &
+                   ~(VkDeviceSize)255;
+  instanceBuffer = createBuffer(
+      device, memoryProperties, instanceStride * framesInFlight,
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      hostFlags, MEMORY_BUFFER, instanceMemory);
+  VK_CHECK(vkd.vkMapMemory(device, instanceMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&instanceMapped));
+
+  VkDescriptorSetLayoutBinding binding = {
+      0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+      VK_SHADER_STAGE_VERTEX_BIT, nullptr};
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+  setLayoutInfo.bindingCount = 1;
+  setLayoutInfo.pBindings = &binding;
+  VK_CHECK(vkd.vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr,
+                                           &setLayout));
+
+  createDescriptorSet();
+
+  VkPushConstantRange range = {VK_SHADER_STAGE_VERTEX_BIT, 0,
+                               sizeof(DrawConstants)};
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &range;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout));
+
+  vertexShader = createShaderRef(device, readFile("shaders/terrain_vert.spv"));
+  fragmentShader =
+      createShaderRef(device, readFile("shaders/terrain_frag.spv"));
+
+  // the grid vertex comes from the index, so the only vertex input is the
+  // per node instance
+  drawDesc = GraphicsPipelineDesc();
+  drawDesc.vertexShader = vertexShader;
+  drawDesc.fragmentShader = fragmentShader;
+  drawDesc.bindingCount = 1;
+  drawDesc.bindings[0] = {0, sizeof(Instance), VK_VERTEX_INPUT_RATE_INSTANCE};
+  drawDesc.attributeCount = 2;
+  drawDesc.attributes[0] = {0, 0, VK_FORMAT_R32G32B32A32_SFLOAT,
+                            offsetof(Instance, node)};
+  drawDesc.attributes[1] = {1, 0, VK_FORMAT_R32G32B32A32_SFLOAT,
+                            offsetof(Instance, tile)};
+  drawDesc.cullMode = VK_CULL_MODE_BACK_BIT;
+  drawDesc.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  drawDesc.depthTestEnable = VK_TRUE;
+  drawDesc.depthWriteEnable = VK_TRUE;
+  drawDesc.layout = layout;
+
+  // the root's tile stands in for everything until finer ones arrive; the
+  // first record() copies it like any other
+  atlas.loadNow(atlasDesc.pinnedKey);
+  insert(atlasDesc.pinnedKey, kLoading);
+
+  float terrainSize = nodeSize(levelCount - 1);
+  printf("terrain: %.0fx%.0f units in %u levels, %ux%u cells per node, %u "
+         "tiles of %ux%u heights resident (%.1fmb)\n",
+         terrainSize, terrainSize, levelCount, kGridCells, kGridCells,
+         slotCount, tileSamples, tileSamples,
+         (double)atlasSize * atlasSize * sizeof(float) / (1024.0 * 1024.0));
+}
+
+void TerrainRenderer::createDescriptorSet() {
+  VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                   1};
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  VK_CHECK(vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                      &descriptorPool));
+  VkDescriptorSetAllocateInfo setInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  setInfo.descriptorPool = descriptorPool;
+  setInfo.descriptorSetCount = 1;
+  setInfo.pSetLayouts = &setLayout;
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &setInfo, &descriptorSet));
+  VkDescriptorImageInfo atlasInfo = {atlasSampler, atlas.view(),
+                                     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+  VkWriteDescriptorSet write = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+  write.dstSet = descriptorSet;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &atlasInfo;
+  vkd.vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+void TerrainRenderer::destroy() {
+  atlas.destroy();
+  vkd.vkDestroyShaderModule(device, vertexShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, fragmentShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(device, layout, nullptr);
+  vkd.vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  vkd.vkDestroySampler(device, atlasSampler, nullptr);
+  vkd.vkUnmapMemory(device, instanceMemory);
+  VkBuffer buffers[] = {indexBuffer, instanceBuffer};
+  VkDeviceMemory memories[] = {indexMemory, instanceMemory};
+  for (uint32_t i = 0; i < 2; i++) {
+    vkd.vkDestroyBuffer(device, buffers[i], nullptr);
+    freeTrackedMemory(device, memories[i]);
+  }
+}
+
+uint32_t TerrainRenderer::lookup(uint64_t key) const {
+  uint32_t mask = (uint32_t)tableKeys.size() - 1;
+  for (uint32_t i = hashKey(key) & mask;; i = (i + 1) & mask) {
+    if (tableKeys[i] == key) return tableValues[i];
+    if (tableKeys[i] == kNoKey) return kNotResident;
+  }
+}
+
+void TerrainRenderer::insert(uint64_t key, uint32_t value) {
+  uint32_t mask = (uint32_t)tableKeys.size() - 1;
+  uint32_t i = hashKey(key) & mask;
+  while (tableKeys[i] != key && tableKeys[i] != kNoKey) i = (i + 1) & mask;
+  tableKeys[i] = key;
+  tableValues[i] = value;
+}
+
+// backward shift: later entries of the run move into the hole if that's
+// no earlier than their home, so lookups never need tombstones
+void TerrainRenderer::erase(uint64_t key) {
+  uint32_t mask = (uint32_t)tableKeys.size() - 1;
+  uint32_t i = hashKey(key) & mask;
+  while (tableKeys[i] != key) {
+    if (tableKeys[i] == kNoKey) return;
+    i = (i + 1) & mask;
+  }
+  tableKeys[i] = kNoKey;
+  for (uint32_t j = (i + 1) & mask; tableKeys[j] != kNoKey;
+       j = (j + 1) & mask) {
+    uint32_t home = hashKey(tableKeys[j]) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      tableKeys[i] = tableKeys[j];
+      tableValues[i] = tableValues[j];
+      tableKeys[j] = kNoKey;
+      i = j;
+    }
+  }
+}
+
+// the grid's samples plus a border for the normals, and the grid's height
+// range for the node's bounds
+void TerrainRenderer::generateTile(uint64_t key, float* heights,
+                                   float& minHeight, float& maxHeight) const {
+  uint32_t level = (uint32_t)(key >> 48);
+  uint32_t y = (uint32_t)(key >> 24) & 0xffffff;
+  uint32_t x = (uint32_t)key & 0xffffff;
+  float size = nodeSize(level);
+  float spacing = size / kGridCells;
+  minHeight = kMaxHeight;
+  maxHeight = 0.0f;
+  for (uint32_t j = 0; j < tileSamples; j++) {
+    float z = y * size + ((float)j - 1.0f) * spacing;
+    for (uint32_t i = 0; i < tileSamples; i++) {
+      float h = terrainHeight(x * size + ((float)i - 1.0f) * spacing, z);
+      heights[j * tileSamples + i] = h;
+      if (i && j && i + 1 < tileSamples && j + 1 < tileSamples) {
+        minHeight = std::min(minHeight, h);
+        maxHeight = std::max(maxHeight, h);
+      }
+    }
+  }
+}
+
+// planes of the world space frustum against the box moved into world space
+bool TerrainRenderer::inFrustum(const glm::vec3& lo,
+                                const glm::vec3& hi) const {
+  glm::vec3 offset((float)drift.x, 0.0f, (float)drift.y);
+  glm::vec3 worldLo = lo - offset;
+  glm::vec3 worldHi = hi - offset;
+  for (const glm::vec4& plane : planes) {
+    // the corner furthest along the plane's normal
+    glm::vec3 p(plane.x > 0.0f ? worldHi.x : worldLo.x,
+                plane.y > 0.0f ? worldHi.y : worldLo.y,
+                plane.z > 0.0f ? worldHi.z : worldLo.z);
+    if (glm::dot(glm::vec3(plane), p) + plane.w < 0.0f) return false;
+  }
+  return true;
+}
+
+bool TerrainRenderer::inRange(const glm::vec3& lo, const glm::vec3& hi,
+                              uint32_t level) const {
+  glm::vec3 nearest = glm::clamp(camera, lo, hi);
+  glm::vec3 d = nearest - camera;
+  return glm::dot(d, d) <= ranges[level] * ranges[level];
+}
+
+void TerrainRenderer::addInstance(const Node& node, uint32_t part) {
+  if (nodesSelected == kMaxNodes) return;
+  nodesSelected++;
+  float size = nodeSize(node.level);
+  Instance instance;
+  glm::dvec2 corner = glm::dvec2(node.x, node.y) * (double)size - cameraXZ;
+  instance.node = glm::vec4((float)corner.x, (float)corner.y, size, 0.0f);
+  instance.tile = glm::vec4((float)(node.tile % kAtlasTiles * tileSamples),
+                            (float)(node.tile / kAtlasTiles * tileSamples),
+                            morphStarts[node.level], ranges[node.level]);
+  parts[part].push_back(instance);
+}
+
+void TerrainRenderer::request(uint32_t level, uint32_t x, uint32_t y,
+                              const glm::vec3& lo, const glm::vec3& hi) {
+  if (requests.size() == requests.capacity()) return;
+  glm::vec3 d = glm::clamp(camera, lo, hi) - camera;
+  requests.push_back({tileKey(level, x, y), glm::dot(d, d)});
+}
+
+// false if the node is out of its level's range, so the parent has to draw
+// its area. the node's own tile is resident.
+bool TerrainRenderer::selectNode(const Node& node) {
+  nodesVisited++;
+  float size = nodeSize(node.level);
+  glm::vec3 lo(node.x * size, node.minHeight, node.y * size);
+  glm::vec3 hi(lo.x + size, node.maxHeight, lo.z + size);
+  if (!inFrustum(lo, hi)) return true;
+  if (!inRange(lo, hi, node.level)) return false;
+  atlas.touch(node.tile);
+  if (node.level == 0 || !inRange(lo, hi, node.level - 1)) {
+    addInstance(node, PART_WHOLE);
+    return true;
+  }
+  for (uint32_t q = 0; q < 4; q++) {
+    uint32_t cx = node.x * 2 + (q & 1);
+    uint32_t cy = node.y * 2 + (q >> 1);
+    uint32_t tile = lookup(tileKey(node.level - 1, cx, cy));
+    if (tile != kNotResident && tile != kLoading) {
+      Node child = {node.level - 1, cx, cy, tile, slotMin[tile],
+                    slotMax[tile]};
+      if (!selectNode(child)) addInstance(node, PART_QUARTER0 + q);
+      continue;
+    }
+    // this node's quarter stands in until the child's tile arrives; its
+    // bounds are the best guess for the child's
+    float half = size * 0.5f;
+    glm::vec3 childLo(lo.x + (q & 1) * half, lo.y, lo.z + (q >> 1) * half);
+    glm::vec3 childHi(childLo.x + half, hi.y, childLo.z + half);
+    if (!inFrustum(childLo, childHi)) continue;
+    if (tile == kNotResident && inRange(childLo, childHi, node.level - 1)) {
+      request(node.level - 1, cx, cy, childLo, childHi);
+    }
+    addInstance(node, PART_QUARTER0 + q);
+  }
+  return true;
+}
+
+void TerrainRenderer::update(uint32_t slot, float time,
+                             const glm::vec3& cameraPosition,
+                             const glm::mat4& viewProj) {
+  frame++;
+  atlas.update(slot, frame);
+
+  uint64_t begin = profilerNow();
+  // a slow circle around the middle of the terrain
+  float terrainSize = nodeSize(levelCount - 1);
+  float radius = terrainSize * 0.25f;
+  double angle = (double)time * kDriftSpeed / radius;
+  drift = glm::dvec2(terrainSize * 0.5 + cos(angle) * radius,
+                     terrainSize * 0.5 + sin(angle) * radius);
+  cameraXZ = glm::dvec2(cameraPosition.x, cameraPosition.z) + drift;
+  camera = glm::vec3((float)cameraXZ.x, cameraPosition.y, (float)cameraXZ.y);
+  cameraWorld = cameraPosition;
+  glm::vec4 x(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+  glm::vec4 y(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+  glm::vec4 z(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+  glm::vec4 w(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+  planes[0] = w + x;
+  planes[1] = w - x;
+  planes[2] = w + y;
+  planes[3] = w - y;
+  planes[4] = z;
+  planes[5] = w - z;
+
+  for (std::vector<Instance>& part : parts) part.clear();
+  nodesSelected = 0;
+  uint32_t rootTile = lookup(tileKey(levelCount - 1, 0, 0));
+  if (rootTile != kLoading) {
+    Node root = {levelCount - 1, 0, 0, rootTile, slotMin[rootTile],
+                 slotMax[rootTile]};
+    // from outside the terrain's range the root is all there is
+    if (!selectNode(root)) addInstance(root, PART_WHOLE);
+  }
+
+  // the parts one after another in the slot's instances
+  Instance* instances = (Instance*)(instanceMapped + slot * instanceStride);
+  for (uint32_t p = 0; p < PART_COUNT; p++) {
+    memcpy(instances, parts[p].data(), parts[p].size() * sizeof(Instance));
+    instances += parts[p].size();
+    instanceCounts[p] = (uint32_t)parts[p].size();
+  }
+  nodesDrawn += nodesSelected;
+  maxDrawn = std::max(maxDrawn, nodesSelected);
+  selectNanoseconds += profilerNow() - begin;
+  startLoads();
+}
+
+void TerrainRenderer::startLoads() {
+  if (requests.empty()) return;
+  tilesRequested += requests.size();
+  // coarse levels first, they stand in for everything below them; then the
+  // nearest
+  std::sort(requests.begin(), requests.end(),
+            [](const Request& a, const Request& b) {
+              uint32_t levelA = (uint32_t)(a.key >> 48);
+              uint32_t levelB = (uint32_t)(b.key >> 48);
+              if (levelA != levelB) return levelA > levelB;
+              return a.distance < b.distance;
+            });
+  uint32_t started = 0;
+  for (const Request& r : requests) {
+    if (started == kMaxLoadsPerFrame || !atlas.startLoad(r.key)) break;
+    insert(r.key, kLoading);
+    started++;
+  }
+  // whatever didn't fit is asked for again by the next walk
+  requests.clear();
+}
+
+// this frame's copies into the atlas
+void TerrainRenderer::record(VkCommandBuffer cmd, uint32_t slot,
+                             GpuTimer& timer) {
+  uint32_t zone = timer.begin(cmd, "terrain tiles");
+  if (atlas.record(cmd, slot)) {
+    // only earlier frames bound the old set
+    deletionQueue->push(descriptorPool);
+    createDescriptorSet();
+  }
+  timer.end(cmd, zone, VK_PIPELINE_STAGE_TRANSFER_BIT);
+}
+
+void TerrainRenderer::draw(VkCommandBuffer cmd, uint32_t slot,
+                           const glm::mat4& viewProj,
+                           PipelineVariantCache& pipelines) {
+  if (!nodesSelected) return;
+  VkPipeline pipeline = pipelines.request(drawDesc);
+  if (!pipeline) return;
+
+  DrawConstants constants;
+  constants.viewProj = viewProj;
+  constants.camera = glm::vec4(cameraWorld, 0.0f);
+  constants.valley =
+      glm::vec4(kValleyFloor, kBaseHeight, kValleyInner, kValleyOuter);
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0,
+                              1, &descriptorSet, 0, nullptr);
+  vkd.vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                         sizeof(constants), &constants);
+  VkDeviceSize offset = slot * instanceStride;
+  vkd.vkCmdBindVertexBuffers(cmd, 0, 1, &instanceBuffer, &offset);
+  vkd.vkCmdBindIndexBuffer(cmd, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+  // one instanced draw per part: the whole grid, or one of its quarters
+  uint32_t first = 0;
+  for (uint32_t p = 0; p < PART_COUNT; p++) {
+    uint32_t count = instanceCounts[p];
+    if (!count) continue;
+    uint32_t indexCount =
+        p == PART_WHOLE ? quarterIndexCount * 4 : quarterIndexCount;
+    uint32_t firstIndex =
+        p == PART_WHOLE ? 0 : (p - PART_QUARTER0) * quarterIndexCount;
+    vkd.vkCmdDrawIndexed(cmd, indexCount, count, firstIndex, 0, first);
+    first += count;
+    drawCalls++;
+  }
+}
+
+void TerrainRenderer::printStats() const {
+  if (!frame) return;
+  const StreamingAtlas::Stats& stats = atlas.stats();
+  printf("terrain: %.3f ms selecting per frame, %.1f nodes visited and %.1f "
+         "drawn (at most %u) with %.1f draws per frame; %llu tiles "
+         "generated, %llu evicted, %.1f requested per frame, %u of %u "
+         "resident (atlas shrunk %llu, grown %llu times)\n",
+         selectNanoseconds / 1e6 / frame, (double)nodesVisited / frame,
+         (double)nodesDrawn / frame, maxDrawn, (double)drawCalls / frame,
+         (unsigned long long)stats.loaded, (unsigned long long)stats.evicted,
+         (double)tilesRequested / frame, atlas.residentCount(),
+         atlas.rows() * kAtlasTiles, (unsigned long long)stats.shrinks,
+         (unsigned long long)stats.grows);
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "job_system.h"
+#include "memory_budget.h"
+#include "pipeline_cache.h"
+#include "streaming_atlas.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+class DeletionQueue;
+class GpuTimer;
+class ResidencyManager;
+
+// A large heightfield terrain drawn with CDLOD (continuous distance
+// dependent level of detail).
+//
+// The terrain is an implicit quadtree: level 0 nodes are kLeafSize across,
+// each level up doubles that, and the root covers the whole terrain. Every
+// node is drawn with the same kGridCells x kGridCells grid, so a node of
+// level L has half the vertex density of one of level L - 1. update() walks
+// the tree from the root, skipping nodes outside the frustum and splitting
+// nodes that are closer than the next finer level's range, so it visits
+// only the nodes it draws and their ancestors however big the terrain is. A
+// child out of its range is drawn as a quarter of its parent's grid.
+// Selected nodes become instances of the one grid mesh, a draw per quarter
+// kind, and the vertex shader morphs each level's odd vertices onto the next
+// coarser grid as they approach the end of the level's range, so neighbours
+// of different levels meet without cracks or popping.
+//
+// Every node reads its heights from a tile of its own resolution in a
+// StreamingAtlas of kAtlasTiles x kAtlasTiles tiles. Tiles are generated on
+// the job workers when the walk wants to split a node whose children aren't
+// resident; record() copies the finished ones into free atlas slots or over
+// the least recently drawn tile. Until a child arrives its parent covers
+// it. The root's tile is always resident. Over budget the atlas gives up
+// rows of tiles and their nodes fall back to their parents.
+//
+// The terrain drifts under the scene in a slow circle so new tiles keep
+// streaming in, and is flattened into a valley around the origin where the
+// other demos stand.
+class TerrainRenderer {
+ public:
+  static const uint32_t kGridCells = 32;   // per node side
+  static const uint32_t kAtlasTiles = 32;  // per side
+  static const uint32_t kMaxNodes = 1024;  // drawn per frame
+
+  // size is the terrain's side in world units, rounded up to kLeafSize
+  // times a power of two. the atlas images it replaces go through the
+  // deletion queue.
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            VkPipelineCache cache, JobSystem& jobs, float size,
+            uint32_t framesInFlight, ResidencyManager& residency,
+            DeletionQueue& deletionQueue);
+  void destroy();
+
+  // once the slot's fence was waited on: selects this frame's nodes into
+  // the slot's instances and starts generating the tiles it's missing
+  void update(uint32_t slot, float time, const glm::vec3& cameraPosition,
+              const glm::mat4& viewProj);
+  // outside a render pass, before the main pass: copies finished tiles
+  // into the atlas
+  void record(VkCommandBuffer cmd, uint32_t slot, GpuTimer& timer);
+  // inside the main pass
+  void draw(VkCommandBuffer cmd, uint32_t slot, const glm::mat4& viewProj,
+            PipelineVariantCache& pipelines);
+
+  void printStats() const;
+
+  // the owner fills in renderPassKey like for any other pipeline
+  GraphicsPipelineDesc drawDesc;
+
+ private:
+  // what a node draws of its grid: all of it, or the quarter of one child
+  // that's out of the finer level's range. quarters are numbered
+  // y * 2 + x.
+  enum Part { PART_WHOLE, PART_QUARTER0, PART_COUNT = PART_QUARTER0 + 4 };
+
+  // binding 0, one per drawn node. mirrors the inputs in terrain.vert.
+  struct Instance {
+    // x, z of its corner relative to the camera, size, unused. far out in
+    // the terrain floats only keep the small offsets exact.
+    glm::vec4 node;
+    glm::vec4 tile;  // atlas texel x, y of its tile, morph start, morph end
+  };
+
+  // mirrors the push constants in terrain.vert
+  struct DrawConstants {
+    glm::mat4 viewProj;
+    glm::vec4 camera;  // world space position, unused
+    glm::vec4 valley;  // floor height, base height, inner and outer radius
+  };
+
+  struct Node {
+    uint32_t level;
+    uint32_t x;
+    uint32_t y;
+    uint32_t tile;  // atlas slot
+    float minHeight;
+    float maxHeight;
+  };
+
+  struct Request {
+    uint64_t key;
+    float distance;
+  };
+
+  static const uint32_t kMaxLoadsPerFrame = 16;
+  static constexpr uint32_t kNotResident = ~0u;
+  static constexpr uint32_t kLoading = ~0u - 1;  // in the table only
+  static constexpr uint64_t kNoKey = StreamingAtlas::kNoKey;
+
+  static uint64_t tileKey(uint32_t level, uint32_t x, uint32_t y) {
+    return (uint64_t)level << 48 | (uint64_t)y << 24 | x;
+  }
+  float nodeSize(uint32_t level) const { return leafSize * (1u << level); }
+
+  // tile key -> atlas slot or kLoading; open addressing with linear probing
+  // in a table twice the atlas size, so lookups stay short and nothing
+  // allocates after init
+  uint32_t lookup(uint64_t key) const;
+  void insert(uint64_t key, uint32_t value);
+  void erase(uint64_t key);
+
+  bool selectNode(const Node& node);
+  void addInstance(const Node& node, uint32_t part);
+  void request(uint32_t level, uint32_t x, uint32_t y, const glm::vec3& lo,
+               const glm::vec3& hi);
+  bool inFrustum(const glm::vec3& lo, const glm::vec3& hi) const;
+  bool inRange(const glm::vec3& lo, const glm::vec3& hi, uint32_t level) const;
+  // on a worker, into a staging tile
+  void generateTile(uint64_t key, float* heights, float& minHeight,
+                    float& maxHeight) const;
+  void startLoads();
+  void createDescriptorSet();
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  uint32_t framesInFlight = 0;
+  DeletionQueue* deletionQueue = nullptr;
+
+  float leafSize = 0.0f;
+  uint32_t levelCount = 0;
+  // per level: the distance its nodes are drawn out to, and where their
+  // vertices start morphing towards the next level's grid
+  std::vector<float> ranges;
+  std::vector<float> morphStarts;
+  uint32_t tileSamples = 0;  // per side, a border sample around the grid
+
+  std::vector<uint64_t> tableKeys;
+  std::vector<uint32_t> tableValues;
+  // per atlas slot: its tile's height range
+  std::vector<float> slotMin;
+  std::vector<float> slotMax;
+  // per staging tile: the height range of the tile generated into it
+  float stagingMin[StreamingAtlas::kStagingTiles] = {};
+  float stagingMax[StreamingAtlas::kStagingTiles] = {};
+  std::vector<Request> requests;  // tiles to generate, this frame
+
+  // this frame's selection
+  glm::vec3 camera = glm::vec3(0.0f);  // terrain space
+  glm::vec3 cameraWorld = glm::vec3(0.0f);
+  // terrain space x, z of the world origin and of the camera, in double so
+  // the instances' camera relative corners stay exact
+  glm::dvec2 drift = glm::dvec2(0.0);
+  glm::dvec2 cameraXZ = glm::dvec2(0.0);
+  glm::vec4 planes[6];
+  std::vector<Instance> parts[PART_COUNT];
+  uint32_t instanceCounts[PART_COUNT] = {};
+  uint32_t nodesSelected = 0;
+
+  // tiles keyed by tileKey()
+  StreamingAtlas atlas;
+  VkSampler atlasSampler = VK_NULL_HANDLE;
+
+  // the grid's indices, quarter by quarter; the vertices come from the
+  // index. per slot instances, persistently mapped.
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory indexMemory = VK_NULL_HANDLE;
+  uint32_t quarterIndexCount = 0;
+  VkBuffer instanceBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory instanceMemory = VK_NULL_HANDLE;
+  uint8_t* instanceMapped = nullptr;
+  VkDeviceSize instanceStride = 0;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+
+  uint64_t frame = 0;
+  uint64_t selectNanoseconds = 0;
+  uint64_t nodesVisited = 0;
+  uint64_t nodesDrawn = 0;
+  uint64_t drawCalls = 0;
+  uint64_t tilesRequested = 0;
+  uint32_t maxDrawn = 0;
+};
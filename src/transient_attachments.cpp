@@ -0,0 +1,249 @@
+#include "transient_attachments.h"
+
+#include "deletion_queue.h"
+#include "memory_budget.h"
+#include "vk_dispatch.h"
+
+#include <algorithm>
+
+static const VkImageUsageFlags kAttachmentOnlyUsage =
+    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+    VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+static bool findMemoryTypeIndex(const VkPhysicalDeviceMemoryProperties& props,
+                                uint32_t typeFilter,
+                                VkMemoryPropertyFlags flags, uint32_t& index) {
+  for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
+    if ((typeFilter & (1u << i)) &&
+        (props.memoryTypes[i].propertyFlags & flags) == flags) {
+      index = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool lifetimesOverlap(const TransientAttachmentDesc& a,
+                             const TransientAttachmentDesc& b) {
+  return a.firstPass <= b.lastPass && b.firstPass <= a.lastPass;
+}
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+uint32_t addTransientAttachment(TransientAttachmentPool& pool,
+                                const TransientAttachmentDesc& desc) {
+  assert(desc.firstPass <= desc.lastPass);
+  TransientAttachment attachment;
+  attachment.desc = desc;
+  pool.attachments.push_back(attachment);
+  return (uint32_t)pool.attachments.size() - 1;
+}
+
+static void createTransientImage(VkDevice device, TransientAttachment& a) {
+  VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = a.desc.format;
+  imageInfo.extent = {a.desc.extent.width, a.desc.extent.height, 1};
+  imageInfo.mipLevels = a.desc.mipLevels;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = a.desc.samples;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage = a.desc.usage;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VK_CHECK(vkd.vkCreateImage(device, &imageInfo, nullptr, &a.image));
+  vkd.vkGetImageMemoryRequirements(device, a.image, &a.memReq);
+}
+
+void allocateTransientAttachments(TransientAttachmentPool& pool,
+                                  VkPhysicalDevice physicalDevice,
+                                  VkDevice device) {
+  pool.device = device;
+  pool.dedicatedBytes = 0;
+  pool.aliasedBytes = 0;
+  pool.lazyBytes = 0;
+
+  VkPhysicalDeviceMemoryProperties memProps;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
+
+  // pass 1: create images; attachment-only targets try lazily allocated memory
+  std::vector<uint32_t> aliasable;
+  for (uint32_t i = 0; i < pool.attachments.size(); i++) {
+    TransientAttachment& a = pool.attachments[i];
+    a.lazy = false;
+    if ((a.desc.usage & ~kAttachmentOnlyUsage) == 0) {
+      a.desc.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    }
+    createTransientImage(device, a);
+    pool.dedicatedBytes += a.memReq.size;
+
+    uint32_t typeIndex;
+    if ((a.desc.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) &&
+        findMemoryTypeIndex(memProps, a.memReq.memoryTypeBits,
+                            VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+                            typeIndex)) {
+      TransientMemoryBlock block;
+      block.size = a.memReq.size;
+      block.memoryTypeIndex = typeIndex;
+      block.lazy = true;
+      a.lazy = true;
+      a.offset = 0;
+      a.block = (uint32_t)pool.blocks.size();
+      pool.blocks.push_back(block);
+      pool.lazyBytes += a.memReq.size;
+    } else {
+      aliasable.push_back(i);
+    }
+  }
+
+  // pass 2: place the rest. biggest first, each at the lowest offset that
+  // doesn't collide with an already placed target whose lifetime overlaps.
+  std::sort(aliasable.begin(), aliasable.end(), [&](uint32_t l, uint32_t r) {
+    return pool.attachments[l].memReq.size > pool.attachments[r].memReq.size;
+  });
+
+  std::vector<uint32_t> placed;
+  for (uint32_t index : aliasable) {
+    TransientAttachment& a = pool.attachments[index];
+    // every image accepts at least one memory type, so the fallback always
+    // finds one; it's just slower than device local memory
+    uint32_t typeIndex = 0;
+    if (!findMemoryTypeIndex(memProps, a.memReq.memoryTypeBits,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, typeIndex)) {
+      bool found =
+          findMemoryTypeIndex(memProps, a.memReq.memoryTypeBits, 0, typeIndex);
+      printf("transient attachments: no device local memory for %s, using "
+             "type %u\n",
+             a.desc.name, typeIndex);
+      assert(found);
+      (void)found;
+    }
+
+    uint32_t blockIndex = UINT32_MAX;
+    for (uint32_t b = 0; b < pool.blocks.size(); b++) {
+      if (!pool.blocks[b].lazy && pool.blocks[b].memoryTypeIndex == typeIndex) {
+        blockIndex = b;
+        break;
+      }
+    }
+    if (blockIndex == UINT32_MAX) {
+      TransientMemoryBlock block;
+      block.memoryTypeIndex = typeIndex;
+      blockIndex = (uint32_t)pool.blocks.size();
+      pool.blocks.push_back(block);
+    }
+
+    std::vector<std::pair<VkDeviceSize, VkDeviceSize>> busy;
+    for (uint32_t other : placed) {
+      const TransientAttachment& o = pool.attachments[other];
+      if (o.block == blockIndex && lifetimesOverlap(o.desc, a.desc)) {
+        busy.push_back({o.offset, o.offset + o.memReq.size});
+      }
+    }
+    std::sort(busy.begin(), busy.end());
+
+    VkDeviceSize offset = 0;
+    for (const auto& range : busy) {
+      if (alignUp(offset, a.memReq.alignment) + a.memReq.size <= range.first) {
+        break;
+      }
+      offset = std::max(offset, range.second);
+    }
+    a.offset = alignUp(offset, a.memReq.alignment);
+    a.block = blockIndex;
+    TransientMemoryBlock& block = pool.blocks[blockIndex];
+    block.size = std::max(block.size, a.offset + a.memReq.size);
+    placed.push_back(index);
+  }
+
+  // pass 3: one allocation per block, then bind and create views
+  for (TransientMemoryBlock& block : pool.blocks) {
+    VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    allocInfo.allocationSize = block.size;
+    allocInfo.memoryTypeIndex = block.memoryTypeIndex;
+    VK_CHECK(allocateTrackedMemory(device, allocInfo, MEMORY_RENDER_TARGET,
+                                   block.memory));
+    if (!block.lazy) {
+      pool.aliasedBytes += block.size;
+    }
+  }
+
+  for (TransientAttachment& a : pool.attachments) {
+    VK_CHECK(vkd.vkBindImageMemory(device, a.image, pool.blocks[a.block].memory,
+                                   a.offset));
+
+    VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+    viewInfo.image = a.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = a.desc.format;
+    viewInfo.subresourceRange.aspectMask = a.desc.aspect;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = a.desc.mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    VK_CHECK(vkd.vkCreateImageView(device, &viewInfo, nullptr, &a.view));
+  }
+}
+
+void destroyTransientAttachments(TransientAttachmentPool& pool, bool clear) {
+  for (TransientAttachment& a : pool.attachments) {
+    vkd.vkDestroyImageView(pool.device, a.view, nullptr);
+    vkd.vkDestroyImage(pool.device, a.image, nullptr);
+    a.view = VK_NULL_HANDLE;
+    a.image = VK_NULL_HANDLE;
+  }
+  for (TransientMemoryBlock& block : pool.blocks) {
+    freeTrackedMemory(pool.device, block.memory);
+  }
+  pool.blocks.clear();
+  if (clear) {
+    pool.attachments.clear();
+  }
+}
+
+void retireTransientAttachments(TransientAttachmentPool& pool,
+                                DeletionQueue& queue) {
+  for (TransientAttachment& a : pool.attachments) {
+    queue.push(a.view);
+    queue.push(a.image);
+    a.view = VK_NULL_HANDLE;
+    a.image = VK_NULL_HANDLE;
+  }
+  for (TransientMemoryBlock& block : pool.blocks) {
+    queue.push(block.memory);
+  }
+  pool.blocks.clear();
+}
+
+VkAttachmentLoadOp transientLoadOp(const TransientAttachment& attachment,
+                                   uint32_t pass, bool clear) {
+  if (clear) {
+    return VK_ATTACHMENT_LOAD_OP_CLEAR;
+  }
+  return pass == attachment.desc.firstPass ? VK_ATTACHMENT_LOAD_OP_DONT_CARE
+                                           : VK_ATTACHMENT_LOAD_OP_LOAD;
+}
+
+VkAttachmentStoreOp transientStoreOp(const TransientAttachment& attachment,
+                                     uint32_t pass) {
+  return pass == attachment.desc.lastPass ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+                                          : VK_ATTACHMENT_STORE_OP_STORE;
+}
+
+void printTransientAttachmentStats(const TransientAttachmentPool& pool) {
+  const double mb = 1024.0 * 1024.0;
+  printf("transient attachments: %zu targets, %.2fmb dedicated -> %.2fmb "
+         "aliased + %.2fmb lazy (%.2fmb saved)\n",
+         pool.attachments.size(), pool.dedicatedBytes / mb,
+         pool.aliasedBytes / mb, pool.lazyBytes / mb,
+         (pool.dedicatedBytes - pool.aliasedBytes) / mb);
+  for (const TransientAttachment& a : pool.attachments) {
+    printf("  %-12s %4ux%-4u passes %u-%u %s offset %llu size %llu\n",
+           a.desc.name, a.desc.extent.width, a.desc.extent.height,
+           a.desc.firstPass, a.desc.lastPass, a.lazy ? "lazy " : "block",
+           (unsigned long long)a.offset, (unsigned long long)a.memReq.size);
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include <vector>
+
+class DeletionQueue;
+
+// Render targets whose contents only live inside a frame (depth, MSAA color,
+// G-buffer, post intermediates). Each target declares the first and last pass
+// index that touches it; targets whose pass ranges don't overlap are placed at
+// the same offset of a shared allocation. Targets that are only ever used as
+// attachments get TRANSIENT_ATTACHMENT usage and lazily allocated memory when
+// the device exposes it, so tiled GPUs never back them with real VRAM.
+// A target that shares memory starts every frame with undefined contents:
+// its first pass has to transition it from UNDEFINED.
+struct TransientAttachmentDesc {
+  const char* name;
+  VkFormat format;
+  VkExtent2D extent;
+  VkImageUsageFlags usage;
+  VkImageAspectFlags aspect;
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  uint32_t mipLevels = 1;  // the view covers all of them
+  uint32_t firstPass = 0;
+  uint32_t lastPass = 0;
+};
+
+struct TransientAttachment {
+  TransientAttachmentDesc desc;
+  VkImage image = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+  VkMemoryRequirements memReq = {};
+  VkDeviceSize offset = 0;
+  uint32_t block = 0;
+  bool lazy = false;
+};
+
+struct TransientMemoryBlock {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  uint32_t memoryTypeIndex = 0;
+  bool lazy = false;
+};
+
+struct TransientAttachmentPool {
+  VkDevice device = VK_NULL_HANDLE;
+  std::vector<TransientAttachment> attachments;
+  std::vector<TransientMemoryBlock> blocks;
+
+  // what every target would cost with its own allocation vs. what we got
+  VkDeviceSize dedicatedBytes = 0;
+  VkDeviceSize aliasedBytes = 0;
+  VkDeviceSize lazyBytes = 0;
+};
+
+uint32_t addTransientAttachment(TransientAttachmentPool& pool,
+                                const TransientAttachmentDesc& desc);
+
+// creates images for every registered target, computes the aliasing layout
+// and binds memory. call again after destroyTransientAttachments() on resize.
+void allocateTransientAttachments(TransientAttachmentPool& pool,
+                                  VkPhysicalDevice physicalDevice,
+                                  VkDevice device);
+
+// frees images, views and memory. keeps registrations unless clear is set.
+void destroyTransientAttachments(TransientAttachmentPool& pool,
+                                 bool clear = false);
+// same, but hands the objects to the deletion queue instead, for resizes
+// while earlier frames may still be rendering into the old targets
+void retireTransientAttachments(TransientAttachmentPool& pool,
+                                DeletionQueue& queue);
+
+// load/store ops for a target used by the given pass: contents coming from
+// before firstPass or going past lastPass are never needed.
+VkAttachmentLoadOp transientLoadOp(const TransientAttachment& attachment,
+                                   uint32_t pass, bool clear);
+VkAttachmentStoreOp transientStoreOp(const TransientAttachment& attachment,
+                                     uint32_t pass);
+
+void printTransientAttachmentStats(const TransientAttachmentPool& pool);
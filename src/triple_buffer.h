@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// Hands the newest value from one producer thread to one consumer thread.
+// There are three copies: the writer fills one, the reader holds one and the
+// third sits in the middle. publish() and acquire() each swap their copy
+// with the middle one in a single atomic exchange, so neither side ever
+// waits for the other; a value the reader doesn't pick up in time is
+// overwritten by the next one.
+template <class T>
+class TripleBuffer {
+ public:
+  // writer: fill back(), then publish() it
+  T& back() { return slots[backIndex]; }
+  void publish() {
+    uint8_t old = middle.exchange(backIndex | kFresh, std::memory_order_acq_rel);
+    backIndex = old & kIndexMask;
+  }
+
+  // reader: takes the newest published value if there is one it hasn't seen
+  // and returns whether it did. front() stays put until the next acquire().
+  bool acquire() {
+    // only the writer changes middle in between, and only to fresh
+    if (!(middle.load(std::memory_order_acquire) & kFresh)) return false;
+    uint8_t old = middle.exchange(frontIndex, std::memory_order_acq_rel);
+    frontIndex = old & kIndexMask;
+    return true;
+  }
+  const T& front() const { return slots[frontIndex]; }
+
+ private:
+  static const uint8_t kIndexMask = 3;
+  static const uint8_t kFresh = 4;
+
+  T slots[3] = {};
+  // each side's index on its own cache line, away from the shared one
+  alignas(64) uint8_t backIndex = 0;
+  alignas(64) std::atomic<uint8_t> middle{1};
+  alignas(64) uint8_t frontIndex = 2;
+};
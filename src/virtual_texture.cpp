@@ -0,0 +1,684 @@
+#include "virtual_texture.h"
+
+#include "deletion_queue.h"
+#include "file_io.h"
+#include "gpu_timer.h"
+#include "vk_dispatch.h"
+#include "vk_util.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+static const VkFormat kAtlasFormat = VK_FORMAT_R8G8B8A8_UNORM;
+static const VkFormat kIndirectionFormat = VK_FORMAT_R8G8B8A8_UINT;
+static const VkFormat kFeedbackFormat = VK_FORMAT_R32_UINT;
+// what the feedback pass leaves where nothing was drawn
+static const uint32_t kNoFeedback = ~0u;
+// the textured ground; a little below the other demos' ground planes so
+// they win where they overlap
+static const float kPlaneHalfSize = 32.0f;
+static const float kPlaneHeight = -0.02f;
+
+VkImage VirtualTexture::createImage(const VkImageCreateInfo& imageInfo,
+                                    MemoryCategory category,
+                                    VkDeviceMemory& memory) {
+  VkImage image;
+  VK_CHECK(vkd.vkCreateImage(device, &imageInfo, nullptr, &image));
+  VkMemoryRequirements memReq;
+  vkd.vkGetImageMemoryRequirements(device, image, &memReq);
+  VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+  allocInfo.allocationSize = memReq.size;
+  allocInfo.memoryTypeIndex =
+      findMemoryType(memoryProperties, memReq.memoryTypeBits, 0,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  assert(allocInfo.memoryTypeIndex != UINT32_MAX);
+  VK_CHECK(allocateTrackedMemory(device, allocInfo, category, memory));
+  VK_CHECK(vkd.vkBindImageMemory(device, image, memory, 0));
+  return image;
+}
+
+VkImageView VirtualTexture::createView(VkImage image, VkFormat format,
+                                       uint32_t levels) {
+  VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = format;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1};
+  VkImageView view;
+  VK_CHECK(vkd.vkCreateImageView(device, &viewInfo, nullptr, &view));
+  return view;
+}
+
+bool VirtualTexture::open(const char* path) {
+  if (!archive.open(path)) {
+    printf("failed to open virtual texture:%s\n", path);
+    return false;
+  }
+  uint32_t infoId = archive.find(kVirtualTextureInfoName);
+  if (infoId == AssetArchive::kInvalidAsset ||
+      archive.size(infoId) != sizeof(info) || !archive.read(infoId, &info) ||
+      info.magic != kVirtualTextureMagic ||
+      info.version != kVirtualTextureVersion) {
+    printf("%s has no virtual texture, cook one with --virtual-texture\n",
+           path);
+    return false;
+  }
+  // square, power of two page counts, so every mip's pages are exactly
+  // four of the mip below. the mip count first, the shift needs it in range.
+  bool square = info.mipCount >= 1 && info.mipCount <= 13 &&
+                info.pagesX == info.pagesY && info.pagesX &&
+                (info.pagesX & (info.pagesX - 1)) == 0 &&
+                (info.pagesX >> (info.mipCount - 1)) == 1 &&
+                info.pagesX <= 4096;
+  if (!square || info.pageSize <= 2 * info.pageBorder ||
+      info.pageSize * kAtlasPages > 4096) {
+    printf("%s: unsupported virtual texture layout (%ux%u pages of %u)\n",
+           path, info.pagesX, info.pagesY, info.pageSize);
+    return false;
+  }
+  pageBytes = (VkDeviceSize)info.pageSize * info.pageSize * sizeof(uint32_t);
+
+  mipFirstPage.resize(info.mipCount);
+  pageCount = 0;
+  for (uint32_t m = 0; m < info.mipCount; m++) {
+    mipFirstPage[m] = pageCount;
+    pageCount += (info.pagesX >> m) * (info.pagesY >> m);
+  }
+  pageAssets.resize(pageCount);
+  for (uint32_t m = 0; m < info.mipCount; m++) {
+    for (uint32_t y = 0; y < info.pagesY >> m; y++) {
+      for (uint32_t x = 0; x < info.pagesX >> m; x++) {
+        char name[64];
+        virtualTexturePageName(name, sizeof(name), m, x, y);
+        uint32_t id = archive.find(name);
+        if (id == AssetArchive::kInvalidAsset ||
+            archive.size(id) != pageBytes) {
+          printf("%s: page %s is missing or the wrong size\n", path, name);
+          return false;
+        }
+        pageAssets[pageIndex(m, x, y)] = id;
+      }
+    }
+  }
+  rootPage = pageIndex(info.mipCount - 1, 0, 0);
+  return true;
+}
+
+void VirtualTexture::init(VkPhysicalDevice physicalDevice, VkDevice device,
+                          VkPipelineCache cache, JobSystem& jobs,
+                          uint32_t framesInFlight, ResidencyManager& residency,
+                          DeletionQueue& deletionQueue) {
+  this->device = device;
+  this->framesInFlight = framesInFlight;
+  this->deletionQueue = &deletionQueue;
+  vki.vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  pageSlots.assign(pageCount, kNotResident);
+  pageLoading.assign(pageCount, 0);
+  pageRequested.assign(pageCount, ~0ull);
+  indirection.assign(pageCount, 0);
+  indirectionDirty.resize(info.mipCount);
+  for (uint32_t m = 0; m < info.mipCount; m++) {
+    indirectionDirty[m] = {0, 0, info.pagesX >> m, info.pagesY >> m};
+  }
+  // reserved here, the steady state frames only reuse them
+  requests.reserve(pageCount);
+  indirectionCopies.reserve(info.mipCount);
+  slotPending.assign(framesInFlight, false);
+
+  // the atlas and the indirection are all the texture memory there is,
+  // however big the virtual texture
+  StreamingAtlas::Desc atlasDesc;
+  atlasDesc.name = "virtual texture atlas";
+  atlasDesc.format = kAtlasFormat;
+  atlasDesc.texelBytes = 4;
+  atlasDesc.tileTexels = info.pageSize;
+  atlasDesc.columns = kAtlasPages;
+  atlasDesc.stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  atlasDesc.pinnedKey = rootPage;
+  atlasDesc.load = [this](uint64_t page, uint32_t, uint8_t* data) {
+    return archive.read(pageAssets[page], data);
+  };
+  atlasDesc.placed = [this](uint64_t page, uint32_t slot, uint32_t) {
+    pageSlots[page] = slot;
+    pageLoading[page] = 0;
+    markDirty((uint32_t)page);
+  };
+  atlasDesc.evicted = [this](uint64_t page) {
+    pageSlots[page] = kNotResident;
+    markDirty((uint32_t)page);
+  };
+  atlas.init(device, memoryProperties, jobs, residency, deletionQueue,
+             atlasDesc);
+  uint32_t atlasSize = kAtlasPages * info.pageSize;
+  VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = kIndirectionFormat;
+  imageInfo.extent = {info.pagesX, info.pagesY, 1};
+  imageInfo.mipLevels = info.mipCount;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage =
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  indirectionImage = createImage(imageInfo, MEMORY_TEXTURE, indirectionMemory);
+  indirectionView = createView(indirectionImage, kIndirectionFormat,
+                               info.mipCount);
+
+  const VkMemoryPropertyFlags hostFlags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  indirectionStride =
+      ((VkDeviceSize)pageCount * sizeof(uint32_t) + 255) & ~(VkDeviceSize)255;
+  indirectionStaging = createBuffer(
+      device, memoryProperties, indirectionStride * framesInFlight,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 0, hostFlags, MEMORY_STAGING,
+      indirectionStagingMemory);
+  VK_CHECK(vkd.vkMapMemory(device, indirectionStagingMemory, 0, VK_WHOLE_SIZE,
+                           0, (void**)&indirectionStagingMapped));
+
+  // the coarsest page stands in for everything until finer ones arrive;
+  // the first record() copies it like any other load
+  bool rootLoaded = atlas.loadNow(rootPage);
+  pageLoading[rootPage] = 1;
+  assert(rootLoaded);
+  (void)rootLoaded;
+
+  // the page border covers bilinear filtering, so the atlas is sampled
+  // like one big texture
+  VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  VK_CHECK(vkd.vkCreateSampler(device, &samplerInfo, nullptr, &atlasSampler));
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.maxLod = (float)info.mipCount;
+  VK_CHECK(vkd.vkCreateSampler(device, &samplerInfo, nullptr,
+                               &indirectionSampler));
+
+  // atlas, indirection
+  VkDescriptorSetLayoutBinding bindings[2] = {};
+  for (uint32_t i = 0; i < 2; i++) {
+    bindings[i] = {i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+                   VK_SHADER_STAGE_FRAGMENT_BIT, nullptr};
+  }
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+  setLayoutInfo.bindingCount = 2;
+  setLayoutInfo.pBindings = bindings;
+  VK_CHECK(vkd.vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr,
+                                           &setLayout));
+  createDescriptorSet();
+
+  VkPushConstantRange range = {
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+      sizeof(DrawConstants)};
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &range;
+  VK_CHECK(vkd.vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout));
+
+  // feedback: cleared to kNoFeedback, then copied out. the plane can't hide
+  // itself, so there's no depth. the dependency in covers the previous
+  // frame's copy, the one out this frame's.
+  VkAttachmentDescription attachment = {};
+  attachment.format = kFeedbackFormat;
+  attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  VkAttachmentReference colorRef = {0,
+                                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &colorRef;
+
+  VkSubpassDependency dependencies[2] = {};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[0].srcAccessMask = 0;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+  VkRenderPassCreateInfo renderPassInfo = {
+      VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+  renderPassInfo.attachmentCount = 1;
+  renderPassInfo.pAttachments = &attachment;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = 2;
+  renderPassInfo.pDependencies = dependencies;
+  VK_CHECK(vkd.vkCreateRenderPass(device, &renderPassInfo, nullptr,
+                                  &feedbackRenderPass));
+
+  vertexShader =
+      createShaderRef(device, readFile("shaders/virtual_texture_vert.spv"));
+  fragmentShader =
+      createShaderRef(device, readFile("shaders/virtual_texture_frag.spv"));
+  feedbackShader = createShaderRef(
+      device, readFile("shaders/virtual_texture_feedback_frag.spv"));
+
+  // the plane is generated from the vertex index, nothing to bind
+  GraphicsPipelineDesc feedbackDesc;
+  feedbackDesc.vertexShader = vertexShader;
+  feedbackDesc.fragmentShader = feedbackShader;
+  feedbackDesc.cullMode = VK_CULL_MODE_NONE;
+  feedbackDesc.depthTestEnable = VK_FALSE;
+  feedbackDesc.depthWriteEnable = VK_FALSE;
+  feedbackDesc.layout = layout;
+  feedbackDesc.renderPass = feedbackRenderPass;
+  feedbackPipeline = compileGraphicsPipeline(device, cache, feedbackDesc);
+  assert(feedbackPipeline);
+
+  drawDesc = GraphicsPipelineDesc();
+  drawDesc.vertexShader = vertexShader;
+  drawDesc.fragmentShader = fragmentShader;
+  drawDesc.cullMode = VK_CULL_MODE_NONE;
+  drawDesc.depthTestEnable = VK_TRUE;
+  drawDesc.depthWriteEnable = VK_TRUE;
+  drawDesc.layout = layout;
+
+  uint32_t texels = info.pagesX * (info.pageSize - 2 * info.pageBorder);
+  printf("virtual texture: %ux%u texels in %u pages (%.1fmb), %u resident "
+         "in a %ux%u atlas (%.1fmb)\n",
+         texels, texels, pageCount, pageCount * pageBytes / (1024.0 * 1024.0),
+         kAtlasPages * kAtlasPages, atlasSize, atlasSize,
+         (double)atlasSize * atlasSize * 4 / (1024.0 * 1024.0));
+}
+
+void VirtualTexture::createDescriptorSet() {
+  VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                   2};
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  VK_CHECK(vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr,
+                                      &descriptorPool));
+  VkDescriptorSetAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+  VK_CHECK(vkd.vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
+  VkDescriptorImageInfo imageInfos[2] = {
+      {atlasSampler, atlas.view(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+      {indirectionSampler, indirectionView,
+       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}};
+  VkWriteDescriptorSet writes[2] = {};
+  for (uint32_t i = 0; i < 2; i++) {
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = descriptorSet;
+    writes[i].dstBinding = i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[i].pImageInfo = &imageInfos[i];
+  }
+  vkd.vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+}
+
+void VirtualTexture::resize(VkExtent2D extent, DeletionQueue& deletionQueue) {
+  deletionQueue.push(feedbackFramebuffer);
+  deletionQueue.push(feedbackView);
+  deletionQueue.push(feedbackImage);
+  deletionQueue.push(feedbackMemory);
+  deletionQueue.push(readbackBuffer);
+  deletionQueue.push(readbackMemory);
+
+  feedbackExtent = {std::max(extent.width / kFeedbackDivisor, 1u),
+                    std::max(extent.height / kFeedbackDivisor, 1u)};
+  VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = kFeedbackFormat;
+  imageInfo.extent = {feedbackExtent.width, feedbackExtent.height, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                    VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  feedbackImage = createImage(imageInfo, MEMORY_RENDER_TARGET, feedbackMemory);
+  feedbackView = createView(feedbackImage, kFeedbackFormat, 1);
+
+  VkFramebufferCreateInfo framebufferInfo = {
+      VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+  framebufferInfo.renderPass = feedbackRenderPass;
+  framebufferInfo.attachmentCount = 1;
+  framebufferInfo.pAttachments = &feedbackView;
+  framebufferInfo.width = feedbackExtent.width;
+  framebufferInfo.height = feedbackExtent.height;
+  framebufferInfo.layers = 1;
+  VK_CHECK(vkd.vkCreateFramebuffer(device, &framebufferInfo, nullptr,
+                                   &feedbackFramebuffer));
+
+  readbackStride = ((VkDeviceSize)feedbackExtent.width * feedbackExtent.height *
+                        sizeof(uint32_t) + 255) & ~(VkDeviceSize)255;
+  readbackBuffer = createBuffer(
+      device, memoryProperties, readbackStride * framesInFlight,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MEMORY_STAGING, readbackMemory);
+  VK_CHECK(vkd.vkMapMemory(device, readbackMemory, 0, VK_WHOLE_SIZE, 0,
+                           (void**)&readbackMapped));
+  // feedback still in flight was copied into the old buffers; the next
+  // frames ask again
+  slotPending.assign(framesInFlight, false);
+}
+
+void VirtualTexture::destroy() {
+  atlas.destroy();
+  vkd.vkDestroyPipeline(device, feedbackPipeline, nullptr);
+  vkd.vkDestroyShaderModule(device, vertexShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, fragmentShader.module, nullptr);
+  vkd.vkDestroyShaderModule(device, feedbackShader.module, nullptr);
+  vkd.vkDestroyPipelineLayout(device, layout, nullptr);
+  vkd.vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  vkd.vkDestroyRenderPass(device, feedbackRenderPass, nullptr);
+  vkd.vkDestroyFramebuffer(device, feedbackFramebuffer, nullptr);
+  vkd.vkDestroyImageView(device, feedbackView, nullptr);
+  vkd.vkDestroyImage(device, feedbackImage, nullptr);
+  freeTrackedMemory(device, feedbackMemory);
+  vkd.vkDestroySampler(device, atlasSampler, nullptr);
+  vkd.vkDestroySampler(device, indirectionSampler, nullptr);
+  vkd.vkDestroyImageView(device, indirectionView, nullptr);
+  vkd.vkDestroyImage(device, indirectionImage, nullptr);
+  freeTrackedMemory(device, indirectionMemory);
+  vkd.vkUnmapMemory(device, indirectionStagingMemory);
+  vkd.vkUnmapMemory(device, readbackMemory);
+  VkBuffer buffers[] = {indirectionStaging, readbackBuffer};
+  VkDeviceMemory memories[] = {indirectionStagingMemory, readbackMemory};
+  for (uint32_t i = 0; i < 2; i++) {
+    vkd.vkDestroyBuffer(device, buffers[i], nullptr);
+    freeTrackedMemory(device, memories[i]);
+  }
+  archive.close();
+}
+
+// the page and every coarser one above it, up to the first that's resident
+void VirtualTexture::request(uint32_t mip, uint32_t x, uint32_t y) {
+  for (; mip < info.mipCount; mip++, x /= 2, y /= 2) {
+    uint32_t page = pageIndex(mip, x, y);
+    // and so was everything above it
+    if (pageRequested[page] == frame) return;
+    pageRequested[page] = frame;
+    if (pageSlots[page] != kNotResident) {
+      atlas.touch(pageSlots[page]);
+      return;
+    }
+    if (!pageLoading[page]) requests.push_back(page);
+  }
+}
+
+void VirtualTexture::update(uint32_t slot) {
+  frame++;
+  atlas.update(slot, frame);
+
+  if (slotPending[slot]) {
+    const uint32_t* ids = (const uint32_t*)(readbackMapped +
+                                            slot * readbackStride);
+    uint32_t count = feedbackExtent.width * feedbackExtent.height;
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t id = ids[i];
+      if (id == kNoFeedback) continue;
+      uint32_t mip = id >> 24;
+      uint32_t x = id & 0xfff;
+      uint32_t y = (id >> 12) & 0xfff;
+      if (mip >= info.mipCount || x >= info.pagesX >> mip ||
+          y >= info.pagesY >> mip) {
+        continue;
+      }
+      request(mip, x, y);
+    }
+    feedbackFrames++;
+    slotPending[slot] = false;
+  }
+  startLoads();
+}
+
+void VirtualTexture::startLoads() {
+  if (requests.empty()) return;
+  requested += requests.size();
+  maxQueued = std::max(maxQueued, (uint32_t)requests.size());
+  // pages are numbered fine to coarse; coarse ones first, they stand in for
+  // everything below them
+  std::sort(requests.begin(), requests.end(),
+            [](uint32_t a, uint32_t b) { return a > b; });
+  uint32_t started = 0;
+  for (uint32_t page : requests) {
+    if (started == kMaxLoadsPerFrame || !atlas.startLoad(page)) break;
+    pageLoading[page] = 1;
+    started++;
+  }
+  // whatever didn't fit is asked for again by the next feedback
+  requests.clear();
+}
+
+void VirtualTexture::markDirty(uint32_t page) {
+  uint32_t mip = info.mipCount - 1;
+  while (mipFirstPage[mip] > page) mip--;
+  uint32_t width = info.pagesX >> mip;
+  uint32_t x = (page - mipFirstPage[mip]) % width;
+  uint32_t y = (page - mipFirstPage[mip]) / width;
+  for (uint32_t m = 0; m <= mip; m++) {
+    uint32_t shift = mip - m;
+    DirtyRect& r = indirectionDirty[m];
+    r.x0 = std::min(r.x0, x << shift);
+    r.y0 = std::min(r.y0, y << shift);
+    r.x1 = std::max(r.x1, (x + 1) << shift);
+    r.y1 = std::max(r.y1, (y + 1) << shift);
+  }
+}
+
+// coarse to fine, so a page that isn't resident copies its parent's entry,
+// whether or not that was rebuilt too. only the dirty texels are staged
+// and copied.
+void VirtualTexture::rebuildIndirection(uint32_t slot) {
+  indirectionCopies.clear();
+  uint8_t* staging = indirectionStagingMapped + slot * indirectionStride;
+  for (uint32_t m = info.mipCount; m-- > 0;) {
+    DirtyRect& r = indirectionDirty[m];
+    if (r.x0 >= r.x1) continue;
+    uint32_t width = info.pagesX >> m;
+    for (uint32_t y = r.y0; y < r.y1; y++) {
+      for (uint32_t x = r.x0; x < r.x1; x++) {
+        uint32_t page = pageIndex(m, x, y);
+        uint32_t atlasSlot = pageSlots[page];
+        if (atlasSlot != kNotResident) {
+          indirection[page] = (atlasSlot % kAtlasPages) |
+                              (atlasSlot / kAtlasPages) << 8 | m << 16 |
+                              0xffu << 24;
+        } else if (m + 1 < info.mipCount) {
+          indirection[page] = indirection[pageIndex(m + 1, x / 2, y / 2)];
+        } else {
+          indirection[page] = 0;
+        }
+      }
+      uint32_t first = pageIndex(m, r.x0, y);
+      memcpy(staging + first * sizeof(uint32_t), &indirection[first],
+             (r.x1 - r.x0) * sizeof(uint32_t));
+    }
+    VkBufferImageCopy region = {};
+    region.bufferOffset = slot * indirectionStride +
+                          pageIndex(m, r.x0, r.y0) * sizeof(uint32_t);
+    region.bufferRowLength = width;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, m, 0, 1};
+    region.imageOffset = {(int32_t)r.x0, (int32_t)r.y0, 0};
+    region.imageExtent = {r.x1 - r.x0, r.y1 - r.y0, 1};
+    indirectionCopies.push_back(region);
+    r = {UINT32_MAX, UINT32_MAX, 0, 0};
+  }
+  if (!indirectionCopies.empty()) indirectionUpdates++;
+}
+
+// this frame's copies into the indirection. the barrier in waits for the
+// fragment shaders of earlier frames, which may still sample it.
+void VirtualTexture::upload(VkCommandBuffer cmd) {
+  // the first frame also moves it out of UNDEFINED
+  if (indirectionCopies.empty() && indirectionInitialized) return;
+  VkImageMemoryBarrier barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = indirectionInitialized
+                          ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                          : VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = indirectionImage;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, info.mipCount, 0,
+                              1};
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                           nullptr, 1, &barrier);
+  if (!indirectionCopies.empty()) {
+    vkd.vkCmdCopyBufferToImage(cmd, indirectionStaging, indirectionImage,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               (uint32_t)indirectionCopies.size(),
+                               indirectionCopies.data());
+  }
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                           0, nullptr, 1, &barrier);
+  indirectionInitialized = true;
+}
+
+void VirtualTexture::setConstants(DrawConstants& constants,
+                                  const glm::mat4& viewProj,
+                                  float lodBias) const {
+  constants.viewProj = viewProj;
+  constants.plane = glm::vec4(kPlaneHalfSize, kPlaneHeight, lodBias, 0.0f);
+  constants.texture =
+      glm::vec4((float)info.pagesX, (float)info.pagesY, (float)info.mipCount,
+                (float)(info.pageSize - 2 * info.pageBorder));
+  constants.atlas = glm::vec4((float)info.pageSize, (float)info.pageBorder,
+                              (float)(kAtlasPages * info.pageSize),
+                              (float)(atlas.imageRows() * info.pageSize));
+}
+
+void VirtualTexture::renderFeedback(VkCommandBuffer cmd, uint32_t slot,
+                                    const glm::mat4& viewProj) {
+  VkClearValue clear = {};
+  clear.color.uint32[0] = kNoFeedback;
+  VkRenderPassBeginInfo beginInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+  beginInfo.renderPass = feedbackRenderPass;
+  beginInfo.framebuffer = feedbackFramebuffer;
+  beginInfo.renderArea.extent = feedbackExtent;
+  beginInfo.clearValueCount = 1;
+  beginInfo.pClearValues = &clear;
+  vkd.vkCmdBeginRenderPass(cmd, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+  VkViewport viewport = {0.0f, 0.0f, (float)feedbackExtent.width,
+                         (float)feedbackExtent.height, 0.0f, 1.0f};
+  VkRect2D scissor = {{0, 0}, feedbackExtent};
+  vkd.vkCmdSetViewport(cmd, 0, 1, &viewport);
+  vkd.vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+  // every pixel covers kFeedbackDivisor screen pixels a side; the bias asks
+  // for the mip the full resolution pass will want
+  DrawConstants constants;
+  setConstants(constants, viewProj, -log2f((float)kFeedbackDivisor));
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, feedbackPipeline);
+  vkd.vkCmdPushConstants(cmd, layout,
+                         VK_SHADER_STAGE_VERTEX_BIT |
+                             VK_SHADER_STAGE_FRAGMENT_BIT,
+                         0, sizeof(constants), &constants);
+  vkd.vkCmdDraw(cmd, 6, 1, 0, 0);
+  vkd.vkCmdEndRenderPass(cmd);
+
+  VkBufferImageCopy region = {};
+  region.bufferOffset = slot * readbackStride;
+  region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageExtent = {feedbackExtent.width, feedbackExtent.height, 1};
+  vkd.vkCmdCopyImageToBuffer(cmd, feedbackImage,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             readbackBuffer, 1, &region);
+  VkBufferMemoryBarrier toHost = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+  toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toHost.buffer = readbackBuffer;
+  toHost.offset = slot * readbackStride;
+  toHost.size = readbackStride;
+  vkd.vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                           &toHost, 0, nullptr);
+  slotPending[slot] = true;
+}
+
+void VirtualTexture::record(VkCommandBuffer cmd, uint32_t slot,
+                            const glm::mat4& viewProj, GpuTimer& timer) {
+  uint32_t zone = timer.begin(cmd, "virtual texture");
+  if (atlas.record(cmd, slot)) {
+    // only earlier frames bound the old set
+    deletionQueue->push(descriptorPool);
+    createDescriptorSet();
+  }
+  rebuildIndirection(slot);
+  upload(cmd);
+  renderFeedback(cmd, slot, viewProj);
+  timer.end(cmd, zone, VK_PIPELINE_STAGE_TRANSFER_BIT);
+}
+
+void VirtualTexture::draw(VkCommandBuffer cmd, const glm::mat4& viewProj,
+                          PipelineVariantCache& pipelines) {
+  VkPipeline pipeline = pipelines.request(drawDesc);
+  if (!pipeline) return;
+
+  DrawConstants constants;
+  setConstants(constants, viewProj, 0.0f);
+  vkd.vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkd.vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0,
+                              1, &descriptorSet, 0, nullptr);
+  vkd.vkCmdPushConstants(cmd, layout,
+                         VK_SHADER_STAGE_VERTEX_BIT |
+                             VK_SHADER_STAGE_FRAGMENT_BIT,
+                         0, sizeof(constants), &constants);
+  vkd.vkCmdDraw(cmd, 6, 1, 0, 0);
+}
+
+void VirtualTexture::printStats() const {
+  if (!feedbackFrames) return;
+  const StreamingAtlas::Stats& stats = atlas.stats();
+  printf("virtual texture: %llu pages loaded (%.1fmb), %llu evicted, %llu "
+         "failed, %u of %u atlas pages in use (shrunk %llu, grown %llu "
+         "times); %.1f pages requested per frame (at most %u), %llu "
+         "indirection updates\n",
+         (unsigned long long)stats.loaded,
+         stats.loaded * pageBytes / (1024.0 * 1024.0),
+         (unsigned long long)stats.evicted, (unsigned long long)stats.failed,
+         atlas.residentCount(), atlas.rows() * kAtlasPages,
+         (unsigned long long)stats.shrinks, (unsigned long long)stats.grows,
+         (double)requested / feedbackFrames, maxQueued,
+         (unsigned long long)indirectionUpdates);
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "vk_common.h"
+
+#include "asset_archive.h"
+#include "job_system.h"
+#include "memory_budget.h"
+#include "pipeline_cache.h"
+#include "streaming_atlas.h"
+#include "virtual_texture_format.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+class DeletionQueue;
+class GpuTimer;
+class ResidencyManager;
+
+// Sparse virtual texturing of a ground plane from a tile file made by
+// `cook --virtual-texture`, in a fixed amount of texture memory no matter
+// how big the virtual texture is.
+//
+// Only kAtlasPages x kAtlasPages pages are resident at a time, in one
+// physical atlas. An indirection texture with a texel per page of every mip
+// points each page at its place in the atlas, or at the nearest coarser
+// resident page; the single page of the coarsest mip is always resident.
+//
+// Every frame a feedback pass renders the plane at 1/kFeedbackDivisor of
+// the screen, writing the page (mip, x, y) each pixel wants. The result is
+// copied back and read in update() once the slot's fence was waited on, so
+// the GPU never waits for it. Pages it names that aren't resident are
+// requested coarse to fine; up to kMaxLoadsPerFrame a frame are read out
+// of the mapped tile file on the job workers, into the StreamingAtlas's
+// staging tiles. record() copies finished loads into free atlas slots or,
+// once the atlas is full, over the least recently wanted page, and
+// rebuilds and uploads the indirection texels that changed. Over budget the
+// atlas gives up rows of pages and their pages fall back to coarser ones.
+class VirtualTexture {
+ public:
+  static const uint32_t kAtlasPages = 16;  // per side
+  static const uint32_t kFeedbackDivisor = 8;
+
+  // maps the tile file and checks it; false (with a message) if it isn't
+  // a virtual texture this build can draw
+  bool open(const char* path);
+  // after open(); loads the coarsest page. the atlas images it replaces go
+  // through the deletion queue.
+  void init(VkPhysicalDevice physicalDevice, VkDevice device,
+            VkPipelineCache cache, JobSystem& jobs, uint32_t framesInFlight,
+            ResidencyManager& residency, DeletionQueue& deletionQueue);
+  void destroy();
+
+  // (re)builds the feedback target for a new screen size; the old one goes
+  // through the deletion queue
+  void resize(VkExtent2D extent, DeletionQueue& deletionQueue);
+
+  // once the slot's fence was waited on: reads the slot's feedback,
+  // releases its staging pages and starts loading what's missing
+  void update(uint32_t slot);
+  // outside a render pass, before the main pass: copies loaded pages into
+  // the atlas, updates the indirection and renders this frame's feedback
+  void record(VkCommandBuffer cmd, uint32_t slot, const glm::mat4& viewProj,
+              GpuTimer& timer);
+  // inside the main pass
+  void draw(VkCommandBuffer cmd, const glm::mat4& viewProj,
+            PipelineVariantCache& pipelines);
+
+  void printStats() const;
+
+  // the owner fills in renderPassKey like for any other pipeline
+  GraphicsPipelineDesc drawDesc;
+
+ private:
+  // mirrors the push constants in virtual_texture_common.glsl
+  struct DrawConstants {
+    glm::mat4 viewProj;
+    glm::vec4 plane;    // half size, height, lod bias, unused
+    glm::vec4 texture;  // pages x, pages y, mip count, texels per page
+    glm::vec4 atlas;    // page size, border, atlas width, height
+  };
+
+  static const uint32_t kMaxLoadsPerFrame = 16;
+  static constexpr uint32_t kNotResident = ~0u;
+
+  uint32_t pageIndex(uint32_t mip, uint32_t x, uint32_t y) const {
+    return mipFirstPage[mip] + y * (info.pagesX >> mip) + x;
+  }
+  void request(uint32_t mip, uint32_t x, uint32_t y);
+  void startLoads();
+  void createDescriptorSet();
+  // the page's entry changed, and with it those of the finer pages that
+  // copy it
+  void markDirty(uint32_t page);
+  void rebuildIndirection(uint32_t slot);
+  void upload(VkCommandBuffer cmd);
+  void renderFeedback(VkCommandBuffer cmd, uint32_t slot,
+                      const glm::mat4& viewProj);
+  VkImage createImage(const VkImageCreateInfo& imageInfo,
+                      MemoryCategory category, VkDeviceMemory& memory);
+  VkImageView createView(VkImage image, VkFormat format, uint32_t levels);
+  void setConstants(DrawConstants& constants, const glm::mat4& viewProj,
+                    float lodBias) const;
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  uint32_t framesInFlight = 0;
+  DeletionQueue* deletionQueue = nullptr;
+
+  AssetArchive archive;
+  VirtualTextureInfo info = {};
+  VkDeviceSize pageBytes = 0;
+  // per mip: index of its first page; pages are numbered mip by mip
+  std::vector<uint32_t> mipFirstPage;
+  uint32_t pageCount = 0;
+  // per page
+  std::vector<uint32_t> pageAssets;
+  std::vector<uint32_t> pageSlots;  // in the atlas, or kNotResident
+  // being loaded, or failed to load; either way not requested again
+  std::vector<uint8_t> pageLoading;
+  std::vector<uint64_t> pageRequested;  // frame it was last requested in
+  uint32_t rootPage = 0;  // the coarsest mip's page, never evicted
+  std::vector<uint32_t> requests;  // pages to load, this frame
+  // per mip: the texels that changed since the last upload, empty while
+  // x0 >= x1
+  struct DirtyRect {
+    uint32_t x0, y0, x1, y1;
+  };
+  std::vector<DirtyRect> indirectionDirty;
+  // RGBA8_UINT texels, mip by mip: atlas x, atlas y, the mip of the page
+  // found there, 255
+  std::vector<uint32_t> indirection;
+  // this frame's copies, recorded by upload()
+  std::vector<VkBufferImageCopy> indirectionCopies;
+
+  // pages keyed by their index
+  StreamingAtlas atlas;
+  VkImage indirectionImage = VK_NULL_HANDLE;
+  VkDeviceMemory indirectionMemory = VK_NULL_HANDLE;
+  VkImageView indirectionView = VK_NULL_HANDLE;
+  bool indirectionInitialized = false;
+  VkSampler atlasSampler = VK_NULL_HANDLE;
+  VkSampler indirectionSampler = VK_NULL_HANDLE;
+
+  // per slot: the indirection, of which the dirty texels are uploaded
+  VkBuffer indirectionStaging = VK_NULL_HANDLE;
+  VkDeviceMemory indirectionStagingMemory = VK_NULL_HANDLE;
+  uint8_t* indirectionStagingMapped = nullptr;
+  VkDeviceSize indirectionStride = 0;
+
+  // feedback: page ids at a fraction of the screen, then per slot a copy
+  // the CPU reads once the slot's fence signalled
+  VkExtent2D feedbackExtent = {};
+  VkImage feedbackImage = VK_NULL_HANDLE;
+  VkDeviceMemory feedbackMemory = VK_NULL_HANDLE;
+  VkImageView feedbackView = VK_NULL_HANDLE;
+  VkFramebuffer feedbackFramebuffer = VK_NULL_HANDLE;
+  VkRenderPass feedbackRenderPass = VK_NULL_HANDLE;
+  VkBuffer readbackBuffer = VK_NULL_HANDLE;
+  VkDeviceMemory readbackMemory = VK_NULL_HANDLE;
+  uint8_t* readbackMapped = nullptr;
+  VkDeviceSize readbackStride = 0;
+  std::vector<bool> slotPending;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  ShaderRef vertexShader;
+  ShaderRef fragmentShader;
+  ShaderRef feedbackShader;
+  VkPipeline feedbackPipeline = VK_NULL_HANDLE;
+
+  uint64_t frame = 0;
+  uint64_t feedbackFrames = 0;
+  uint64_t requested = 0;
+  uint64_t indirectionUpdates = 0;
+  uint32_t maxQueued = 0;
+};
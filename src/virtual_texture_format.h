@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Layout of the virtual textures tools/cook bakes with --virtual-texture,
+// shared with the engine.
+//
+// A virtual texture is a set of assets in a cooked archive
+// (archive_format.h): a VirtualTextureInfo named kVirtualTextureInfoName
+// and one asset per page, named by virtualTexturePageName(). Mip m is
+// pagesX >> m by pagesY >> m pages (at least one), down to a single page.
+//
+// A page is pageSize x pageSize RGBA8 texels, rows top to bottom. The outer
+// pageBorder texels on each side repeat the neighbouring pages' texels of
+// the same mip (clamped at the edges of the texture), so a page can be
+// filtered on its own wherever it ends up in the atlas. The texels a page
+// covers are the pageSize - 2 * pageBorder in between.
+
+static const uint32_t kVirtualTextureMagic = 0x54585456;  // "VTXT"
+static const uint32_t kVirtualTextureVersion = 1;
+static const char kVirtualTextureInfoName[] = "vt/info";
+
+struct VirtualTextureInfo {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pageSize;    // texels per side, border included
+  uint32_t pageBorder;  // texels on each side
+  uint32_t pagesX;      // of mip 0, powers of two
+  uint32_t pagesY;
+  uint32_t mipCount;
+  uint32_t reserved;
+};
+
+inline void virtualTexturePageName(char* name, size_t size, uint32_t mip,
+                                   uint32_t x, uint32_t y) {
+  snprintf(name, size, "vt/%u/%u_%u", mip, x, y);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define VK_CHECK(call)        \
+  do {                        \
+    VkResult _r = call;       \
+    assert(_r == VK_SUCCESS); \
+  } while (0)
@@ -0,0 +1,21 @@
+#include "vk_dispatch.h"
+
+VkInstanceDispatch vki;
+VkDeviceDispatch vkd;
+
+void loadInstanceDispatch(VkInstanceDispatch& table, VkInstance instance) {
+#define VK_LOAD_INSTANCE(name) \
+  table.name = (PFN_##name)vkGetInstanceProcAddr(instance, #name);
+  VK_INSTANCE_FUNCTIONS(VK_LOAD_INSTANCE)
+#undef VK_LOAD_INSTANCE
+  assert(table.vkGetDeviceProcAddr);
+}
+
+void loadDeviceDispatch(VkDeviceDispatch& table,
+                        const VkInstanceDispatch& instanceTable,
+                        VkDevice device) {
+#define VK_LOAD_DEVICE(name) \
+  table.name = (PFN_##name)instanceTable.vkGetDeviceProcAddr(device, #name);
+  VK_DEVICE_FUNCTIONS(VK_LOAD_DEVICE)
+#undef VK_LOAD_DEVICE
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "vk_common.h"
+
+// Function tables filled from vkGetInstanceProcAddr / vkGetDeviceProcAddr.
+// Calling through a device table jumps straight into the driver; the exported
+// vk* symbols go through the loader trampoline (and any enabled layers' chain
+// lookup) on every call, which adds up when recording thousands of draws.
+// Members keep the vk names, so `vkCmdDraw(cb, ...)` becomes
+// `vkd.vkCmdDraw(cb, ...)`. Entry points of extensions that aren't enabled stay
+// null. To use a new function add it to the matching list below.
+//
+// The engine has one instance and one device, so their tables are globals:
+// vki is loaded right after instance creation and vkd right after device
+// creation, and every call past that point goes through them.
+
+#define VK_INSTANCE_FUNCTIONS(X)                \
+  X(vkDestroyInstance)                          \
+  X(vkEnumeratePhysicalDevices)                 \
+  X(vkGetPhysicalDeviceProperties)              \
+  X(vkGetPhysicalDeviceProperties2)             \
+  X(vkGetPhysicalDeviceFormatProperties)        \
+  X(vkGetPhysicalDeviceFeatures)                \
+  X(vkGetPhysicalDeviceQueueFamilyProperties)   \
+  X(vkGetPhysicalDeviceMemoryProperties)        \
+  X(vkGetPhysicalDeviceMemoryProperties2)       \
+  X(vkEnumerateDeviceExtensionProperties)       \
+  X(vkCreateDevice)                             \
+  X(vkGetDeviceProcAddr)                        \
+  X(vkDestroySurfaceKHR)                        \
+  X(vkGetPhysicalDeviceSurfaceSupportKHR)       \
+  X(vkGetPhysicalDeviceSurfaceCapabilitiesKHR)  \
+  X(vkGetPhysicalDeviceSurfaceFormatsKHR)       \
+  X(vkGetPhysicalDeviceSurfacePresentModesKHR)  \
+  X(vkCreateDebugUtilsMessengerEXT)             \
+  X(vkDestroyDebugUtilsMessengerEXT)
+
+#define VK_DEVICE_FUNCTIONS(X)          \
+  X(vkDestroyDevice)                    \
+  X(vkGetDeviceQueue)                   \
+  X(vkQueueSubmit)                      \
+  X(vkQueueWaitIdle)                    \
+  X(vkDeviceWaitIdle)                   \
+  X(vkAllocateMemory)                   \
+  X(vkFreeMemory)                       \
+  X(vkMapMemory)                        \
+  X(vkUnmapMemory)                      \
+  X(vkFlushMappedMemoryRanges)          \
+  X(vkInvalidateMappedMemoryRanges)     \
+  X(vkBindBufferMemory)                 \
+  X(vkBindImageMemory)                  \
+  X(vkGetBufferMemoryRequirements)      \
+  X(vkGetImageMemoryRequirements)       \
+  X(vkCreateFence)                      \
+  X(vkDestroyFence)                     \
+  X(vkResetFences)                      \
+  X(vkGetFenceStatus)                   \
+  X(vkWaitForFences)                    \
+  X(vkCreateSemaphore)                  \
+  X(vkDestroySemaphore)                 \
+  X(vkCreateQueryPool)                  \
+  X(vkDestroyQueryPool)                 \
+  X(vkGetQueryPoolResults)              \
+  X(vkCreateBuffer)                     \
+  X(vkDestroyBuffer)                    \
+  X(vkCreateImage)                      \
+  X(vkDestroyImage)                     \
+  X(vkCreateImageView)                  \
+  X(vkDestroyImageView)                 \
+  X(vkCreateShaderModule)               \
+  X(vkDestroyShaderModule)              \
+  X(vkCreatePipelineCache)              \
+  X(vkDestroyPipelineCache)             \
+  X(vkGetPipelineCacheData)             \
+  X(vkCreateGraphicsPipelines)          \
+  X(vkCreateComputePipelines)           \
+  X(vkDestroyPipeline)                  \
+  X(vkCreatePipelineLayout)             \
+  X(vkDestroyPipelineLayout)            \
+  X(vkCreateSampler)                    \
+  X(vkDestroySampler)                   \
+  X(vkCreateDescriptorSetLayout)        \
+  X(vkDestroyDescriptorSetLayout)       \
+  X(vkCreateDescriptorPool)             \
+  X(vkDestroyDescriptorPool)            \
+  X(vkResetDescriptorPool)              \
+  X(vkAllocateDescriptorSets)           \
+  X(vkFreeDescriptorSets)               \
+  X(vkUpdateDescriptorSets)             \
+  X(vkCreateFramebuffer)                \
+  X(vkDestroyFramebuffer)               \
+  X(vkCreateRenderPass)                 \
+  X(vkDestroyRenderPass)                \
+  X(vkCreateCommandPool)                \
+  X(vkDestroyCommandPool)               \
+  X(vkResetCommandPool)                 \
+  X(vkAllocateCommandBuffers)           \
+  X(vkFreeCommandBuffers)               \
+  X(vkBeginCommandBuffer)               \
+  X(vkEndCommandBuffer)                 \
+  X(vkResetCommandBuffer)               \
+  X(vkCmdBindPipeline)                  \
+  X(vkCmdSetViewport)                   \
+  X(vkCmdSetScissor)                    \
+  X(vkCmdSetLineWidth)                  \
+  X(vkCmdSetDepthBias)                  \
+  X(vkCmdBindDescriptorSets)            \
+  X(vkCmdBindIndexBuffer)               \
+  X(vkCmdBindVertexBuffers)             \
+  X(vkCmdDraw)                          \
+  X(vkCmdDrawIndexed)                   \
+  X(vkCmdDrawIndirect)                  \
+  X(vkCmdDrawIndexedIndirect)           \
+  X(vkCmdDispatch)                      \
+  X(vkCmdDispatchIndirect)              \
+  X(vkCmdCopyBuffer)                    \
+  X(vkCmdCopyBufferToImage)             \
+  X(vkCmdCopyImageToBuffer)             \
+  X(vkCmdCopyImage)                     \
+  X(vkCmdBlitImage)                     \
+  X(vkCmdUpdateBuffer)                  \
+  X(vkCmdFillBuffer)                    \
+  X(vkCmdClearColorImage)               \
+  X(vkCmdPipelineBarrier)               \
+  X(vkCmdResetQueryPool)                \
+  X(vkCmdWriteTimestamp)                \
+  X(vkCmdPushConstants)                 \
+  X(vkCmdBeginRenderPass)               \
+  X(vkCmdNextSubpass)                   \
+  X(vkCmdEndRenderPass)                 \
+  X(vkCmdExecuteCommands)               \
+  X(vkCreateSwapchainKHR)               \
+  X(vkDestroySwapchainKHR)              \
+  X(vkGetSwapchainImagesKHR)            \
+  X(vkAcquireNextImageKHR)              \
+  X(vkQueuePresentKHR)
+
+#define VK_DISPATCH_MEMBER(name) PFN_##name name = nullptr;
+
+struct VkInstanceDispatch {
+  VK_INSTANCE_FUNCTIONS(VK_DISPATCH_MEMBER)
+};
+
+struct VkDeviceDispatch {
+  VK_DEVICE_FUNCTIONS(VK_DISPATCH_MEMBER)
+};
+
+#undef VK_DISPATCH_MEMBER
+
+void loadInstanceDispatch(VkInstanceDispatch& table, VkInstance instance);
+// needs table.vkGetDeviceProcAddr from a loaded instance table
+void loadDeviceDispatch(VkDeviceDispatch& table,
+                        const VkInstanceDispatch& instanceTable,
+                        VkDevice device);
+
+extern VkInstanceDispatch vki;
+extern VkDeviceDispatch vkd;
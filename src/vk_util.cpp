@@ -0,0 +1,60 @@
+#include "vk_util.h"
+
+#include "vk_dispatch.h"
+
+VkShaderModule createShaderModule(VkDevice device,
+                                  const std::vector<char>& code) {
+  VkShaderModuleCreateInfo createInfo = {
+      VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+  createInfo.codeSize = code.size();
+  createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  VkShaderModule module;
+  VK_CHECK(vkd.vkCreateShaderModule(device, &createInfo, nullptr, &module));
+  return module;
+}
+
+uint32_t findMemoryType(const VkPhysicalDeviceMemoryProperties& properties,
+                        uint32_t typeBits, VkMemoryPropertyFlags preferred,
+                        VkMemoryPropertyFlags required) {
+  for (VkMemoryPropertyFlags flags : {preferred | required, required}) {
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+      if ((typeBits & (1u << i)) &&
+          (properties.memoryTypes[i].propertyFlags & flags) == flags) {
+        return i;
+      }
+    }
+  }
+  return UINT32_MAX;
+}
+
+VkBuffer createBuffer(VkDevice device,
+                      const VkPhysicalDeviceMemoryProperties& properties,
+                      VkDeviceSize size, VkBufferUsageFlags usage,
+                      VkMemoryPropertyFlags preferred,
+                      VkMemoryPropertyFlags required, MemoryCategory category,
+                      VkDeviceMemory& memory) {
+  VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VkBuffer buffer;
+  VK_CHECK(vkd.vkCreateBuffer(device, &bufferInfo, nullptr, &buffer));
+
+  VkMemoryRequirements memReq;
+  vkd.vkGetBufferMemoryRequirements(device, buffer, &memReq);
+  VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+  allocInfo.allocationSize = memReq.size;
+  allocInfo.memoryTypeIndex = findMemoryType(properties, memReq.memoryTypeBits,
+                                             preferred, required);
+  assert(allocInfo.memoryTypeIndex != UINT32_MAX);
+  VK_CHECK(allocateTrackedMemory(device, allocInfo, category, memory));
+  VK_CHECK(vkd.vkBindBufferMemory(device, buffer, memory, 0));
+  return buffer;
+}
+
+float randomFloat(uint32_t& state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return (state & 0xffffff) / (float)0x1000000;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "memory_budget.h"
+#include "vk_common.h"
+
+#include <vector>
+
+// small helpers shared by the subsystems that own their own buffers and
+// pipelines
+
+VkShaderModule createShaderModule(VkDevice device,
+                                  const std::vector<char>& code);
+
+// first type in typeBits with preferred | required, else the first with just
+// required; UINT32_MAX when none has required
+uint32_t findMemoryType(const VkPhysicalDeviceMemoryProperties& properties,
+                        uint32_t typeBits, VkMemoryPropertyFlags preferred,
+                        VkMemoryPropertyFlags required);
+
+// buffer with its own tracked allocation, memory picked as findMemoryType()
+// does; asserts if no type has required
+VkBuffer createBuffer(VkDevice device,
+                      const VkPhysicalDeviceMemoryProperties& properties,
+                      VkDeviceSize size, VkBufferUsageFlags usage,
+                      VkMemoryPropertyFlags preferred,
+                      VkMemoryPropertyFlags required, MemoryCategory category,
+                      VkDeviceMemory& memory);
+
+// xorshift in [0, 1); for demo layouts that only have to be the same every
+// run
+float randomFloat(uint32_t& state);
@@ -0,0 +1,402 @@
+#include "archive_format.h"
+#include "asset_archive.h"
+#include "file_io.h"
+#include "job_system.h"
+#include "lz4.h"
+#include "virtual_texture_format.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Packs files into one archive (archive_format.h) that the engine mounts
+// with --archive. Names are the paths as the engine would pass them to
+// readFile(), so cook from the directory the engine runs in:
+//
+//   cook <archive> [--virtual-texture <pages>] <file or directory>...
+//
+// Directories are packed recursively. --virtual-texture also bakes a
+// procedural virtual texture (virtual_texture_format.h) of pages x pages
+// pages into the archive, for the engine's --virtual-texture; it can be the
+// only input. Each asset becomes one chunk, compressed with LZ4 on the job
+// workers and kept compressed only when that saves at least a sixteenth,
+// since a stored chunk is a plain copy out of the mapping. The finished
+// archive is read back and compared with the sources before cook reports
+// success.
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// the baked virtual texture's pages; 120 texels and a 4 texel border
+const uint32_t kPageSize = 128;
+const uint32_t kPageBorder = 4;
+// rows per baking job
+const uint32_t kBakeRows = 64;
+
+struct Asset {
+  std::string name;
+  std::vector<char> data;
+  std::vector<uint8_t> compressed;  // empty if stored
+  bool baked = false;  // data was generated, not read from the file `name`
+};
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// false if the seek or the write failed. long is 32 bits on windows, so
+// archives past 2gb need the 64 bit seek.
+bool writeAt(FILE* file, uint64_t offset, const void* data, size_t size) {
+#ifdef _WIN32
+  int seeked = _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+  int seeked = fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+  return seeked == 0 && fwrite(data, 1, size, file) == size;
+}
+
+float hashLattice(int32_t x, int32_t y) {
+  uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u;
+  h = (h ^ (h >> 13)) * 1274126177u;
+  return ((h ^ (h >> 16)) & 0xffffff) / (float)0x1000000;
+}
+
+float valueNoise(float x, float y) {
+  float fx = floorf(x), fy = floorf(y);
+  int32_t ix = (int32_t)fx, iy = (int32_t)fy;
+  float tx = x - fx, ty = y - fy;
+  tx = tx * tx * (3.0f - 2.0f * tx);
+  ty = ty * ty * (3.0f - 2.0f * ty);
+  float a = hashLattice(ix, iy), b = hashLattice(ix + 1, iy);
+  float c = hashLattice(ix, iy + 1), d = hashLattice(ix + 1, iy + 1);
+  return (a + (b - a) * tx) + ((c + (d - c) * tx) - (a + (b - a) * tx)) * ty;
+}
+
+float fbm(float x, float y, uint32_t octaves) {
+  float sum = 0.0f, amplitude = 0.5f;
+  for (uint32_t i = 0; i < octaves; i++) {
+    sum += valueNoise(x, y) * amplitude;
+    x *= 2.03f;
+    y *= 2.03f;
+    amplitude *= 0.5f;
+  }
+  return sum;
+}
+
+float smoothRange(float edge0, float edge1, float x) {
+  float t = std::min(std::max((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+  return t * t * (3.0f - 2.0f * t);
+}
+
+// RGBA8 at texel (x, y) of a size x size texture: grass, dirt and rock by
+// low frequency noise, fine grain on top and a dark grid every 64 texels,
+// so the full resolution is easy to tell from a magnified coarser mip
+uint32_t bakeTexel(uint32_t x, uint32_t y, uint32_t size) {
+  float u = (float)x / size, v = (float)y / size;
+  float ground = fbm(u * 12.0f, v * 12.0f, 6);
+  float grain = fbm(x * 0.35f, y * 0.35f, 3);
+  float r = 0.30f, g = 0.45f, b = 0.18f;
+  float dirt = smoothRange(0.45f, 0.55f, ground);
+  r += (0.50f - r) * dirt;
+  g += (0.38f - g) * dirt;
+  b += (0.24f - b) * dirt;
+  float rock = smoothRange(0.62f, 0.70f, ground);
+  r += (0.58f - r) * rock;
+  g += (0.57f - g) * rock;
+  b += (0.54f - b) * rock;
+  float shade = 0.75f + 0.5f * grain;
+  if (x % 64 < 2 || y % 64 < 2) shade *= 0.45f;
+  uint32_t cr = (uint32_t)std::min(r * shade * 255.0f + 0.5f, 255.0f);
+  uint32_t cg = (uint32_t)std::min(g * shade * 255.0f + 0.5f, 255.0f);
+  uint32_t cb = (uint32_t)std::min(b * shade * 255.0f + 0.5f, 255.0f);
+  return cr | cg << 8 | cb << 16 | 0xffu << 24;
+}
+
+// adds the info and every page of a pages x pages virtual texture to
+// assets. mip 0 is baked texel by texel and every other mip is a box
+// filtered copy of the one above, all on the job workers; then each page is
+// cut out of its mip with its border.
+void bakeVirtualTexture(JobSystem& jobs, uint32_t pages,
+                        std::vector<Asset>& assets) {
+  const uint32_t content = kPageSize - 2 * kPageBorder;
+  uint32_t mipCount = 1;
+  while (pages >> mipCount) mipCount++;
+
+  std::vector<std::vector<uint32_t>> mips(mipCount);
+  uint32_t size = pages * content;
+  mips[0].resize((size_t)size * size);
+  JobCounter baked;
+  for (uint32_t row = 0; row < size; row += kBakeRows) {
+    jobs.run(&baked, [&mips, row, size] {
+      uint32_t end = std::min(row + kBakeRows, size);
+      for (uint32_t y = row; y < end; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+          mips[0][(size_t)y * size + x] = bakeTexel(x, y, size);
+        }
+      }
+    }, "bake texels");
+  }
+  jobs.wait(&baked);
+  for (uint32_t m = 1; m < mipCount; m++) {
+    uint32_t source = size >> (m - 1);
+    uint32_t target = size >> m;
+    mips[m].resize((size_t)target * target);
+    for (uint32_t row = 0; row < target; row += kBakeRows) {
+      jobs.run(&baked, [&mips, m, row, source, target] {
+        const uint32_t* above = mips[m - 1].data();
+        uint32_t end = std::min(row + kBakeRows, target);
+        for (uint32_t y = row; y < end; y++) {
+          for (uint32_t x = 0; x < target; x++) {
+            const uint32_t* quad = above + (size_t)y * 2 * source + x * 2;
+            uint32_t texels[4] = {quad[0], quad[1], quad[source],
+                                  quad[source + 1]};
+            uint32_t result = 0;
+            for (uint32_t shift = 0; shift < 32; shift += 8) {
+              uint32_t sum = 2;
+              for (uint32_t t : texels) sum += (t >> shift) & 0xff;
+              result |= (sum / 4) << shift;
+            }
+            mips[m][(size_t)y * target + x] = result;
+          }
+        }
+      }, "bake mip");
+    }
+    jobs.wait(&baked);
+  }
+
+  VirtualTextureInfo info = {};
+  info.magic = kVirtualTextureMagic;
+  info.version = kVirtualTextureVersion;
+  info.pageSize = kPageSize;
+  info.pageBorder = kPageBorder;
+  info.pagesX = pages;
+  info.pagesY = pages;
+  info.mipCount = mipCount;
+  Asset infoAsset;
+  infoAsset.name = kVirtualTextureInfoName;
+  infoAsset.data.resize(sizeof(info));
+  memcpy(infoAsset.data.data(), &info, sizeof(info));
+  infoAsset.baked = true;
+  assets.push_back(std::move(infoAsset));
+
+  size_t first = assets.size();
+  for (uint32_t m = 0; m < mipCount; m++) {
+    uint32_t count = pages >> m;
+    for (uint32_t y = 0; y < count; y++) {
+      for (uint32_t x = 0; x < count; x++) {
+        char name[64];
+        virtualTexturePageName(name, sizeof(name), m, x, y);
+        Asset asset;
+        asset.name = name;
+        asset.baked = true;
+        assets.push_back(std::move(asset));
+      }
+    }
+  }
+  size_t index = first;
+  for (uint32_t m = 0; m < mipCount; m++) {
+    uint32_t count = pages >> m;
+    int32_t last = (int32_t)(count * content) - 1;
+    for (uint32_t y = 0; y < count; y++) {
+      for (uint32_t x = 0; x < count; x++) {
+        Asset* asset = &assets[index++];
+        jobs.run(&baked, [&mips, asset, m, x, y, count, last] {
+          const uint32_t* mip = mips[m].data();
+          asset->data.resize(kPageSize * kPageSize * sizeof(uint32_t));
+          uint32_t* texels = (uint32_t*)asset->data.data();
+          for (uint32_t j = 0; j < kPageSize; j++) {
+            int32_t sy = (int32_t)(y * content + j) - (int32_t)kPageBorder;
+            sy = std::min(std::max(sy, 0), last);
+            for (uint32_t i = 0; i < kPageSize; i++) {
+              int32_t sx = (int32_t)(x * content + i) - (int32_t)kPageBorder;
+              sx = std::min(std::max(sx, 0), last);
+              texels[j * kPageSize + i] =
+                  mip[(size_t)sy * count * content + sx];
+            }
+          }
+        }, "bake page");
+      }
+    }
+  }
+  jobs.wait(&baked);
+  printf("virtual texture: %ux%u texels, %u mips, %zu pages of %ux%u\n",
+         size, size, mipCount, assets.size() - first, kPageSize, kPageSize);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    printf("usage: cook <archive> [--virtual-texture <pages>] "
+           "<file or directory>...\n");
+    return 1;
+  }
+  const char* archivePath = argv[1];
+
+  std::vector<Asset> assets;
+  uint32_t virtualTexturePages = 0;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--virtual-texture") == 0 && i + 1 < argc) {
+      // a power of two, and page coordinates have to fit the engine's
+      // 12 bit feedback
+      uint32_t pages = (uint32_t)strtoul(argv[++i], nullptr, 10);
+      virtualTexturePages = 1;
+      while (virtualTexturePages < std::min(pages, 4096u)) {
+        virtualTexturePages *= 2;
+      }
+      continue;
+    }
+    fs::path input(argv[i]);
+    std::vector<fs::path> paths;
+    if (fs::is_directory(input)) {
+      for (const auto& entry : fs::recursive_directory_iterator(input))
+        if (entry.is_regular_file()) paths.push_back(entry.path());
+    } else if (fs::is_regular_file(input)) {
+      paths.push_back(input);
+    } else {
+      printf("no such file or directory:%s\n", argv[i]);
+      return 1;
+    }
+    for (const fs::path& path : paths) {
+      // recooking into the directory being packed
+      std::error_code ec;
+      if (fs::equivalent(path, archivePath, ec)) continue;
+      Asset asset;
+      asset.name = path.lexically_normal().generic_string();
+      assets.push_back(std::move(asset));
+    }
+  }
+  JobSystem jobs;
+  jobs.start();
+  if (virtualTexturePages) {
+    bakeVirtualTexture(jobs, virtualTexturePages, assets);
+  }
+
+  // stable output for the same inputs
+  std::sort(assets.begin(), assets.end(),
+            [](const Asset& a, const Asset& b) { return a.name < b.name; });
+  assets.erase(std::unique(assets.begin(), assets.end(),
+                           [](const Asset& a, const Asset& b) {
+                             return a.name == b.name;
+                           }),
+               assets.end());
+
+  JobCounter compressed;
+  for (Asset& asset : assets) {
+    jobs.run(&compressed, [&asset] {
+      if (!asset.baked) asset.data = readFile(asset.name);
+      size_t size = asset.data.size();
+      asset.compressed.resize(lz4CompressBound(size));
+      size_t packed = lz4Compress(asset.data.data(), size,
+                                  asset.compressed.data(),
+                                  asset.compressed.size());
+      if (packed && packed <= size - size / 16) {
+        asset.compressed.resize(packed);
+      } else {
+        asset.compressed.clear();
+      }
+    }, "compress");
+  }
+  jobs.wait(&compressed);
+  jobs.stop();
+
+  // header, chunks, entries, hash table, names
+  uint32_t slotCount = 1;
+  while (slotCount < assets.size() * 2 + 1) slotCount *= 2;
+  std::vector<ArchiveEntry> entries(assets.size());
+  std::vector<uint32_t> table(slotCount, 0);
+  std::string names;
+  uint64_t offset = alignUp(sizeof(ArchiveHeader), kArchiveChunkAlignment);
+  for (size_t i = 0; i < assets.size(); i++) {
+    const Asset& asset = assets[i];
+    ArchiveEntry& entry = entries[i];
+    entry.nameHash = archiveNameHash(asset.name.data(), asset.name.size());
+    entry.offset = offset;
+    entry.size = asset.data.size();
+    entry.storedSize =
+        asset.compressed.empty() ? entry.size : asset.compressed.size();
+    entry.flags =
+        asset.compressed.empty() ? 0u : (uint32_t)ARCHIVE_ENTRY_LZ4;
+    entry.nameOffset = (uint32_t)names.size();
+    entry.nameLength = (uint32_t)asset.name.size();
+    names += asset.name;
+    names += '\0';
+    offset = alignUp(offset + entry.storedSize, kArchiveChunkAlignment);
+
+    uint32_t slot = (uint32_t)entry.nameHash & (slotCount - 1);
+    while (table[slot]) slot = (slot + 1) & (slotCount - 1);
+    table[slot] = (uint32_t)i + 1;
+  }
+
+  ArchiveHeader header = {};
+  header.magic = kArchiveMagic;
+  header.version = kArchiveVersion;
+  header.entryCount = (uint32_t)entries.size();
+  header.tableSlotCount = slotCount;
+  header.entriesOffset = offset;
+  header.tableOffset =
+      header.entriesOffset + entries.size() * sizeof(ArchiveEntry);
+  header.namesOffset = header.tableOffset + table.size() * sizeof(uint32_t);
+  header.namesSize = names.size();
+
+  FILE* file = fopen(archivePath, "wb");
+  if (!file) {
+    printf("failed to open file:%s \n", archivePath);
+    return 1;
+  }
+  bool written = writeAt(file, 0, &header, sizeof(header));
+  for (size_t i = 0; i < assets.size(); i++) {
+    const Asset& asset = assets[i];
+    if (asset.compressed.empty()) {
+      written = written && writeAt(file, entries[i].offset, asset.data.data(),
+                                   asset.data.size());
+    } else {
+      written = written && writeAt(file, entries[i].offset,
+                                   asset.compressed.data(),
+                                   asset.compressed.size());
+    }
+  }
+  written = written && writeAt(file, header.entriesOffset, entries.data(),
+                               entries.size() * sizeof(ArchiveEntry));
+  written = written && writeAt(file, header.tableOffset, table.data(),
+                               table.size() * sizeof(uint32_t));
+  written = written &&
+            writeAt(file, header.namesOffset, names.data(), names.size());
+  written = ferror(file) == 0 && written;
+  written = fclose(file) == 0 && written;
+  if (!written) {
+    printf("failed to write %s\n", archivePath);
+    return 1;
+  }
+
+  // read everything back through the engine's path
+  AssetArchive archive;
+  if (!archive.open(archivePath)) return 1;
+  uint64_t stored = 0;
+  uint64_t unpacked = 0;
+  uint32_t compressedCount = 0;
+  for (const Asset& asset : assets) {
+    uint32_t id = archive.find(asset.name.c_str());
+    bool found = id != AssetArchive::kInvalidAsset;
+    std::vector<char> data(found ? archive.size(id) : 0);
+    if (!found || data.size() != asset.data.size() ||
+        !archive.read(id, data.data()) || data != asset.data) {
+      printf("%s doesn't read back from %s\n", asset.name.c_str(), archivePath);
+      return 1;
+    }
+    stored += asset.compressed.empty() ? asset.data.size()
+                                       : asset.compressed.size();
+    unpacked += asset.data.size();
+    if (!asset.compressed.empty()) compressedCount++;
+  }
+  printf("%s: %zu assets (%u compressed), %.2fMB -> %.2fMB\n", archivePath,
+         assets.size(), compressedCount, unpacked / (1024.0 * 1024.0),
+         stored / (1024.0 * 1024.0));
+  return 0;
+}
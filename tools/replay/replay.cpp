@@ -0,0 +1,1042 @@
+#include "capture_format.h"
+#include "file_io.h"
+#include "pipeline_cache.h"
+#include "profiler.h"
+#include "vk_dispatch.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+// Replays a --capture file without the engine or a window. Objects are
+// recreated on whatever device this machine has, then every captured frame
+// is re-recorded from the command stream, submitted on its own and timed, so
+// the GPU cost of the same frames can be compared across drivers, devices
+// and engine builds.
+//
+//   replay <capture> [--repeat <n>] [--csv <file>]
+//
+// Swapchain images become offscreen images and PRESENT_SRC layouts become
+// GENERAL. Every object gets its own memory, so transient attachment
+// aliasing isn't reproduced. A capture that spans a swapchain resize replays
+// once, but its repeats run against the objects of the last size.
+
+namespace {
+
+struct RecordRef {
+  uint16_t type;
+  uint32_t size;
+  const uint8_t* data;
+};
+
+// a FRAME_BEGIN record, the records inside and the FRAME_END
+struct FrameRange {
+  uint64_t frame;
+  size_t begin;
+  size_t end;
+};
+
+class Reader {
+ public:
+  explicit Reader(const RecordRef& record)
+      : p(record.data), end(record.data + record.size) {}
+
+  template <class T>
+  T get() {
+    T value;
+    read(&value, sizeof(T));
+    return value;
+  }
+  template <class T>
+  std::vector<T> getArray(uint32_t count) {
+    std::vector<T> values(count);
+    read(values.data(), count * sizeof(T));
+    return values;
+  }
+  const uint8_t* bytes(size_t size) {
+    assert(p + size <= end);
+    const uint8_t* data = p;
+    p += size;
+    return data;
+  }
+
+ private:
+  void read(void* dst, size_t size) {
+    if (size == 0) return;
+    assert(p + size <= end);
+    memcpy(dst, p, size);
+    p += size;
+  }
+
+  const uint8_t* p;
+  const uint8_t* end;
+};
+
+struct BufferObject {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  uint8_t* mapped = nullptr;
+};
+
+VkInstance instance;
+VkPhysicalDevice physicalDevice;
+VkPhysicalDeviceMemoryProperties memoryProperties;
+VkDevice device;
+uint32_t queueFamily;
+VkQueue queue;
+VkCommandPool commandPool;
+VkCommandBuffer cmd;
+VkFence fence;
+VkQueryPool queryPool = VK_NULL_HANDLE;
+double timestampPeriod = 0.0;
+VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+
+// capture ids to replay objects. replaced objects stay alive until exit,
+// nothing else may reference them by then
+std::unordered_map<uint64_t, VkShaderModule> shaders;
+std::unordered_map<uint64_t, VkDescriptorSetLayout> setLayouts;
+std::unordered_map<uint64_t, VkPipelineLayout> pipelineLayouts;
+std::unordered_map<uint64_t, VkRenderPass> renderPasses;
+std::unordered_map<uint64_t, VkPipeline> pipelines;
+std::unordered_map<uint64_t, BufferObject> buffers;
+std::unordered_map<uint64_t, VkImage> images;
+std::unordered_map<uint64_t, VkImageView> imageViews;
+std::unordered_map<uint64_t, VkSampler> samplers;
+std::unordered_map<uint64_t, VkFramebuffer> framebuffers;
+std::unordered_map<uint64_t, VkDescriptorSet> descriptorSets;
+std::vector<std::function<void()>> cleanup;
+
+template <class Handle>
+Handle lookup(const std::unordered_map<uint64_t, Handle>& objects,
+              uint64_t id) {
+  if (id == 0) return Handle();
+  auto it = objects.find(id);
+  if (it == objects.end()) {
+    printf("capture references an object it never created: %llx\n",
+           (unsigned long long)id);
+    exit(1);
+  }
+  return it->second;
+}
+
+VkBuffer lookupBuffer(uint64_t id) {
+  if (id == 0) return VK_NULL_HANDLE;
+  return lookup(buffers, id).buffer;
+}
+
+VkImageLayout replayLayout(uint32_t layout) {
+  return layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR ? VK_IMAGE_LAYOUT_GENERAL
+                                                   : (VkImageLayout)layout;
+}
+
+uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags flags) {
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+    if ((typeBits & (1u << i)) &&
+        (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags) {
+      return i;
+    }
+  }
+  // device local is a preference, any type the object allows will run
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+    if (typeBits & (1u << i)) return i;
+  }
+  assert(false);
+  return 0;
+}
+
+VkDeviceMemory allocate(const VkMemoryRequirements& memReq,
+                        VkMemoryPropertyFlags flags) {
+  VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+  allocInfo.allocationSize = memReq.size;
+  allocInfo.memoryTypeIndex = findMemoryType(memReq.memoryTypeBits, flags);
+  VkDeviceMemory memory;
+  VK_CHECK(vkAllocateMemory(device, &allocInfo, nullptr, &memory));
+  cleanup.push_back([memory] { vkFreeMemory(device, memory, nullptr); });
+  return memory;
+}
+
+bool createDevice() {
+  VkApplicationInfo appInfo = {VK_STRUCTURE_TYPE_APPLICATION_INFO};
+  appInfo.pApplicationName = "replay";
+  appInfo.apiVersion = VK_API_VERSION_1_1;
+  VkInstanceCreateInfo instanceInfo = {VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO};
+  instanceInfo.pApplicationInfo = &appInfo;
+  if (vkCreateInstance(&instanceInfo, nullptr, &instance) != VK_SUCCESS) {
+    printf("failed to create a vulkan instance\n");
+    return false;
+  }
+  // the shared code (pipeline_cache) calls through the tables
+  loadInstanceDispatch(vki, instance);
+
+  uint32_t count = 0;
+  VK_CHECK(vkEnumeratePhysicalDevices(instance, &count, nullptr));
+  std::vector<VkPhysicalDevice> devices(count);
+  VK_CHECK(vkEnumeratePhysicalDevices(instance, &count, devices.data()));
+  const VkQueueFlags needed = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+  uint32_t timestampBits = 0;
+  physicalDevice = VK_NULL_HANDLE;
+  for (VkPhysicalDevice candidate : devices) {
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(candidate, &familyCount,
+                                             nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(candidate, &familyCount,
+                                             families.data());
+    for (uint32_t i = 0; i < familyCount; i++) {
+      if ((families[i].queueFlags & needed) == needed) {
+        physicalDevice = candidate;
+        queueFamily = i;
+        timestampBits = families[i].timestampValidBits;
+        break;
+      }
+    }
+    if (physicalDevice) break;
+  }
+  if (!physicalDevice) {
+    printf("no device with a graphics and compute queue\n");
+    return false;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  printf("replay device: %s\n", properties.deviceName);
+
+  // same as the engine: no optional features, robust buffer access would
+  // skew the timings
+  VkPhysicalDeviceFeatures features = {};
+  const float priority = 1.0f;
+  VkDeviceQueueCreateInfo queueInfo = {
+      VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
+  queueInfo.queueFamilyIndex = queueFamily;
+  queueInfo.queueCount = 1;
+  queueInfo.pQueuePriorities = &priority;
+  VkDeviceCreateInfo deviceInfo = {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
+  deviceInfo.queueCreateInfoCount = 1;
+  deviceInfo.pQueueCreateInfos = &queueInfo;
+  deviceInfo.pEnabledFeatures = &features;
+  VK_CHECK(vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device));
+  loadDeviceDispatch(vkd, vki, device);
+  vkGetDeviceQueue(device, queueFamily, 0, &queue);
+
+  VkCommandPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = queueFamily;
+  VK_CHECK(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool));
+  VkCommandBufferAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = 1;
+  VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &cmd));
+  VkFenceCreateInfo fenceInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+  VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &fence));
+
+  if (timestampBits) {
+    VkQueryPoolCreateInfo queryInfo = {
+        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryInfo.queryCount = 2;
+    VK_CHECK(vkCreateQueryPool(device, &queryInfo, nullptr, &queryPool));
+    timestampPeriod = properties.limits.timestampPeriod;
+  } else {
+    printf("queue has no timestamps, only cpu times are reported\n");
+  }
+  return true;
+}
+
+void destroyDevice() {
+  for (auto it = cleanup.rbegin(); it != cleanup.rend(); ++it) (*it)();
+  if (descriptorPool) vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  if (queryPool) vkDestroyQueryPool(device, queryPool, nullptr);
+  vkDestroyFence(device, fence, nullptr);
+  vkDestroyCommandPool(device, commandPool, nullptr);
+  vkDestroyDevice(device, nullptr);
+  vkDestroyInstance(instance, nullptr);
+}
+
+void beginCommands() {
+  VK_CHECK(vkResetCommandBuffer(cmd, 0));
+  VkCommandBufferBeginInfo beginInfo = {
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+}
+
+void submitAndWait() {
+  VK_CHECK(vkEndCommandBuffer(cmd));
+  VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &cmd;
+  VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fence));
+  VK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+  VK_CHECK(vkResetFences(device, 1, &fence));
+}
+
+// pool sized for every set the capture allocates, none are ever freed
+void createDescriptorPool(const std::vector<RecordRef>& records) {
+  std::unordered_map<uint64_t, std::vector<CaptureLayoutBinding>> layouts;
+  std::unordered_map<uint32_t, uint32_t> typeCounts;
+  uint32_t setCount = 0;
+  for (const RecordRef& record : records) {
+    Reader reader(record);
+    if (record.type == CAPTURE_SET_LAYOUT) {
+      CaptureSetLayout layout = reader.get<CaptureSetLayout>();
+      layouts[layout.id] =
+          reader.getArray<CaptureLayoutBinding>(layout.bindingCount);
+    } else if (record.type == CAPTURE_DESCRIPTOR_SET) {
+      CaptureDescriptorSet set = reader.get<CaptureDescriptorSet>();
+      for (const CaptureLayoutBinding& binding : layouts[set.layout]) {
+        typeCounts[binding.descriptorType] += binding.descriptorCount;
+      }
+      setCount++;
+    }
+  }
+  if (setCount == 0) return;
+
+  std::vector<VkDescriptorPoolSize> poolSizes;
+  for (const auto& typeCount : typeCounts) {
+    poolSizes.push_back({(VkDescriptorType)typeCount.first, typeCount.second});
+  }
+  VkDescriptorPoolCreateInfo poolInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  poolInfo.maxSets = setCount;
+  poolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+  poolInfo.pPoolSizes = poolSizes.data();
+  VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool));
+}
+
+void upload(Reader& reader) {
+  CaptureUpload upload = reader.get<CaptureUpload>();
+  const uint8_t* data = reader.bytes((size_t)upload.size);
+  BufferObject& object = buffers[upload.buffer];
+  assert(object.buffer);
+  if (object.mapped) {
+    memcpy(object.mapped + upload.offset, data, (size_t)upload.size);
+    return;
+  }
+
+  VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  bufferInfo.size = upload.size;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VkBuffer staging;
+  VK_CHECK(vkCreateBuffer(device, &bufferInfo, nullptr, &staging));
+  VkMemoryRequirements memReq;
+  vkGetBufferMemoryRequirements(device, staging, &memReq);
+  VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+  allocInfo.allocationSize = memReq.size;
+  allocInfo.memoryTypeIndex = findMemoryType(
+      memReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  VkDeviceMemory memory;
+  VK_CHECK(vkAllocateMemory(device, &allocInfo, nullptr, &memory));
+  VK_CHECK(vkBindBufferMemory(device, staging, memory, 0));
+  void* mapped;
+  VK_CHECK(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+  memcpy(mapped, data, (size_t)upload.size);
+  vkUnmapMemory(device, memory);
+
+  beginCommands();
+  VkBufferCopy region = {0, upload.offset, upload.size};
+  vkCmdCopyBuffer(cmd, staging, object.buffer, 1, &region);
+  submitAndWait();
+  vkDestroyBuffer(device, staging, nullptr);
+  vkFreeMemory(device, memory, nullptr);
+}
+
+void createShader(Reader& reader) {
+  CaptureShader shader = reader.get<CaptureShader>();
+  VkShaderModuleCreateInfo createInfo = {
+      VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+  createInfo.codeSize = shader.codeSize;
+  // bytes() isn't aligned for uint32_t, copy the code out first
+  std::vector<uint32_t> code((shader.codeSize + 3) / 4);
+  memcpy(code.data(), reader.bytes(shader.codeSize), shader.codeSize);
+  createInfo.pCode = code.data();
+  VkShaderModule module;
+  VK_CHECK(vkCreateShaderModule(device, &createInfo, nullptr, &module));
+  cleanup.push_back(
+      [module] { vkDestroyShaderModule(device, module, nullptr); });
+  shaders[shader.id] = module;
+}
+
+void createSetLayout(Reader& reader) {
+  CaptureSetLayout layout = reader.get<CaptureSetLayout>();
+  std::vector<CaptureLayoutBinding> captured =
+      reader.getArray<CaptureLayoutBinding>(layout.bindingCount);
+  std::vector<VkDescriptorSetLayoutBinding> bindings(layout.bindingCount);
+  for (uint32_t i = 0; i < layout.bindingCount; i++) {
+    bindings[i] = {};
+    bindings[i].binding = captured[i].binding;
+    bindings[i].descriptorType = (VkDescriptorType)captured[i].descriptorType;
+    bindings[i].descriptorCount = captured[i].descriptorCount;
+    bindings[i].stageFlags = captured[i].stageFlags;
+  }
+  VkDescriptorSetLayoutCreateInfo createInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+  createInfo.bindingCount = layout.bindingCount;
+  createInfo.pBindings = bindings.data();
+  VkDescriptorSetLayout setLayout;
+  VK_CHECK(
+      vkCreateDescriptorSetLayout(device, &createInfo, nullptr, &setLayout));
+  cleanup.push_back([setLayout] {
+    vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+  });
+  setLayouts[layout.id] = setLayout;
+}
+
+void createPipelineLayout(Reader& reader) {
+  CapturePipelineLayout layout = reader.get<CapturePipelineLayout>();
+  std::vector<uint64_t> ids = reader.getArray<uint64_t>(layout.setLayoutCount);
+  std::vector<VkPushConstantRange> pushRanges =
+      reader.getArray<VkPushConstantRange>(layout.pushRangeCount);
+  std::vector<VkDescriptorSetLayout> sets;
+  for (uint64_t id : ids) sets.push_back(lookup(setLayouts, id));
+  VkPipelineLayoutCreateInfo createInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  createInfo.setLayoutCount = layout.setLayoutCount;
+  createInfo.pSetLayouts = sets.data();
+  createInfo.pushConstantRangeCount = layout.pushRangeCount;
+  createInfo.pPushConstantRanges = pushRanges.data();
+  VkPipelineLayout pipelineLayout;
+  VK_CHECK(
+      vkCreatePipelineLayout(device, &createInfo, nullptr, &pipelineLayout));
+  cleanup.push_back([pipelineLayout] {
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+  });
+  pipelineLayouts[layout.id] = pipelineLayout;
+}
+
+void createRenderPass(Reader& reader) {
+  CaptureRenderPass pass = reader.get<CaptureRenderPass>();
+  std::vector<VkAttachmentDescription> attachments =
+      reader.getArray<VkAttachmentDescription>(pass.attachmentCount);
+  std::vector<VkAttachmentReference> colors =
+      reader.getArray<VkAttachmentReference>(pass.colorCount);
+  std::vector<VkSubpassDependency> dependencies =
+      reader.getArray<VkSubpassDependency>(pass.dependencyCount);
+  for (VkAttachmentDescription& attachment : attachments) {
+    attachment.initialLayout = replayLayout(attachment.initialLayout);
+    attachment.finalLayout = replayLayout(attachment.finalLayout);
+  }
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = pass.colorCount;
+  subpass.pColorAttachments = colors.data();
+  subpass.pDepthStencilAttachment = pass.hasDepth ? &pass.depth : nullptr;
+  VkRenderPassCreateInfo createInfo = {
+      VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+  createInfo.attachmentCount = pass.attachmentCount;
+  createInfo.pAttachments = attachments.data();
+  createInfo.subpassCount = 1;
+  createInfo.pSubpasses = &subpass;
+  createInfo.dependencyCount = pass.dependencyCount;
+  createInfo.pDependencies = dependencies.data();
+  VkRenderPass renderPass;
+  VK_CHECK(vkCreateRenderPass(device, &createInfo, nullptr, &renderPass));
+  cleanup.push_back(
+      [renderPass] { vkDestroyRenderPass(device, renderPass, nullptr); });
+  renderPasses[pass.id] = renderPass;
+}
+
+void createComputePipeline(Reader& reader) {
+  CaptureComputePipeline compute = reader.get<CaptureComputePipeline>();
+  VkPipeline pipeline = compileComputePipeline(
+      device, VK_NULL_HANDLE, lookup(shaders, compute.shader),
+      lookup(pipelineLayouts, compute.layout));
+  assert(pipeline);
+  cleanup.push_back(
+      [pipeline] { vkDestroyPipeline(device, pipeline, nullptr); });
+  pipelines[compute.id] = pipeline;
+}
+
+void createGraphicsPipeline(Reader& reader) {
+  CaptureGraphicsPipeline g = reader.get<CaptureGraphicsPipeline>();
+  GraphicsPipelineDesc desc;
+  desc.vertexShader.module = lookup(shaders, g.vertexShader);
+  desc.fragmentShader.module = lookup(shaders, g.fragmentShader);
+  desc.bindingCount = g.bindingCount;
+  memcpy(desc.bindings, g.bindings, sizeof(desc.bindings));
+  desc.attributeCount = g.attributeCount;
+  memcpy(desc.attributes, g.attributes, sizeof(desc.attributes));
+  desc.topology = (VkPrimitiveTopology)g.topology;
+  desc.polygonMode = (VkPolygonMode)g.polygonMode;
+  desc.cullMode = g.cullMode;
+  desc.frontFace = (VkFrontFace)g.frontFace;
+  desc.depthBiasEnable = g.depthBiasEnable;
+  desc.depthTestEnable = g.depthTestEnable;
+  desc.depthWriteEnable = g.depthWriteEnable;
+  desc.depthCompareOp = (VkCompareOp)g.depthCompareOp;
+  desc.blendEnable = g.blendEnable;
+  desc.srcColorBlendFactor = (VkBlendFactor)g.srcColorBlendFactor;
+  desc.dstColorBlendFactor = (VkBlendFactor)g.dstColorBlendFactor;
+  desc.colorBlendOp = (VkBlendOp)g.colorBlendOp;
+  desc.srcAlphaBlendFactor = (VkBlendFactor)g.srcAlphaBlendFactor;
+  desc.dstAlphaBlendFactor = (VkBlendFactor)g.dstAlphaBlendFactor;
+  desc.alphaBlendOp = (VkBlendOp)g.alphaBlendOp;
+  desc.colorAttachmentCount = g.colorAttachmentCount;
+  desc.samples = (VkSampleCountFlagBits)g.samples;
+  desc.layout = lookup(pipelineLayouts, g.layout);
+  desc.renderPass = lookup(renderPasses, g.renderPass);
+  desc.subpass = g.subpass;
+  VkPipeline pipeline = compileGraphicsPipeline(device, VK_NULL_HANDLE, desc);
+  assert(pipeline);
+  cleanup.push_back(
+      [pipeline] { vkDestroyPipeline(device, pipeline, nullptr); });
+  pipelines[g.id] = pipeline;
+}
+
+void createBuffer(Reader& reader) {
+  CaptureBuffer b = reader.get<CaptureBuffer>();
+  VkBufferCreateInfo createInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  createInfo.size = b.size;
+  // device local buffers are filled through a staging copy
+  createInfo.usage = b.usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  BufferObject object;
+  VK_CHECK(vkCreateBuffer(device, &createInfo, nullptr, &object.buffer));
+  VkBuffer buffer = object.buffer;
+  cleanup.push_back([buffer] { vkDestroyBuffer(device, buffer, nullptr); });
+
+  const bool hostVisible = b.memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+  VkMemoryRequirements memReq;
+  vkGetBufferMemoryRequirements(device, buffer, &memReq);
+  VkDeviceMemory memory = allocate(
+      memReq, hostVisible ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                          : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  VK_CHECK(vkBindBufferMemory(device, buffer, memory, 0));
+  if (hostVisible) {
+    VK_CHECK(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0,
+                         (void**)&object.mapped));
+  }
+  buffers[b.id] = object;
+}
+
+void createImage(Reader& reader) {
+  CaptureImage i = reader.get<CaptureImage>();
+  VkImageCreateInfo createInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+  createInfo.flags = i.flags;
+  createInfo.imageType = (VkImageType)i.imageType;
+  createInfo.format = (VkFormat)i.format;
+  createInfo.extent = {i.width, i.height, i.depth};
+  createInfo.mipLevels = i.mipLevels;
+  createInfo.arrayLayers = i.arrayLayers;
+  createInfo.samples = (VkSampleCountFlagBits)i.samples;
+  createInfo.tiling = (VkImageTiling)i.tiling;
+  createInfo.usage = i.usage;
+  createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkImage image;
+  VK_CHECK(vkCreateImage(device, &createInfo, nullptr, &image));
+  cleanup.push_back([image] { vkDestroyImage(device, image, nullptr); });
+  VkMemoryRequirements memReq;
+  vkGetImageMemoryRequirements(device, image, &memReq);
+  VK_CHECK(vkBindImageMemory(
+      device, image, allocate(memReq, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+      0));
+  images[i.id] = image;
+}
+
+void createImageView(Reader& reader) {
+  CaptureImageView v = reader.get<CaptureImageView>();
+  VkImageViewCreateInfo createInfo = {
+      VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+  createInfo.image = lookup(images, v.image);
+  createInfo.viewType = (VkImageViewType)v.viewType;
+  createInfo.format = (VkFormat)v.format;
+  createInfo.components = v.components;
+  createInfo.subresourceRange = v.range;
+  VkImageView view;
+  VK_CHECK(vkCreateImageView(device, &createInfo, nullptr, &view));
+  cleanup.push_back([view] { vkDestroyImageView(device, view, nullptr); });
+  imageViews[v.id] = view;
+}
+
+void createSampler(Reader& reader) {
+  CaptureSampler s = reader.get<CaptureSampler>();
+  VkSamplerCreateInfo createInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+  createInfo.magFilter = (VkFilter)s.magFilter;
+  createInfo.minFilter = (VkFilter)s.minFilter;
+  createInfo.mipmapMode = (VkSamplerMipmapMode)s.mipmapMode;
+  createInfo.addressModeU = (VkSamplerAddressMode)s.addressModeU;
+  createInfo.addressModeV = (VkSamplerAddressMode)s.addressModeV;
+  createInfo.addressModeW = (VkSamplerAddressMode)s.addressModeW;
+  createInfo.mipLodBias = s.mipLodBias;
+  createInfo.anisotropyEnable = s.anisotropyEnable;
+  createInfo.maxAnisotropy = s.maxAnisotropy;
+  createInfo.compareEnable = s.compareEnable;
+  createInfo.compareOp = (VkCompareOp)s.compareOp;
+  createInfo.minLod = s.minLod;
+  createInfo.maxLod = s.maxLod;
+  createInfo.borderColor = (VkBorderColor)s.borderColor;
+  VkSampler sampler;
+  VK_CHECK(vkCreateSampler(device, &createInfo, nullptr, &sampler));
+  cleanup.push_back([sampler] { vkDestroySampler(device, sampler, nullptr); });
+  samplers[s.id] = sampler;
+}
+
+void createFramebuffer(Reader& reader) {
+  CaptureFramebuffer f = reader.get<CaptureFramebuffer>();
+  std::vector<uint64_t> ids = reader.getArray<uint64_t>(f.attachmentCount);
+  std::vector<VkImageView> attachments;
+  for (uint64_t id : ids) attachments.push_back(lookup(imageViews, id));
+  VkFramebufferCreateInfo createInfo = {
+      VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+  createInfo.renderPass = lookup(renderPasses, f.renderPass);
+  createInfo.attachmentCount = f.attachmentCount;
+  createInfo.pAttachments = attachments.data();
+  createInfo.width = f.width;
+  createInfo.height = f.height;
+  createInfo.layers = f.layers;
+  VkFramebuffer framebuffer;
+  VK_CHECK(vkCreateFramebuffer(device, &createInfo, nullptr, &framebuffer));
+  cleanup.push_back(
+      [framebuffer] { vkDestroyFramebuffer(device, framebuffer, nullptr); });
+  framebuffers[f.id] = framebuffer;
+}
+
+void allocateDescriptorSet(Reader& reader) {
+  CaptureDescriptorSet s = reader.get<CaptureDescriptorSet>();
+  VkDescriptorSetLayout layout = lookup(setLayouts, s.layout);
+  VkDescriptorSetAllocateInfo allocInfo = {
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &layout;
+  VkDescriptorSet set;
+  VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, &set));
+  descriptorSets[s.id] = set;
+}
+
+void writeDescriptors(Reader& reader) {
+  CaptureDescriptorWrite w = reader.get<CaptureDescriptorWrite>();
+  std::vector<CaptureDescriptorInfo> infos =
+      reader.getArray<CaptureDescriptorInfo>(w.descriptorCount);
+  std::vector<VkDescriptorBufferInfo> bufferInfos(w.descriptorCount);
+  std::vector<VkDescriptorImageInfo> imageInfos(w.descriptorCount);
+  for (uint32_t i = 0; i < w.descriptorCount; i++) {
+    bufferInfos[i] = {lookupBuffer(infos[i].buffer), infos[i].offset,
+                      infos[i].range};
+    imageInfos[i] = {lookup(samplers, infos[i].sampler),
+                     lookup(imageViews, infos[i].imageView),
+                     replayLayout(infos[i].imageLayout)};
+  }
+  VkWriteDescriptorSet write = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+  write.dstSet = lookup(descriptorSets, w.set);
+  write.dstBinding = w.binding;
+  write.dstArrayElement = w.arrayElement;
+  write.descriptorCount = w.descriptorCount;
+  write.descriptorType = (VkDescriptorType)w.descriptorType;
+  switch (write.descriptorType) {
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+      write.pBufferInfo = bufferInfos.data();
+      break;
+    default:
+      write.pImageInfo = imageInfos.data();
+      break;
+  }
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+// object and upload records; false for anything else
+bool applyObjectRecord(const RecordRef& record) {
+  Reader reader(record);
+  switch (record.type) {
+    case CAPTURE_SHADER: createShader(reader); break;
+    case CAPTURE_SET_LAYOUT: createSetLayout(reader); break;
+    case CAPTURE_PIPELINE_LAYOUT: createPipelineLayout(reader); break;
+    case CAPTURE_RENDER_PASS: createRenderPass(reader); break;
+    case CAPTURE_COMPUTE_PIPELINE: createComputePipeline(reader); break;
+    case CAPTURE_GRAPHICS_PIPELINE: createGraphicsPipeline(reader); break;
+    case CAPTURE_BUFFER: createBuffer(reader); break;
+    case CAPTURE_IMAGE: createImage(reader); break;
+    case CAPTURE_IMAGE_VIEW: createImageView(reader); break;
+    case CAPTURE_SAMPLER: createSampler(reader); break;
+    case CAPTURE_FRAMEBUFFER: createFramebuffer(reader); break;
+    case CAPTURE_DESCRIPTOR_SET: allocateDescriptorSet(reader); break;
+    case CAPTURE_DESCRIPTOR_WRITE: writeDescriptors(reader); break;
+    case CAPTURE_UPLOAD: upload(reader); break;
+    default: return false;
+  }
+  return true;
+}
+
+void pipelineBarrier(Reader& reader) {
+  CaptureCmdPipelineBarrier b = reader.get<CaptureCmdPipelineBarrier>();
+  std::vector<VkMemoryBarrier> memoryBarriers(b.memoryCount);
+  for (VkMemoryBarrier& barrier : memoryBarriers) {
+    CaptureMemoryBarrier m = reader.get<CaptureMemoryBarrier>();
+    barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = m.srcAccessMask;
+    barrier.dstAccessMask = m.dstAccessMask;
+  }
+  std::vector<VkBufferMemoryBarrier> bufferBarriers(b.bufferCount);
+  for (VkBufferMemoryBarrier& barrier : bufferBarriers) {
+    CaptureBufferBarrier c = reader.get<CaptureBufferBarrier>();
+    barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    barrier.srcAccessMask = c.srcAccessMask;
+    barrier.dstAccessMask = c.dstAccessMask;
+    barrier.srcQueueFamilyIndex = c.srcQueueFamilyIndex;
+    barrier.dstQueueFamilyIndex = c.dstQueueFamilyIndex;
+    barrier.buffer = lookupBuffer(c.buffer);
+    barrier.offset = c.offset;
+    barrier.size = c.size;
+  }
+  std::vector<VkImageMemoryBarrier> imageBarriers(b.imageCount);
+  for (VkImageMemoryBarrier& barrier : imageBarriers) {
+    CaptureImageBarrier c = reader.get<CaptureImageBarrier>();
+    barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    barrier.srcAccessMask = c.srcAccessMask;
+    barrier.dstAccessMask = c.dstAccessMask;
+    barrier.oldLayout = replayLayout(c.oldLayout);
+    barrier.newLayout = replayLayout(c.newLayout);
+    barrier.srcQueueFamilyIndex = c.srcQueueFamilyIndex;
+    barrier.dstQueueFamilyIndex = c.dstQueueFamilyIndex;
+    barrier.image = lookup(images, c.image);
+    barrier.subresourceRange = c.range;
+  }
+  vkCmdPipelineBarrier(cmd, b.srcStageMask, b.dstStageMask, b.dependencyFlags,
+                       b.memoryCount, memoryBarriers.data(), b.bufferCount,
+                       bufferBarriers.data(), b.imageCount,
+                       imageBarriers.data());
+}
+
+void recordCommand(const RecordRef& record) {
+  Reader reader(record);
+  switch (record.type) {
+    case CAPTURE_CMD_BIND_PIPELINE: {
+      CaptureCmdBindPipeline b = reader.get<CaptureCmdBindPipeline>();
+      vkCmdBindPipeline(cmd, (VkPipelineBindPoint)b.bindPoint,
+                        lookup(pipelines, b.pipeline));
+      break;
+    }
+    case CAPTURE_CMD_BIND_DESCRIPTOR_SETS: {
+      CaptureCmdBindDescriptorSets b =
+          reader.get<CaptureCmdBindDescriptorSets>();
+      std::vector<uint64_t> ids = reader.getArray<uint64_t>(b.setCount);
+      std::vector<uint32_t> offsets =
+          reader.getArray<uint32_t>(b.dynamicOffsetCount);
+      std::vector<VkDescriptorSet> sets;
+      for (uint64_t id : ids) sets.push_back(lookup(descriptorSets, id));
+      vkCmdBindDescriptorSets(cmd, (VkPipelineBindPoint)b.bindPoint,
+                              lookup(pipelineLayouts, b.layout), b.firstSet,
+                              b.setCount, sets.data(), b.dynamicOffsetCount,
+                              offsets.data());
+      break;
+    }
+    case CAPTURE_CMD_PUSH_CONSTANTS: {
+      CaptureCmdPushConstants p = reader.get<CaptureCmdPushConstants>();
+      vkCmdPushConstants(cmd, lookup(pipelineLayouts, p.layout), p.stageFlags,
+                         p.offset, p.size, reader.bytes(p.size));
+      break;
+    }
+    case CAPTURE_CMD_BIND_VERTEX_BUFFERS: {
+      CaptureCmdBindVertexBuffers b =
+          reader.get<CaptureCmdBindVertexBuffers>();
+      std::vector<uint64_t> ids = reader.getArray<uint64_t>(b.bindingCount);
+      std::vector<VkDeviceSize> offsets =
+          reader.getArray<VkDeviceSize>(b.bindingCount);
+      std::vector<VkBuffer> vertexBuffers;
+      for (uint64_t id : ids) vertexBuffers.push_back(lookupBuffer(id));
+      vkCmdBindVertexBuffers(cmd, b.firstBinding, b.bindingCount,
+                             vertexBuffers.data(), offsets.data());
+      break;
+    }
+    case CAPTURE_CMD_BIND_INDEX_BUFFER: {
+      CaptureCmdBindIndexBuffer b = reader.get<CaptureCmdBindIndexBuffer>();
+      vkCmdBindIndexBuffer(cmd, lookupBuffer(b.buffer), b.offset,
+                           (VkIndexType)b.indexType);
+      break;
+    }
+    case CAPTURE_CMD_SET_VIEWPORT: {
+      VkViewport viewport = reader.get<VkViewport>();
+      vkCmdSetViewport(cmd, 0, 1, &viewport);
+      break;
+    }
+    case CAPTURE_CMD_SET_SCISSOR: {
+      VkRect2D scissor = reader.get<VkRect2D>();
+      vkCmdSetScissor(cmd, 0, 1, &scissor);
+      break;
+    }
+    case CAPTURE_CMD_BEGIN_RENDER_PASS: {
+      CaptureCmdBeginRenderPass b = reader.get<CaptureCmdBeginRenderPass>();
+      std::vector<VkClearValue> clearValues =
+          reader.getArray<VkClearValue>(b.clearValueCount);
+      VkRenderPassBeginInfo beginInfo = {
+          VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+      beginInfo.renderPass = lookup(renderPasses, b.renderPass);
+      beginInfo.framebuffer = lookup(framebuffers, b.framebuffer);
+      beginInfo.renderArea = b.renderArea;
+      beginInfo.clearValueCount = b.clearValueCount;
+      beginInfo.pClearValues = clearValues.data();
+      vkCmdBeginRenderPass(cmd, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+      break;
+    }
+    case CAPTURE_CMD_END_RENDER_PASS:
+      vkCmdEndRenderPass(cmd);
+      break;
+    case CAPTURE_CMD_DRAW: {
+      CaptureCmdDraw d = reader.get<CaptureCmdDraw>();
+      vkCmdDraw(cmd, d.vertexCount, d.instanceCount, d.firstVertex,
+                d.firstInstance);
+      break;
+    }
+    case CAPTURE_CMD_DRAW_INDEXED: {
+      CaptureCmdDrawIndexed d = reader.get<CaptureCmdDrawIndexed>();
+      vkCmdDrawIndexed(cmd, d.indexCount, d.instanceCount, d.firstIndex,
+                       d.vertexOffset, d.firstInstance);
+      break;
+    }
+    case CAPTURE_CMD_DRAW_INDIRECT: {
+      CaptureCmdDrawIndirect d = reader.get<CaptureCmdDrawIndirect>();
+      vkCmdDrawIndirect(cmd, lookupBuffer(d.buffer), d.offset, d.drawCount,
+                        d.stride);
+      break;
+    }
+    case CAPTURE_CMD_DRAW_INDEXED_INDIRECT: {
+      CaptureCmdDrawIndirect d = reader.get<CaptureCmdDrawIndirect>();
+      vkCmdDrawIndexedIndirect(cmd, lookupBuffer(d.buffer), d.offset,
+                               d.drawCount, d.stride);
+      break;
+    }
+    case CAPTURE_CMD_DISPATCH: {
+      CaptureCmdDispatch d = reader.get<CaptureCmdDispatch>();
+      vkCmdDispatch(cmd, d.x, d.y, d.z);
+      break;
+    }
+    case CAPTURE_CMD_DISPATCH_INDIRECT: {
+      CaptureCmdDispatchIndirect d = reader.get<CaptureCmdDispatchIndirect>();
+      vkCmdDispatchIndirect(cmd, lookupBuffer(d.buffer), d.offset);
+      break;
+    }
+    case CAPTURE_CMD_PIPELINE_BARRIER:
+      pipelineBarrier(reader);
+      break;
+    case CAPTURE_CMD_COPY_BUFFER: {
+      CaptureCmdCopyBuffer c = reader.get<CaptureCmdCopyBuffer>();
+      std::vector<VkBufferCopy> regions =
+          reader.getArray<VkBufferCopy>(c.regionCount);
+      vkCmdCopyBuffer(cmd, lookupBuffer(c.src), lookupBuffer(c.dst),
+                      c.regionCount, regions.data());
+      break;
+    }
+    case CAPTURE_CMD_FILL_BUFFER: {
+      CaptureCmdFillBuffer f = reader.get<CaptureCmdFillBuffer>();
+      vkCmdFillBuffer(cmd, lookupBuffer(f.buffer), f.offset, f.size, f.data);
+      break;
+    }
+    case CAPTURE_CMD_COPY_IMAGE: {
+      CaptureCmdCopyImage c = reader.get<CaptureCmdCopyImage>();
+      std::vector<VkImageCopy> regions =
+          reader.getArray<VkImageCopy>(c.regionCount);
+      vkCmdCopyImage(cmd, lookup(images, c.src), replayLayout(c.srcLayout),
+                     lookup(images, c.dst), replayLayout(c.dstLayout),
+                     c.regionCount, regions.data());
+      break;
+    }
+    case CAPTURE_CMD_BLIT_IMAGE: {
+      CaptureCmdBlitImage b = reader.get<CaptureCmdBlitImage>();
+      std::vector<VkImageBlit> regions =
+          reader.getArray<VkImageBlit>(b.regionCount);
+      vkCmdBlitImage(cmd, lookup(images, b.src), replayLayout(b.srcLayout),
+                     lookup(images, b.dst), replayLayout(b.dstLayout),
+                     b.regionCount, regions.data(), (VkFilter)b.filter);
+      break;
+    }
+    case CAPTURE_CMD_COPY_BUFFER_TO_IMAGE: {
+      CaptureCmdCopyBufferImage c = reader.get<CaptureCmdCopyBufferImage>();
+      std::vector<VkBufferImageCopy> regions =
+          reader.getArray<VkBufferImageCopy>(c.regionCount);
+      vkCmdCopyBufferToImage(cmd, lookupBuffer(c.buffer),
+                             lookup(images, c.image),
+                             replayLayout(c.imageLayout), c.regionCount,
+                             regions.data());
+      break;
+    }
+    case CAPTURE_CMD_COPY_IMAGE_TO_BUFFER: {
+      CaptureCmdCopyBufferImage c = reader.get<CaptureCmdCopyBufferImage>();
+      std::vector<VkBufferImageCopy> regions =
+          reader.getArray<VkBufferImageCopy>(c.regionCount);
+      vkCmdCopyImageToBuffer(cmd, lookup(images, c.image),
+                             replayLayout(c.imageLayout),
+                             lookupBuffer(c.buffer), c.regionCount,
+                             regions.data());
+      break;
+    }
+    case CAPTURE_CMD_SET_DEPTH_BIAS: {
+      CaptureCmdSetDepthBias b = reader.get<CaptureCmdSetDepthBias>();
+      vkCmdSetDepthBias(cmd, b.constantFactor, b.clamp, b.slopeFactor);
+      break;
+    }
+    default:
+      printf("skipping unknown capture record %u\n", record.type);
+      break;
+  }
+}
+
+struct FrameTiming {
+  double cpuMs;  // recording the command buffer
+  double gpuMs;  // first to last command, 0 without timestamps
+};
+
+// objects created while the frame was recorded only exist after the first
+// pass; host writes are applied every time, before recording like in the
+// engine
+FrameTiming playFrame(const std::vector<RecordRef>& records,
+                      const FrameRange& frame, bool firstPass) {
+  for (size_t i = frame.begin + 1; i < frame.end; i++) {
+    const RecordRef& record = records[i];
+    if (record.type >= CAPTURE_CMD_BIND_PIPELINE) continue;
+    if (firstPass || record.type == CAPTURE_UPLOAD) {
+      applyObjectRecord(record);
+    }
+  }
+
+  FrameTiming timing = {};
+  uint64_t begin = profilerNow();
+  beginCommands();
+  if (queryPool) {
+    vkCmdResetQueryPool(cmd, queryPool, 0, 2);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+  }
+  for (size_t i = frame.begin + 1; i < frame.end; i++) {
+    if (records[i].type >= CAPTURE_CMD_BIND_PIPELINE) {
+      recordCommand(records[i]);
+    }
+  }
+  if (queryPool) {
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool,
+                        1);
+  }
+  timing.cpuMs = (profilerNow() - begin) / 1e6;
+  submitAndWait();
+
+  if (queryPool) {
+    uint64_t stamps[2];
+    VK_CHECK(vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(stamps),
+                                   stamps, sizeof(uint64_t),
+                                   VK_QUERY_RESULT_64_BIT |
+                                       VK_QUERY_RESULT_WAIT_BIT));
+    timing.gpuMs = (stamps[1] - stamps[0]) * timestampPeriod / 1e6;
+  }
+  return timing;
+}
+
+void printSpread(const char* name, std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  printf("  %s ms: min %.3f  median %.3f  max %.3f\n", name, values.front(),
+         values[values.size() / 2], values.back());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* capturePath = nullptr;
+  const char* csvPath = nullptr;
+  uint32_t repeat = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = std::max(1u, (uint32_t)strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+      csvPath = argv[++i];
+    } else if (!capturePath) {
+      capturePath = argv[i];
+    }
+  }
+  if (!capturePath) {
+    printf("usage: replay <capture> [--repeat <n>] [--csv <file>]\n");
+    return 1;
+  }
+
+  std::vector<char> file = readFile(capturePath);
+  CaptureFileHeader header = {};
+  if (file.size() >= sizeof(header)) memcpy(&header, file.data(), sizeof(header));
+  if (header.magic != kCaptureMagic || header.version != kCaptureVersion) {
+    printf("%s is not a version %u capture\n", capturePath, kCaptureVersion);
+    return 1;
+  }
+
+  std::vector<RecordRef> records;
+  std::vector<FrameRange> frames;
+  const uint8_t* p = (const uint8_t*)file.data() + sizeof(header);
+  const uint8_t* end = (const uint8_t*)file.data() + file.size();
+  while (p + sizeof(CaptureRecordHeader) <= end) {
+    CaptureRecordHeader recordHeader;
+    memcpy(&recordHeader, p, sizeof(recordHeader));
+    p += sizeof(recordHeader);
+    // a capture cut short by a crash ends with a partial record
+    if (recordHeader.size > (size_t)(end - p)) break;
+    if (recordHeader.type == CAPTURE_FRAME_BEGIN) {
+      CaptureFrameBegin begin;
+      memcpy(&begin, p, sizeof(begin));
+      frames.push_back({begin.frame, records.size(), 0});
+    } else if (recordHeader.type == CAPTURE_FRAME_END && !frames.empty()) {
+      frames.back().end = records.size();
+    }
+    records.push_back({recordHeader.type, recordHeader.size, p});
+    p += recordHeader.size;
+  }
+  // and so does its last frame
+  if (!frames.empty() && frames.back().end == 0) frames.pop_back();
+  if (frames.empty()) {
+    printf("%s has no complete frames\n", capturePath);
+    return 1;
+  }
+  printf("capture: %zu records, %zu frames (%llu to %llu)\n", records.size(),
+         frames.size(), (unsigned long long)frames.front().frame,
+         (unsigned long long)frames.back().frame);
+
+  if (!createDevice()) return 1;
+  createDescriptorPool(records);
+
+  std::vector<FrameTiming> timings;
+  std::vector<uint32_t> timingPass;
+  size_t next = 0;
+  for (uint32_t pass = 0; pass < repeat; pass++) {
+    for (const FrameRange& frame : frames) {
+      // the first pass also creates what was made between frames
+      if (pass == 0) {
+        for (; next < frame.begin; next++) applyObjectRecord(records[next]);
+        next = frame.end + 1;
+      }
+      timings.push_back(playFrame(records, frame, pass == 0));
+      timingPass.push_back(pass);
+    }
+  }
+
+  std::vector<double> cpu, gpu;
+  for (const FrameTiming& timing : timings) {
+    cpu.push_back(timing.cpuMs);
+    gpu.push_back(timing.gpuMs);
+  }
+  printf("replayed %zu frames x%u\n", frames.size(), repeat);
+  printSpread("record", cpu);
+  if (queryPool) printSpread("gpu", gpu);
+
+  if (csvPath) {
+    FILE* csv = fopen(csvPath, "w");
+    if (csv) {
+      fprintf(csv, "pass,frame,record_ms,gpu_ms\n");
+      for (size_t i = 0; i < timings.size(); i++) {
+        fprintf(csv, "%u,%llu,%.4f,%.4f\n", timingPass[i],
+                (unsigned long long)frames[i % frames.size()].frame,
+                timings[i].cpuMs, timings[i].gpuMs);
+      }
+      fclose(csv);
+    } else {
+      printf("failed to open csv file:%s \n", csvPath);
+    }
+  }
+
+  VK_CHECK(vkDeviceWaitIdle(device));
+  destroyDevice();
+  return 0;
+}